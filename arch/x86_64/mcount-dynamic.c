@@ -17,8 +17,8 @@
 #define XRAY_SECT  "xray_instr_map"
 #define MCOUNTLOC_SECT  "__mcount_loc"
 
-/* target instrumentation function it needs to call */
-extern void __fentry__(void);
+/* target instrumentation function it needs to call (libc can have one too) */
+extern __weak void uftrace___fentry__(void);
 extern void __dentry__(void);
 extern void __xray_entry(void);
 extern void __xray_exit(void);
@@ -52,10 +52,22 @@ struct arch_dynamic_info {
 	unsigned			nr_mcount_loc;
 };
 
+/* check if the trampoline page was added already (by the agent) */
+static bool has_trampoline_page(unsigned long addr, unsigned char *code,
+				size_t size)
+{
+	unsigned char vec;
+
+	if (mincore(PAGE_ADDR(addr), PAGE_SIZE, &vec) < 0)
+		return false;
+
+	return !memcmp((void *)addr, code, size);
+}
+
 int mcount_setup_trampoline(struct mcount_dynamic_info *mdi)
 {
 	unsigned char trampoline[] = { 0x3e, 0xff, 0x25, 0x01, 0x00, 0x00, 0x00, 0xcc };
-	unsigned long fentry_addr = (unsigned long)__fentry__;
+	unsigned long fentry_addr = (unsigned long)uftrace___fentry__;
 	unsigned long xray_entry_addr = (unsigned long)__xray_entry;
 	unsigned long xray_exit_addr = (unsigned long)__xray_exit;
 	struct arch_dynamic_info *adi = mdi->arch;
@@ -73,6 +85,10 @@ int mcount_setup_trampoline(struct mcount_dynamic_info *mdi)
 		mdi->trampoline += trampoline_size;
 		mdi->text_size  += PAGE_SIZE;
 
+		if (has_trampoline_page(mdi->trampoline, trampoline,
+					sizeof(trampoline)))
+			goto setup;
+
 		pr_dbg2("adding a page for fentry trampoline at %#lx\n",
 			mdi->trampoline);
 
@@ -85,6 +101,7 @@ int mcount_setup_trampoline(struct mcount_dynamic_info *mdi)
 			pr_err("failed to mmap trampoline for setup");
 	}
 
+setup:
 	if (mprotect(PAGE_ADDR(mdi->text_addr), 
 			 PAGE_LEN(mdi->text_addr, mdi->text_size),
 		     PROT_READ | PROT_WRITE | PROT_EXEC)) {
@@ -182,6 +199,25 @@ static void read_mcount_loc(struct arch_dynamic_info *adi,
 	}
 }
 
+/* check if the instruction calls the trampoline to __fentry__ */
+static bool call_fentry_trampoline(unsigned char *insn)
+{
+	unsigned char trampoline[] = { 0x3e, 0xff, 0x25, 0x01, 0x00, 0x00, 0x00, 0xcc };
+	unsigned long fentry_addr = (unsigned long)uftrace___fentry__;
+	unsigned char *target;
+	int offset;
+
+	if (insn[0] != 0xe8)
+		return false;
+
+	memcpy(&offset, &insn[1], sizeof(offset));
+	target = insn + CALL_INSN_SIZE + offset;
+
+	return !memcmp(target, trampoline, sizeof(trampoline)) &&
+	       !memcmp(target + sizeof(trampoline), &fentry_addr,
+		       sizeof(fentry_addr));
+}
+
 void mcount_arch_find_module(struct mcount_dynamic_info *mdi,
 			     struct symtab *symtab)
 {
@@ -221,7 +257,7 @@ void mcount_arch_find_module(struct mcount_dynamic_info *mdi,
 			continue;
 
 		/* dont' check special functions */
-		if (sym->name[0] == '_')
+		if (symbol_name(sym)[0] == '_')
 			continue;
 
 		/* only support calls to __fentry__ at the beginning */
@@ -230,6 +266,12 @@ void mcount_arch_find_module(struct mcount_dynamic_info *mdi,
 			adi->type = DYNAMIC_FENTRY_NOP;
 			goto out;
 		}
+
+		/* or it's patched already (the agent updates it again) */
+		if (call_fentry_trampoline(code_addr)) {
+			adi->type = DYNAMIC_FENTRY_NOP;
+			goto out;
+		}
 	}
 
 	switch (check_trace_functions(mdi->map->libname)) {
@@ -256,11 +298,32 @@ static unsigned long get_target_addr(struct mcount_dynamic_info *mdi, unsigned l
 	return mdi->trampoline - (addr + CALL_INSN_SIZE);
 }
 
+/*
+ * Update the 5-byte instruction with a single store if possible, since
+ * other threads can run the code when the agent changes it at runtime.
+ */
+static void write_insn5(unsigned char *insn, const unsigned char *code)
+{
+	unsigned long offset = (unsigned long)insn & 7;
+	uint64_t *word = (void *)insn - offset;
+	uint64_t val;
+
+	if (offset + CALL_INSN_SIZE > sizeof(val)) {
+		memcpy(insn, code, CALL_INSN_SIZE);
+		return;
+	}
+
+	val = *word;
+	memcpy((void *)&val + offset, code, CALL_INSN_SIZE);
+	__atomic_store_n(word, val, __ATOMIC_SEQ_CST);
+}
+
 static int patch_fentry_func(struct mcount_dynamic_info *mdi, struct sym *sym)
 {
 	unsigned char nop1[] = { 0x67, 0x0f, 0x1f, 0x04, 0x00 };
 	unsigned char nop2[] = { 0x0f, 0x1f, 0x44, 0x00, 0x00 };
 	unsigned char *insn = (void *)sym->addr + mdi->map->start;
+	unsigned char call[CALL_INSN_SIZE] = { 0xe8, };
 	unsigned int target_addr;
 
 	/* only support calls to __fentry__ at the beginning */
@@ -276,9 +339,9 @@ static int patch_fentry_func(struct mcount_dynamic_info *mdi, struct sym *sym)
 		return INSTRUMENT_SKIPPED;
 
 	/* make a "call" insn with 4-byte offset */
-	insn[0] = 0xe8;
+	memcpy(&call[1], &target_addr, sizeof(target_addr));
 	/* hopefully we're not patching 'memcpy' itself */
-	memcpy(&insn[1], &target_addr, sizeof(target_addr));
+	write_insn5(insn, call);
 
 	pr_dbg3("update function '%s' dynamically to call __fentry__\n",
 		sym->name);
@@ -533,7 +596,10 @@ static int unpatch_func(uint8_t *insn, char *name)
 	}
 
 	pr_dbg3("unpatch fentry: %s\n", name);
-	memcpy(insn, nop_insn, nop_size);
+	if (nop_size == CALL_INSN_SIZE)
+		write_insn5(insn, nop_insn);
+	else
+		memcpy(insn, nop_insn, nop_size);
 	__builtin___clear_cache((void *)insn, (void *)insn + nop_size);
 
 	return INSTRUMENT_SUCCESS;
@@ -629,6 +695,20 @@ int mcount_unpatch_func(struct mcount_dynamic_info *mdi, struct sym *sym,
 	return result;
 }
 
+/*
+ * Revert the call to the trampoline made by patch_fentry_func().  It doesn't
+ * check the patch type of the module so that it can be used for any module.
+ */
+int mcount_revert_func(struct mcount_dynamic_info *mdi, struct sym *sym)
+{
+	unsigned char *insn = (void *)sym->addr + mdi->map->start;
+
+	if (sym->size < CALL_INSN_SIZE || !call_fentry_trampoline(insn))
+		return INSTRUMENT_SKIPPED;
+
+	return unpatch_func(insn, sym->name);
+}
+
 static void revert_normal_func(struct mcount_dynamic_info *mdi, struct sym *sym,
 			       struct mcount_disasm_engine *disasm)
 {
@@ -87,10 +87,9 @@ int arch_load_dynsymtab_noplt(struct symtab *dsymtab,
 		sym->type = ST_PLT_FUNC;
 
 		name = elf_get_name(elf, &sym_iter, sym_iter.sym.st_name);
-		if (flags & SYMTAB_FL_DEMANGLE)
-			sym->name = demangle(name);
-		else
-			sym->name = xstrdup(name);
+		sym->name = xstrdup(name);
+		sym->dname = NULL;
+		sym->flags = 0;
 
 		pr_dbg3("[%zd] %c %lx + %-5u %s\n", dsymtab->nr_sym,
 			sym->type, sym->addr, sym->size, sym->name);
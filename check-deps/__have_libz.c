@@ -0,0 +1,7 @@
+#include <zlib.h>
+
+int main(void)
+{
+	uLong len = compressBound(1);
+	return len == 0;
+}
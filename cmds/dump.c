@@ -4,6 +4,7 @@
 #include <inttypes.h>
 #include <time.h>
 #include <assert.h>
+#include <errno.h>
 #include <sys/stat.h>
 
 #include "uftrace.h"
@@ -14,6 +15,8 @@
 #include "utils/filter.h"
 #include "utils/kernel.h"
 #include "utils/graph.h"
+#include "utils/hashmap.h"
+#include "utils/pipeline.h"
 #include "libtraceevent/kbuffer.h"
 #include "libtraceevent/event-parse.h"
 
@@ -31,6 +34,9 @@ struct uftrace_dump_ops {
 	/* this is called for each user-level function entry/exit */
 	void (*task_rstack)(struct uftrace_dump_ops *ops,
 			    struct uftrace_task_reader *task, char *name);
+	/* same as above but it gets the symbol instead (to get name later) */
+	void (*task_func)(struct uftrace_dump_ops *ops,
+			  struct uftrace_task_reader *task, struct sym *sym);
 	/* this is called for each user-level event */
 	void (*task_event)(struct uftrace_dump_ops *ops,
 			   struct uftrace_task_reader *task);
@@ -71,15 +77,69 @@ struct uftrace_raw_dump {
 
 struct uftrace_chrome_dump {
 	struct uftrace_dump_ops ops;
+	struct uftrace_pipeline pipe;
 	unsigned lost_event_cnt;
 	bool last_comma;
 };
 
+struct pb_buf {
+	unsigned char *buf;
+	size_t len;
+	size_t size;
+};
+
+struct uftrace_perfetto_dump {
+	struct uftrace_dump_ops ops;
+	struct pb_buf pb;
+	Hashmap *names;
+	uint64_t last_iid;
+	uint64_t last_time;
+	unsigned lost_event_cnt;
+};
+
+enum columnar_column {
+	COL_TIME,
+	COL_TID,
+	COL_DEPTH,
+	COL_TYPE,
+	COL_FUNC,
+	COL_DURATION,
+	NR_COLUMNS,
+};
+
+struct uftrace_columnar_dump {
+	struct uftrace_dump_ops ops;
+	char *dirname;
+	FILE *fp[NR_COLUMNS];
+	FILE *names_fp;
+	Hashmap *names;
+	uint32_t nr_names;
+	/* rows in the current batch */
+	uint64_t *time;
+	int32_t *tid;
+	uint16_t *depth;
+	uint8_t *type;
+	uint32_t *func;
+	uint64_t *duration;
+	unsigned nr_batch;
+	uint64_t nr_rows;
+	unsigned lost_event_cnt;
+};
+
 struct uftrace_flame_dump {
 	struct uftrace_dump_ops ops;
 	struct rb_root tasks;
-	struct fg_node *node;
+	struct fg_path *paths;
+	uint32_t nr_paths;
+	uint32_t max_paths;
+	uint32_t *slots;
+	uint32_t nr_slots;
+	uint32_t flush_paths;
+	Hashmap *names;
+	char *buf;
+	size_t buflen;
 	uint64_t sample_time;
+	uint64_t prune;
 };
 
 struct uftrace_graphviz_dump {
@@ -359,7 +419,7 @@ static void pr_args(struct fstack_arguments *args)
 						 (uint64_t)val);
 
 			if (sym)
-				pr_out("  args[%d] p: %lx (&%s)\n", i, val, sym->name);
+				pr_out("  args[%d] p: %lx (&%s)\n", i, val, symbol_name(sym));
 			else if (val)
 				pr_out("  args[%d] p: %p\n", i, (void *)val);
 			else
@@ -471,7 +531,7 @@ static void pr_retval(struct fstack_arguments *args)
 						 (uint64_t)val);
 
 			if (sym)
-				pr_out("  retval p: %lx (&%s)\n", val, sym->name);
+				pr_out("  retval p: %lx (&%s)\n", val, symbol_name(sym));
 			else
 				pr_out("  retval p: %p\n", (void *)val);
 		}
@@ -854,6 +914,147 @@ static void dump_raw_perf_event(struct uftrace_dump_ops *ops,
 }
 
 /* chrome support */
+
+/*
+ * The reader thread saves necessary info into a chrome_item and the
+ * JSON output is rendered in the pipeline worker threads.  The symbol
+ * name and the arguments are also formatted there, using the raw data
+ * of the arguments copied from the task.
+ */
+struct chrome_item {
+	char		ph;	/* 'B', 'E' or 'M' (for comm) */
+	bool		comma;
+	bool		is_process;
+	bool		has_name;	/* no symbol, name is in data */
+	bool		has_args;
+	int		pid;
+	int		tid;
+	uint64_t	time;
+	uint64_t	addr;
+	struct sym	*sym;
+	struct uftrace_data	*handle;
+	struct uftrace_task	*t;
+	struct list_head	*argspec;
+	size_t		name_len;
+	size_t		args_len;
+	/* name (if has_name) followed by raw data of arguments or retval */
+	char		data[];
+};
+
+void print_json_escaped_char(char **args, size_t *len, const char c);
+
+/* format arguments as if it's done by the task reader */
+static void get_chrome_argspec(struct chrome_item *item,
+			       char *buf, size_t len)
+{
+	enum argspec_string_bits str_mode = NEEDS_JSON | HAS_MORE;
+	struct uftrace_record rec = {
+		.time = item->time,
+		.addr = item->addr,
+		.more = 1,
+	};
+	struct uftrace_task_reader task = {
+		.tid    = item->tid,
+		.t      = item->t,
+		.h      = item->handle,
+		.rstack = &rec,
+		.args   = {
+			.args = item->argspec,
+			.len  = item->args_len,
+			.data = item->data + item->name_len,
+		},
+	};
+
+	if (item->ph == 'B')
+		str_mode |= NEEDS_PAREN;
+	else
+		str_mode |= IS_RETVAL;
+
+	get_argspec_string(&task, buf, len, str_mode);
+}
+
+static void render_chrome_func(struct uftrace_pipe_batch *batch,
+			       struct chrome_item *item)
+{
+	char name_buf[2048];
+	char spec_buf[2048];
+	char *p = name_buf;
+	size_t len = sizeof(name_buf) - 1;
+	char *name;
+	size_t i;
+
+	if (item->has_name)
+		name = item->data;
+	else
+		name = symbol_getname(item->sym, item->addr);
+
+	/* escape the function name */
+	for (i = 0; name[i]; i++)
+		print_json_escaped_char(&p, &len, name[i]);
+	*p = '\0';
+
+	if (!item->has_name)
+		symbol_putname(item->sym, name);
+
+	if (item->comma)
+		pipeline_write(batch, ",\n", 2);
+
+	if (item->is_process) {
+		/* no need to add "tid" field */
+		pipeline_printf(batch, "{\"ts\":%"PRIu64".%03d,\"ph\":\"%c\",\"pid\":%d,\"name\":\"%s\"",
+				item->time / 1000, (int)(item->time % 1000), item->ph,
+				item->tid, name_buf);
+	}
+	else {
+		pipeline_printf(batch, "{\"ts\":%"PRIu64".%03d,\"ph\":\"%c\",\"pid\":%d,\"tid\":%d,\"name\":\"%s\"",
+				item->time / 1000, (int)(item->time % 1000), item->ph,
+				item->pid, item->tid, name_buf);
+	}
+
+	if (item->has_args) {
+		get_chrome_argspec(item, spec_buf, sizeof(spec_buf));
+		pipeline_printf(batch, ",\"args\":{\"%s\":\"%s\"}}",
+				item->ph == 'B' ? "arguments" : "retval",
+				spec_buf);
+	}
+	else
+		pipeline_write(batch, "}", 1);
+}
+
+static void render_chrome_comm(struct uftrace_pipe_batch *batch,
+			       struct chrome_item *item)
+{
+	if (item->is_process) {
+		pipeline_printf(batch, ",\n{\"ts\":0,\"ph\":\"M\",\"pid\":%d,"
+				"\"name\":\"process_name\","
+				"\"args\":{\"name\":\"%s\"}}",
+				item->tid, item->data);
+		pipeline_printf(batch, ",\n{\"ts\":0,\"ph\":\"M\",\"pid\":%d,"
+				"\"name\":\"thread_name\","
+				"\"args\":{\"name\":\"%s\"}}",
+				item->tid, item->data);
+	} else {
+		pipeline_printf(batch, ",\n{\"ts\":0,\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+				"\"name\":\"thread_name\","
+				"\"args\":{\"name\":\"[%d] %s\"}}",
+				item->pid, item->tid,
+				item->tid, item->data);
+	}
+}
+
+static void render_chrome_batch(struct uftrace_pipeline *pl,
+				struct uftrace_pipe_batch *batch)
+{
+	struct chrome_item *item;
+
+	pipeline_for_each_item(batch, item) {
+		if (item->ph == 'M')
+			render_chrome_comm(batch, item);
+		else
+			render_chrome_func(batch, item);
+	}
+}
+
 static void dump_chrome_header(struct uftrace_dump_ops *ops,
 				struct uftrace_data *handle,
 				struct opts *opts)
@@ -883,25 +1084,20 @@ static void dump_chrome_header(struct uftrace_dump_ops *ops,
 	}
 
 	chrome->last_comma = false;
-}
 
-void print_json_escaped_char(char **args, size_t *len, const char c);
+	setup_pipeline(&chrome->pipe, pipeline_nr_workers(),
+		       render_chrome_batch, chrome, outfp);
+}
 
-static void dump_chrome_task_rstack(struct uftrace_dump_ops *ops,
-				     struct uftrace_task_reader *task, char *name)
+static void add_chrome_func(struct uftrace_chrome_dump *chrome,
+			    struct uftrace_task_reader *task,
+			    struct sym *sym, char *name)
 {
-	char ph;
-	char spec_buf[2048];
-	char name_buf[2048];
 	struct uftrace_record *frs = task->rstack;
-	enum argspec_string_bits str_mode = NEEDS_JSON;
-	struct uftrace_chrome_dump *chrome = container_of(ops, typeof(*chrome), ops);
-	bool is_process = task->t->pid == task->tid;
+	struct chrome_item *item;
 	int rec_type = frs->type;
-	size_t namelen = strlen(name);
-	char *p = name_buf;
-	size_t len = sizeof(name_buf) - 1;
-	size_t i;
+	size_t namelen = 0;
+	size_t argslen = 0;
 
 	if (rec_type == UFTRACE_EVENT) {
 		switch (frs->addr) {
@@ -922,58 +1118,61 @@ static void dump_chrome_task_rstack(struct uftrace_dump_ops *ops,
 		}
 	}
 
-	/* escape the function name */
-	for (i = 0; i < namelen; i++)
-		print_json_escaped_char(&p, &len, name[i]);
-	*p = '\0';
+	if (rec_type == UFTRACE_LOST) {
+		chrome->lost_event_cnt++;
+		return;
+	}
+	if (rec_type != UFTRACE_ENTRY && rec_type != UFTRACE_EXIT)
+		return;
+
+	if (name)
+		namelen = strlen(name) + 1;
+
+	/* the argument data will be overwritten, copy it */
+	if (frs->more)
+		argslen = task->args.len;
+
+	item = pipeline_add_item(&chrome->pipe,
+				 sizeof(*item) + namelen + argslen);
+	item->ph         = rec_type == UFTRACE_ENTRY ? 'B' : 'E';
+	item->comma      = chrome->last_comma;
+	item->is_process = task->t->pid == task->tid;
+	item->has_name   = name != NULL;
+	item->has_args   = frs->more;
+	item->pid        = task->t->pid;
+	item->tid        = task->tid;
+	item->time       = frs->time;
+	item->addr       = frs->addr;
+	item->sym        = sym;
+	item->handle     = task->h;
+	item->t          = task->t;
+	item->argspec    = frs->more ? task->args.args : NULL;
+	item->name_len   = namelen;
+	item->args_len   = argslen;
+
+	if (namelen)
+		memcpy(item->data, name, namelen);
+	if (argslen)
+		memcpy(item->data + namelen, task->args.data, argslen);
 
-	if (chrome->last_comma)
-		pr_out(",\n");
 	chrome->last_comma = true;
+}
 
-	if (rec_type == UFTRACE_ENTRY) {
-		ph = 'B';
-		if (is_process) {
-			/* no need to add "tid" field */
-			pr_out("{\"ts\":%"PRIu64".%03d,\"ph\":\"%c\",\"pid\":%d,\"name\":\"%s\"",
-			       frs->time / 1000, (int)(frs->time % 1000), ph, task->tid, name_buf);
-		}
-		else {
-			pr_out("{\"ts\":%"PRIu64".%03d,\"ph\":\"%c\",\"pid\":%d,\"tid\":%d,\"name\":\"%s\"",
-			       frs->time / 1000, (int)(frs->time % 1000), ph, task->t->pid, task->tid, name_buf);
-		}
+static void dump_chrome_task_rstack(struct uftrace_dump_ops *ops,
+				    struct uftrace_task_reader *task, char *name)
+{
+	struct uftrace_chrome_dump *chrome = container_of(ops, typeof(*chrome), ops);
 
-		if (frs->more) {
-			str_mode |= NEEDS_PAREN | HAS_MORE;
-			get_argspec_string(task, spec_buf, sizeof(spec_buf), str_mode);
-			pr_out(",\"args\":{\"arguments\":\"%s\"}}", spec_buf);
-		}
-		else
-			pr_out("}");
-	}
-	else if (rec_type == UFTRACE_EXIT) {
-		ph = 'E';
-		if (is_process) {
-			/* no need to add "tid" field */
-			pr_out("{\"ts\":%"PRIu64".%03d,\"ph\":\"%c\",\"pid\":%d,\"name\":\"%s\"",
-			       frs->time / 1000, (int)(frs->time % 1000), ph, task->tid, name_buf);
-		}
-		else {
-			pr_out("{\"ts\":%"PRIu64".%03d,\"ph\":\"%c\",\"pid\":%d,\"tid\":%d,\"name\":\"%s\"",
-			       frs->time / 1000, (int)(frs->time % 1000), ph, task->t->pid, task->tid, name_buf);
-		}
+	add_chrome_func(chrome, task, NULL, name);
+}
 
-		if (frs->more) {
-			str_mode |= IS_RETVAL | HAS_MORE;
-			get_argspec_string(task, spec_buf, sizeof(spec_buf), str_mode);
-			pr_out(",\"args\":{\"retval\":\"%s\"}}",
-				spec_buf);
-		}
-		else
-			pr_out("}");
-	}
-	else if (rec_type == UFTRACE_LOST)
-		chrome->lost_event_cnt++;
+static void dump_chrome_task_func(struct uftrace_dump_ops *ops,
+				  struct uftrace_task_reader *task,
+				  struct sym *sym)
+{
+	struct uftrace_chrome_dump *chrome = container_of(ops, typeof(*chrome), ops);
+
+	add_chrome_func(chrome, task, sym, NULL);
 }
 
 static void dump_chrome_kernel_rstack(struct uftrace_dump_ops *ops,
@@ -993,31 +1192,23 @@ static void dump_chrome_perf_event(struct uftrace_dump_ops *ops,
 				    struct uftrace_perf_reader *perf,
 				    struct uftrace_record *frs)
 {
-	uint64_t evt_id = frs->addr;
-	bool is_process = perf->u.comm.pid == perf->tid;
-
-	switch (evt_id) {
-	case EVENT_ID_PERF_COMM:
-		if (is_process) {
-			pr_out(",\n{\"ts\":0,\"ph\":\"M\",\"pid\":%d,"
-			       "\"name\":\"process_name\","
-			       "\"args\":{\"name\":\"%s\"}}",
-			       perf->tid, perf->u.comm.comm);
-			pr_out(",\n{\"ts\":0,\"ph\":\"M\",\"pid\":%d,"
-			       "\"name\":\"thread_name\","
-			       "\"args\":{\"name\":\"%s\"}}",
-			       perf->tid, perf->u.comm.comm);
-		} else {
-			pr_out(",\n{\"ts\":0,\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
-			       "\"name\":\"thread_name\","
-			       "\"args\":{\"name\":\"[%d] %s\"}}",
-			       perf->u.comm.pid, perf->tid,
-			       perf->tid, perf->u.comm.comm);
-		}
-		break;
-	default:
-		break;
-	};
+	struct uftrace_chrome_dump *chrome = container_of(ops, typeof(*chrome), ops);
+	struct chrome_item *item;
+	size_t len;
+
+	if (frs->addr != EVENT_ID_PERF_COMM)
+		return;
+
+	len = strlen(perf->u.comm.comm);
+
+	item = pipeline_add_item(&chrome->pipe, sizeof(*item) + len + 1);
+	item->ph         = 'M';
+	item->is_process = perf->u.comm.pid == perf->tid;
+	item->pid        = perf->u.comm.pid;
+	item->tid        = perf->tid;
+	item->name_len   = len;
+
+	memcpy(item->data, perf->u.comm.comm, len + 1);
 }
 
 static void dump_chrome_footer(struct uftrace_dump_ops *ops,
@@ -1028,6 +1219,9 @@ static void dump_chrome_footer(struct uftrace_dump_ops *ops,
 	struct stat statbuf;
 	struct uftrace_chrome_dump *chrome = container_of(ops, typeof(*chrome), ops);
 
+	/* write all the events before the footer */
+	finish_pipeline(&chrome->pipe);
+
 	/* read recorded date and time */
 	snprintf(buf, sizeof(buf), "%s/info", opts->dirname);
 	if (stat(buf, &statbuf) < 0)
@@ -1062,233 +1256,1243 @@ static void dump_chrome_footer(struct uftrace_dump_ops *ops,
 	}
 }
 
-/* flamegraph support */
-static struct uftrace_graph flame_graph = {
-	.root.head     = LIST_HEAD_INIT(flame_graph.root.head),
-	.special_nodes = LIST_HEAD_INIT(flame_graph.special_nodes),
+/* perfetto support */
+
+/*
+ * It writes a subset of perfetto trace protobuf messages (TrackEvent) by
+ * hand.  Please see the below for the definitions:
+ *   https://github.com/google/perfetto/tree/master/protos/perfetto/trace
+ */
+#define PB_WIRE_VARINT  0
+#define PB_WIRE_LENGTH  2
+
+/* nested message length is written as a redundant 4-byte varint */
+#define PB_NESTED_LEN   4
+
+#define PERFETTO_FLUSH_SIZE  (1024 * 1024)
+
+/* field numbers */
+enum perfetto_field {
+	TRACE_PACKET			= 1,
+
+	/* TracePacket */
+	PACKET_CLOCK_SNAPSHOT		= 6,
+	PACKET_TIMESTAMP		= 8,
+	PACKET_SEQUENCE_ID		= 10,
+	PACKET_TRACK_EVENT		= 11,
+	PACKET_INTERNED_DATA		= 12,
+	PACKET_SEQUENCE_FLAGS		= 13,
+	PACKET_TIMESTAMP_CLOCK_ID	= 58,
+	PACKET_DEFAULTS			= 59,
+	PACKET_TRACK_DESCRIPTOR		= 60,
+
+	/* ClockSnapshot */
+	CLOCK_SNAPSHOT_CLOCKS		= 1,
+	CLOCK_SNAPSHOT_PRIMARY		= 2,
+	/* ClockSnapshot.Clock */
+	CLOCK_ID			= 1,
+	CLOCK_TIMESTAMP			= 2,
+	CLOCK_IS_INCREMENTAL		= 3,
+
+	/* TracePacketDefaults */
+	DEFAULTS_TIMESTAMP_CLOCK_ID	= 58,
+
+	/* TrackDescriptor */
+	TRACK_UUID			= 1,
+	TRACK_PROCESS			= 3,
+	TRACK_THREAD			= 4,
+	TRACK_PARENT_UUID		= 5,
+	/* ProcessDescriptor */
+	PROCESS_PID			= 1,
+	PROCESS_NAME			= 6,
+	/* ThreadDescriptor */
+	THREAD_PID			= 1,
+	THREAD_TID			= 2,
+	THREAD_NAME			= 5,
+
+	/* TrackEvent */
+	EVENT_DEBUG_ANNOTATIONS		= 4,
+	EVENT_TYPE			= 9,
+	EVENT_NAME_IID			= 10,
+	EVENT_TRACK_UUID		= 11,
+	/* DebugAnnotation */
+	ANNOTATION_STRING_VALUE		= 6,
+	ANNOTATION_NAME			= 10,
+
+	/* InternedData */
+	INTERNED_EVENT_NAMES		= 2,
+	/* EventName */
+	EVENT_NAME_IID_FIELD		= 1,
+	EVENT_NAME_NAME			= 2,
 };
 
-static void adjust_fg_time(struct uftrace_task_graph *tg, void *arg)
-{
-	struct uftrace_dump_ops *ops = arg;
-	struct uftrace_flame_dump *flame = container_of(ops, typeof(*flame), ops);
-	struct uftrace_graph_node *node = tg->node;
-	struct fstack *fstack;
-	uint64_t curr_time;
-	uint64_t sample_time;
-	uint64_t accounted_time;
-
-	if (flame->sample_time == 0)
-		return;
+enum perfetto_event_type {
+	EVENT_TYPE_SLICE_BEGIN		= 1,
+	EVENT_TYPE_SLICE_END		= 2,
+};
 
-	if (tg->node->parent == NULL)
-		return;
+enum perfetto_sequence_flags {
+	SEQ_INCREMENTAL_STATE_CLEARED	= 1,
+	SEQ_NEEDS_INCREMENTAL_STATE	= 2,
+};
 
-	fstack = fstack_get(tg->task, tg->task->stack_count);
-	if (fstack == NULL)
-		return;
+#define PERFETTO_CLOCK_MONOTONIC    3   /* BUILTIN_CLOCK_MONOTONIC */
+#define PERFETTO_CLOCK_INCREMENTAL  64  /* sequence-scoped clock */
+#define PERFETTO_SEQUENCE_ID        1
 
-	curr_time = fstack->total_time;
-	sample_time = flame->sample_time;
+/* track uuid for processes (threads use tid) */
+#define PERFETTO_PROCESS_UUID(pid)  ((1ULL << 32) | (pid))
 
-	/*
-	 * it needs to track the child time separately
-	 * since child time not accounted due to sample time
-	 * should be accounted to parent.
-	 *
-	 * For example, with 1us sample time:
-	 *
-	 * # DURATION    TID     FUNCTION
-	 *             [12345] | main() {
-	 *    4.789 us [12345] |   foo();
-	 *    4.987 us [12345] |   bar();
-	 *   10.567 us [12345] | } // main
-	 *
-	 * In this case, main's total time is more than 10us
-	 * so 10 samples should be shown, but after accounting
-	 * foo and bar (4 samples each), its time would be
-	 * 10.567 - 4.789 - 4.987 = 0.791 so no samples for main.
-	 * But it actually needs to get 2 samples.
-	 *
-	 * So add the accounted child time only, not real time.
-	 */
-	accounted_time = (curr_time / sample_time) * sample_time;
+static void pb_reserve(struct pb_buf *pb, size_t len)
+{
+	if (pb->len + len <= pb->size)
+		return;
 
-	node->parent->child_time -= curr_time;
-	node->parent->child_time += accounted_time;
+	pb->size = ALIGN(pb->len + len, PERFETTO_FLUSH_SIZE);
+	pb->buf = xrealloc(pb->buf, pb->size);
 }
 
-static void print_flame_graph(struct uftrace_graph_node *node, struct opts *opts)
+static void pb_varint(struct pb_buf *pb, uint64_t val)
 {
-	struct uftrace_graph_node *child;
-	unsigned long sample = node->nr_calls;
-
-	if (sample && opts->sample_time)
-		sample = (node->time - node->child_time) / opts->sample_time;
-
-	if (sample) {
-		struct uftrace_graph_node *parent = node;
-		char *names[opts->max_stack];
-		char *buf, *ptr;
-		int i = 0;
-		size_t len = 0;
-
-		while (parent != NULL && parent->name != NULL) {
-			names[i++] = parent->name;
-			len += strlen(parent->name) + 1;
-			parent = parent->parent;
-		}
-
-		buf = ptr = xmalloc(len + 32);
-		while (--i >= 0)
-			ptr += snprintf(ptr, len, "%s;", names[i]);
-		ptr[-1] = ' ';
-		snprintf(ptr, len, "%lu", sample);
+	pb_reserve(pb, 10);
 
-		pr_out("%s\n", buf);
-		free(buf);
+	while (val >= 0x80) {
+		pb->buf[pb->len++] = (val & 0x7f) | 0x80;
+		val >>= 7;
 	}
-
-	list_for_each_entry(child, &node->head, list)
-		print_flame_graph(child, opts);
+	pb->buf[pb->len++] = val;
 }
 
-static void dump_flame_header(struct uftrace_dump_ops *ops,
-			       struct uftrace_data *handle,
-			       struct opts *opts)
+static void pb_uint(struct pb_buf *pb, int field, uint64_t val)
 {
-	graph_init_callbacks(NULL, adjust_fg_time, NULL, ops);
+	pb_varint(pb, (field << 3) | PB_WIRE_VARINT);
+	pb_varint(pb, val);
 }
 
-static void dump_flame_task_rstack(struct uftrace_dump_ops *ops,
-				    struct uftrace_task_reader *task, char *name)
+static void pb_string(struct pb_buf *pb, int field, const char *str)
 {
-	struct uftrace_record *frs = task->rstack;
-	struct uftrace_task_graph *graph;
+	size_t len = strlen(str);
 
-	graph = graph_get_task(task, sizeof(*graph));
+	pb_varint(pb, (field << 3) | PB_WIRE_LENGTH);
+	pb_varint(pb, len);
+	pb_reserve(pb, len);
+	memcpy(pb->buf + pb->len, str, len);
+	pb->len += len;
+}
 
-	graph->graph = &flame_graph;
-	flame_graph.sess = find_task_session(&task->h->sessions,
-					     task->t, frs->time);
+/* start a nested message, returns position to be passed to pb_end() */
+static size_t pb_begin(struct pb_buf *pb, int field)
+{
+	size_t pos;
 
-	if (graph->node == NULL)
-		graph->node = &flame_graph.root;
+	pb_varint(pb, (field << 3) | PB_WIRE_LENGTH);
+	pb_reserve(pb, PB_NESTED_LEN);
 
-	graph_add_node(graph, frs->type, name, sizeof(struct uftrace_graph_node), NULL);
+	pos = pb->len;
+	pb->len += PB_NESTED_LEN;
+	return pos;
 }
 
-static void dump_flame_kernel_rstack(struct uftrace_dump_ops *ops,
-				     struct uftrace_kernel_reader *kernel, int cpu,
-				     struct uftrace_record *rec, char *name)
+static void pb_end(struct pb_buf *pb, size_t pos)
 {
-	int tid;
-	struct uftrace_task_reader *task;
-	struct uftrace_task_graph *graph;
-
-	tid = kernel->tids[cpu];
-	task = get_task_handle(kernel->handle, tid);
-
-	graph = graph_get_task(task, sizeof(*graph));
+	size_t len = pb->len - pos - PB_NESTED_LEN;
+	int i;
 
-	graph->graph = &flame_graph;
-	flame_graph.sess = kernel->handle->sessions.first;
+	for (i = 0; i < PB_NESTED_LEN - 1; i++) {
+		pb->buf[pos + i] = (len & 0x7f) | 0x80;
+		len >>= 7;
+	}
+	pb->buf[pos + i] = len & 0x7f;
+}
 
-	if (graph->node == NULL)
-		graph->node = &flame_graph.root;
+static void pb_flush(struct pb_buf *pb, FILE *fp)
+{
+	if (pb->len && fwrite(pb->buf, 1, pb->len, fp) != pb->len)
+		pr_dbg("failed to write perfetto data: %m\n");
 
-	graph_add_node(graph, rec->type, name, sizeof(struct uftrace_graph_node), NULL);
+	pb->len = 0;
 }
 
-static void dump_flame_footer(struct uftrace_dump_ops *ops,
-			       struct uftrace_data *handle,
-			       struct opts *opts)
+static size_t perfetto_begin_packet(struct uftrace_perfetto_dump *perfetto)
 {
-	print_flame_graph(&flame_graph.root, opts);
+	size_t pkt;
 
-	graph_destroy(&flame_graph);
-	graph_remove_task();
+	pkt = pb_begin(&perfetto->pb, TRACE_PACKET);
+	pb_uint(&perfetto->pb, PACKET_SEQUENCE_ID, PERFETTO_SEQUENCE_ID);
+	return pkt;
 }
 
-/* graphviz support */
-static struct uftrace_graph graphviz_graph = {
-	.root.head     = LIST_HEAD_INIT(graphviz_graph.root.head),
-	.special_nodes = LIST_HEAD_INIT(graphviz_graph.special_nodes),
-};
-
-static void dump_graphviz_header(struct uftrace_dump_ops *ops,
-				  struct uftrace_data *handle,
-				  struct opts *opts)
+static void perfetto_end_packet(struct uftrace_perfetto_dump *perfetto, size_t pkt)
 {
-	pr_out("# version\":\"uftrace %s\",\n", UFTRACE_VERSION);
-
-	if (handle->hdr.info_mask & (1UL << CMDLINE))
-		pr_out("# command_line \"%s\"\n", handle->info.cmdline);
+	pb_end(&perfetto->pb, pkt);
 
-	pr_out("digraph \"");
-	pr_out("%s", (&handle->info)->exename);
-	pr_out("\" { \n");
-	pr_out("\n\t# Attributes \n");
-	pr_out("\tsplines=ortho;\n");
-	pr_out("\tconcentrate=true;\n");
-	pr_out("\tnode [shape=\"rect\",fontsize=\"7\",style=\"filled\"];\n");
-	pr_out("\tedge [fontsize=\"7\"];\n\n");
+	if (perfetto->pb.len >= PERFETTO_FLUSH_SIZE)
+		pb_flush(&perfetto->pb, outfp);
+}
 
-	graph_init_callbacks(NULL, NULL, NULL, ops);
+static void perfetto_thread_track(struct uftrace_perfetto_dump *perfetto,
+				  int pid, int tid, const char *comm)
+{
+	struct pb_buf *pb = &perfetto->pb;
+	size_t pkt, desc, thread;
+
+	pkt = perfetto_begin_packet(perfetto);
+	desc = pb_begin(pb, PACKET_TRACK_DESCRIPTOR);
+	pb_uint(pb, TRACK_UUID, tid);
+	pb_uint(pb, TRACK_PARENT_UUID, PERFETTO_PROCESS_UUID(pid));
+
+	thread = pb_begin(pb, TRACK_THREAD);
+	pb_uint(pb, THREAD_PID, pid);
+	pb_uint(pb, THREAD_TID, tid);
+	pb_string(pb, THREAD_NAME, comm);
+	pb_end(pb, thread);
+
+	pb_end(pb, desc);
+	perfetto_end_packet(perfetto, pkt);
 }
 
-static void dump_graphviz_task_rstack(struct uftrace_dump_ops *ops,
-				       struct uftrace_task_reader *task,
-				       char *name)
+static void perfetto_process_track(struct uftrace_perfetto_dump *perfetto,
+				   int pid, const char *comm)
 {
-	struct uftrace_record *frs = task->rstack;
-	struct uftrace_task_graph *graph;
+	struct pb_buf *pb = &perfetto->pb;
+	size_t pkt, desc, process;
 
-	graph = graph_get_task(task, sizeof(*graph));
+	pkt = perfetto_begin_packet(perfetto);
+	desc = pb_begin(pb, PACKET_TRACK_DESCRIPTOR);
+	pb_uint(pb, TRACK_UUID, PERFETTO_PROCESS_UUID(pid));
 
-	graph->graph = &graphviz_graph;
-	graphviz_graph.sess = find_task_session(&task->h->sessions,
-						task->t, frs->time);
-	if (graph->node == NULL)
-		graph->node = &graphviz_graph.root;
+	process = pb_begin(pb, TRACK_PROCESS);
+	pb_uint(pb, PROCESS_PID, pid);
+	pb_string(pb, PROCESS_NAME, comm);
+	pb_end(pb, process);
 
-	graph_add_node(graph, frs->type, name, sizeof(struct uftrace_graph_node), NULL);
+	pb_end(pb, desc);
+	perfetto_end_packet(perfetto, pkt);
 }
 
-static void dump_graphviz_kernel_rstack(struct uftrace_dump_ops *ops,
-					struct uftrace_kernel_reader *kernel, int cpu,
-					struct uftrace_record *rec, char *name)
+static void dump_perfetto_header(struct uftrace_dump_ops *ops,
+				 struct uftrace_data *handle,
+				 struct opts *opts)
 {
+	struct uftrace_perfetto_dump *perfetto = container_of(ops, typeof(*perfetto), ops);
+	struct uftrace_info *info = &handle->info;
+	struct uftrace_task *task;
+	struct pb_buf *pb = &perfetto->pb;
+	size_t pkt, snapshot, clock, defaults;
 	int tid;
-	struct uftrace_task_reader *task;
-	struct uftrace_task_graph *graph;
+	int i;
 
-	tid = kernel->tids[cpu];
-	task = get_task_handle(kernel->handle, tid);
+	if (handle->hdr.feat_mask & PERF_EVENT)
+		update_perf_task_comm(handle);
 
-	graph = graph_get_task(task, sizeof(*graph));
+	perfetto->names = hashmap_create(512, hashmap_string_hash,
+					 hashmap_string_equals);
 
-	graph->graph = &graphviz_graph;
-	graphviz_graph.sess = kernel->handle->sessions.first;
+	/*
+	 * Define an incremental clock (starting from 0) so that each packet
+	 * can have a small delta of timestamp and use it by default.
+	 */
+	pkt = perfetto_begin_packet(perfetto);
+	pb_uint(pb, PACKET_SEQUENCE_FLAGS, SEQ_INCREMENTAL_STATE_CLEARED);
+
+	snapshot = pb_begin(pb, PACKET_CLOCK_SNAPSHOT);
+	clock = pb_begin(pb, CLOCK_SNAPSHOT_CLOCKS);
+	pb_uint(pb, CLOCK_ID, PERFETTO_CLOCK_MONOTONIC);
+	pb_uint(pb, CLOCK_TIMESTAMP, 0);
+	pb_end(pb, clock);
+	clock = pb_begin(pb, CLOCK_SNAPSHOT_CLOCKS);
+	pb_uint(pb, CLOCK_ID, PERFETTO_CLOCK_INCREMENTAL);
+	pb_uint(pb, CLOCK_TIMESTAMP, 0);
+	pb_uint(pb, CLOCK_IS_INCREMENTAL, 1);
+	pb_end(pb, clock);
+	pb_uint(pb, CLOCK_SNAPSHOT_PRIMARY, PERFETTO_CLOCK_MONOTONIC);
+	pb_end(pb, snapshot);
+
+	defaults = pb_begin(pb, PACKET_DEFAULTS);
+	pb_uint(pb, DEFAULTS_TIMESTAMP_CLOCK_ID, PERFETTO_CLOCK_INCREMENTAL);
+	pb_end(pb, defaults);
+
+	perfetto_end_packet(perfetto, pkt);
 
-	if (graph->node == NULL)
-		graph->node = &graphviz_graph.root;
+	for (i = 0; i < info->nr_tid; i++) {
+		tid = info->tids[i];
+		task = find_task(&handle->sessions, tid);
 
-	graph_add_node(graph, rec->type, name, sizeof(struct uftrace_graph_node), NULL);
+		if (task->pid == tid)
+			perfetto_process_track(perfetto, tid, task->comm);
+		perfetto_thread_track(perfetto, task->pid, tid, task->comm);
+	}
 }
 
-static void print_graph_to_graphviz(struct uftrace_graph_node *node,
-				    struct opts *opts)
+/* returns interned id of the name, @added is set for a new name */
+static uint64_t perfetto_intern_name(struct uftrace_perfetto_dump *perfetto,
+				     char *name, bool *added)
 {
-	struct uftrace_graph_node *child;
-	unsigned long n_calls = node->nr_calls;
+	uint64_t iid;
 
-	if (n_calls) {
-		struct uftrace_graph_node *parent = node->parent;
+	iid = (uintptr_t)hashmap_get(perfetto->names, name);
+	if (iid)
+		return iid;
 
-		pr_out("\t");
-		if (parent != NULL && parent->name != NULL) {
-			pr_out("\"%s\" -> ", parent->name);
+	iid = ++perfetto->last_iid;
+	hashmap_put(perfetto->names, xstrdup(name), (void *)(uintptr_t)iid);
+
+	*added = true;
+	return iid;
+}
+
+static void dump_perfetto_task_rstack(struct uftrace_dump_ops *ops,
+				      struct uftrace_task_reader *task, char *name)
+{
+	char spec_buf[2048];
+	struct uftrace_record *frs = task->rstack;
+	struct uftrace_perfetto_dump *perfetto = container_of(ops, typeof(*perfetto), ops);
+	struct pb_buf *pb = &perfetto->pb;
+	enum argspec_string_bits str_mode = 0;
+	int rec_type = frs->type;
+	uint64_t iid = 0;
+	bool new_name = false;
+	size_t pkt, event, sub;
+
+	if (rec_type == UFTRACE_EVENT) {
+		switch (frs->addr) {
+		case EVENT_ID_PERF_SCHED_IN:
+			/*
+			 * new thread starts with a sched-in event
+			 * which should be ignored
+			 */
+			if (task->timestamp_last == 0)
+				return;
+			rec_type = UFTRACE_EXIT;
+			break;
+		case EVENT_ID_PERF_SCHED_OUT:
+			rec_type = UFTRACE_ENTRY;
+			break;
+		default:
+			return;
+		}
+	}
+
+	if (rec_type == UFTRACE_LOST) {
+		perfetto->lost_event_cnt++;
+		return;
+	}
+	if (rec_type != UFTRACE_ENTRY && rec_type != UFTRACE_EXIT)
+		return;
+
+	if (rec_type == UFTRACE_ENTRY)
+		iid = perfetto_intern_name(perfetto, name, &new_name);
+
+	pkt = perfetto_begin_packet(perfetto);
+
+	if (frs->time >= perfetto->last_time) {
+		pb_uint(pb, PACKET_TIMESTAMP, frs->time - perfetto->last_time);
+		perfetto->last_time = frs->time;
+	}
+	else {
+		/* the incremental clock cannot go backward */
+		pb_uint(pb, PACKET_TIMESTAMP, frs->time);
+		pb_uint(pb, PACKET_TIMESTAMP_CLOCK_ID, PERFETTO_CLOCK_MONOTONIC);
+	}
+
+	if (new_name) {
+		size_t interned = pb_begin(pb, PACKET_INTERNED_DATA);
+
+		sub = pb_begin(pb, INTERNED_EVENT_NAMES);
+		pb_uint(pb, EVENT_NAME_IID_FIELD, iid);
+		pb_string(pb, EVENT_NAME_NAME, name);
+		pb_end(pb, sub);
+
+		pb_end(pb, interned);
+	}
+	pb_uint(pb, PACKET_SEQUENCE_FLAGS, SEQ_NEEDS_INCREMENTAL_STATE);
+
+	event = pb_begin(pb, PACKET_TRACK_EVENT);
+	pb_uint(pb, EVENT_TRACK_UUID, task->tid);
+
+	if (rec_type == UFTRACE_ENTRY) {
+		pb_uint(pb, EVENT_TYPE, EVENT_TYPE_SLICE_BEGIN);
+		pb_uint(pb, EVENT_NAME_IID, iid);
+		str_mode |= NEEDS_PAREN;
+	}
+	else {
+		pb_uint(pb, EVENT_TYPE, EVENT_TYPE_SLICE_END);
+		str_mode |= IS_RETVAL;
+	}
+
+	if (frs->more) {
+		str_mode |= HAS_MORE;
+		get_argspec_string(task, spec_buf, sizeof(spec_buf), str_mode);
+
+		sub = pb_begin(pb, EVENT_DEBUG_ANNOTATIONS);
+		pb_string(pb, ANNOTATION_NAME,
+			  rec_type == UFTRACE_ENTRY ? "arguments" : "retval");
+		pb_string(pb, ANNOTATION_STRING_VALUE, spec_buf);
+		pb_end(pb, sub);
+	}
+
+	pb_end(pb, event);
+	perfetto_end_packet(perfetto, pkt);
+}
+
+static void dump_perfetto_kernel_rstack(struct uftrace_dump_ops *ops,
+					struct uftrace_kernel_reader *kernel, int cpu,
+					struct uftrace_record *rec, char *name)
+{
+	int tid;
+	struct uftrace_task_reader *task;
+
+	tid = kernel->tids[cpu];
+	task = get_task_handle(kernel->handle, tid);
+
+	dump_perfetto_task_rstack(ops, task, name);
+}
+
+static void dump_perfetto_perf_event(struct uftrace_dump_ops *ops,
+				     struct uftrace_perf_reader *perf,
+				     struct uftrace_record *frs)
+{
+	struct uftrace_perfetto_dump *perfetto = container_of(ops, typeof(*perfetto), ops);
+	int pid = perf->u.comm.pid;
+
+	if (frs->addr != EVENT_ID_PERF_COMM)
+		return;
+
+	/* a new descriptor with the same uuid updates the name */
+	if (pid == perf->tid)
+		perfetto_process_track(perfetto, pid, perf->u.comm.comm);
+	perfetto_thread_track(perfetto, pid, perf->tid, perf->u.comm.comm);
+}
+
+static bool free_perfetto_name(void *key, void *value, void *arg)
+{
+	free(key);
+	return true;
+}
+
+static void dump_perfetto_footer(struct uftrace_dump_ops *ops,
+				 struct uftrace_data *handle,
+				 struct opts *opts)
+{
+	struct uftrace_perfetto_dump *perfetto = container_of(ops, typeof(*perfetto), ops);
+
+	pb_flush(&perfetto->pb, outfp);
+	free(perfetto->pb.buf);
+
+	hashmap_for_each(perfetto->names, free_perfetto_name, NULL);
+	hashmap_free(perfetto->names);
+
+	/* see dump_chrome_footer() */
+	if (perfetto->lost_event_cnt) {
+		pr_warn("Some of function trace records are lost. "
+			"(%d times shown)\n", perfetto->lost_event_cnt);
+		pr_warn("The output may not show the correct view.\n");
+	}
+}
+
+/* columnar output support */
+
+/*
+ * The columnar output writes each field of function records to a
+ * separate file as a fixed-width array (in the host byte order) so that
+ * external tools can load them directly.  Function names are saved in a
+ * dictionary (names.txt) and the func column has the (0-based) line
+ * number of the name.  The "schema" file describes the columns.
+ * Rows are kept in memory and written in large batches.
+ */
+#define COLUMNAR_BATCH  (64 * 1024)
+
+static const struct {
+	const char	*name;
+	const char	*type;
+	size_t		size;
+} columnar_columns[NR_COLUMNS] = {
+	[COL_TIME]     = { "time",     "u64", sizeof(uint64_t) },
+	[COL_TID]      = { "tid",      "i32", sizeof(int32_t)  },
+	[COL_DEPTH]    = { "depth",    "u16", sizeof(uint16_t) },
+	[COL_TYPE]     = { "type",     "u8",  sizeof(uint8_t)  },
+	[COL_FUNC]     = { "func",     "u32", sizeof(uint32_t) },
+	[COL_DURATION] = { "duration", "u64", sizeof(uint64_t) },
+};
+
+static FILE *open_columnar_file(struct uftrace_columnar_dump *columnar,
+				const char *name)
+{
+	char *filename;
+	FILE *fp;
+
+	xasprintf(&filename, "%s/%s", columnar->dirname, name);
+
+	fp = fopen(filename, "w");
+	if (fp == NULL)
+		pr_err("cannot open columnar file: %s", filename);
+
+	free(filename);
+	return fp;
+}
+
+static void flush_columnar_batch(struct uftrace_columnar_dump *columnar)
+{
+	void *cols[NR_COLUMNS] = {
+		[COL_TIME]     = columnar->time,
+		[COL_TID]      = columnar->tid,
+		[COL_DEPTH]    = columnar->depth,
+		[COL_TYPE]     = columnar->type,
+		[COL_FUNC]     = columnar->func,
+		[COL_DURATION] = columnar->duration,
+	};
+	int i;
+
+	if (columnar->nr_batch == 0)
+		return;
+
+	for (i = 0; i < NR_COLUMNS; i++) {
+		if (fwrite(cols[i], columnar_columns[i].size, columnar->nr_batch,
+			   columnar->fp[i]) != columnar->nr_batch)
+			pr_err("cannot write columnar data");
+	}
+
+	columnar->nr_rows += columnar->nr_batch;
+	columnar->nr_batch = 0;
+}
+
+static void dump_columnar_header(struct uftrace_dump_ops *ops,
+				 struct uftrace_data *handle,
+				 struct opts *opts)
+{
+	struct uftrace_columnar_dump *columnar = container_of(ops, typeof(*columnar), ops);
+	char filename[64];
+	int i;
+
+	if (mkdir(columnar->dirname, 0755) < 0 && errno != EEXIST)
+		pr_err("cannot create columnar directory: %s", columnar->dirname);
+
+	for (i = 0; i < NR_COLUMNS; i++) {
+		snprintf(filename, sizeof(filename), "%s.%s",
+			 columnar_columns[i].name, columnar_columns[i].type);
+		columnar->fp[i] = open_columnar_file(columnar, filename);
+	}
+	columnar->names_fp = open_columnar_file(columnar, "names.txt");
+
+	columnar->names = hashmap_create(1024, hashmap_string_hash,
+					 hashmap_string_equals);
+
+	columnar->time     = xmalloc(COLUMNAR_BATCH * sizeof(*columnar->time));
+	columnar->tid      = xmalloc(COLUMNAR_BATCH * sizeof(*columnar->tid));
+	columnar->depth    = xmalloc(COLUMNAR_BATCH * sizeof(*columnar->depth));
+	columnar->type     = xmalloc(COLUMNAR_BATCH * sizeof(*columnar->type));
+	columnar->func     = xmalloc(COLUMNAR_BATCH * sizeof(*columnar->func));
+	columnar->duration = xmalloc(COLUMNAR_BATCH * sizeof(*columnar->duration));
+}
+
+static uint32_t columnar_name_id(struct uftrace_columnar_dump *columnar,
+				 char *name)
+{
+	void *id;
+
+	/* ids are saved with 1 offset to distinguish from NULL */
+	id = hashmap_get(columnar->names, name);
+	if (id)
+		return (uintptr_t)id - 1;
+
+	hashmap_put(columnar->names, xstrdup(name),
+		    (void *)(uintptr_t)(columnar->nr_names + 1));
+	fprintf(columnar->names_fp, "%s\n", name);
+
+	return columnar->nr_names++;
+}
+
+static void add_columnar_row(struct uftrace_columnar_dump *columnar,
+			     struct uftrace_task_reader *task,
+			     struct uftrace_record *rec, char *name)
+{
+	struct fstack *fstack;
+	int type = rec->type;
+	unsigned n;
+
+	if (type == UFTRACE_LOST) {
+		columnar->lost_event_cnt++;
+		return;
+	}
+
+	/* handle schedule events as if functions */
+	if (type == UFTRACE_EVENT) {
+		if (rec->addr == EVENT_ID_PERF_SCHED_OUT)
+			type = UFTRACE_ENTRY;
+		else if (rec->addr == EVENT_ID_PERF_SCHED_IN)
+			type = UFTRACE_EXIT;
+		else
+			return;
+	}
+
+	n = columnar->nr_batch;
+
+	columnar->time[n]     = rec->time;
+	columnar->tid[n]      = task->tid;
+	columnar->depth[n]    = rec->depth;
+	columnar->type[n]     = type;
+	columnar->func[n]     = columnar_name_id(columnar, name ?: "none");
+	columnar->duration[n] = 0;
+
+	/* event records don't have a (function) depth */
+	if (rec->type == UFTRACE_EVENT)
+		columnar->depth[n] = task->stack_count;
+
+	if (type == UFTRACE_EXIT) {
+		fstack = fstack_get(task, task->stack_count);
+		if (fstack)
+			columnar->duration[n] = fstack->total_time;
+	}
+
+	if (++columnar->nr_batch == COLUMNAR_BATCH)
+		flush_columnar_batch(columnar);
+}
+
+static void dump_columnar_task_rstack(struct uftrace_dump_ops *ops,
+				      struct uftrace_task_reader *task, char *name)
+{
+	struct uftrace_columnar_dump *columnar = container_of(ops, typeof(*columnar), ops);
+
+	add_columnar_row(columnar, task, task->rstack, name);
+}
+
+static void dump_columnar_kernel_rstack(struct uftrace_dump_ops *ops,
+					struct uftrace_kernel_reader *kernel, int cpu,
+					struct uftrace_record *rec, char *name)
+{
+	struct uftrace_columnar_dump *columnar = container_of(ops, typeof(*columnar), ops);
+	struct uftrace_task_reader *task;
+	int tid;
+
+	tid = kernel->tids[cpu];
+	task = get_task_handle(kernel->handle, tid);
+
+	add_columnar_row(columnar, task, rec, name);
+}
+
+static bool free_columnar_name(void *key, void *value, void *arg)
+{
+	free(key);
+	return true;
+}
+
+static void dump_columnar_footer(struct uftrace_dump_ops *ops,
+				 struct uftrace_data *handle,
+				 struct opts *opts)
+{
+	struct uftrace_columnar_dump *columnar = container_of(ops, typeof(*columnar), ops);
+	FILE *fp;
+	int i;
+
+	flush_columnar_batch(columnar);
+
+	for (i = 0; i < NR_COLUMNS; i++)
+		fclose(columnar->fp[i]);
+	fclose(columnar->names_fp);
+
+	fp = open_columnar_file(columnar, "schema");
+	fprintf(fp, "# uftrace columnar data\n");
+	fprintf(fp, "version: 1\n");
+	fprintf(fp, "rows: %"PRIu64"\n", columnar->nr_rows);
+	fprintf(fp, "byte-order: %s\n",
+		__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ ? "little" : "big");
+	for (i = 0; i < NR_COLUMNS; i++) {
+		fprintf(fp, "column: %s %s %s.%s\n", columnar_columns[i].name,
+			columnar_columns[i].type, columnar_columns[i].name,
+			columnar_columns[i].type);
+	}
+	fprintf(fp, "dictionary: func names.txt %u\n", columnar->nr_names);
+	fprintf(fp, "type: %d=entry %d=exit\n", UFTRACE_ENTRY, UFTRACE_EXIT);
+	fclose(fp);
+
+	free(columnar->time);
+	free(columnar->tid);
+	free(columnar->depth);
+	free(columnar->type);
+	free(columnar->func);
+	free(columnar->duration);
+
+	hashmap_for_each(columnar->names, free_columnar_name, NULL);
+	hashmap_free(columnar->names);
+
+	pr_dbg("%"PRIu64" rows written to %s\n", columnar->nr_rows,
+	       columnar->dirname);
+
+	/* see dump_chrome_footer() */
+	if (columnar->lost_event_cnt) {
+		pr_warn("Some of function trace records are lost. "
+			"(%d times shown)\n", columnar->lost_event_cnt);
+		pr_warn("The output may not show the correct view.\n");
+	}
+}
+
+/* flamegraph support */
+
+/*
+ * Flame graph data is aggregated per call path (a function name and its
+ * parent path) rather than building a full graph.  Each path has an
+ * index in flame->paths and is found by a hash table of the indices.
+ * When it has too many paths, the folded output is written and unused
+ * paths are discarded.  The FlameGraph tools merge the same stacks anyway.
+ *
+ * With --min-samples, a path is not printed until it gets enough samples
+ * in total, so paths with pending samples are kept across the flushes.
+ * Once printed, later samples of the path are printed unconditionally.
+ * At most FLAME_MAX_KEPT paths are kept this way, the ones with smallest
+ * samples are dropped first, so the pruning is approximate for a huge data.
+ */
+#define FLAME_MAX_PATHS  (1024 * 1024)
+#define FLAME_MAX_KEPT   (FLAME_MAX_PATHS / 4)
+
+/* path index 0 is used for the root (of all tasks) */
+#define FLAME_ROOT  0
+
+struct fg_path {
+	uint32_t	parent;
+	bool		active;
+	bool		printed;	/* passed the min-samples already */
+	char		*name;		/* interned */
+	uint64_t	calls;
+	int64_t		self_time;
+};
+
+struct fg_task {
+	struct rb_node	link;
+	int		tid;
+	uint32_t	path;
+};
+
+static char *intern_flame_name(struct uftrace_flame_dump *flame, char *name)
+{
+	char *str = hashmap_get(flame->names, name);
+
+	if (str == NULL) {
+		str = xstrdup(name);
+		hashmap_put(flame->names, str, str);
+	}
+	return str;
+}
+
+static uint32_t hash_flame_path(uint32_t parent, char *name)
+{
+	uint64_t key = ((uint64_t)parent << 32) ^ (uintptr_t)name;
+
+	/* from hash_64() in the Linux kernel */
+	return (key * 0x61c8864680b583ebULL) >> 32;
+}
+
+static void add_flame_slot(struct uftrace_flame_dump *flame, uint32_t idx)
+{
+	struct fg_path *path = &flame->paths[idx];
+	uint32_t mask = flame->nr_slots - 1;
+	uint32_t pos = hash_flame_path(path->parent, path->name) & mask;
+
+	while (flame->slots[pos])
+		pos = (pos + 1) & mask;
+	flame->slots[pos] = idx;
+}
+
+static void rehash_flame_paths(struct uftrace_flame_dump *flame)
+{
+	uint32_t i;
+
+	/* keep load factor below 0.5 */
+	while (flame->nr_slots < flame->nr_paths * 2)
+		flame->nr_slots *= 2;
+
+	free(flame->slots);
+	flame->slots = xcalloc(flame->nr_slots, sizeof(*flame->slots));
+
+	for (i = 1; i < flame->nr_paths; i++)
+		add_flame_slot(flame, i);
+}
+
+static uint32_t get_flame_path(struct uftrace_flame_dump *flame,
+			       uint32_t parent, char *name)
+{
+	uint32_t mask = flame->nr_slots - 1;
+	uint32_t pos = hash_flame_path(parent, name) & mask;
+	struct fg_path *path;
+	uint32_t idx;
+
+	while ((idx = flame->slots[pos]) != 0) {
+		path = &flame->paths[idx];
+		if (path->parent == parent && path->name == name)
+			return idx;
+		pos = (pos + 1) & mask;
+	}
+
+	if (flame->nr_paths == flame->max_paths) {
+		flame->max_paths *= 2;
+		flame->paths = xrealloc(flame->paths,
+					flame->max_paths * sizeof(*flame->paths));
+	}
+
+	idx = flame->nr_paths++;
+	path = &flame->paths[idx];
+	memset(path, 0, sizeof(*path));
+	path->parent = parent;
+	path->name   = name;
+
+	if (flame->nr_paths * 2 > flame->nr_slots)
+		rehash_flame_paths(flame);
+	else
+		flame->slots[pos] = idx;
+
+	return idx;
+}
+
+static struct fg_task *get_flame_task(struct uftrace_flame_dump *flame, int tid)
+{
+	struct rb_node *parent = NULL;
+	struct rb_node **p = &flame->tasks.rb_node;
+	struct fg_task *ft;
+
+	while (*p) {
+		parent = *p;
+		ft = rb_entry(parent, struct fg_task, link);
+
+		if (ft->tid == tid)
+			return ft;
+
+		if (ft->tid > tid)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+
+	ft = xmalloc(sizeof(*ft));
+	ft->tid  = tid;
+	ft->path = FLAME_ROOT;
+
+	rb_link_node(&ft->link, parent, p);
+	rb_insert_color(&ft->link, &flame->tasks);
+
+	return ft;
+}
+
+static uint64_t flame_sample(struct uftrace_flame_dump *flame,
+			     struct fg_path *path)
+{
+	if (flame->sample_time == 0)
+		return path->calls;
+	if (path->self_time <= 0)
+		return 0;
+	return path->self_time / flame->sample_time;
+}
+
+static void print_flame_path(struct uftrace_flame_dump *flame, uint32_t idx,
+			     uint64_t sample)
+{
+	struct fg_path *path;
+	size_t len = 0;
+	size_t namelen;
+	size_t pos;
+	uint32_t i;
+
+	for (i = idx; i != FLAME_ROOT; i = flame->paths[i].parent)
+		len += strlen(flame->paths[i].name) + 1;
+
+	if (len + 32 > flame->buflen) {
+		flame->buflen = ALIGN(len + 32, 4096);
+		flame->buf = xrealloc(flame->buf, flame->buflen);
+	}
+
+	/* build folded stack from the end */
+	pos = len - 1;
+	flame->buf[pos] = ' ';
+
+	for (i = idx; i != FLAME_ROOT; i = path->parent) {
+		path = &flame->paths[i];
+		namelen = strlen(path->name);
+
+		pos -= namelen;
+		memcpy(&flame->buf[pos], path->name, namelen);
+		if (pos)
+			flame->buf[--pos] = ';';
+	}
+	snprintf(&flame->buf[len], flame->buflen - len, "%"PRIu64, sample);
+
+	pr_out("%s\n", flame->buf);
+}
+
+/* a path kept for --min-samples */
+struct fg_kept {
+	uint64_t	sample;
+	uint32_t	idx;
+};
+
+static int cmp_flame_kept(const void *a, const void *b)
+{
+	const struct fg_kept *ka = a;
+	const struct fg_kept *kb = b;
+
+	/* larger samples first */
+	if (ka->sample != kb->sample)
+		return ka->sample > kb->sample ? -1 : 1;
+	return ka->idx < kb->idx ? -1 : 1;
+}
+
+/* keep paths for min-samples up to FLAME_MAX_KEPT, drop the smallest */
+static void limit_flame_kept(struct uftrace_flame_dump *flame,
+			     struct fg_kept *kept, uint32_t nr_kept)
+{
+	struct fg_path *path;
+	uint32_t i;
+
+	if (nr_kept <= FLAME_MAX_KEPT)
+		return;
+
+	qsort(kept, nr_kept, sizeof(*kept), cmp_flame_kept);
+
+	for (i = FLAME_MAX_KEPT; i < nr_kept; i++) {
+		path = &flame->paths[kept[i].idx];
+		path->active = false;
+		path->printed = false;
+	}
+
+	pr_dbg2("drop %u paths kept for min-samples\n", nr_kept - FLAME_MAX_KEPT);
+}
+
+/*
+ * Print folded stacks of all paths and discard paths not used by any
+ * tasks.  Remaining paths keep unprinted time (less than a sample).
+ * Samples of paths below the min-samples are carried to the next flush
+ * and dropped in the final flush only (or when too many are kept).
+ */
+static void flush_flame_paths(struct uftrace_flame_dump *flame, bool final)
+{
+	struct fg_path *path;
+	struct fg_task *ft;
+	struct rb_node *node;
+	struct fg_kept *kept = NULL;
+	uint32_t nr_kept = 0;
+	uint32_t *map;
+	uint32_t i, nr;
+	uint64_t sample;
+	bool pruning = flame->prune > 1;
+
+	if (pruning && !final)
+		kept = xmalloc(flame->nr_paths * sizeof(*kept));
+
+	for (i = 1; i < flame->nr_paths; i++) {
+		path = &flame->paths[i];
+
+		sample = flame_sample(flame, path);
+		if (sample == 0 && !path->printed)
+			continue;
+
+		if (sample < flame->prune && !path->printed) {
+			/* keep it for later flushes */
+			if (!final) {
+				path->active = true;
+				kept[nr_kept].sample = sample;
+				kept[nr_kept++].idx = i;
+			}
+			continue;
+		}
+
+		if (sample) {
+			print_flame_path(flame, i, sample);
+
+			path->calls = 0;
+			if (flame->sample_time)
+				path->self_time -= sample * flame->sample_time;
+		}
+
+		/* remember it to print the remaining samples later */
+		if (pruning && !final) {
+			path->printed = true;
+			path->active = true;
+			/* it's worth as much as a path at the threshold */
+			kept[nr_kept].sample = flame->prune;
+			kept[nr_kept++].idx = i;
+		}
+	}
+
+	if (kept) {
+		limit_flame_kept(flame, kept, nr_kept);
+		free(kept);
+	}
+
+	/* mark paths used by current tasks */
+	for (node = rb_first(&flame->tasks); node; node = rb_next(node)) {
+		ft = rb_entry(node, struct fg_task, link);
+		flame->paths[ft->path].active = true;
+	}
+
+	/* and their parents (which always have a smaller index) */
+	for (i = flame->nr_paths - 1; i > 0; i--) {
+		path = &flame->paths[i];
+		if (path->active)
+			flame->paths[path->parent].active = true;
+	}
+
+	/* so compaction can be done in place */
+	map = xcalloc(flame->nr_paths, sizeof(*map));
+	for (i = 1, nr = 1; i < flame->nr_paths; i++) {
+		path = &flame->paths[i];
+		if (!path->active)
+			continue;
+
+		map[i] = nr;
+		path->active = false;
+		path->parent = map[path->parent];
+		flame->paths[nr++] = *path;
+	}
+	flame->paths[FLAME_ROOT].active = false;
+
+	for (node = rb_first(&flame->tasks); node; node = rb_next(node)) {
+		ft = rb_entry(node, struct fg_task, link);
+		ft->path = map[ft->path];
+	}
+	free(map);
+
+	pr_dbg2("flush flame graph paths: %u -> %u\n", flame->nr_paths, nr);
+
+	flame->nr_paths = nr;
+	rehash_flame_paths(flame);
+
+	/* do not flush again soon if many paths are still used by tasks */
+	flame->flush_paths = FLAME_MAX_PATHS;
+	while (flame->flush_paths < nr * 2)
+		flame->flush_paths *= 2;
+}
+
+static void add_flame_entry(struct uftrace_flame_dump *flame,
+			    struct fg_task *ft, char *name)
+{
+	if (flame->nr_paths >= flame->flush_paths)
+		flush_flame_paths(flame, false);
+
+	name = intern_flame_name(flame, name ?: "none");
+	ft->path = get_flame_path(flame, ft->path, name);
+	flame->paths[ft->path].calls++;
+}
+
+static void add_flame_exit(struct uftrace_flame_dump *flame,
+			   struct fg_task *ft, struct uftrace_task_reader *task)
+{
+	struct fstack *fstack = fstack_get(task, task->stack_count);
+	struct fg_path *path;
+	uint64_t accounted_time;
+
+	if (ft->path == FLAME_ROOT || fstack == NULL)
+		return;
+
+	path = &flame->paths[ft->path];
+	ft->path = path->parent;
+
+	if (flame->sample_time == 0)
+		return;
+
+	path->self_time += fstack->total_time - fstack->child_time;
+
+	if (ft->path == FLAME_ROOT)
+		return;
+
+	/*
+	 * it needs to track the child time separately
+	 * since child time not accounted due to sample time
+	 * should be accounted to parent.
+	 *
+	 * For example, with 1us sample time:
+	 *
+	 * # DURATION    TID     FUNCTION
+	 *             [12345] | main() {
+	 *    4.789 us [12345] |   foo();
+	 *    4.987 us [12345] |   bar();
+	 *   10.567 us [12345] | } // main
+	 *
+	 * In this case, main's total time is more than 10us
+	 * so 10 samples should be shown, but after accounting
+	 * foo and bar (4 samples each), its time would be
+	 * 10.567 - 4.789 - 4.987 = 0.791 so no samples for main.
+	 * But it actually needs to get 2 samples.
+	 *
+	 * So add the accounted child time only, not real time.
+	 */
+	accounted_time = (fstack->total_time / flame->sample_time) * flame->sample_time;
+	flame->paths[ft->path].self_time += fstack->total_time - accounted_time;
+}
+
+static void add_flame_record(struct uftrace_flame_dump *flame,
+			     struct uftrace_task_reader *task,
+			     struct uftrace_record *rec, char *name)
+{
+	struct fg_task *ft = get_flame_task(flame, task->tid);
+
+	switch (rec->type) {
+	case UFTRACE_ENTRY:
+		add_flame_entry(flame, ft, name);
+		break;
+	case UFTRACE_EXIT:
+		add_flame_exit(flame, ft, task);
+		break;
+	case UFTRACE_EVENT:
+		/* handle schedule events as if functions */
+		if (rec->addr == EVENT_ID_PERF_SCHED_OUT)
+			add_flame_entry(flame, ft, name);
+		else if (rec->addr == EVENT_ID_PERF_SCHED_IN)
+			add_flame_exit(flame, ft, task);
+		break;
+	default:
+		break;
+	}
+}
+
+static void dump_flame_header(struct uftrace_dump_ops *ops,
+			       struct uftrace_data *handle,
+			       struct opts *opts)
+{
+	struct uftrace_flame_dump *flame = container_of(ops, typeof(*flame), ops);
+
+	flame->names = hashmap_create(1024, hashmap_string_hash,
+				      hashmap_string_equals);
+
+	flame->max_paths = 1024;
+	flame->paths = xcalloc(flame->max_paths, sizeof(*flame->paths));
+	flame->nr_paths = 1;  /* for root */
+
+	flame->nr_slots = 1024;
+	flame->slots = xcalloc(flame->nr_slots, sizeof(*flame->slots));
+
+	flame->flush_paths = FLAME_MAX_PATHS;
+}
+
+static void dump_flame_task_rstack(struct uftrace_dump_ops *ops,
+				    struct uftrace_task_reader *task, char *name)
+{
+	struct uftrace_flame_dump *flame = container_of(ops, typeof(*flame), ops);
+
+	add_flame_record(flame, task, task->rstack, name);
+}
+
+static void dump_flame_kernel_rstack(struct uftrace_dump_ops *ops,
+				     struct uftrace_kernel_reader *kernel, int cpu,
+				     struct uftrace_record *rec, char *name)
+{
+	struct uftrace_flame_dump *flame = container_of(ops, typeof(*flame), ops);
+	struct uftrace_task_reader *task;
+	int tid;
+
+	tid = kernel->tids[cpu];
+	task = get_task_handle(kernel->handle, tid);
+
+	add_flame_record(flame, task, rec, name);
+}
+
+static bool free_flame_name(void *key, void *value, void *arg)
+{
+	free(key);
+	return true;
+}
+
+static void dump_flame_footer(struct uftrace_dump_ops *ops,
+			       struct uftrace_data *handle,
+			       struct opts *opts)
+{
+	struct uftrace_flame_dump *flame = container_of(ops, typeof(*flame), ops);
+	struct fg_task *ft;
+	struct rb_node *node;
+
+	/* discard remaining tasks so that all paths can be flushed */
+	while (!RB_EMPTY_ROOT(&flame->tasks)) {
+		node = rb_first(&flame->tasks);
+		ft = rb_entry(node, struct fg_task, link);
+
+		rb_erase(node, &flame->tasks);
+		free(ft);
+	}
+	flush_flame_paths(flame, true);
+
+	hashmap_for_each(flame->names, free_flame_name, NULL);
+	hashmap_free(flame->names);
+
+	free(flame->paths);
+	free(flame->slots);
+	free(flame->buf);
+}
+
+/* graphviz support */
+static struct uftrace_graph graphviz_graph = {
+	.root.head     = LIST_HEAD_INIT(graphviz_graph.root.head),
+	.special_nodes = LIST_HEAD_INIT(graphviz_graph.special_nodes),
+};
+
+static void dump_graphviz_header(struct uftrace_dump_ops *ops,
+				  struct uftrace_data *handle,
+				  struct opts *opts)
+{
+	pr_out("# version\":\"uftrace %s\",\n", UFTRACE_VERSION);
+
+	if (handle->hdr.info_mask & (1UL << CMDLINE))
+		pr_out("# command_line \"%s\"\n", handle->info.cmdline);
+
+	pr_out("digraph \"");
+	pr_out("%s", (&handle->info)->exename);
+	pr_out("\" { \n");
+	pr_out("\n\t# Attributes \n");
+	pr_out("\tsplines=ortho;\n");
+	pr_out("\tconcentrate=true;\n");
+	pr_out("\tnode [shape=\"rect\",fontsize=\"7\",style=\"filled\"];\n");
+	pr_out("\tedge [fontsize=\"7\"];\n\n");
+
+	graph_init_callbacks(NULL, NULL, NULL, ops);
+}
+
+static void dump_graphviz_task_rstack(struct uftrace_dump_ops *ops,
+				       struct uftrace_task_reader *task,
+				       char *name)
+{
+	struct uftrace_record *frs = task->rstack;
+	struct uftrace_task_graph *graph;
+
+	graph = graph_get_task(task, sizeof(*graph));
+
+	graph->graph = &graphviz_graph;
+	graphviz_graph.sess = find_task_session(&task->h->sessions,
+						task->t, frs->time);
+	if (graph->node == NULL)
+		graph->node = &graphviz_graph.root;
+
+	graph_add_node(graph, frs->type, name, sizeof(struct uftrace_graph_node), NULL);
+}
+
+static void dump_graphviz_kernel_rstack(struct uftrace_dump_ops *ops,
+					struct uftrace_kernel_reader *kernel, int cpu,
+					struct uftrace_record *rec, char *name)
+{
+	int tid;
+	struct uftrace_task_reader *task;
+	struct uftrace_task_graph *graph;
+
+	tid = kernel->tids[cpu];
+	task = get_task_handle(kernel->handle, tid);
+
+	graph = graph_get_task(task, sizeof(*graph));
+
+	graph->graph = &graphviz_graph;
+	graphviz_graph.sess = kernel->handle->sessions.first;
+
+	if (graph->node == NULL)
+		graph->node = &graphviz_graph.root;
+
+	graph_add_node(graph, rec->type, name, sizeof(struct uftrace_graph_node), NULL);
+}
+
+static void print_graph_to_graphviz(struct uftrace_graph_node *node,
+				    struct opts *opts)
+{
+	struct uftrace_graph_node *child;
+	unsigned long n_calls = node->nr_calls;
+
+	if (n_calls) {
+		struct uftrace_graph_node *parent = node->parent;
+
+		pr_out("\t");
+		if (parent != NULL && parent->name != NULL) {
+			pr_out("\"%s\" -> ", parent->name);
 		}
 		pr_out("\"%s\"", node->name);
 
@@ -1486,6 +2690,12 @@ static void dump_replay_func(struct uftrace_dump_ops *ops,
 	if (!opts->libcall && sym && sym->type == ST_PLT_FUNC)
 		return;
 
+	/* let it get the name later */
+	if (ops->task_func && !is_kernel_record(task, rec)) {
+		ops->task_func(ops, task, sym);
+		return;
+	}
+
 	name = symbol_getname(sym, rec->addr);
 	if (is_kernel_record(task, rec)) {
 		struct uftrace_kernel_reader *kernel = task->h->kernel;
@@ -1656,6 +2866,7 @@ int command_dump(int argc, char *argv[], struct opts *opts)
 			.ops = {
 				.header         = dump_chrome_header,
 				.task_rstack    = dump_chrome_task_rstack,
+				.task_func      = dump_chrome_task_func,
 				.kernel_func    = dump_chrome_kernel_rstack,
 				.perf_event     = dump_chrome_perf_event,
 				.footer         = dump_chrome_footer,
@@ -1664,6 +2875,32 @@ int command_dump(int argc, char *argv[], struct opts *opts)
 
 		do_dump_replay(&dump.ops, opts, &handle);
 	}
+	else if (opts->perfetto) {
+		struct uftrace_perfetto_dump dump = {
+			.ops = {
+				.header         = dump_perfetto_header,
+				.task_rstack    = dump_perfetto_task_rstack,
+				.kernel_func    = dump_perfetto_kernel_rstack,
+				.perf_event     = dump_perfetto_perf_event,
+				.footer         = dump_perfetto_footer,
+			},
+		};
+
+		do_dump_replay(&dump.ops, opts, &handle);
+	}
+	else if (opts->columnar) {
+		struct uftrace_columnar_dump dump = {
+			.ops = {
+				.header         = dump_columnar_header,
+				.task_rstack    = dump_columnar_task_rstack,
+				.kernel_func    = dump_columnar_kernel_rstack,
+				.footer         = dump_columnar_footer,
+			},
+			.dirname = opts->columnar,
+		};
+
+		do_dump_replay(&dump.ops, opts, &handle);
+	}
 	else if (opts->flame_graph) {
 		struct uftrace_flame_dump dump = {
 			.ops = {
@@ -1674,6 +2911,7 @@ int command_dump(int argc, char *argv[], struct opts *opts)
 			},
 			.tasks = RB_ROOT,
 			.sample_time = opts->sample_time,
+			.prune = opts->min_samples,
 		};
 
 		do_dump_replay(&dump.ops, opts, &handle);
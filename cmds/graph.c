@@ -733,7 +733,7 @@ static int find_func(struct uftrace_session *s, void *arg)
 		if (map->mod == NULL)
 			continue;
 
-		if (find_symname(&map->mod->symtab, data->name)) {
+		if (find_demangled_symname(&map->mod->symtab, data->name)) {
 			data->found = true;
 			break;
 		}
@@ -1070,6 +1070,11 @@ void process_uftrace_info(struct uftrace_data *handle, struct opts *opts,
 		}
 		process(data, "# %-20s: %s\n", "task list", task_list);
 		free(task_list);
+
+		if (handle->perf_lost) {
+			process(data, "# %-20s: %"PRIu64"\n", "lost perf events",
+				handle->perf_lost);
+		}
 	}
 
 	if (info_mask & (1UL << EXE_NAME))
@@ -1209,7 +1214,7 @@ int command_info(int argc, char *argv[], struct opts *opts)
 		struct symtabs symtabs = {
 			.dirname = opts->dirname,
 			.filename = opts->exename,
-			.flags = SYMTAB_FL_USE_SYMFILE | SYMTAB_FL_DEMANGLE,
+			.flags = SYMTAB_FL_USE_SYMFILE,
 		};
 		struct uftrace_module *mod;
 		char build_id[BUILD_ID_STR_SIZE];
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <inttypes.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -19,15 +20,19 @@
 #include <sys/resource.h>
 #include <sys/epoll.h>
 #include <sys/personality.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include "uftrace.h"
 #include "libmcount/mcount.h"
 #include "utils/utils.h"
 #include "utils/symbol.h"
+#include "utils/dwarf.h"
 #include "utils/list.h"
 #include "utils/filter.h"
 #include "utils/kernel.h"
 #include "utils/perf.h"
+#include "utils/inject.h"
 
 #ifndef EFD_SEMAPHORE
 # define EFD_SEMAPHORE (1 << 0)
@@ -42,6 +47,11 @@ struct shmem_list {
 static LIST_HEAD(shmem_list_head);
 static LIST_HEAD(shmem_need_unlink);
 
+/* all buffers in the rings for flight recorder */
+static LIST_HEAD(flight_list);
+/* rings of exited tasks, saved in the next snapshot and released */
+static LIST_HEAD(flight_exited);
+
 struct buf_list {
 	struct list_head list;
 	int tid;
@@ -63,17 +73,29 @@ static bool has_perf_event;
 static bool has_sched_event;
 static bool finish_received;
 
+/* flight recorder mode: keep the data in shmem until a snapshot */
+static bool flight_mode;
+static bool flight_snapshot_requested;
+static int flight_snapshot_count;
+static int flight_nr_exited;
+
+/* max number of exited tasks to keep the ring until a snapshot */
+#define FLIGHT_MAX_EXITED  64
+
 static bool can_use_fast_libmcount(struct opts *opts)
 {
 	if (debug)
 		return false;
 	if (opts->depth != MCOUNT_DEFAULT_DEPTH)
 		return false;
+	if (opts->flight_threshold)
+		return false;
 	if (getenv("UFTRACE_FILTER")    || getenv("UFTRACE_TRIGGER") ||
 	    getenv("UFTRACE_ARGUMENT")  || getenv("UFTRACE_RETVAL") ||
 	    getenv("UFTRACE_PATCH")     || getenv("UFTRACE_SCRIPT") ||
 	    getenv("UFTRACE_AUTO_ARGS") || getenv("UFTRACE_WATCH") ||
-	    getenv("UFTRACE_CALLER")    || getenv("UFTRACE_SIGNAL"))
+	    getenv("UFTRACE_CALLER")    || getenv("UFTRACE_SIGNAL") ||
+	    getenv("UFTRACE_AGENT"))
 		return false;
 	return true;
 }
@@ -100,6 +122,10 @@ char * get_libmcount_path(struct opts *opts)
 	bool must_use_multi_thread = has_dependency(opts->exename,
 						    "libpthread.so.0");
 
+	/* the agent runs in a separate thread */
+	if (opts->agent)
+		must_use_multi_thread = true;
+
 	if (opts->nop) {
 		libmcount = "libmcount-nop.so";
 	}
@@ -278,6 +304,18 @@ static void setup_child_environ(struct opts *opts, int argc, char *argv[])
 		setenv("UFTRACE_BUFFER", buf, 1);
 	}
 
+	if (opts->flight_size) {
+		unsigned long nr_buf = opts->flight_size / opts->bufsize;
+
+		snprintf(buf, sizeof(buf), "%lu", nr_buf < 2 ? 2 : nr_buf);
+		setenv("UFTRACE_FLIGHT", buf, 1);
+
+		if (opts->flight_threshold) {
+			snprintf(buf, sizeof(buf), "%"PRIu64, opts->flight_threshold);
+			setenv("UFTRACE_FLIGHT_THRESHOLD", buf, 1);
+		}
+	}
+
 	if (opts->logfile) {
 		snprintf(buf, sizeof(buf), "%d", fileno(logfp));
 		setenv("UFTRACE_LOGFD", buf, 1);
@@ -294,6 +332,9 @@ static void setup_child_environ(struct opts *opts, int argc, char *argv[])
 	if (opts->disabled)
 		setenv("UFTRACE_DISABLED", "1", 1);
 
+	if (opts->agent)
+		setenv("UFTRACE_AGENT", "1", 1);
+
 	if (log_color == COLOR_ON) {
 		snprintf(buf, sizeof(buf), "%d", log_color);
 		setenv("UFTRACE_COLOR", buf, 1);
@@ -318,6 +359,15 @@ static void setup_child_environ(struct opts *opts, int argc, char *argv[])
 	if (opts->srcline)
 		setenv("UFTRACE_SRCLINE", "1", 1);
 
+	if (!opts->no_debug_cache) {
+		char *cache_dir = get_debug_cache_dir();
+
+		/* libmcount reads the cache, saving it is done here */
+		if (cache_dir)
+			setenv("UFTRACE_DEBUG_CACHE", cache_dir, 1);
+		free(cache_dir);
+	}
+
 	if (opts->estimate_return)
 		setenv("UFTRACE_ESTIMATE_RETURN", "1", 1);
 
@@ -538,7 +588,6 @@ struct writer_arg {
 	struct list_head		bufs;
 	struct opts			*opts;
 	struct uftrace_kernel_writer	*kern;
-	struct uftrace_perf_writer	*perf;
 	int				sock;
 	int				idx;
 	int				tid;
@@ -577,14 +626,12 @@ static void write_buf_list(struct list_head *buf_head, struct opts *opts,
 }
 
 static int setup_pollfd(struct pollfd **pollfd, struct writer_arg *warg,
-			bool setup_perf, bool setup_kernel)
+			bool setup_kernel)
 {
 	int nr_poll = 1;
 	struct pollfd *p;
 	int i;
 
-	if (setup_perf)
-		nr_poll += warg->nr_cpu;
 	if (setup_kernel)
 		nr_poll += warg->nr_cpu;
 
@@ -594,14 +641,6 @@ static int setup_pollfd(struct pollfd **pollfd, struct writer_arg *warg,
 	p[0].events = POLLIN;
 	nr_poll = 1;
 
-	if (setup_perf) {
-		for (i = 0; i < warg->nr_cpu; i++) {
-			p[i + nr_poll].fd = warg->perf->event_fd[warg->cpus[i]];
-			p[i + nr_poll].events = POLLIN;
-		}
-		nr_poll += warg->nr_cpu;
-	}
-
 	if (setup_kernel) {
 		for (i = 0; i < warg->nr_cpu; i++) {
 			p[i + nr_poll].fd = warg->kern->traces[warg->cpus[i]];
@@ -615,16 +654,13 @@ static int setup_pollfd(struct pollfd **pollfd, struct writer_arg *warg,
 }
 
 static bool handle_pollfd(struct pollfd *pollfd, struct writer_arg *warg,
-			  bool trace_task, bool trace_perf, bool trace_kernel,
-			  int timeout)
+			  bool trace_task, bool trace_kernel, int timeout)
 {
 	int start = trace_task ? 0 : 1;
 	int nr_poll = trace_task ? 1 : 0;
 	bool check_task = false;
 	int i;
 
-	if (trace_perf)
-		nr_poll += warg->nr_cpu;
 	if (trace_kernel)
 		nr_poll += warg->nr_cpu;
 
@@ -637,10 +673,6 @@ static bool handle_pollfd(struct pollfd *pollfd, struct writer_arg *warg,
 
 		if (i == 0)
 			check_task = true;
-		else if (trace_perf && i < (warg->nr_cpu + 1)) {
-			record_perf_data(warg->perf, warg->cpus[i - 1],
-					 warg->sock);
-		}
 		else if (trace_kernel) {
 			int idx = i - (nr_poll - warg->nr_cpu);
 
@@ -664,7 +696,7 @@ void *writer_thread(void *arg)
 	struct writer_arg *warg = arg;
 	struct opts *opts = warg->opts;
 	struct pollfd *pollfd;
-	int i, dummy;
+	int dummy;
 	sigset_t sigset;
 
 	pthread_setname_np(pthread_self(), "WriterThread");
@@ -681,17 +713,20 @@ void *writer_thread(void *arg)
 	sigfillset(&sigset);
 	pthread_sigmask(SIG_BLOCK, &sigset, NULL);
 
-	setup_pollfd(&pollfd, warg, has_perf_event, opts->kernel);
+	setup_pollfd(&pollfd, warg, opts->kernel);
 
 	pr_dbg2("start writer thread %d\n", warg->idx);
 	while (!buf_done) {
 		LIST_HEAD(head);
 		bool check_list = false;
 
-		check_list = handle_pollfd(pollfd, warg, true, has_perf_event,
-					   opts->kernel, 1000);
-		if (!check_list)
+		check_list = handle_pollfd(pollfd, warg, true, opts->kernel,
+					   1000);
+		if (!check_list) {
+			if (opts->host)
+				send_trace_flush(warg->sock);
 			continue;
+		}
 
 		if (read(thread_ctl[0], &dummy, sizeof(dummy)) < 0) {
 			if (errno == EAGAIN || errno == EINTR)
@@ -734,25 +769,72 @@ void *writer_thread(void *arg)
 			}
 			pthread_mutex_unlock(&write_list_lock);
 
-			if (!has_perf_event && !opts->kernel)
+			if (!opts->kernel)
 				continue;
 
-			handle_pollfd(pollfd, warg, false, has_perf_event,
-				      opts->kernel, 0);
+			handle_pollfd(pollfd, warg, false, opts->kernel, 0);
 		}
 	}
 	pr_dbg2("stop writer thread %d\n", warg->idx);
 
-	if (has_perf_event) {
-		for (i = 0; i < warg->nr_cpu; i++)
-			record_perf_data(warg->perf, warg->cpus[i], warg->sock);
-	}
-
 	finish_pollfd(pollfd);
 	free(warg);
 	return NULL;
 }
 
+struct perf_reader_arg {
+	struct opts			*opts;
+	struct uftrace_perf_writer	*perf;
+	int				sock;
+	int				cpu;
+};
+
+/*
+ * Perf events are read by a dedicated thread for each cpu so that it
+ * can keep up with the kernel even when writer threads are busy.
+ */
+void *perf_reader_thread(void *arg)
+{
+	struct perf_reader_arg *parg = arg;
+	struct opts *opts = parg->opts;
+	struct pollfd pollfd = {
+		.fd	= parg->perf->event_fd[parg->cpu],
+		.events	= POLLIN,
+	};
+	sigset_t sigset;
+
+	pthread_setname_np(pthread_self(), "PerfReader");
+
+	if (opts->rt_prio) {
+		struct sched_param param = {
+			.sched_priority = opts->rt_prio,
+		};
+
+		if (sched_setscheduler(0, SCHED_FIFO, &param) < 0)
+			pr_warn("set scheduling param failed\n");
+	}
+
+	sigfillset(&sigset);
+	pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+
+	pr_dbg2("start perf reader thread for cpu %d\n", parg->cpu);
+	while (!buf_done) {
+		/* it'll be woken up by the watermark */
+		if (poll(&pollfd, 1, 1000) <= 0)
+			continue;
+
+		if (pollfd.revents & POLLIN)
+			record_perf_data(parg->perf, parg->cpu, parg->sock);
+	}
+
+	/* read remaining data */
+	record_perf_data(parg->perf, parg->cpu, parg->sock);
+	pr_dbg2("stop perf reader thread for cpu %d\n", parg->cpu);
+
+	free(parg);
+	return NULL;
+}
+
 static struct buf_list *make_write_buffer(void)
 {
 	struct buf_list *buf;
@@ -962,6 +1044,217 @@ static void flush_old_shmem(const char *dirname, int tid, int bufsize)
 	}
 }
 
+struct flight_data {
+	int		tid;
+	int		ring;
+	unsigned	seqnum;
+	unsigned	size;
+	void		*data;
+};
+
+static int cmp_flight_data(const void *a, const void *b)
+{
+	const struct flight_data *fa = a;
+	const struct flight_data *fb = b;
+
+	if (fa->tid != fb->tid)
+		return fa->tid - fb->tid;
+	if (fa->ring != fb->ring)
+		return fa->ring - fb->ring;
+	return fa->seqnum < fb->seqnum ? -1 : fa->seqnum > fb->seqnum;
+}
+
+/*
+ * Copy the shmem buffer while the task might be writing to it.
+ * libmcount clears the seqnum before reusing the buffer, so the copy is
+ * valid only if the seqnum is not changed.  See get_next_flight_buffer().
+ */
+static bool copy_flight_buffer(char *sess_id, int bufsize,
+			       struct flight_data *fdata)
+{
+	struct mcount_shmem_buffer *shmem_buf;
+	unsigned seqnum;
+	int fd;
+
+	fd = shm_open(sess_id, O_RDONLY, 0600);
+	if (fd < 0) {
+		pr_dbg("open shmem buffer failed: %s: %m\n", sess_id);
+		return false;
+	}
+
+	shmem_buf = mmap(NULL, bufsize, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (shmem_buf == MAP_FAILED) {
+		pr_dbg("mmap shmem buffer failed: %s: %m\n", sess_id);
+		return false;
+	}
+
+	seqnum = shmem_buf->seqnum;
+	__sync_synchronize();
+	fdata->size = shmem_buf->size;
+
+	if (seqnum == 0 || fdata->size == 0) {
+		munmap(shmem_buf, bufsize);
+		return false;
+	}
+
+	fdata->data = xmalloc(fdata->size);
+	memcpy(fdata->data, shmem_buf->data, fdata->size);
+	__sync_synchronize();
+
+	if (shmem_buf->seqnum != seqnum) {
+		pr_dbg2("skip overwritten buffer: %s\n", sess_id);
+		free(fdata->data);
+		munmap(shmem_buf, bufsize);
+		return false;
+	}
+
+	fdata->seqnum = seqnum;
+	munmap(shmem_buf, bufsize);
+	return true;
+}
+
+static void release_flight_buffer(struct shmem_list *sl)
+{
+	list_del(&sl->list);
+	shm_unlink(sl->id);
+	free(sl);
+}
+
+/*
+ * The ring of an exited task is kept until the next snapshot so that its
+ * last data can be saved.  But don't let them pile up in the shared
+ * memory when no snapshot is taken for a long time.
+ */
+static void exit_flight_task(int tid)
+{
+	struct shmem_list *sl, *tmp;
+	bool found = false;
+	int sl_tid, old_tid;
+
+	list_for_each_entry_safe(sl, tmp, &flight_list, list) {
+		parse_msg_id(sl->id, NULL, &sl_tid, NULL);
+		if (sl_tid != tid)
+			continue;
+
+		list_move_tail(&sl->list, &flight_exited);
+		found = true;
+	}
+
+	if (!found || ++flight_nr_exited <= FLIGHT_MAX_EXITED)
+		return;
+
+	/* release the oldest ring */
+	sl = list_first_entry(&flight_exited, struct shmem_list, list);
+	parse_msg_id(sl->id, NULL, &old_tid, NULL);
+
+	list_for_each_entry_safe(sl, tmp, &flight_exited, list) {
+		parse_msg_id(sl->id, NULL, &sl_tid, NULL);
+		if (sl_tid != old_tid)
+			break;
+
+		release_flight_buffer(sl);
+	}
+	flight_nr_exited--;
+}
+
+static void add_flight_data(struct list_head *head, struct flight_data **fdata,
+			    int *nr_data, int *ring, int bufsize)
+{
+	struct shmem_list *sl;
+
+	list_for_each_entry(sl, head, list) {
+		struct flight_data *data;
+		int idx;
+
+		*fdata = xrealloc(*fdata, (*nr_data + 1) * sizeof(**fdata));
+		data = &(*fdata)[*nr_data];
+
+		parse_msg_id(sl->id, NULL, &data->tid, &idx);
+
+		/* a new ring starts from index 0 (see prepare_shmem_buffer) */
+		if (idx == 0)
+			(*ring)++;
+		data->ring = *ring;
+
+		if (copy_flight_buffer(sl->id, bufsize, data))
+			(*nr_data)++;
+	}
+}
+
+/* save data in all flight recorder buffers to the data files */
+static void save_flight_snapshot(const char *dirname, int bufsize)
+{
+	struct shmem_list *sl, *tmp;
+	struct flight_data *fdata = NULL;
+	int nr_data = 0;
+	int ring = -1;
+	int fd = -1;
+	int i;
+
+	/* exited tasks first, in case the tid was reused */
+	add_flight_data(&flight_exited, &fdata, &nr_data, &ring, bufsize);
+	add_flight_data(&flight_list, &fdata, &nr_data, &ring, bufsize);
+
+	/* make it time-ordered in each task */
+	qsort(fdata, nr_data, sizeof(*fdata), cmp_flight_data);
+
+	for (i = 0; i < nr_data; i++) {
+		if (i == 0 || fdata[i].tid != fdata[i-1].tid) {
+			char *filename = make_disk_name(dirname, fdata[i].tid);
+
+			if (fd >= 0)
+				close(fd);
+
+			fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			if (fd < 0)
+				pr_err("open disk file");
+			free(filename);
+		}
+
+		if (write_all(fd, fdata[i].data, fdata[i].size) < 0)
+			pr_err("write flight recorder data");
+
+		free(fdata[i].data);
+	}
+
+	if (fd >= 0)
+		close(fd);
+	free(fdata);
+
+	/* data of exited tasks is saved, no need to keep it anymore */
+	list_for_each_entry_safe(sl, tmp, &flight_exited, list)
+		release_flight_buffer(sl);
+	flight_nr_exited = 0;
+
+	flight_snapshot_count++;
+	flight_snapshot_requested = false;
+
+	pr_dbg("flight recorder snapshot #%d: %d buffers saved\n",
+	       flight_snapshot_count, nr_data);
+}
+
+static void finish_flight_recorder(const char *dirname, int bufsize)
+{
+	struct shmem_list *sl, *tmp;
+
+	if (!flight_mode)
+		return;
+
+	/* the task requested a snapshot right before exit */
+	if (flight_snapshot_requested)
+		save_flight_snapshot(dirname, bufsize);
+
+	if (flight_snapshot_count == 0)
+		pr_warn("flight recorder: no snapshot was taken\n");
+
+	list_for_each_entry_safe(sl, tmp, &flight_exited, list)
+		release_flight_buffer(sl);
+	list_for_each_entry_safe(sl, tmp, &flight_list, list)
+		release_flight_buffer(sl);
+}
+
 static int shmem_lost_count;
 
 struct tid_list {
@@ -1100,6 +1393,12 @@ static void read_record_mmap(int pfd, const char *dirname, int bufsize)
 		sl->id[msg.len] = '\0';
 		pr_dbg2("MSG START: %s\n", sl->id);
 
+		/* flight recorder buffers are read only for snapshot */
+		if (flight_mode) {
+			list_add_tail(&sl->list, &flight_list);
+			break;
+		}
+
 		/* link to shmem_list */
 		list_add_tail(&sl->list, &shmem_list_head);
 		break;
@@ -1165,6 +1464,9 @@ static void read_record_mmap(int pfd, const char *dirname, int bufsize)
 				break;
 			}
 		}
+
+		if (flight_mode)
+			exit_flight_task(tmsg.tid);
 		break;
 
 	case UFTRACE_MSG_FORK_START:
@@ -1275,6 +1577,18 @@ static void read_record_mmap(int pfd, const char *dirname, int bufsize)
 		finish_received = true;
 		break;
 
+	case UFTRACE_MSG_SNAPSHOT:
+		if (msg.len > sizeof(buf))
+			pr_err_ns("invalid message length\n");
+
+		if (read_all(pfd, buf, msg.len) < 0)
+			pr_err("reading pipe failed");
+
+		pr_dbg2("MSG SNAPSHOT\n");
+		/* it'll be saved after reading pending messages */
+		flight_snapshot_requested = flight_mode;
+		break;
+
 	default:
 		pr_warn("Unknown message type: %u\n", msg.type);
 		break;
@@ -1666,6 +1980,157 @@ again:
 	close(fd);
 }
 
+/* connect to the agent in the process (started by record --agent) */
+static int connect_agent(int pid)
+{
+	struct sockaddr_un addr = {
+		.sun_family = AF_UNIX,
+	};
+	socklen_t len;
+	int sock;
+
+	/* sun_path[0] = '\0' for the abstract namespace */
+	snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1,
+		 UFTRACE_AGENT_SOCKET, pid);
+	len = offsetof(struct sockaddr_un, sun_path) + 1 +
+		strlen(addr.sun_path + 1);
+
+	sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock < 0)
+		return -1;
+
+	if (connect(sock, (struct sockaddr *)&addr, len) < 0) {
+		pr_dbg("cannot connect to agent of process %d: %m\n", pid);
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+/* send a message to the agent and return the result */
+static int send_agent_msg(int sock, int type, void *data, int len)
+{
+	struct uftrace_msg msg = {
+		.magic = UFTRACE_MSG_MAGIC,
+		.type = type,
+		.len = len,
+	};
+	struct iovec iov[2] = {
+		{ .iov_base = &msg, .iov_len = sizeof(msg), },
+		{ .iov_base = data, .iov_len = len, },
+	};
+	struct {
+		struct uftrace_msg msg;
+		int status;
+	} reply;
+
+	if (writev_all(sock, iov, 2) < 0 ||
+	    read_all(sock, &reply, sizeof(reply)) < 0) {
+		pr_dbg("cannot communicate with agent: %m\n");
+		return -1;
+	}
+
+	if (reply.msg.magic != UFTRACE_MSG_MAGIC || reply.msg.type != type)
+		return -1;
+
+	return reply.status;
+}
+
+static int send_agent_trace(int sock, enum uftrace_trace_state trace)
+{
+	int on = trace == TRACE_STATE_ON;
+
+	if (send_agent_msg(sock, UFTRACE_MSG_AGENT_TRACE, &on, sizeof(on)) < 0) {
+		pr_warn("cannot turn tracing %s\n", on ? "on" : "off");
+		return -1;
+	}
+	return 0;
+}
+
+/* change tracing of the process which has the agent already */
+static int control_agent(int sock, struct opts *opts)
+{
+	int ret = 0;
+
+	if (opts->trace == TRACE_STATE_NONE && opts->filter == NULL &&
+	    !opts->clear_filter && opts->depth == OPT_DEPTH_DEFAULT &&
+	    !opts->threshold_set && opts->patch == NULL) {
+		pr_warn("process %d is traced already, nothing to change\n",
+			opts->attach_pid);
+		return -1;
+	}
+
+	/* stop tracing before other changes */
+	if (opts->trace == TRACE_STATE_OFF)
+		ret |= send_agent_trace(sock, opts->trace);
+
+	if (opts->filter || opts->clear_filter) {
+		char *filter_str = uftrace_clear_kernel(opts->filter);
+		char *str = filter_str ?: "";
+		int type = opts->clear_filter ? UFTRACE_MSG_AGENT_SET_FILTER :
+						UFTRACE_MSG_AGENT_ADD_FILTER;
+
+		if (send_agent_msg(sock, type, str, strlen(str) + 1) < 0) {
+			pr_warn("cannot update filters: %s\n", str);
+			ret = -1;
+		}
+		free(filter_str);
+	}
+
+	if (opts->depth != OPT_DEPTH_DEFAULT) {
+		if (send_agent_msg(sock, UFTRACE_MSG_AGENT_DEPTH, &opts->depth,
+				   sizeof(opts->depth)) < 0) {
+			pr_warn("cannot update depth: %d\n", opts->depth);
+			ret = -1;
+		}
+	}
+
+	if (opts->threshold_set) {
+		if (send_agent_msg(sock, UFTRACE_MSG_AGENT_THRESHOLD,
+				   &opts->threshold,
+				   sizeof(opts->threshold)) < 0) {
+			pr_warn("cannot update time filter\n");
+			ret = -1;
+		}
+	}
+
+	if (opts->patch) {
+		if (send_agent_msg(sock, UFTRACE_MSG_AGENT_PATCH, opts->patch,
+				   strlen(opts->patch) + 1) < 0) {
+			pr_warn("cannot update patch: %s\n", opts->patch);
+			ret = -1;
+		}
+	}
+
+	if (opts->trace == TRACE_STATE_ON)
+		ret |= send_agent_trace(sock, opts->trace);
+
+	return ret;
+}
+
+static void check_attach(struct opts *opts)
+{
+	char buf[PATH_MAX];
+	char exe[PATH_MAX];
+	ssize_t len;
+
+	if (opts->nop || opts->keep_pid || opts->kernel)
+		pr_err_ns("--pid cannot be used with --nop, --keep-pid or --kernel\n");
+
+	if (kill(opts->attach_pid, 0) < 0)
+		pr_err_ns("cannot find process %d: %m\n", opts->attach_pid);
+
+	snprintf(buf, sizeof(buf), "/proc/%d/exe", opts->attach_pid);
+	len = readlink(buf, exe, sizeof(exe) - 1);
+	if (len < 0)
+		pr_err_ns("cannot read executable of process %d: %m\n",
+			  opts->attach_pid);
+	exe[len] = '\0';
+
+	opts->exename = xstrdup(exe);
+	pr_dbg("process %d is running %s\n", opts->attach_pid, opts->exename);
+}
+
 static void check_perf_event(struct opts *opts)
 {
 	struct strv strv = STRV_INIT;
@@ -1676,6 +2141,14 @@ static void check_perf_event(struct opts *opts)
 
 	has_perf_event = has_sched_event = !opts->no_event;
 
+	/* perf data cannot be kept in the flight recorder */
+	if (opts->flight_size)
+		has_perf_event = has_sched_event = false;
+
+	/* the process is already running before the perf events are set up */
+	if (opts->attach_pid)
+		has_perf_event = has_sched_event = false;
+
 	if (opts->no_sched)
 		has_sched_event = false;
 
@@ -1718,6 +2191,7 @@ struct writer_data {
 	int				nr_cpu;
 	int				status;
 	pthread_t			*writers;
+	pthread_t			*perf_readers;
 	struct timespec			ts1, ts2;
 	struct rusage			usage;
 	struct uftrace_kernel_writer	kernel;
@@ -1749,6 +2223,7 @@ static void setup_writers(struct writer_data *wd, struct opts *opts)
 
 	if (opts->host) {
 		wd->sock = setup_client_socket(opts);
+		send_trace_hello(wd->sock, opts->compress);
 		send_trace_dir_name(wd->sock, opts->dirname);
 	}
 	else
@@ -1804,8 +2279,8 @@ static void setup_writers(struct writer_data *wd, struct opts *opts)
 		opts->nr_thread = wd->nr_cpu;
 
 	if (has_perf_event) {
-		if (setup_perf_record(perf, wd->nr_cpu, wd->pid,
-				      opts->dirname, has_sched_event) < 0)
+		if (setup_perf_record(perf, wd->nr_cpu, wd->pid, opts->dirname,
+				      has_sched_event, opts->perf_bufsize) < 0)
 			has_perf_event = false;
 	}
 
@@ -1839,12 +2314,11 @@ static void start_tracing(struct writer_data *wd, struct opts *opts, int ready_f
 		warg->idx  = i;
 		warg->sock = wd->sock;
 		warg->kern = &wd->kernel;
-		warg->perf = &wd->perf;
 		warg->nr_cpu = 0;
 		INIT_LIST_HEAD(&warg->list);
 		INIT_LIST_HEAD(&warg->bufs);
 
-		if (opts->kernel || has_perf_event) {
+		if (opts->kernel) {
 			warg->nr_cpu = cpu_per_thread;
 
 			for (k = 0; k < cpu_per_thread; k++) {
@@ -1858,6 +2332,23 @@ static void start_tracing(struct writer_data *wd, struct opts *opts, int ready_f
 		pthread_create(&wd->writers[i], NULL, writer_thread, warg);
 	}
 
+	if (has_perf_event) {
+		wd->perf_readers = xcalloc(wd->nr_cpu, sizeof(*wd->perf_readers));
+
+		for (i = 0; i < wd->nr_cpu; i++) {
+			struct perf_reader_arg *parg;
+
+			parg = xmalloc(sizeof(*parg));
+			parg->opts = opts;
+			parg->perf = &wd->perf;
+			parg->sock = wd->sock;
+			parg->cpu  = i;
+
+			pthread_create(&wd->perf_readers[i], NULL,
+				       perf_reader_thread, parg);
+		}
+	}
+
 	/* signal child that I'm ready */
 	if (write(ready_fd, &go, sizeof(go)) != (ssize_t)sizeof(go))
 		pr_err("signal to child failed");
@@ -1900,7 +2391,7 @@ static int stop_tracing(struct writer_data *wd, struct opts *opts)
 		pr_dbg2("waiting for FORK2\n");
 	}
 
-	if (child_exited) {
+	if (child_exited && !opts->attach_pid) {
 		wait4(wd->pid, &status, 0, &wd->usage);
 		if (WIFEXITED(status)) {
 			pr_dbg("child terminated with exit code: %d\n",
@@ -1923,7 +2414,7 @@ static int stop_tracing(struct writer_data *wd, struct opts *opts)
 			ret = UFTRACE_EXIT_UNKNOWN;
 		}
 	}
-	else if (opts->keep_pid)
+	else if (opts->keep_pid || opts->attach_pid)
 		memset(&wd->usage, 0, sizeof(wd->usage));
 	else
 		getrusage(RUSAGE_CHILDREN, &wd->usage);
@@ -1932,6 +2423,14 @@ static int stop_tracing(struct writer_data *wd, struct opts *opts)
 	if (opts->kernel)
 		stop_kernel_tracing(&wd->kernel);
 
+	if (has_perf_event) {
+		int i;
+
+		for (i = 0; i < wd->nr_cpu; i++)
+			pthread_join(wd->perf_readers[i], NULL);
+		free(wd->perf_readers);
+	}
+
 	clock_gettime(CLOCK_MONOTONIC, &wd->ts2);
 
 	wd->status = status;
@@ -1961,6 +2460,16 @@ static void finish_writers(struct writer_data *wd, struct opts *opts)
 	if (shmem_lost_count)
 		pr_warn("LOST %d records\n", shmem_lost_count);
 
+	if (has_perf_event) {
+		uint64_t perf_lost = 0;
+
+		for (i = 0; i < wd->nr_cpu; i++)
+			perf_lost += wd->perf.lost[i];
+
+		if (perf_lost)
+			pr_warn("LOST %"PRIu64" perf events\n", perf_lost);
+	}
+
 	for (i = 0; i < opts->nr_thread; i++)
 		pthread_join(wd->writers[i], NULL);
 	free(wd->writers);
@@ -1969,6 +2478,7 @@ static void finish_writers(struct writer_data *wd, struct opts *opts)
 	flush_shmem_list(opts->dirname, opts->bufsize);
 	record_remaining_buffer(opts, wd->sock);
 	unlink_shmem_list();
+	finish_flight_recorder(opts->dirname, opts->bufsize);
 	free_tid_list();
 
 	if (opts->kernel)
@@ -2010,6 +2520,14 @@ static void write_symbol_files(struct writer_data *wd, struct opts *opts)
 	save_module_symtabs(opts->dirname);
 	unload_module_symtabs();
 
+	if (!opts->no_debug_cache) {
+		char *cache_dir = get_debug_cache_dir();
+
+		if (cache_dir)
+			update_debug_cache(opts->dirname, cache_dir);
+		free(cache_dir);
+	}
+
 	if (opts->host) {
 		int sock = wd->sock;
 
@@ -2035,10 +2553,70 @@ static void write_symbol_files(struct writer_data *wd, struct opts *opts)
 		chown_directory(opts->dirname);
 }
 
+/* load libmcount into the running process to start tracing */
+static void attach_process(struct opts *opts, struct uftrace_inject *inj)
+{
+	extern char **environ;
+	struct strv envs = STRV_INIT;
+	char fullpath[PATH_MAX];
+	char *libpath;
+	int i;
+
+	setup_child_environ(opts, 0, NULL);
+
+	/* the target process has a different working directory */
+	if (realpath(opts->dirname, fullpath) != NULL)
+		setenv("UFTRACE_DIR", fullpath, 1);
+
+	for (i = 0; environ[i]; i++) {
+		if (strncmp(environ[i], "UFTRACE_", 8))
+			continue;
+		/* the log file is not opened in the target */
+		if (!strncmp(environ[i], "UFTRACE_LOGFD=", 14))
+			continue;
+
+		strv_append(&envs, environ[i]);
+	}
+	strv_append(&envs, "UFTRACE_ATTACH=1");
+
+	libpath = get_libmcount_path(opts);
+	if (libpath == NULL)
+		pr_err_ns("cannot found libmcount.so\n");
+
+	/* use the absolute path if possible */
+	if (realpath(libpath, fullpath) != NULL) {
+		free(libpath);
+		libpath = xstrdup(fullpath);
+	}
+
+	pr_dbg("attaching to process %d using %s\n", opts->attach_pid, libpath);
+
+	if (inject_library(inj, opts->attach_pid, libpath, &envs) < 0)
+		pr_err_ns("cannot attach to process %d\n", opts->attach_pid);
+
+	put_libmcount_path(libpath);
+	strv_free(&envs);
+}
+
+/* stop tracing but the process keeps running */
+static void detach_process(struct opts *opts, struct uftrace_inject *inj)
+{
+	pr_dbg("detaching from process %d\n", opts->attach_pid);
+
+	if (inject_call_function(inj, "mcount_detach") < 0) {
+		pr_warn("cannot detach from process %d\n", opts->attach_pid);
+		return;
+	}
+
+	/* read the remaining data until it receives the FINISH message */
+	uftrace_done = false;
+}
+
 int do_main_loop(int ready, struct opts *opts, int pid)
 {
 	int ret;
 	struct writer_data wd;
+	struct uftrace_inject inj;
 	char *channel = NULL;
 
 	if (opts->nop) {
@@ -2066,10 +2644,15 @@ int do_main_loop(int ready, struct opts *opts, int pid)
 	if (opts->sig_trigger)
 		pr_out("uftrace: install signal handlers to task %d\n", pid);
 
+	flight_mode = opts->flight_size != 0;
+
 	setup_writers(&wd, opts);
 	start_tracing(&wd, opts, ready);
 	close(ready);
 
+	if (opts->attach_pid)
+		attach_process(opts, &inj);
+
 	while (!uftrace_done) {
 		struct pollfd pollfd = {
 			.fd = wd.pipefd,
@@ -2085,10 +2668,22 @@ int do_main_loop(int ready, struct opts *opts, int pid)
 		if (pollfd.revents & POLLIN)
 			read_record_mmap(wd.pipefd, opts->dirname, opts->bufsize);
 
+		if (flight_snapshot_requested) {
+			int remaining = 0;
+
+			/* merge consecutive requests into a snapshot */
+			if (ioctl(wd.pipefd, FIONREAD, &remaining) == 0 && !remaining)
+				save_flight_snapshot(opts->dirname, opts->bufsize);
+		}
+
 		if (pollfd.revents & (POLLERR | POLLHUP))
 			break;
 	}
 
+	/* it was interrupted by user while the process is running */
+	if (opts->attach_pid && uftrace_done)
+		detach_process(opts, &inj);
+
 	ret = stop_tracing(&wd, opts);
 	finish_writers(&wd, opts);
 
@@ -2169,9 +2764,35 @@ int command_record(int argc, char *argv[], struct opts *opts)
 	if (opts->script_file)
 		parse_script_opt(opts);
 
+	if (opts->attach_pid) {
+		int sock = connect_agent(opts->attach_pid);
+
+		/* it's traced already, just change the settings */
+		if (sock >= 0) {
+			ret = control_agent(sock, opts);
+			close(sock);
+			return ret;
+		}
+
+		check_attach(opts);
+	}
+
 	check_binary(opts);
 	check_perf_event(opts);
 
+	if (opts->flight_size && (opts->host || opts->kernel))
+		pr_err_ns("--flight-recorder cannot be used with --host or --kernel\n");
+
+	if (opts->flight_threshold && !opts->flight_size)
+		pr_err_ns("--flight-threshold requires --flight-recorder\n");
+
+	/*
+	 * the agent can change the time filter later, don't apply the
+	 * initial one again when analyzing the data (in default.opts).
+	 */
+	if (opts->agent)
+		strv_free(&default_opts);
+
 	if (!opts->nop) {
 		if (create_directory(opts->dirname) < 0)
 			return -1;
@@ -2187,6 +2808,12 @@ int command_record(int argc, char *argv[], struct opts *opts)
 	if (ready < 0)
 		pr_dbg("creating eventfd failed: %d\n", ready);
 
+	/* no child process, the target is already running */
+	if (opts->attach_pid) {
+		ret = do_main_loop(ready, opts, opts->attach_pid);
+		goto out;
+	}
+
 	pid = fork();
 	if (pid < 0)
 		pr_err("cannot start child process");
@@ -2209,6 +2836,7 @@ int command_record(int argc, char *argv[], struct opts *opts)
 	else
 		ret = do_main_loop(ready, opts, pid);
 
+out:
 	if (channel) {
 		unlink(channel);
 		free(channel);
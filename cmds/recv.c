@@ -12,8 +12,15 @@
 #include <sys/epoll.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
 #include <sys/wait.h>
 
+#ifdef HAVE_LIBZ
+# include <zlib.h>
+#endif
+
 #include "uftrace.h"
 #include "utils/utils.h"
 #include "utils/list.h"
@@ -26,6 +33,61 @@ struct client_data {
 
 static LIST_HEAD(client_list);
 
+/* maximum length of the (ignored) data in a hello request */
+#define HELLO_MAX_LEN  4096
+
+/* flush batched data when it grows larger than this */
+#define BATCH_SIZE  (1 * MB)
+
+/* or when the oldest data was added before this (msec) */
+#define BATCH_FLUSH_TIME  1000
+
+/* receiver won't accept a batch larger than this */
+#define BATCH_MAX_LEN  (256 * MB)
+
+static struct {
+	pthread_mutex_t	lock;
+	pthread_mutex_t	send_lock;  /* to write batches in order */
+	pthread_cond_t	send_cond;
+	int		version;
+	int		codec;
+	bool		hello_pending;
+	bool		compress;
+	int		count;
+	size_t		len;
+	size_t		size;
+	char		*buf;
+	char		*spare;  /* (sent) buffer to reuse */
+	size_t		spare_size;
+	uint64_t	time;  /* when the first data was added (msec) */
+	unsigned long	seq;   /* number of batches taken */
+	unsigned long	sent;  /* number of batches sent */
+} send_batch = {
+	.lock		= PTHREAD_MUTEX_INITIALIZER,
+	.send_lock	= PTHREAD_MUTEX_INITIALIZER,
+	.send_cond	= PTHREAD_COND_INITIALIZER,
+	.version	= UFTRACE_MSG_PROTO_V1,
+};
+
+/* batch data taken out of send_batch to be sent */
+struct pending_batch {
+	unsigned long	seq;
+	int		count;
+	size_t		len;
+	size_t		size;
+	char		*buf;
+};
+
+static unsigned supported_codecs(void)
+{
+	unsigned codecs = 1U << UFTRACE_MSG_CODEC_NONE;
+
+#ifdef HAVE_LIBZ
+	codecs |= 1U << UFTRACE_MSG_CODEC_ZLIB;
+#endif
+	return codecs;
+}
+
 static int server_socket(struct opts *opts)
 {
 	int sock;
@@ -102,6 +164,279 @@ int setup_client_socket(struct opts *opts)
 	return sock;
 }
 
+/*
+ * Old receivers ignore an (empty) hello message and never reply, so
+ * don't wait for the reply here.  It keeps using the protocol v1 until
+ * the reply arrives (see check_trace_hello) which costs nothing for old
+ * receivers and only a few unbatched messages for new ones.
+ */
+void send_trace_hello(int sock, bool compress)
+{
+	struct uftrace_msg msg = {
+		.magic = htons(UFTRACE_MSG_MAGIC),
+		.type  = htons(UFTRACE_MSG_SEND_HELLO),
+		.len   = 0,
+	};
+
+	pr_dbg2("send UFTRACE_MSG_SEND_HELLO\n");
+	if (write_all(sock, &msg, sizeof(msg)) < 0)
+		pr_err("send hello failed");
+
+	send_batch.compress = compress;
+	send_batch.hello_pending = true;
+}
+
+/* it should be called with send_batch.lock held */
+static void recv_hello_reply(int sock)
+{
+	struct uftrace_msg msg;
+	struct uftrace_msg_hello hello;
+	unsigned codecs;
+	int version;
+
+	if (read_all(sock, &msg, sizeof(msg)) < 0)
+		pr_err("recv hello failed");
+
+	if (ntohs(msg.magic) != UFTRACE_MSG_MAGIC ||
+	    ntohs(msg.type) != UFTRACE_MSG_SEND_HELLO ||
+	    ntohl(msg.len) != sizeof(hello))
+		pr_err_ns("invalid hello message\n");
+
+	if (read_all(sock, &hello, sizeof(hello)) < 0)
+		pr_err("recv hello failed");
+
+	version = ntohl(hello.version);
+	if (version > UFTRACE_MSG_PROTO_V2)
+		version = UFTRACE_MSG_PROTO_V2;
+
+	if (version < UFTRACE_MSG_PROTO_V2)
+		return;
+
+	codecs = ntohl(hello.codecs) & supported_codecs();
+
+	send_batch.size = BATCH_SIZE;
+	send_batch.buf  = xmalloc(send_batch.size);
+
+	if (send_batch.compress) {
+		if (codecs & (1U << UFTRACE_MSG_CODEC_ZLIB))
+			send_batch.codec = UFTRACE_MSG_CODEC_ZLIB;
+		else
+			pr_warn("compression is not supported, ignoring..\n");
+	}
+
+	/* set it last as other threads check it without the lock */
+	__atomic_store_n(&send_batch.version, version, __ATOMIC_RELEASE);
+
+	pr_dbg("using protocol v%d (codec: %d)\n",
+	       send_batch.version, send_batch.codec);
+}
+
+/* switch to the new protocol if the receiver replied the hello */
+static void check_trace_hello(int sock)
+{
+	struct pollfd pfd = {
+		.fd     = sock,
+		.events = POLLIN,
+	};
+
+	if (!__atomic_load_n(&send_batch.hello_pending, __ATOMIC_ACQUIRE))
+		return;
+
+	pthread_mutex_lock(&send_batch.lock);
+	if (send_batch.hello_pending && poll(&pfd, 1, 0) > 0) {
+		recv_hello_reply(sock);
+		__atomic_store_n(&send_batch.hello_pending, false,
+				 __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&send_batch.lock);
+}
+
+static int send_version(int sock)
+{
+	check_trace_hello(sock);
+	return __atomic_load_n(&send_batch.version, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Take the current batch out so that it can be compressed and sent
+ * without blocking other threads adding data.  It should be called
+ * with send_batch.lock held.
+ */
+static bool take_batch_data(struct pending_batch *pb)
+{
+	if (send_batch.count == 0)
+		return false;
+
+	pb->seq   = send_batch.seq++;
+	pb->count = send_batch.count;
+	pb->len   = send_batch.len;
+	pb->size  = send_batch.size;
+	pb->buf   = send_batch.buf;
+
+	if (send_batch.spare) {
+		send_batch.buf  = send_batch.spare;
+		send_batch.size = send_batch.spare_size;
+		send_batch.spare = NULL;
+	}
+	else {
+		send_batch.size = BATCH_SIZE;
+		send_batch.buf  = xmalloc(send_batch.size);
+	}
+
+	send_batch.count = 0;
+	send_batch.len = 0;
+	return true;
+}
+
+/* compress and send the batch taken out, in the order of taking */
+static void send_batch_data(int sock, struct pending_batch *pb)
+{
+	void *data = pb->buf;
+	size_t len = pb->len;
+	void *zbuf = NULL;
+	struct uftrace_msg_batch batch = {
+		.count   = htonl(pb->count),
+		.codec   = htonl(UFTRACE_MSG_CODEC_NONE),
+		.raw_len = htonl(pb->len),
+	};
+	struct uftrace_msg msg = {
+		.magic = htons(UFTRACE_MSG_MAGIC),
+		.type  = htons(UFTRACE_MSG_SEND_BATCH),
+	};
+	struct iovec iov[] = {
+		{ .iov_base = &msg,   .iov_len = sizeof(msg), },
+		{ .iov_base = &batch, .iov_len = sizeof(batch), },
+		{ /* to be filled */ },
+	};
+	int on = 1, off = 0;
+
+#ifdef HAVE_LIBZ
+	if (send_batch.codec == UFTRACE_MSG_CODEC_ZLIB) {
+		uLongf zlen = compressBound(pb->len);
+
+		zbuf = xmalloc(zlen);
+
+		/* send it uncompressed if something goes wrong */
+		if (compress2((Bytef *)zbuf, &zlen, (Bytef *)pb->buf, pb->len,
+			      Z_BEST_SPEED) == Z_OK) {
+			batch.codec = htonl(UFTRACE_MSG_CODEC_ZLIB);
+			data = zbuf;
+			len  = zlen;
+		}
+	}
+#endif
+
+	msg.len = htonl(sizeof(batch) + len);
+	iov[2].iov_base = data;
+	iov[2].iov_len  = len;
+
+	/* the receiver should see data of a task in order */
+	pthread_mutex_lock(&send_batch.send_lock);
+	while (send_batch.sent != pb->seq)
+		pthread_cond_wait(&send_batch.send_cond, &send_batch.send_lock);
+
+	/* send the whole batch in full-sized segments */
+	setsockopt(sock, SOL_TCP, TCP_CORK, &on, sizeof(on));
+
+	pr_dbg2("send UFTRACE_MSG_SEND_BATCH: %d buffers\n", pb->count);
+	if (writev_all(sock, iov, ARRAY_SIZE(iov)) < 0)
+		pr_err("send batch failed");
+
+	setsockopt(sock, SOL_TCP, TCP_CORK, &off, sizeof(off));
+
+	send_batch.sent++;
+	pthread_cond_broadcast(&send_batch.send_cond);
+	pthread_mutex_unlock(&send_batch.send_lock);
+
+	free(zbuf);
+
+	/* keep a buffer to be reused by the next batch */
+	pthread_mutex_lock(&send_batch.lock);
+	if (send_batch.spare == NULL && pb->size == BATCH_SIZE) {
+		send_batch.spare = pb->buf;
+		send_batch.spare_size = pb->size;
+		pb->buf = NULL;
+	}
+	pthread_mutex_unlock(&send_batch.lock);
+
+	free(pb->buf);
+}
+
+static uint64_t batch_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / NSEC_PER_MSEC;
+}
+
+static void add_batch_data(int sock, int type, int id, void *data, size_t len)
+{
+	struct uftrace_msg_batch_data bd = {
+		.type = htons(type),
+		.id   = htonl(id),
+		.len  = htonl(len),
+	};
+	size_t size = sizeof(bd) + len;
+	struct pending_batch full = { .count = 0, };
+	struct pending_batch old = { .count = 0, };
+
+	pthread_mutex_lock(&send_batch.lock);
+
+	if (send_batch.len + size > BATCH_SIZE)
+		take_batch_data(&full);
+
+	if (send_batch.size < size) {
+		send_batch.size = size;
+		send_batch.buf = xrealloc(send_batch.buf, size);
+	}
+
+	memcpy(send_batch.buf + send_batch.len, &bd, sizeof(bd));
+	memcpy(send_batch.buf + send_batch.len + sizeof(bd), data, len);
+
+	if (send_batch.count == 0)
+		send_batch.time = batch_time();
+
+	send_batch.len += size;
+	send_batch.count++;
+
+	/* do not keep data from a slow producer for too long */
+	if (batch_time() - send_batch.time >= BATCH_FLUSH_TIME)
+		take_batch_data(&old);
+
+	pthread_mutex_unlock(&send_batch.lock);
+
+	if (full.count)
+		send_batch_data(sock, &full);
+	if (old.count)
+		send_batch_data(sock, &old);
+}
+
+/**
+ * send_trace_flush - send pending batch data if it's too old
+ * @sock: socket to the receiver
+ *
+ * This is called when writer threads are idle so that a partial batch
+ * doesn't wait for more data (or the end of recording) to be sent.
+ */
+void send_trace_flush(int sock)
+{
+	struct pending_batch pb;
+	bool taken = false;
+
+	if (send_version(sock) < UFTRACE_MSG_PROTO_V2)
+		return;
+
+	pthread_mutex_lock(&send_batch.lock);
+	if (send_batch.count &&
+	    batch_time() - send_batch.time >= BATCH_FLUSH_TIME)
+		taken = take_batch_data(&pb);
+	pthread_mutex_unlock(&send_batch.lock);
+
+	if (taken)
+		send_batch_data(sock, &pb);
+}
+
 void send_trace_dir_name(int sock, char *name)
 {
 	ssize_t len = strlen(name);
@@ -134,6 +469,11 @@ void send_trace_data(int sock, int tid, void *data, size_t len)
 		{ .iov_base = data,     .iov_len = len, },
 	};
 
+	if (send_version(sock) >= UFTRACE_MSG_PROTO_V2) {
+		add_batch_data(sock, UFTRACE_MSG_SEND_DATA, tid, data, len);
+		return;
+	}
+
 	pr_dbg2("send UFTRACE_MSG_SEND_DATA\n");
 	if (writev_all(sock, iov, ARRAY_SIZE(iov)) < 0)
 		pr_err("send data failed");
@@ -153,6 +493,11 @@ void send_trace_kernel_data(int sock, int cpu, void *data, size_t len)
 		{ .iov_base = data,     .iov_len = len, },
 	};
 
+	if (send_version(sock) >= UFTRACE_MSG_PROTO_V2) {
+		add_batch_data(sock, UFTRACE_MSG_SEND_KERNEL_DATA, cpu, data, len);
+		return;
+	}
+
 	pr_dbg2("send UFTRACE_MSG_SEND_KERNEL_DATA\n");
 	if (writev_all(sock, iov, ARRAY_SIZE(iov)) < 0)
 		pr_err("send kernel data failed");
@@ -172,6 +517,11 @@ void send_trace_perf_data(int sock, int cpu, void *data, size_t len)
 		{ .iov_base = data,     .iov_len = len, },
 	};
 
+	if (send_version(sock) >= UFTRACE_MSG_PROTO_V2) {
+		add_batch_data(sock, UFTRACE_MSG_SEND_PERF_DATA, cpu, data, len);
+		return;
+	}
+
 	pr_dbg2("send UFTRACE_MSG_SEND_PERF_DATA\n");
 	if (writev_all(sock, iov, ARRAY_SIZE(iov)) < 0)
 		pr_err("send kernel data failed");
@@ -261,6 +611,21 @@ void send_trace_end(int sock)
 		.magic = htons(UFTRACE_MSG_MAGIC),
 		.type  = htons(UFTRACE_MSG_SEND_END),
 	};
+	struct pending_batch pb;
+	bool taken;
+
+	pthread_mutex_lock(&send_batch.lock);
+	taken = take_batch_data(&pb);
+	pthread_mutex_unlock(&send_batch.lock);
+
+	if (taken)
+		send_batch_data(sock, &pb);
+
+	if (send_version(sock) < UFTRACE_MSG_PROTO_V2) {
+		pr_dbg("no reply from receiver: used protocol v1\n");
+		if (send_batch.compress)
+			pr_warn("receiver doesn't support compression\n");
+	}
 
 	pr_dbg2("send UFTRACE_MSG_SEND_END\n");
 	if (write_all(sock, &msg, sizeof(msg)) < 0)
@@ -479,6 +844,162 @@ static void recv_trace_info(int sock, int len)
 	free(info);
 }
 
+static int recv_trace_hello(int sock, int len)
+{
+	struct uftrace_msg msg = {
+		.magic = htons(UFTRACE_MSG_MAGIC),
+		.type  = htons(UFTRACE_MSG_SEND_HELLO),
+		.len   = htonl(sizeof(struct uftrace_msg_hello)),
+	};
+	struct uftrace_msg_hello hello = {
+		.version = htonl(UFTRACE_MSG_PROTO_V2),
+		.codecs  = htonl(supported_codecs()),
+	};
+	struct iovec iov[] = {
+		{ .iov_base = &msg,   .iov_len = sizeof(msg), },
+		{ .iov_base = &hello, .iov_len = sizeof(hello), },
+	};
+	void *buf;
+
+	if (len < 0 || len > HELLO_MAX_LEN) {
+		pr_warn("invalid hello length: %d\n", len);
+		return -1;
+	}
+
+	/* ignore any data in the request for now */
+	buf = xmalloc(len + 1);
+	if (read_all(sock, buf, len) < 0)
+		pr_err("recv hello failed");
+	free(buf);
+
+	pr_dbg2("send UFTRACE_MSG_SEND_HELLO\n");
+	if (writev_all(sock, iov, ARRAY_SIZE(iov)) < 0)
+		pr_err("send hello failed");
+
+	return 0;
+}
+
+static char *batch_file_name(int type, int id)
+{
+	char *filename = NULL;
+
+	switch (type) {
+	case UFTRACE_MSG_SEND_DATA:
+		xasprintf(&filename, "%d.dat", id);
+		break;
+	case UFTRACE_MSG_SEND_KERNEL_DATA:
+		xasprintf(&filename, "kernel-cpu%d.dat", id);
+		break;
+	case UFTRACE_MSG_SEND_PERF_DATA:
+		xasprintf(&filename, "perf-cpu%d.dat", id);
+		break;
+	default:
+		pr_warn("invalid data type in batch: %d\n", type);
+		break;
+	}
+	return filename;
+}
+
+static int recv_trace_batch(int sock, int len)
+{
+	struct client_data *client;
+	struct uftrace_msg_batch batch;
+	struct uftrace_msg_batch_data *bd;
+	char *filename;
+	void *buffer;
+	void *data = NULL;
+	size_t raw_len, pos;
+	unsigned i, count;
+	int ret = -1;
+
+	client = find_client(sock);
+	if (client == NULL)
+		pr_err_ns("no client on this socket\n");
+
+	/* check the lengths before allocating anything */
+	if (len < (int)sizeof(batch) || len - sizeof(batch) > BATCH_MAX_LEN) {
+		pr_warn("invalid batch length: %d\n", len);
+		return -1;
+	}
+
+	if (read_all(sock, &batch, sizeof(batch)) < 0)
+		pr_err("recv batch header failed");
+
+	count   = ntohl(batch.count);
+	raw_len = ntohl(batch.raw_len);
+	len    -= sizeof(batch);
+
+	if (raw_len > BATCH_MAX_LEN || count > raw_len / sizeof(*bd)) {
+		pr_warn("invalid batch: count = %u, raw_len = %zu\n",
+			count, raw_len);
+		return -1;
+	}
+
+	buffer = xmalloc(len);
+	if (read_all(sock, buffer, len) < 0)
+		pr_err("recv buffer failed");
+
+	switch (ntohl(batch.codec)) {
+	case UFTRACE_MSG_CODEC_NONE:
+		if (raw_len != (size_t)len) {
+			pr_warn("invalid batch length\n");
+			goto out;
+		}
+		data = buffer;
+		break;
+#ifdef HAVE_LIBZ
+	case UFTRACE_MSG_CODEC_ZLIB: {
+		uLongf zlen = raw_len;
+
+		data = xmalloc(raw_len);
+		if (uncompress(data, &zlen, buffer, len) != Z_OK ||
+		    zlen != raw_len) {
+			pr_warn("decompress batch failed\n");
+			goto out;
+		}
+		break;
+	}
+#endif
+	default:
+		pr_warn("unsupported codec: %u\n", ntohl(batch.codec));
+		goto out;
+	}
+
+	/* save each buffer to the same file as protocol v1 does */
+	for (i = 0, pos = 0; i < count; i++) {
+		size_t size;
+
+		if (pos + sizeof(*bd) > raw_len)
+			goto invalid;
+
+		bd = data + pos;
+		size = ntohl(bd->len);
+		pos += sizeof(*bd);
+
+		if (size > raw_len - pos)
+			goto invalid;
+
+		filename = batch_file_name(ntohs(bd->type), ntohl(bd->id));
+		if (filename == NULL)
+			goto out;
+
+		write_client_file(client, filename, 1, data + pos, size);
+		free(filename);
+
+		pos += size;
+	}
+	ret = 0;
+	goto out;
+
+invalid:
+	pr_warn("invalid batch data\n");
+out:
+	if (data != buffer)
+		free(data);
+	free(buffer);
+	return ret;
+}
+
 static void recv_trace_end(int sock, int efd)
 {
 	struct client_data *client;
@@ -593,6 +1114,18 @@ static void handle_client_sock(struct epoll_event *ev, int efd, struct opts *opt
 		pr_dbg2("receive UFTRACE_MSG_SEND_META_DATA\n");
 		recv_trace_metadata(sock, msg.len);
 		break;
+	case UFTRACE_MSG_SEND_HELLO:
+		pr_dbg2("receive UFTRACE_MSG_SEND_HELLO\n");
+		if (recv_trace_hello(sock, msg.len) < 0)
+			recv_trace_end(sock, efd);
+		break;
+	case UFTRACE_MSG_SEND_BATCH:
+		pr_dbg2("receive UFTRACE_MSG_SEND_BATCH\n");
+		if (recv_trace_batch(sock, msg.len) < 0) {
+			/* the stream is out of sync, drop this client */
+			recv_trace_end(sock, efd);
+		}
+		break;
 	case UFTRACE_MSG_SEND_END:
 		pr_dbg2("receive UFTRACE_MSG_SEND_END\n");
 		recv_trace_end(sock, efd);
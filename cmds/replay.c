@@ -13,6 +13,7 @@
 #include "utils/list.h"
 #include "utils/kernel.h"
 #include "utils/field.h"
+#include "utils/pipeline.h"
 
 #include "libtraceevent/event-parse.h"
 
@@ -221,6 +222,255 @@ static void print_field(struct uftrace_task_reader *task,
 		pr_out(" | ");
 }
 
+enum replay_line_type {
+	REPLAY_LINE_TEXT,
+	REPLAY_LINE_ENTRY,
+	REPLAY_LINE_LEAF,
+	REPLAY_LINE_EXIT,
+};
+
+/* a function line in the graph output */
+struct replay_line {
+	enum replay_line_type	type;
+	int			depth;
+	char			color;  /* trigger color or 0 */
+	const char		*name;
+	const char		*libname;
+	const char		*args;
+	const char		*retval;
+	const char		*loc;
+};
+
+/*
+ * The graph output can be rendered by the pipeline worker threads.
+ * The reader keeps all the (per-task) state like depth and arguments
+ * and saves a line with copies of the task and fstack data needed by
+ * the output fields.  Other output of the reader is saved as a text item
+ * so that everything is written in order.
+ */
+struct replay_item {
+	enum replay_line_type	type;
+	int			depth;
+	char			color;
+	bool			has_fstack;
+	int			tid;
+	struct uftrace_task	t;      /* copy for the (changing) comm */
+	uint64_t		timestamp;
+	uint64_t		timestamp_last;
+	struct fstack		fstack;
+	size_t			len;
+	/* text or strings of name, libname, args, retval and location */
+	char			str[];
+};
+
+struct replay_pipe {
+	struct uftrace_pipeline	pl;
+	struct uftrace_data	*handle;
+	struct opts		*opts;
+	/* output of the reader */
+	FILE			*fp;
+	char			*buf;
+	size_t			len;
+};
+
+static struct replay_pipe *replay_pipe;
+
+static void print_func_line(struct uftrace_task_reader *task,
+			    struct fstack *fstack, struct replay_line *line,
+			    bool comment)
+{
+	if (line->type == REPLAY_LINE_EXIT) {
+		print_field(task, fstack, NULL);
+		pr_out("%*s}%s", line->depth * 2, "", line->retval);
+		if (comment) {
+			pr_gray(" /* %s%s%s ", line->name,
+				*line->libname ? "@" : "", line->libname);
+			if (line->loc)
+				pr_gray("at %s ", line->loc);
+			pr_gray("*/");
+		}
+		pr_out("\n");
+		return;
+	}
+
+	print_field(task, fstack,
+		    line->type == REPLAY_LINE_ENTRY ? NO_TIME : NULL);
+	pr_out("%*s", line->depth * 2, "");
+	if (line->color) {
+		pr_color(line->color, "%s", line->name);
+		if (*line->libname)
+			pr_color(line->color, "@%s", line->libname);
+		pr_out("%s", line->args);
+	}
+	else {
+		pr_out("%s%s%s%s", line->name, *line->libname ? "@" : "",
+		       line->libname, line->args);
+	}
+
+	if (line->type == REPLAY_LINE_LEAF)
+		pr_out("%s", line->retval);
+	else
+		pr_out(" {");
+
+	if (line->loc)
+		pr_gray(" /* %s */", line->loc);
+	pr_out("\n");
+}
+
+static void render_replay_batch(struct uftrace_pipeline *pl,
+				struct uftrace_pipe_batch *batch)
+{
+	struct replay_pipe *rp = pl->arg;
+	struct replay_item *item;
+	FILE *fp, *old_fp;
+
+	fp = pipeline_open_stream(batch);
+	old_fp = set_thread_outfp(fp);
+
+	pipeline_for_each_item(batch, item) {
+		struct uftrace_task_reader task = {
+			.tid            = item->tid,
+			.t              = item->t.tid ? &item->t : NULL,
+			.h              = rp->handle,
+			.timestamp      = item->timestamp,
+			.timestamp_last = item->timestamp_last,
+		};
+		struct replay_line line = {
+			.type  = item->type,
+			.depth = item->depth,
+			.color = item->color,
+		};
+		char *str = item->str;
+
+		if (item->type == REPLAY_LINE_TEXT) {
+			fwrite(item->str, 1, item->len, fp);
+			continue;
+		}
+
+		line.name    = str;  str += strlen(str) + 1;
+		line.libname = str;  str += strlen(str) + 1;
+		line.args    = str;  str += strlen(str) + 1;
+		line.retval  = str;  str += strlen(str) + 1;
+		line.loc     = *str ? str : NULL;
+
+		print_func_line(&task, item->has_fstack ? &item->fstack : NULL,
+				&line, rp->opts->comment);
+	}
+
+	set_thread_outfp(old_fp);
+	fclose(fp);
+}
+
+static void setup_replay_pipe(struct uftrace_data *handle, struct opts *opts)
+{
+	int nr_workers = pipeline_nr_workers();
+
+	/* no need to use the pipeline if there's a single cpu */
+	if (nr_workers == 0)
+		return;
+
+	replay_pipe = xzalloc(sizeof(*replay_pipe));
+	replay_pipe->handle = handle;
+	replay_pipe->opts = opts;
+
+	replay_pipe->fp = open_memstream(&replay_pipe->buf, &replay_pipe->len);
+	if (replay_pipe->fp == NULL) {
+		pr_dbg("cannot open memory stream: %m\n");
+		free(replay_pipe);
+		replay_pipe = NULL;
+		return;
+	}
+
+	setup_pipeline(&replay_pipe->pl, nr_workers, render_replay_batch,
+		       replay_pipe, outfp);
+	set_thread_outfp(replay_pipe->fp);
+}
+
+/* save the output of the reader so far as a text item */
+static void flush_reader_output(struct replay_pipe *rp)
+{
+	struct replay_item *item;
+
+	fflush(rp->fp);
+	if (rp->len == 0)
+		return;
+
+	item = pipeline_add_item(&rp->pl, sizeof(*item) + rp->len);
+	item->type = REPLAY_LINE_TEXT;
+	item->len = rp->len;
+	memcpy(item->str, rp->buf, rp->len);
+
+	rewind(rp->fp);
+	rp->len = 0;
+}
+
+static void finish_replay_pipe(void)
+{
+	if (replay_pipe == NULL)
+		return;
+
+	flush_reader_output(replay_pipe);
+	set_thread_outfp(NULL);
+
+	finish_pipeline(&replay_pipe->pl);
+
+	fclose(replay_pipe->fp);
+	free(replay_pipe->buf);
+	free(replay_pipe);
+	replay_pipe = NULL;
+}
+
+static void output_func_line(struct uftrace_task_reader *task,
+			     struct fstack *fstack, struct replay_line *line,
+			     struct opts *opts)
+{
+	struct replay_pipe *rp = replay_pipe;
+	struct replay_item *item;
+	const char *strs[] = {
+		line->name, line->libname, line->args ?: "",
+		line->retval ?: "", line->loc ?: "",
+	};
+	size_t lens[ARRAY_SIZE(strs)];
+	size_t total = 0;
+	char *str;
+	unsigned i;
+
+	if (rp == NULL) {
+		print_func_line(task, fstack, line, opts->comment);
+		return;
+	}
+
+	flush_reader_output(rp);
+
+	for (i = 0; i < ARRAY_SIZE(strs); i++) {
+		lens[i] = strlen(strs[i]) + 1;
+		total += lens[i];
+	}
+
+	item = pipeline_add_item(&rp->pl, sizeof(*item) + total);
+	item->type           = line->type;
+	item->depth          = line->depth;
+	item->color          = line->color;
+	item->has_fstack     = fstack != NULL;
+	item->tid            = task->tid;
+	item->timestamp      = task->timestamp;
+	item->timestamp_last = task->timestamp_last;
+	item->len            = total;
+
+	if (task->t)
+		item->t = *task->t;
+	else
+		memset(&item->t, 0, sizeof(item->t));
+	if (fstack)
+		item->fstack = *fstack;
+
+	str = item->str;
+	for (i = 0; i < ARRAY_SIZE(strs); i++) {
+		memcpy(str, strs[i], lens[i]);
+		str += lens[i];
+	}
+}
+
 static void setup_default_field(struct list_head *fields, struct opts *opts,
 				struct display_field *p_field_table[])
 {
@@ -704,7 +954,7 @@ void get_argspec_string(struct uftrace_task_reader *task,
 
 			if (sym) {
 				print_args(&args, &len, "%s", color_symbol);
-				print_args(&args, &len, "&%s", sym->name);
+				print_args(&args, &len, "&%s", symbol_name(sym));
 				print_args(&args, &len, "%s", color_reset);
 			}
 			else if (val.p)
@@ -806,6 +1056,9 @@ static int print_graph_rstack(struct uftrace_data *handle,
 	struct uftrace_mmap *map = NULL;
 	struct debug_location *loc = NULL;
 	char *str_loc = NULL;
+	struct replay_line line = {
+		.type = REPLAY_LINE_TEXT,
+	};
 
 	if (task == NULL)
 		return 0;
@@ -883,6 +1136,14 @@ static int print_graph_rstack(struct uftrace_data *handle,
 
 		fstack = fstack_get(task, task->stack_count - 1);
 
+		line.depth = depth;
+		line.name = symname;
+		line.libname = libname;
+		line.args = args;
+		line.loc = str_loc;
+		if (tr.flags & TRIGGER_FL_COLOR)
+			line.color = tr.color;
+
 		if (!opts->no_merge)
 			next = fstack_skip(handle, task, rstack_depth, opts);
 
@@ -901,22 +1162,9 @@ static int print_graph_rstack(struct uftrace_data *handle,
 			}
 			get_argspec_string(task, retval, sizeof(retval), str_mode);
 
-			print_field(task, fstack, NULL);
-			pr_out("%*s", depth * 2, "");
-			if (tr.flags & TRIGGER_FL_COLOR) {
-				pr_color(tr.color, "%s", symname);
-				if (*libname)
-					pr_color(tr.color, "@%s", libname);
-				pr_out("%s%s", args, retval);
-			}
-			else {
-				pr_out("%s%s%s%s%s", symname,
-				       *libname ? "@" : "",
-				       libname, args, retval);
-			}
-			if (str_loc)
-				pr_gray(" /* %s */", str_loc);
-			pr_out("\n");
+			line.type = REPLAY_LINE_LEAF;
+			line.retval = retval;
+			output_func_line(task, fstack, &line, opts);
 
 			/* fstack_update() is not needed here */
 
@@ -924,21 +1172,8 @@ static int print_graph_rstack(struct uftrace_data *handle,
 		}
 		else {
 			/* function entry */
-			print_field(task, fstack, NO_TIME);
-			pr_out("%*s", depth * 2, "");
-			if (tr.flags & TRIGGER_FL_COLOR) {
-				pr_color(tr.color, "%s", symname);
-				if (*libname)
-					pr_color(tr.color, "@%s", libname);
-				pr_out("%s {", args);
-			}
-			else {
-				pr_out("%s%s%s%s {", symname,
-				       *libname ? "@" : "", libname, args);
-			}
-			if (str_loc)
-				pr_gray(" /* %s */", str_loc);
-			pr_out("\n");
+			line.type = REPLAY_LINE_ENTRY;
+			output_func_line(task, fstack, &line, opts);
 
 			fstack_update(UFTRACE_ENTRY, task, fstack);
 		}
@@ -968,16 +1203,13 @@ static int print_graph_rstack(struct uftrace_data *handle,
 			if (opts->task_newline)
 				print_task_newline(task->tid);
 
-			print_field(task, fstack, NULL);
-			pr_out("%*s}%s", depth * 2, "", retval);
-			if (opts->comment) {
-				pr_gray(" /* %s%s%s ", symname,
-					*libname ? "@" : "", libname);
-				if (str_loc)
-					pr_gray("at %s ", str_loc);
-				pr_gray("*/");
-			}
-			pr_out("\n");
+			line.type = REPLAY_LINE_EXIT;
+			line.depth = depth;
+			line.name = symname;
+			line.libname = libname;
+			line.retval = retval;
+			line.loc = str_loc;
+			output_func_line(task, fstack, &line, opts);
 		}
 
 		fstack_exit(task);
@@ -1210,6 +1442,9 @@ int command_replay(int argc, char *argv[], struct opts *opts)
 		pr_out("\n");
 	}
 
+	if (!opts->flat)
+		setup_replay_pipe(&handle, opts);
+
 	while (read_rstack(&handle, &task) == 0 && !uftrace_done) {
 		struct uftrace_record *rstack = task->rstack;
 		uint64_t curr_time = rstack->time;
@@ -1237,6 +1472,8 @@ int command_replay(int argc, char *argv[], struct opts *opts)
 			break;
 	}
 
+	finish_replay_pipe();
+
 	print_remaining_stack(opts, &handle);
 
 	close_data_file(opts, &handle);
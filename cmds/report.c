@@ -18,6 +18,18 @@ static int maxlen = 20;
 
 static LIST_HEAD(output_fields);
 
+/* time window for --window option */
+struct report_window {
+	uint64_t	size;
+	uint64_t	first;	/* start time of the first window */
+	uint64_t	start;	/* start time of the current window */
+	bool		started;
+};
+
+static struct report_window window;
+
+static void print_window(struct rb_root *root);
+
 static void print_field(struct uftrace_report_node *node, int space)
 {
 	struct field_data fd = {
@@ -119,6 +131,22 @@ static void add_remaining_fstack(struct uftrace_data *handle,
 	}
 }
 
+/* print and flush the nodes when @time is out of the current window */
+static void update_window(struct rb_root *root, uint64_t time)
+{
+	if (!window.started) {
+		window.first = window.start = time;
+		window.started = true;
+		return;
+	}
+
+	if (time < window.start + window.size)
+		return;
+
+	print_window(root);
+	window.start += (time - window.start) / window.size * window.size;
+}
+
 static void build_function_tree(struct uftrace_data *handle,
 				struct rb_root *root, struct opts *opts)
 {
@@ -134,6 +162,9 @@ static void build_function_tree(struct uftrace_data *handle,
 		if (rstack->type != UFTRACE_LOST)
 			task->timestamp_last = rstack->time;
 
+		if (opts->window && rstack->type != UFTRACE_LOST)
+			update_window(root, rstack->time);
+
 		if (!fstack_check_opts(task, opts))
 			continue;
 
@@ -201,6 +232,7 @@ static void print_and_delete(struct rb_root *root, bool sorted, void *arg,
 			node = rb_entry(n, typeof(*node), name_link);
 
 		print_func(node, arg, space);
+		report_hist_free(&node->hist);
 		free(node->name);
 		free(node);
 	}
@@ -264,6 +296,64 @@ static void report_functions(struct uftrace_data *handle, struct opts *opts)
 	print_and_delete(&sort_root, true, NULL, print_function, field_space);
 }
 
+static void print_window_function(struct uftrace_report_node *node,
+				  void *unused, int space)
+{
+	uint64_t elapsed = window.start - window.first;
+
+	pr_out("%*s", space, "");
+	pr_out("%6"PRIu64".%06"PRIu64, elapsed / NSEC_PER_SEC,
+	       elapsed % NSEC_PER_SEC / 1000);
+	pr_out("%*s%10"PRIu64, space, "", node->call);
+	pr_out("%*s", space, "");
+	print_time_unit(node->total.avg);
+	pr_out("%*s", space, "");
+	print_time_unit(node->hist.p50);
+	pr_out("%*s", space, "");
+	print_time_unit(node->hist.p99);
+	pr_out("%*s", space, "");
+	print_time_unit(node->total.max);
+	pr_out("%*s%s\n", space, "", node->name);
+}
+
+static void print_window(struct rb_root *root)
+{
+	struct rb_root sort_root = RB_ROOT;
+	const int field_space = 2;
+
+	if (RB_EMPTY_ROOT(root))
+		return;
+
+	report_calc_avg(root);
+	report_sort_nodes(root, &sort_root);
+
+	/* all nodes are freed */
+	print_and_delete(&sort_root, true, NULL, print_window_function,
+			 field_space);
+	*root = RB_ROOT;
+}
+
+static void report_windows(struct uftrace_data *handle, struct opts *opts)
+{
+	struct rb_root name_root = RB_ROOT;
+	const char line[] = "==========";
+
+	report_use_hist = true;
+	window.size = opts->window;
+
+	pr_out("  %13s  %10s  %10s  %10s  %10s  %10s  %s\n", "Window(s)",
+	       "Calls", "Total avg", "P50", "P99", "Max", "Function");
+	pr_out("  %.13s===  %s  %s  %s  %s  %s  %s==========\n", line,
+	       line, line, line, line, line, line);
+
+	build_function_tree(handle, &name_root, opts);
+
+	if (uftrace_done)
+		return;
+
+	print_window(&name_root);
+}
+
 static void add_remaining_task_fstack(struct uftrace_data *handle,
 				      struct rb_root *root)
 {
@@ -546,6 +636,11 @@ int command_report(int argc, char *argv[], struct opts *opts)
 		avg_mode = AVG_SELF;
 	}
 
+	if (opts->window && (opts->diff || opts->show_task)) {
+		pr_use("--window option cannot be used with --diff or --task.\n");
+		exit(1);
+	}
+
 	ret = open_data_file(opts, &handle);
 	if (ret < 0) {
 		pr_warn("cannot open record data: %s: %m\n", opts->dirname);
@@ -579,10 +674,15 @@ int command_report(int argc, char *argv[], struct opts *opts)
 	if (opts->diff_policy)
 		apply_diff_policy(opts->diff_policy);
 
+	if (report_needs_hist(opts))
+		report_use_hist = true;
+
 	if (opts->show_task)
 		report_task(&handle, opts);
 	else if (opts->diff)
 		report_diff(&handle, opts);
+	else if (opts->window)
+		report_windows(&handle, opts);
 	else
 		report_functions(&handle, opts);
 
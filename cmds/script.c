@@ -9,6 +9,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdio_ext.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 #include "uftrace.h"
 #include "version.h"
@@ -16,6 +19,7 @@
 #include "utils/symbol.h"
 #include "utils/filter.h"
 #include "utils/fstack.h"
+#include "utils/kernel.h"
 #include "utils/script.h"
 
 #include "libtraceevent/event-parse.h"
@@ -59,7 +63,7 @@ static int run_script_for_rstack(struct uftrace_data *handle,
 		fstack = fstack_get(task ,task->stack_count - 1);
 		fstack_update(UFTRACE_ENTRY, task, fstack);
 
-		if (!script_match_filter(symname))
+		if (!script_match_filter(sym, symname))
 			goto out;
 
 		sc_ctx.tid       = task->tid;
@@ -75,7 +79,10 @@ static int run_script_for_rstack(struct uftrace_data *handle,
 		}
 
 		/* script hooking for function entry */
-		script_uftrace_entry(&sc_ctx);
+		if (script_uftrace_batch)
+			script_batch_add(SCRIPT_BATCH_ENTRY, &sc_ctx);
+		else
+			script_uftrace_entry(&sc_ctx);
 	}
 	else if (rstack->type == UFTRACE_EXIT) {
 		struct script_context sc_ctx = { 0, };
@@ -88,7 +95,7 @@ static int run_script_for_rstack(struct uftrace_data *handle,
 		    !(fstack->flags & FSTACK_FL_NORECORD)) {
 			int depth = fstack_update(UFTRACE_EXIT, task, fstack);
 
-			if (!script_match_filter(symname)) {
+			if (!script_match_filter(sym, symname)) {
 				fstack_exit(task);
 				goto out;
 			}
@@ -111,7 +118,10 @@ static int run_script_for_rstack(struct uftrace_data *handle,
 			}
 
 			/* script hooking for function exit */
-			script_uftrace_exit(&sc_ctx);
+			if (script_uftrace_batch)
+				script_batch_add(SCRIPT_BATCH_EXIT, &sc_ctx);
+			else
+				script_uftrace_exit(&sc_ctx);
 		}
 
 		fstack_exit(task);
@@ -127,11 +137,281 @@ out:
 	return 0;
 }
 
+static int run_script(struct uftrace_data *handle, struct opts *opts)
+{
+	struct uftrace_task_reader *task;
+	int ret = 0;
+
+	while (read_rstack(handle, &task) == 0 && !uftrace_done) {
+		if (!fstack_check_opts(task, opts))
+			continue;
+
+		ret = run_script_for_rstack(handle, task, opts);
+
+		if (ret)
+			break;
+	}
+
+	if (script_uftrace_batch)
+		script_batch_flush();
+
+	return ret;
+}
+
+struct script_worker {
+	pid_t		pid;
+	FILE		*fp;		/* to receive partial result */
+	uint64_t	size;		/* size of task data to process */
+};
+
+static uint64_t get_task_data_size(struct uftrace_data *handle, int tid)
+{
+	char *filename;
+	struct stat stbuf;
+	uint64_t size = 0;
+
+	xasprintf(&filename, "%s/%d.dat", handle->dirname, tid);
+	if (stat(filename, &stbuf) == 0)
+		size = stbuf.st_size;
+	free(filename);
+
+	return size;
+}
+
+/* assign tasks to workers from the biggest one to the least loaded worker */
+static void assign_script_tasks(struct uftrace_data *handle, int *shard,
+				struct script_worker *workers, int nr_workers)
+{
+	uint64_t *sizes = xcalloc(handle->nr_tasks, sizeof(*sizes));
+	int i, k;
+
+	for (i = 0; i < handle->nr_tasks; i++) {
+		shard[i] = -1;
+		if (!handle->tasks[i].done)
+			sizes[i] = get_task_data_size(handle, handle->tasks[i].tid);
+	}
+
+	while (true) {
+		int max = -1;
+		int min = 0;
+
+		for (i = 0; i < handle->nr_tasks; i++) {
+			if (handle->tasks[i].done || shard[i] >= 0)
+				continue;
+			if (max < 0 || sizes[i] > sizes[max])
+				max = i;
+		}
+		if (max < 0)
+			break;
+
+		for (k = 1; k < nr_workers; k++) {
+			if (workers[k].size < workers[min].size)
+				min = k;
+		}
+
+		shard[max] = min;
+		workers[min].size += sizes[max];
+	}
+
+	free(sizes);
+}
+
+/* file offset is shared after fork(), so each worker should open it again */
+static void reopen_task_file(struct uftrace_data *handle,
+			     struct uftrace_task_reader *task, off_t pos)
+{
+	char *filename;
+
+	xasprintf(&filename, "%s/%d.dat", handle->dirname, task->tid);
+	task->fp = fopen(filename, "rb");
+	if (task->fp == NULL)
+		pr_err("cannot open task data file: %s", filename);
+
+	fseeko(task->fp, pos, SEEK_SET);
+	free(filename);
+}
+
+static void run_script_worker(struct uftrace_data *handle, struct opts *opts,
+			      int *shard, off_t *pos, int idx, FILE *fp)
+{
+	int i;
+	int ret;
+
+	for (i = 0; i < handle->nr_tasks; i++) {
+		struct uftrace_task_reader *task = &handle->tasks[i];
+
+		if (shard[i] < 0)
+			continue;
+
+		reopen_task_file(handle, task, pos[i]);
+		if (shard[i] != idx)
+			skip_task_handle(handle, task);
+	}
+
+	ret = run_script(handle, opts);
+
+	if (script_uftrace_merge) {
+		void *buf = NULL;
+		size_t len = 0;
+
+		if (script_uftrace_partial(&buf, &len) < 0 ||
+		    fwrite(buf, 1, len, fp) != len)
+			ret = -1;
+		free(buf);
+	}
+	else {
+		/* nothing to merge, each worker shows its own result */
+		script_uftrace_end();
+	}
+
+	script_finish();
+	fflush(outfp);
+	fflush(fp);
+
+	_exit(ret ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+static int merge_script_results(struct script_worker *workers, int nr_workers)
+{
+	void **bufs = xcalloc(nr_workers, sizeof(*bufs));
+	size_t *lens = xcalloc(nr_workers, sizeof(*lens));
+	int nr = 0;
+	int i;
+	int ret;
+
+	for (i = 0; i < nr_workers; i++) {
+		FILE *fp = workers[i].fp;
+		long len;
+
+		if (fp == NULL)
+			continue;
+
+		fseek(fp, 0, SEEK_END);
+		len = ftell(fp);
+		if (len <= 0)
+			continue;
+
+		rewind(fp);
+		bufs[nr] = xmalloc(len);
+		if (fread(bufs[nr], 1, len, fp) != (size_t)len) {
+			pr_warn("cannot read result of script worker %d\n", i);
+			free(bufs[nr]);
+			continue;
+		}
+		lens[nr++] = len;
+	}
+
+	ret = script_uftrace_merge(bufs, lens, nr);
+
+	for (i = 0; i < nr; i++)
+		free(bufs[i]);
+	free(bufs);
+	free(lens);
+
+	return ret;
+}
+
+/*
+ * Run the script in multiple processes.  Each worker process handles
+ * a subset of tasks using its own copy of the script (interpreter) and
+ * the results are merged by uftrace_merge() in the script if it has.
+ * Returns negative value if it cannot be run in parallel.
+ */
+static int run_script_parallel(struct uftrace_data *handle, struct opts *opts)
+{
+	struct script_worker *workers;
+	int *shard;
+	off_t *pos;
+	int nr_workers = 0;
+	int i;
+	int ret = 0;
+
+	/* kernel records are not split by task */
+	if (has_kernel_data(handle->kernel)) {
+		pr_warn("cannot run script in parallel with kernel data\n");
+		return -1;
+	}
+
+	for (i = 0; i < handle->nr_tasks; i++) {
+		if (!handle->tasks[i].done)
+			nr_workers++;
+	}
+	if (nr_workers > opts->nr_script_jobs)
+		nr_workers = opts->nr_script_jobs;
+	if (nr_workers <= 1)
+		return -1;
+
+	pr_dbg("run script in %d processes\n", nr_workers);
+
+	workers = xcalloc(nr_workers, sizeof(*workers));
+	shard = xcalloc(handle->nr_tasks, sizeof(*shard));
+	assign_script_tasks(handle, shard, workers, nr_workers);
+
+	pos = xcalloc(handle->nr_tasks, sizeof(*pos));
+	for (i = 0; i < handle->nr_tasks; i++) {
+		struct uftrace_task_reader *task = &handle->tasks[i];
+
+		if (shard[i] < 0)
+			continue;
+
+		pos[i] = ftello(task->fp);
+		fclose(task->fp);
+		task->fp = NULL;
+	}
+
+	/* do not print buffered output multiple times */
+	if (script_atfork_prepare)
+		script_atfork_prepare();
+	fflush(outfp);
+	fflush(logfp);
+
+	for (i = 0; i < nr_workers; i++) {
+		if (script_uftrace_merge) {
+			workers[i].fp = tmpfile();
+			if (workers[i].fp == NULL)
+				pr_err("cannot create a temp file");
+		}
+
+		workers[i].pid = fork();
+		if (workers[i].pid < 0)
+			pr_err("cannot start script worker");
+
+		if (workers[i].pid == 0)
+			run_script_worker(handle, opts, shard, pos, i,
+					  workers[i].fp);
+	}
+
+	for (i = 0; i < nr_workers; i++) {
+		int status;
+
+		if (waitpid(workers[i].pid, &status, 0) < 0 ||
+		    !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			pr_warn("script worker %d failed\n", workers[i].pid);
+			ret = 1;
+		}
+	}
+
+	/* workers called uftrace_end() already if no merge */
+	if (script_uftrace_merge) {
+		merge_script_results(workers, nr_workers);
+		script_uftrace_end();
+	}
+
+	for (i = 0; i < nr_workers; i++) {
+		if (workers[i].fp)
+			fclose(workers[i].fp);
+	}
+	free(workers);
+	free(shard);
+	free(pos);
+
+	return ret;
+}
+
 int command_script(int argc, char *argv[], struct opts *opts)
 {
 	int ret;
 	struct uftrace_data handle;
-	struct uftrace_task_reader *task;
 	struct script_info info = {
 		.name           = opts->script_file,
 		.version        = UFTRACE_VERSION,
@@ -185,16 +465,15 @@ int command_script(int argc, char *argv[], struct opts *opts)
 		goto out;
 	}
 
-	while (read_rstack(&handle, &task) == 0 && !uftrace_done) {
-		if (!fstack_check_opts(task, opts))
-			continue;
-
-		ret = run_script_for_rstack(&handle, task, opts);
-
-		if (ret)
-			break;
+	if (opts->nr_script_jobs > 1) {
+		ret = run_script_parallel(&handle, opts);
+		if (ret >= 0)
+			goto out;
+		/* fallback to run it in this process */
 	}
 
+	ret = run_script(&handle, opts);
+
 	/* dtor for script support */
 	script_uftrace_end();
 out:
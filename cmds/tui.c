@@ -9,6 +9,7 @@
 #include <inttypes.h>
 #include <unistd.h>
 #include <errno.h>
+#include <pthread.h>
 #include <sys/wait.h>
 
 #include "uftrace.h"
@@ -25,6 +26,11 @@
 #define KEY_ESCAPE  27
 #define BLANK  32
 
+/* number of records to read before checking user input */
+#define TUI_LOAD_CHUNK  10000
+/* interval (in msec) to update windows while loading data */
+#define TUI_LOAD_INTERVAL  1000
+
 static bool tui_finished;
 static bool tui_debug;
 
@@ -75,6 +81,7 @@ struct tui_window {
 	int curr_index;
 	int last_index;
 	int search_count;
+	unsigned long gen;
 };
 
 struct tui_report {
@@ -107,6 +114,25 @@ struct tui_list {
 	int nr_node;
 };
 
+/*
+ * The data is read by a separate thread so that users can see (partial)
+ * result before loading the whole data.  The main thread should hold
+ * the lock while accessing the graphs and report nodes.
+ */
+struct tui_loader {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct opts *opts;
+	struct uftrace_data *handle;
+	unsigned long nr_records;
+	unsigned long gen;
+	int waiting;
+	bool loading;
+	bool threaded;
+	bool stop;
+};
+
 static LIST_HEAD(tui_graph_list);
 static LIST_HEAD(graph_output_fields);
 static LIST_HEAD(report_output_fields);
@@ -114,6 +140,7 @@ static struct tui_report tui_report;
 static struct tui_graph partial_graph;
 static struct tui_list tui_info;
 static struct tui_list tui_session;
+static struct tui_loader tui_loader;
 static char *tui_search;
 
 static const struct tui_window_ops graph_ops;
@@ -168,12 +195,12 @@ static const char *graph_field_names[NUM_GRAPH_FIELD] = {
 	"TOTAL TIME", "SELF TIME", "ADDRESS",
 };
 
-#define NUM_REPORT_FIELD 9
+#define NUM_REPORT_FIELD 13
 
 static const char *report_field_names[NUM_REPORT_FIELD] = {
 	"TOTAL TIME", "TOTAL AVG", "TOTAL MIN", "TOTAL MAX",
 	"SELF TIME", "SELF AVG", "SELF MIN", "SELF MAX",
-	"CALL",
+	"CALL", "TOTAL P50", "TOTAL P90", "TOTAL P99", "TOTAL P999",
 };
 
 static const char *field_help[] = {
@@ -193,7 +220,7 @@ enum tui_mode {
 static char *report_sort_key[] = {
 	OPT_SORT_KEYS, "total_avg", "total_min", "total_max",
 	"self", "self_avg", "self_min", "self_max",
-	"call"
+	"call", "total_p50", "total_p90", "total_p99", "total_p999",
 };
 
 static char *selected_report_sort_key[NUM_REPORT_FIELD];
@@ -356,6 +383,10 @@ REPORT_FIELD_TIME(REPORT_F_SELF_TIME_AVG, self-avg, self.avg, self_avg, "SELF AV
 REPORT_FIELD_TIME(REPORT_F_SELF_TIME_MIN, self-min, self.min, self_min, "SELF MIN");
 REPORT_FIELD_TIME(REPORT_F_SELF_TIME_MAX, self-max, self.max, self_max, "SELF MAX");
 REPORT_FIELD_CALL(REPORT_F_CALL, call, call, call, "CALL");
+REPORT_FIELD_TIME(REPORT_F_TOTAL_TIME_P50, total-p50, hist.p50, total_p50, "TOTAL P50");
+REPORT_FIELD_TIME(REPORT_F_TOTAL_TIME_P90, total-p90, hist.p90, total_p90, "TOTAL P90");
+REPORT_FIELD_TIME(REPORT_F_TOTAL_TIME_P99, total-p99, hist.p99, total_p99, "TOTAL P99");
+REPORT_FIELD_TIME(REPORT_F_TOTAL_TIME_P999, total-p999, hist.p999, total_p999, "TOTAL P999");
 
 static struct display_field *report_field_table[] = {
 	&report_field_total,
@@ -367,6 +398,10 @@ static struct display_field *report_field_table[] = {
 	&report_field_self_min,
 	&report_field_self_max,
 	&report_field_call,
+	&report_field_total_p50,
+	&report_field_total_p90,
+	&report_field_total_p99,
+	&report_field_total_p999,
 };
 
 static void setup_default_graph_field(struct list_head *fields, struct opts *opts,
@@ -416,6 +451,8 @@ static void tui_setup(struct uftrace_data *handle, struct opts *opts)
 	walk_sessions(&handle->sessions, create_data, NULL);
 
 	tui_report.name_tree = RB_ROOT;
+	/* percentile fields can be selected later */
+	report_use_hist = true;
 
 	setup_field(&graph_output_fields, opts, setup_default_graph_field,
 		    graph_field_table, ARRAY_SIZE(graph_field_table));
@@ -512,8 +549,11 @@ static int build_tui_node(struct uftrace_task_reader *task,
 		addr = get_kernel_address(&fsess->symtabs, addr);
 	}
 
-	tg = graph_get_task(task, sizeof(*tg));
 	graph = get_graph(task, rec->time, addr);
+	if (graph == NULL)
+		return 0;
+
+	tg = graph_get_task(task, sizeof(*tg));
 
 	if (tg->node == NULL || tg->graph != graph)
 		tg->node = &graph->root;
@@ -612,21 +652,128 @@ static void add_remaining_node(struct opts *opts, struct uftrace_data *handle)
 	}
 }
 
+static void *tui_loader_thread(void *arg)
+{
+	struct tui_loader *loader = arg;
+	struct uftrace_data *handle = loader->handle;
+	struct uftrace_task_reader *task;
+	bool done = false;
+	int n;
+
+	pthread_mutex_lock(&loader->lock);
+	while (!done) {
+		for (n = 0; n < TUI_LOAD_CHUNK; n++) {
+			struct uftrace_record *rec;
+
+			if (loader->stop || uftrace_done ||
+			    read_rstack(handle, &task) != 0) {
+				done = true;
+				break;
+			}
+
+			rec = task->rstack;
+
+			if (!fstack_check_opts(task, loader->opts))
+				continue;
+
+			if (!fstack_check_filter(task))
+				continue;
+
+			if (build_tui_node(task, rec, loader->opts)) {
+				done = true;
+				break;
+			}
+
+			fstack_check_filter_done(task);
+		}
+
+		loader->nr_records += n;
+		loader->gen++;
+
+		/* let the main thread handle user input */
+		while (loader->waiting && !loader->stop)
+			pthread_cond_wait(&loader->cond, &loader->lock);
+	}
+
+	if (!loader->stop)
+		add_remaining_node(loader->opts, handle);
+
+	loader->gen++;
+	loader->loading = false;
+	pthread_mutex_unlock(&loader->lock);
+
+	return NULL;
+}
+
+/* get the lock from the loader thread (which will wait for us) */
+static void tui_lock(void)
+{
+	__sync_fetch_and_add(&tui_loader.waiting, 1);
+	pthread_mutex_lock(&tui_loader.lock);
+	__sync_fetch_and_sub(&tui_loader.waiting, 1);
+}
+
+static void tui_unlock(void)
+{
+	pthread_cond_broadcast(&tui_loader.cond);
+	pthread_mutex_unlock(&tui_loader.lock);
+}
+
+/* start loading data and return (with the lock) when there's something to show */
+static void tui_start_loader(struct opts *opts, struct uftrace_data *handle)
+{
+	struct tui_loader *loader = &tui_loader;
+
+	pthread_mutex_init(&loader->lock, NULL);
+	pthread_cond_init(&loader->cond, NULL);
+
+	loader->opts = opts;
+	loader->handle = handle;
+	loader->loading = true;
+
+	if (pthread_create(&loader->thread, NULL, tui_loader_thread, loader) != 0) {
+		pr_dbg("cannot create loader thread: %m\n");
+		tui_loader_thread(loader);
+		tui_lock();
+		return;
+	}
+	loader->threaded = true;
+
+	while (true) {
+		tui_lock();
+		if (tui_report.nr_func || !loader->loading)
+			break;
+		tui_unlock();
+
+		usleep(10 * 1000);
+	}
+}
+
+/* should be called with the lock */
+static void tui_stop_loader(void)
+{
+	struct tui_loader *loader = &tui_loader;
+
+	loader->stop = true;
+	tui_unlock();
+
+	if (loader->threaded)
+		pthread_join(loader->thread, NULL);
+
+	pthread_mutex_destroy(&loader->lock);
+	pthread_cond_destroy(&loader->cond);
+}
+
 static struct tui_graph_node * append_graph_node(struct uftrace_graph_node *dst,
 						 struct tui_graph *graph,
 						 char *name)
 {
 	struct tui_graph_node *node;
 
-	node = xzalloc(sizeof(*node));
-
-	node->n.name = xstrdup(name);
-	INIT_LIST_HEAD(&node->n.head);
-
-	node->n.parent = dst;
+	/* it's only used to build the partial graph */
+	node = (void *)graph_new_node(&partial_graph.ug, dst, name,
+				      sizeof(*node));
 	node->graph = &graph->ug;
-	list_add_tail(&node->n.list, &dst->head);
-	dst->nr_edges++;
 
 	return node;
 }
@@ -638,12 +785,9 @@ static void copy_graph_node(struct uftrace_graph_node *dst,
 	struct tui_graph_node *node;
 
 	list_for_each_entry(child, &src->head, list) {
-		list_for_each_entry(node, &dst->head, n.list) {
-			if (!strcmp(child->name, node->n.name))
-				break;
-		}
+		node = (void *)graph_find_node(&partial_graph.ug, dst, child->name);
 
-		if (list_no_entry(node, &dst->head, n.list)) {
+		if (node == NULL) {
 			struct tui_graph *graph;
 
 			node = (struct tui_graph_node *)src;
@@ -690,23 +834,32 @@ static void tui_window_init(struct tui_window *win,
 	win->curr = win->old = top;
 	win->top_index = win->curr_index = 0;
 	win->last_index = tui_last_index(win);
+	win->gen = tui_loader.gen;
+}
+
+static void tui_graph_update_root(struct tui_graph *graph)
+{
+	struct uftrace_graph_node *top, *node;
+
+	/* top (root) is an artificial node, fill the info */
+	top = &graph->ug.root;
+	top->name = basename(graph->ug.sess->exename);
+	top->nr_calls = 1;
+	top->time = 0;
+	top->child_time = 0;
+
+	list_for_each_entry(node, &graph->ug.root.head, list) {
+		top->time       += node->time;
+		top->child_time += node->time;
+	}
 }
 
 static struct tui_graph * tui_graph_init(struct opts *opts)
 {
 	struct tui_graph *graph;
-	struct uftrace_graph_node *top, *node;
 
 	list_for_each_entry(graph, &tui_graph_list, list) {
-		/* top (root) is an artificial node, fill the info */
-		top = &graph->ug.root;
-		top->name = basename(graph->ug.sess->exename);
-		top->nr_calls = 1;
-
-		list_for_each_entry(node, &graph->ug.root.head, list) {
-			top->time       += node->time;
-			top->child_time += node->time;
-		}
+		tui_graph_update_root(graph);
 
 		tui_window_init(&graph->win, &graph_ops);
 
@@ -1138,6 +1291,16 @@ static void win_footer(struct tui_window *win, char *msg)
 	if (pos_start > msg_len)
 		snprintf(footer + pos_start, POS_SIZE, "%3d%%", win_pos_percent(win));
 
+	if (tui_loader.loading) {
+		char buf[64];
+		int len;
+
+		len = snprintf(buf, sizeof(buf), "[loading: %lu records] ",
+			       tui_loader.nr_records);
+		if (pos_start - len > msg_len)
+			memcpy(footer + pos_start - len, buf, len);
+	}
+
 	footer[COLS] = '\0';
 
 	printw("%-*s", COLS, footer);
@@ -1631,7 +1794,12 @@ static struct tui_list * tui_info_init(struct opts *opts,
 				       struct uftrace_data *handle)
 {
 	INIT_LIST_HEAD(&tui_info.head);
-	process_uftrace_info(handle, opts, build_info_node, &tui_info);
+
+	/* it reads task and perf data again, wait for the loader */
+	if (tui_loader.loading)
+		build_info_node(&tui_info, "# loading data...\n");
+	else
+		process_uftrace_info(handle, opts, build_info_node, &tui_info);
 
 	tui_window_init(&tui_info.win, &info_ops);
 
@@ -2196,6 +2364,41 @@ static void tui_window_set_middle(struct tui_window *win)
 		tui_window_set_middle_next(win, win->curr);
 }
 
+/* reflect new data from the loader and keep the current node */
+static void tui_window_update(struct tui_window *win)
+{
+	/* stay at the top if user didn't move */
+	void *target = win->curr_index ? win->curr : NULL;
+
+	if (win->gen == tui_loader.gen)
+		return;
+
+	win->gen = tui_loader.gen;
+
+	if (win->ops == &report_ops) {
+		report_sort_nodes(&tui_report.name_tree, &tui_report.sort_tree);
+		report_calc_avg(&tui_report.name_tree);
+	}
+	else if (win->ops == &graph_ops && win != &partial_graph.win) {
+		tui_graph_update_root((struct tui_graph *)win);
+	}
+	else {
+		/* other windows don't change */
+		return;
+	}
+
+	tui_window_move_home(win);
+	while (target && win->curr != target) {
+		void *prev = win->curr;
+
+		tui_window_move_down(win);
+		if (win->curr == prev)
+			break;
+	}
+	tui_window_set_middle_next(win, win->curr);
+	win->last_index = tui_last_index(win);
+}
+
 static bool tui_window_can_search(struct tui_window *win)
 {
 	return win->ops->search != NULL;
@@ -2678,7 +2881,9 @@ static void tui_main_loop(struct opts *opts, struct uftrace_data *handle)
 	struct tui_list *info;
 	struct tui_list *session;
 	struct tui_window *win;
+	struct tui_window *old_win;
 	void *old_top;
+	bool loading;
 	enum tui_mode tui_mode;
 	int num_sort_key = 3;
 
@@ -2704,6 +2909,8 @@ static void tui_main_loop(struct opts *opts, struct uftrace_data *handle)
 	}
 
 	old_top = win->top;
+	old_win = win;
+	loading = tui_loader.loading;
 
 	while (true) {
 		switch (key) {
@@ -2827,6 +3034,7 @@ static void tui_main_loop(struct opts *opts, struct uftrace_data *handle)
 
 				/* change to report window */
 				win = &report->win;
+				tui_window_update(win);
 
 				/* move focus on the same function */
 				tui_window_move_home(win);
@@ -2945,6 +3153,23 @@ static void tui_main_loop(struct opts *opts, struct uftrace_data *handle)
 			break;
 		}
 
+		if (loading && !tui_loader.loading) {
+			/* update info window after loading is done */
+			tui_info_finish();
+			tui_info_init(opts, handle);
+
+			loading = false;
+			full_redraw = true;
+		}
+
+		/* update windows periodically while loading */
+		if (key == ERR || win != old_win || !tui_loader.loading) {
+			if (win->gen != tui_loader.gen) {
+				tui_window_update(win);
+				full_redraw = true;
+			}
+		}
+
 		if (win->top != old_top)
 			full_redraw = true;
 
@@ -2958,12 +3183,21 @@ static void tui_main_loop(struct opts *opts, struct uftrace_data *handle)
 
 		win->old = win->curr;
 		old_top = win->top;
+		old_win = win;
 
 		move(LINES-1, COLS-1);
+		timeout(tui_loader.loading ? TUI_LOAD_INTERVAL : -1);
+
+		tui_unlock();
 		key = getch();
+		tui_lock();
+
+		timeout(-1);
 	}
 
 out:
+	tui_stop_loader();
+
 	tui_graph_finish();
 	tui_report_finish();
 	tui_info_finish();
@@ -2984,7 +3218,6 @@ int command_tui(int argc, char *argv[], struct opts *opts)
 {
 	int ret;
 	struct uftrace_data handle;
-	struct uftrace_task_reader *task;
 
 	ret = open_data_file(opts, &handle);
 	if (ret < 0) {
@@ -3008,23 +3241,8 @@ int command_tui(int argc, char *argv[], struct opts *opts)
 	tui_setup(&handle, opts);
 	fstack_setup_filters(opts, &handle);
 
-	while (read_rstack(&handle, &task) == 0 && !uftrace_done) {
-		struct uftrace_record *rec = task->rstack;
-
-		if (!fstack_check_opts(task, opts))
-			continue;
-
-		if (!fstack_check_filter(task))
-			continue;
-
-		ret = build_tui_node(task, rec, opts);
-		if (ret)
-			break;
-
-		fstack_check_filter_done(task);
-	}
-	add_remaining_node(opts, &handle);
-
+	/* the main loop will be started before loading whole data */
+	tui_start_loader(opts, &handle);
 	tui_main_loop(opts, &handle);
 
 	close_data_file(opts, &handle);
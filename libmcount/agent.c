@@ -0,0 +1,280 @@
+/*
+ * Agent to control tracing of a running process (uftrace record --agent).
+ *
+ * It listens on an abstract unix socket named "uftrace-agent-<pid>" and
+ * handles messages from "uftrace record -p <pid>" to turn tracing on or
+ * off, change depth and time filters, update function filters and dynamic
+ * patching while the program is running.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* This should be defined before #include "utils.h" */
+#define PR_FMT     "agent"
+#define PR_DOMAIN  DBG_MCOUNT
+
+#include "libmcount/mcount.h"
+#include "libmcount/internal.h"
+#include "utils/utils.h"
+
+#if defined(DISABLE_MCOUNT_FILTER) || defined(SINGLE_THREAD)
+
+void mcount_agent_init(enum uftrace_pattern_type ptype)
+{
+	pr_dbg("agent is not supported in this libmcount\n");
+}
+
+void mcount_agent_finish(void)
+{
+}
+
+#else
+
+/* maximum length of a message (for filter or patch string) */
+#define AGENT_MSG_MAX  (64 * 1024)
+
+static int agent_sock = -1;
+static int agent_pid;
+static pthread_t agent_thread;
+static enum uftrace_pattern_type agent_ptype;
+
+/* connection being served, to wake the agent up at exit */
+static pthread_mutex_t agent_lock = PTHREAD_MUTEX_INITIALIZER;
+static int agent_client = -1;
+static bool agent_done;
+
+/* only the same user (or root) can control the process */
+static bool agent_check_peer(int fd)
+{
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0)
+		return false;
+
+	return cred.uid == 0 || cred.uid == geteuid();
+}
+
+static int agent_apply(struct uftrace_msg *msg, char *data)
+{
+	int val;
+	uint64_t threshold;
+
+	switch (msg->type) {
+	case UFTRACE_MSG_AGENT_TRACE:
+		if (msg->len != sizeof(val))
+			return -1;
+		memcpy(&val, data, sizeof(val));
+
+		pr_dbg("turn tracing %s\n", val ? "on" : "off");
+		mcount_update_trace(val);
+		break;
+
+	case UFTRACE_MSG_AGENT_DEPTH:
+		if (msg->len != sizeof(val))
+			return -1;
+		memcpy(&val, data, sizeof(val));
+		if (val <= 0)
+			return -1;
+
+		pr_dbg("update depth: %d\n", val);
+		mcount_update_depth(val);
+		break;
+
+	case UFTRACE_MSG_AGENT_THRESHOLD:
+		if (msg->len != sizeof(threshold))
+			return -1;
+		memcpy(&threshold, data, sizeof(threshold));
+
+		pr_dbg("update time filter: %"PRIu64"\n", threshold);
+		mcount_update_threshold(threshold);
+		break;
+
+	case UFTRACE_MSG_AGENT_ADD_FILTER:
+	case UFTRACE_MSG_AGENT_SET_FILTER:
+		mcount_update_filter(data,
+				     msg->type == UFTRACE_MSG_AGENT_SET_FILTER);
+		break;
+
+	case UFTRACE_MSG_AGENT_PATCH:
+		pr_dbg("update patch: %s\n", data);
+		return mcount_update_patch(data, agent_ptype);
+
+	default:
+		pr_dbg("unknown message type: %u\n", msg->type);
+		return -1;
+	}
+	return 0;
+}
+
+static int agent_reply(int fd, int type, int status)
+{
+	struct {
+		struct uftrace_msg msg;
+		int status;
+	} reply = {
+		.msg = {
+			.magic = UFTRACE_MSG_MAGIC,
+			.type = type,
+			.len = sizeof(status),
+		},
+		.status = status,
+	};
+
+	/* do not kill the process if the client went away */
+	if (send(fd, &reply, sizeof(reply), MSG_NOSIGNAL) != sizeof(reply))
+		return -1;
+	return 0;
+}
+
+static void agent_serve(int fd)
+{
+	struct uftrace_msg msg;
+	char *data;
+	int status;
+
+	while (read_all(fd, &msg, sizeof(msg)) == 0) {
+		if (msg.magic != UFTRACE_MSG_MAGIC || msg.len > AGENT_MSG_MAX) {
+			pr_dbg("invalid message: magic = %#x, len = %u\n",
+			       msg.magic, msg.len);
+			break;
+		}
+
+		/* make sure strings are terminated */
+		data = xmalloc(msg.len + 1);
+		if (read_all(fd, data, msg.len) < 0) {
+			free(data);
+			break;
+		}
+		data[msg.len] = '\0';
+
+		status = agent_apply(&msg, data);
+		free(data);
+
+		if (agent_reply(fd, msg.type, status) < 0)
+			break;
+	}
+}
+
+static void *agent_main(void *arg)
+{
+	sigset_t sigset;
+	int fd;
+
+	/* signals should be delivered to the program threads */
+	sigfillset(&sigset);
+	pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+
+	while (true) {
+		fd = accept4(agent_sock, NULL, NULL, SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			/* the socket was shut down */
+			break;
+		}
+
+		pthread_mutex_lock(&agent_lock);
+		if (agent_done) {
+			pthread_mutex_unlock(&agent_lock);
+			close(fd);
+			break;
+		}
+		agent_client = fd;
+		pthread_mutex_unlock(&agent_lock);
+
+		if (agent_check_peer(fd))
+			agent_serve(fd);
+		else
+			pr_dbg("deny connection from other user\n");
+
+		pthread_mutex_lock(&agent_lock);
+		agent_client = -1;
+		close(fd);
+		pthread_mutex_unlock(&agent_lock);
+	}
+
+	pr_dbg("agent exited\n");
+	return NULL;
+}
+
+/**
+ * mcount_agent_init - start the agent thread
+ * @ptype: pattern type for filter and patch strings
+ *
+ * The socket is in the abstract namespace so it doesn't leave a file.
+ * Note that forked children don't have the agent as the thread is not
+ * copied, but they get their own after exec.
+ */
+void mcount_agent_init(enum uftrace_pattern_type ptype)
+{
+	struct sockaddr_un addr = {
+		.sun_family = AF_UNIX,
+	};
+	socklen_t len;
+
+	agent_ptype = ptype;
+	agent_pid = getpid();
+
+	/* sun_path[0] = '\0' for the abstract namespace */
+	snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1,
+		 UFTRACE_AGENT_SOCKET, agent_pid);
+	len = offsetof(struct sockaddr_un, sun_path) + 1 +
+		strlen(addr.sun_path + 1);
+
+	agent_sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (agent_sock < 0) {
+		pr_warn("cannot create agent socket: %m\n");
+		return;
+	}
+
+	if (bind(agent_sock, (struct sockaddr *)&addr, len) < 0 ||
+	    listen(agent_sock, 1) < 0) {
+		pr_warn("cannot setup agent socket: %m\n");
+		goto err;
+	}
+
+	if (pthread_create(&agent_thread, NULL, agent_main, NULL) != 0) {
+		pr_warn("cannot start agent thread\n");
+		goto err;
+	}
+
+	pr_dbg("agent is waiting at @%s\n", addr.sun_path + 1);
+	return;
+
+err:
+	close(agent_sock);
+	agent_sock = -1;
+}
+
+void mcount_agent_finish(void)
+{
+	/* forked child shares the socket but has no agent thread */
+	if (agent_sock < 0 || agent_pid != getpid())
+		return;
+
+	/*
+	 * wake up the agent thread waiting in accept() or in read() for
+	 * a client which doesn't send (or close) anything.
+	 */
+	pthread_mutex_lock(&agent_lock);
+	agent_done = true;
+	if (agent_client >= 0)
+		shutdown(agent_client, SHUT_RDWR);
+	pthread_mutex_unlock(&agent_lock);
+
+	shutdown(agent_sock, SHUT_RDWR);
+	pthread_join(agent_thread, NULL);
+
+	close(agent_sock);
+	agent_sock = -1;
+}
+
+#endif /* DISABLE_MCOUNT_FILTER || SINGLE_THREAD */
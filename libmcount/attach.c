@@ -0,0 +1,202 @@
+/*
+ * Support for attaching to a running process (uftrace record -p).
+ *
+ * In this case, libmcount is loaded by dlopen() after the program started.
+ * So the program was already bound to the (dummy) mcount functions in libc
+ * and it needs to update the GOT entries to call the ones in libmcount.
+ * They are restored when uftrace detaches from the process.
+ */
+#include <link.h>
+#include <fnmatch.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/* This should be defined before #include "utils.h" */
+#define PR_FMT     "mcount"
+#define PR_DOMAIN  DBG_MCOUNT
+
+#include "libmcount/mcount.h"
+#include "libmcount/internal.h"
+#include "utils/utils.h"
+#include "utils/symbol.h"
+#include "utils/list.h"
+
+struct attach_got {
+	struct list_head	list;
+	unsigned long		*addr;
+	unsigned long		orig;
+};
+
+static LIST_HEAD(attach_got_list);
+
+struct relro_data {
+	unsigned long	addr;
+	bool		found;
+};
+
+static int find_relro(struct dl_phdr_info *info, size_t sz, void *arg)
+{
+	struct relro_data *rd = arg;
+	int i;
+
+	for (i = 0; i < info->dlpi_phnum; i++) {
+		const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+		unsigned long start = info->dlpi_addr + phdr->p_vaddr;
+
+		if (phdr->p_type != PT_GNU_RELRO)
+			continue;
+
+		if (start <= rd->addr && rd->addr < start + phdr->p_memsz) {
+			rd->found = true;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * mcount_update_got - update a GOT entry
+ * @addr: address of the GOT entry
+ * @val: new value of the entry
+ *
+ * This function updates the GOT entry even if it's in the RELRO region
+ * which is read-only after the dynamic linker resolved the symbols.
+ */
+void mcount_update_got(unsigned long *addr, unsigned long val)
+{
+	struct relro_data rd = {
+		.addr = (unsigned long)addr,
+	};
+	unsigned long page_size = getpagesize();
+	void *page = (void *)((unsigned long)addr & ~(page_size - 1));
+
+	dl_iterate_phdr(find_relro, &rd);
+
+	if (rd.found)
+		mprotect(page, page_size, PROT_READ | PROT_WRITE);
+
+	*addr = val;
+
+	if (rd.found)
+		mprotect(page, page_size, PROT_READ);
+}
+
+static void hook_got_entry(const char *name, unsigned long *addr)
+{
+	struct attach_got *ag;
+	size_t i;
+
+	for (i = 0; i < plt_skip_nr; i++) {
+		const struct plthook_skip_symbol *skip_sym = &plt_skip_syms[i];
+
+		if (skip_sym->addr == NULL || strcmp(name, skip_sym->name))
+			continue;
+
+		ag = xmalloc(sizeof(*ag));
+		ag->addr = addr;
+		ag->orig = *addr;
+		list_add(&ag->list, &attach_got_list);
+
+		pr_dbg2("update GOT for %s at %p\n", name, addr);
+		mcount_update_got(addr, (unsigned long)skip_sym->addr);
+		break;
+	}
+}
+
+static int hook_module_got(struct dl_phdr_info *info, size_t sz, void *arg)
+{
+	const char *modname = info->dlpi_name;
+	unsigned long offset = info->dlpi_addr;
+	struct uftrace_elf_data elf;
+	struct uftrace_elf_iter sec_iter;
+	struct uftrace_elf_iter dyn_iter;
+	struct uftrace_elf_iter rel_iter;
+	bool found_dynsym = false;
+	unsigned symidx;
+	char *name;
+
+	/* main executable */
+	if (modname[0] == '\0')
+		modname = mcount_exename;
+
+	/* skip uftrace itself and vDSO */
+	if (!fnmatch("libmcount*.so", basename(modname), 0) ||
+	    !fnmatch("linux-*.so.*", basename(modname), 0))
+		return 0;
+
+	if (elf_init(modname, &elf) < 0)
+		return 0;
+
+	elf_for_each_shdr(&elf, &sec_iter) {
+		if (sec_iter.shdr.sh_type == SHT_DYNSYM) {
+			memcpy(&dyn_iter, &sec_iter, sizeof(sec_iter));
+			elf_get_strtab(&elf, &dyn_iter, sec_iter.shdr.sh_link);
+			elf_get_secdata(&elf, &dyn_iter);
+			found_dynsym = true;
+			break;
+		}
+	}
+
+	if (!found_dynsym)
+		goto out;
+
+	/* check both of PLT (JUMP_SLOT) and GOT (GLOB_DAT) relocations */
+	elf_for_each_shdr(&elf, &sec_iter) {
+		if (!(sec_iter.shdr.sh_flags & SHF_ALLOC))
+			continue;
+
+		memcpy(&rel_iter, &sec_iter, sizeof(sec_iter));
+
+		if (sec_iter.shdr.sh_type == SHT_RELA) {
+			elf_for_each_rela(&elf, &rel_iter) {
+				symidx = elf_rel_symbol(&rel_iter.rela);
+				if (symidx == 0)
+					continue;
+
+				elf_get_symbol(&elf, &dyn_iter, symidx);
+				name = elf_get_name(&elf, &dyn_iter,
+						    dyn_iter.sym.st_name);
+				hook_got_entry(name, (void *)(offset +
+						rel_iter.rela.r_offset));
+			}
+		}
+		else if (sec_iter.shdr.sh_type == SHT_REL) {
+			elf_for_each_rel(&elf, &rel_iter) {
+				symidx = elf_rel_symbol(&rel_iter.rel);
+				if (symidx == 0)
+					continue;
+
+				elf_get_symbol(&elf, &dyn_iter, symidx);
+				name = elf_get_name(&elf, &dyn_iter,
+						    dyn_iter.sym.st_name);
+				hook_got_entry(name, (void *)(offset +
+						rel_iter.rel.r_offset));
+			}
+		}
+	}
+
+out:
+	elf_finish(&elf);
+	return 0;
+}
+
+/* redirect calls to mcount (and friends) in all modules to libmcount */
+void mcount_setup_attach(void)
+{
+	pr_dbg("setup GOT for attaching\n");
+	dl_iterate_phdr(hook_module_got, NULL);
+}
+
+/* restore the original GOT entries when uftrace detaches */
+void mcount_finish_attach(void)
+{
+	struct attach_got *ag, *tmp;
+
+	list_for_each_entry_safe(ag, tmp, &attach_got_list, list) {
+		mcount_update_got(ag->addr, ag->orig);
+
+		list_del(&ag->list);
+		free(ag);
+	}
+}
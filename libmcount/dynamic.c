@@ -198,6 +198,7 @@ void mcount_release_code(void)
 {
 	hashmap_for_each(code_hmap, release_code, NULL);
 	hashmap_free(code_hmap);
+	code_hmap = NULL;
 
 	while (!list_empty(&code_pages)) {
 		struct code_page *cp;
@@ -232,6 +233,11 @@ __weak int mcount_unpatch_func(struct mcount_dynamic_info *mdi, struct sym *sym,
 	return -1;
 }
 
+__weak int mcount_revert_func(struct mcount_dynamic_info *mdi, struct sym *sym)
+{
+	return -1;
+}
+
 __weak void mcount_arch_find_module(struct mcount_dynamic_info *mdi,
 				    struct symtab *symtab)
 {
@@ -335,8 +341,10 @@ static void prepare_dynamic_update(struct symtabs *symtabs,
 	if (needs_modules)
 		hash_size *= 2;
 
-	code_hmap = hashmap_create(hash_size, hashmap_ptr_hash,
-				   hashmap_ptr_equals);
+	/* the agent can update it later, keep the existing code */
+	if (code_hmap == NULL)
+		code_hmap = hashmap_create(hash_size, hashmap_ptr_hash,
+					   hashmap_ptr_equals);
 
 	dl_iterate_phdr(find_dynamic_module, &fmd);
 }
@@ -497,8 +505,10 @@ static void patch_func_matched(struct mcount_dynamic_info *mdi,
 		    sym->type != ST_GLOBAL_FUNC)
 			continue;
 
-		if (!match_pattern_list(map, sym->name)) {
-			if (mcount_unpatch_func(mdi, sym, &disasm) == 0)
+		if (!match_pattern_list(map, symbol_name(sym))) {
+			/* it might be patched before (by the agent) */
+			if (mcount_unpatch_func(mdi, sym, &disasm) == 0 ||
+			    mcount_revert_func(mdi, sym) == 0)
 				stats.unpatch++;
 			continue;
 		}
@@ -567,6 +577,7 @@ static void freeze_dynamic_update(void)
 
 		mdi = tmp;
 	}
+	mdinfo = NULL;
 
 	mcount_freeze_code();
 }
@@ -587,7 +598,10 @@ int mcount_dynamic_update(struct symtabs *symtabs, char *patch_funcs,
 	char *size_filter;
 	bool needs_modules = !!strchr(patch_funcs, '@');
 
-	mcount_disasm_init(&disasm);
+	/* it's called again when the agent updates patching */
+	if (code_hmap == NULL)
+		mcount_disasm_init(&disasm);
+	memset(&stats, 0, sizeof(stats));
 
 	prepare_dynamic_update(symtabs, needs_modules);
 
@@ -659,6 +673,70 @@ void mcount_dynamic_dlopen(struct symtabs *symtabs, struct dl_phdr_info *info,
 	mcount_freeze_code();
 }
 
+static void revert_func_matched(struct mcount_dynamic_info *mdi,
+				struct uftrace_mmap *map)
+{
+	struct symtab *symtab = &map->mod->symtab;
+	unsigned long page_addr = mdi->text_addr & ~(PAGE_SIZE - 1);
+	unsigned long page_len = mdi->text_addr + mdi->text_size - page_addr;
+	struct sym *sym;
+	unsigned i;
+	int count = 0;
+
+	if (mprotect((void *)page_addr, page_len,
+		     PROT_READ | PROT_WRITE | PROT_EXEC)) {
+		pr_dbg("cannot revert functions due to protection: %m\n");
+		return;
+	}
+
+	for (i = 0; i < symtab->nr_sym; i++) {
+		sym = &symtab->sym[i];
+
+		if (sym->type != ST_LOCAL_FUNC &&
+		    sym->type != ST_GLOBAL_FUNC)
+			continue;
+
+		if (!match_pattern_list(map, symbol_name(sym)))
+			continue;
+
+		if (mcount_revert_func(mdi, sym) == 0)
+			count++;
+	}
+
+	mprotect((void *)page_addr, page_len, PROT_READ | PROT_EXEC);
+
+	pr_dbg("reverted %d functions in '%s'\n", count, basename(map->libname));
+}
+
+/* callback for dl_iterate_phdr() */
+static int revert_dynamic_module(struct dl_phdr_info *info, size_t sz,
+				 void *data)
+{
+	struct symtabs *symtabs = data;
+	struct mcount_dynamic_info *mdi;
+	struct uftrace_mmap *map;
+
+	mdi = create_mdi(info);
+
+	map = find_map(symtabs, mdi->base_addr);
+	if (map && map->mod && match_pattern_module(map->libname)) {
+		mdi->map = map;
+		revert_func_matched(mdi, map);
+	}
+
+	free(mdi);
+	return 0;
+}
+
+/* revert the patched functions when detaching from a running process */
+void mcount_dynamic_unpatch(struct symtabs *symtabs)
+{
+	if (list_empty(&patterns))
+		return;
+
+	dl_iterate_phdr(revert_dynamic_module, symtabs);
+}
+
 void mcount_dynamic_finish(void)
 {
 	release_pattern_list();
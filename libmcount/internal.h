@@ -53,6 +53,8 @@ struct filter_control {
 	uint16_t saved_depth;
 	uint64_t time;
 	uint64_t saved_time;
+	/* to check depth or time filter was changed by agent */
+	unsigned gen;
 };
 #else
 struct filter_control {};
@@ -99,10 +101,20 @@ struct mcount_watchpoint {
 };
 
 #ifndef DISABLE_MCOUNT_FILTER
+/* number of validated pages kept while saving arguments of a call */
+#define MEM_REGION_CACHE  8
+
 struct mcount_mem_regions {
 	struct rb_root root;
 	unsigned long  heap;
 	unsigned long  brk;
+	/*
+	 * pages found valid (by probing) after reading the maps.  They can
+	 * be unmapped later, even by libc internally (e.g. free), so it's
+	 * only valid until the arguments (or retval) of a call are saved.
+	 */
+	unsigned long  pages[MEM_REGION_CACHE];
+	unsigned       nr_pages;
 };
 void finish_mem_region(struct mcount_mem_regions *regions);
 #else
@@ -170,6 +182,8 @@ void mcount_unguard_recursion(struct mcount_thread_data *mtdp);
 extern uint64_t mcount_threshold;  /* nsec */
 extern pthread_key_t mtd_key;
 extern int shmem_bufsize;
+extern int mcount_flight_bufs;
+extern uint64_t mcount_flight_threshold;  /* nsec */
 extern int pfd;
 extern char *mcount_exename;
 extern int page_size_in_kb;
@@ -264,6 +278,7 @@ extern struct mcount_thread_data * mcount_prepare(void);
 extern void update_kernel_tid(int tid);
 extern const char *mcount_session_name(void);
 extern void uftrace_send_message(int type, void *data, size_t len);
+extern void mcount_flight_snapshot(void);
 extern void build_debug_domain(char *dbg_domain_str);
 
 extern void mcount_rstack_restore(struct mcount_thread_data *mtdp);
@@ -278,6 +293,7 @@ extern void prepare_shmem_buffer(struct mcount_thread_data *mtdp);
 extern void clear_shmem_buffer(struct mcount_thread_data *mtdp);
 extern void shmem_finish(struct mcount_thread_data *mtdp);
 
+/* should fit in a byte (see plthook_data->special_flags) */
 enum plthook_special_action {
 	PLT_FL_SKIP		= 1U << 0,
 	PLT_FL_LONGJMP		= 1U << 1,
@@ -289,11 +305,6 @@ enum plthook_special_action {
 	PLT_FL_DLSYM		= 1U << 7,
 };
 
-struct plthook_special_func {
-	unsigned idx;
-	unsigned flags;  /* enum plthook_special_action */
-};
-
 struct plthook_skip_symbol {
 	const char *name;
 	void       *addr;
@@ -316,9 +327,8 @@ struct plthook_data {
 	unsigned long			*pltgot_ptr;
 	/* original address of each function (resolved by dynamic linker) */
 	unsigned long			*resolved_addr;
-	/* array of function that needs special care (see above) */
-	struct plthook_special_func	*special_funcs;
-	int				nr_special;
+	/* special action flags of each function, indexed by dynsym (see above) */
+	uint8_t				*special_flags;
 	/* architecture-specific info */
 	void				*arch;
 };
@@ -326,6 +336,7 @@ struct plthook_data {
 unsigned long setup_pltgot(struct plthook_data *pd, int got_idx, int sym_idx,
 			   void *data);
 extern void mcount_setup_plthook(char *exename, bool nest_libcall);
+extern void mcount_restore_plthook(void);
 
 extern void setup_dynsym_indexes(struct plthook_data *pd);
 extern void destroy_dynsym_indexes(void);
@@ -336,6 +347,20 @@ extern unsigned long plthook_resolver_addr;
 extern const struct plthook_skip_symbol plt_skip_syms[];
 extern size_t plt_skip_nr;
 
+extern void mcount_setup_attach(void);
+extern void mcount_finish_attach(void);
+extern void mcount_update_got(unsigned long *addr, unsigned long val);
+
+extern void mcount_agent_init(enum uftrace_pattern_type ptype);
+extern void mcount_agent_finish(void);
+
+/* called by the agent to change tracing at runtime */
+extern void mcount_update_trace(bool enable);
+extern void mcount_update_depth(int depth);
+extern void mcount_update_threshold(uint64_t threshold);
+extern void mcount_update_filter(char *filter, bool replace);
+extern int mcount_update_patch(char *patch, enum uftrace_pattern_type ptype);
+
 struct uftrace_trigger;
 struct uftrace_arg_spec;
 struct mcount_regs;
@@ -436,6 +461,7 @@ int mcount_dynamic_update(struct symtabs *symtabs, char *patch_funcs,
 void mcount_dynamic_dlopen(struct symtabs *symtabs, struct dl_phdr_info *info,
 			   char *path);
 void mcount_dynamic_finish(void);
+void mcount_dynamic_unpatch(struct symtabs *symtabs);
 
 struct mcount_orig_insn {
 	struct rb_node		node;
@@ -490,6 +516,7 @@ void mcount_cleanup_trampoline(struct mcount_dynamic_info *mdi);
 
 int mcount_patch_func(struct mcount_dynamic_info *mdi, struct sym *sym,
 		      struct mcount_disasm_engine *disasm, unsigned min_size);
+int mcount_revert_func(struct mcount_dynamic_info *mdi, struct sym *sym);
 
 void mcount_disasm_init(struct mcount_disasm_engine *disasm);
 void mcount_disasm_finish(struct mcount_disasm_engine *disasm);
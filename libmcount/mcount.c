@@ -35,12 +35,18 @@ uint64_t mcount_threshold;
 
 /* symbol table of main executable */
 struct symtabs symtabs = {
-	.flags = SYMTAB_FL_DEMANGLE | SYMTAB_FL_ADJ_OFFSET,
+	.flags = SYMTAB_FL_ADJ_OFFSET,
 };
 
 /* size of shmem buffer to save uftrace_record */
 int shmem_bufsize = SHMEM_BUFFER_SIZE;
 
+/* number of shmem buffers in a ring for flight recorder (0 if not used) */
+int mcount_flight_bufs;
+
+/* request a snapshot if a function runs longer than this (nsec) */
+uint64_t mcount_flight_threshold;
+
 /* recover return address of parent automatically */
 bool mcount_auto_recover = ARCH_SUPPORT_AUTO_RECOVER;
 
@@ -126,6 +132,28 @@ static void mcount_finish_trigger(void)
 	mcount_global_flags |= MCOUNT_GFL_FINISH;
 }
 
+/* minimum interval between snapshot requests (nsec) */
+#define FLIGHT_SNAPSHOT_INTERVAL  (100 * NSEC_PER_MSEC)
+
+/* ask uftrace record to save the flight recorder buffers */
+void mcount_flight_snapshot(void)
+{
+	static uint64_t last_snapshot;
+	uint64_t now;
+
+	if (!mcount_flight_bufs)
+		return;
+
+	/* don't flood the pipe if it's triggered repeatedly */
+	now = mcount_gettime();
+	if (last_snapshot && now - last_snapshot < FLIGHT_SNAPSHOT_INTERVAL)
+		return;
+	last_snapshot = now;
+
+	pr_dbg("request a snapshot of flight recorder\n");
+	uftrace_send_message(UFTRACE_MSG_SNAPSHOT, &now, sizeof(now));
+}
+
 static LIST_HEAD(siglist);
 
 struct signal_trigger_item {
@@ -175,8 +203,13 @@ static void mcount_signal_trigger(int sig)
 		mcount_enabled = true;
 	}
 	if (tr->flags & TRIGGER_FL_TRACE_OFF) {
+		if (mcount_enabled)
+			mcount_flight_snapshot();
 		mcount_enabled = false;
 	}
+	if (tr->flags & TRIGGER_FL_SNAPSHOT) {
+		mcount_flight_snapshot();
+	}
 	if (tr->flags & TRIGGER_FL_FINISH) {
 		mcount_finish_trigger();
 	}
@@ -370,6 +403,51 @@ static void mcount_signal_finish(void)
 	}
 }
 
+/* options to build the trigger tree, kept for updates from the agent */
+static struct mcount_filter_opts {
+	char *filter;
+	char *trigger;
+	char *argument;
+	char *retval;
+	char *caller;
+	bool auto_args;
+	struct uftrace_filter_setting setting;
+} filter_opts;
+
+/* incremented when the agent changes depth or time filter */
+static unsigned __maybe_unused mcount_filter_gen;
+
+static void mcount_build_triggers(struct mcount_filter_opts *fopts,
+				  struct rb_root *root, enum filter_mode *mode)
+{
+	struct uftrace_filter_setting *setting = &fopts->setting;
+
+	setting->auto_args = false;
+
+	uftrace_setup_filter(fopts->filter, &symtabs, root, mode, setting);
+	uftrace_setup_trigger(fopts->trigger, &symtabs, root, mode, setting);
+	uftrace_setup_argument(fopts->argument, &symtabs, root, setting);
+	uftrace_setup_retval(fopts->retval, &symtabs, root, setting);
+
+	if (fopts->caller) {
+		uftrace_setup_caller_filter(fopts->caller, &symtabs,
+					    root, setting);
+	}
+
+	if (fopts->auto_args) {
+		char *autoarg = ".";
+		char *autoret = ".";
+
+		if (setting->ptype == PATT_GLOB)
+			autoarg = autoret = "*";
+
+		setting->auto_args = true;
+
+		uftrace_setup_argument(autoarg, &symtabs, root, setting);
+		uftrace_setup_retval(autoret, &symtabs, root, setting);
+	}
+}
+
 static void mcount_filter_init(enum uftrace_pattern_type ptype, char *dirname,
 			       bool force)
 {
@@ -411,39 +489,21 @@ static void mcount_filter_init(enum uftrace_pattern_type ptype, char *dirname,
 		save_debug_info(&symtabs, dirname);
 	}
 
-	uftrace_setup_filter(filter_str, &symtabs, &mcount_triggers,
-			     &mcount_filter_mode, &filter_setting);
-	uftrace_setup_trigger(trigger_str, &symtabs, &mcount_triggers,
-			      &mcount_filter_mode, &filter_setting);
-	uftrace_setup_argument(argument_str, &symtabs, &mcount_triggers,
-			       &filter_setting);
-	uftrace_setup_retval(retval_str, &symtabs, &mcount_triggers,
-			     &filter_setting);
+	filter_opts.filter    = filter_str ? xstrdup(filter_str) : NULL;
+	filter_opts.trigger   = trigger_str;
+	filter_opts.argument  = argument_str;
+	filter_opts.retval    = retval_str;
+	filter_opts.caller    = caller_str;
+	filter_opts.auto_args = !!autoargs_str;
+	filter_opts.setting   = filter_setting;
 
-	if (caller_str) {
-		uftrace_setup_caller_filter(caller_str, &symtabs,
-					    &mcount_triggers, &filter_setting);
-	}
+	mcount_build_triggers(&filter_opts, &mcount_triggers,
+			      &mcount_filter_mode);
 
 	/* there might be caller triggers, count it separately */
 	if (uftrace_count_filter(&mcount_triggers, TRIGGER_FL_CALLER) != 0)
 		mcount_has_caller = true;
 
-	if (autoargs_str) {
-		char *autoarg = ".";
-		char *autoret = ".";
-
-		if (ptype == PATT_GLOB)
-			autoarg = autoret = "*";
-
-		filter_setting.auto_args = true;
-
-		uftrace_setup_argument(autoarg, &symtabs,
-				       &mcount_triggers, &filter_setting);
-		uftrace_setup_retval(autoret, &symtabs,
-				     &mcount_triggers, &filter_setting);
-	}
-
 	if (getenv("UFTRACE_DEPTH"))
 		mcount_depth = strtol(getenv("UFTRACE_DEPTH"), NULL, 0);
 
@@ -455,6 +515,7 @@ static void mcount_filter_setup(struct mcount_thread_data *mtdp)
 {
 	mtdp->filter.depth  = mcount_depth;
 	mtdp->filter.time   = mcount_threshold;
+	mtdp->filter.gen    = mcount_filter_gen;
 	mtdp->enable_cached = mcount_enabled;
 	mtdp->argbuf        = xmalloc(mcount_rstack_max * ARGBUF_SIZE);
 	INIT_LIST_HEAD(&mtdp->pmu_fds);
@@ -472,11 +533,68 @@ static void mcount_filter_finish(void)
 	uftrace_cleanup_filter(&mcount_triggers);
 	finish_auto_args();
 
+	free(filter_opts.filter);
+	filter_opts.filter = NULL;
+
 	finish_debug_info(&symtabs);
 
 	mcount_signal_finish();
 }
 
+void mcount_update_trace(bool enable)
+{
+	if (!enable && mcount_enabled)
+		mcount_flight_snapshot();
+
+	mcount_enabled = enable;
+}
+
+/* existing threads will apply it at the next function entry */
+void mcount_update_depth(int depth)
+{
+	mcount_depth = depth;
+	mcount_filter_gen++;
+}
+
+void mcount_update_threshold(uint64_t threshold)
+{
+	mcount_threshold = threshold;
+	mcount_filter_gen++;
+}
+
+/**
+ * mcount_update_filter - change function filters at runtime
+ * @filter: filter string (separated by ';') to add
+ * @replace: whether it removes the existing filters
+ *
+ * This builds a new trigger tree with the other triggers and replaces
+ * the current one.  The old tree is not released since other threads
+ * might be looking at it (and retval specs in their return stacks).
+ */
+void mcount_update_filter(char *filter, bool replace)
+{
+	struct rb_root root = RB_ROOT;
+	enum filter_mode mode = FILTER_MODE_NONE;
+
+	if (replace) {
+		free(filter_opts.filter);
+		filter_opts.filter = NULL;
+	}
+	if (filter && *filter)
+		filter_opts.filter = strjoin(filter_opts.filter, filter, ";");
+
+	pr_dbg("update filter: %s\n", filter_opts.filter ?: "(none)");
+
+	mcount_build_triggers(&filter_opts, &root, &mode);
+
+	mcount_has_caller = uftrace_count_filter(&root, TRIGGER_FL_CALLER) != 0;
+	mcount_filter_mode = mode;
+
+	/* readers don't take a lock, make sure they see a complete tree */
+	__atomic_store_n(&mcount_triggers.rb_node, root.rb_node,
+			 __ATOMIC_RELEASE);
+}
+
 static void mcount_watch_init(void)
 {
 	char *watch_str   = getenv("UFTRACE_WATCH");
@@ -848,6 +966,16 @@ static void mcount_save_filter(struct mcount_thread_data *mtdp)
 	mtdp->filter.saved_time  = mtdp->filter.time;
 }
 
+/* apply new depth and time filter set by the agent */
+static void mcount_refresh_filter(struct mcount_thread_data *mtdp)
+{
+	int depth = mcount_depth - mtdp->record_idx;
+
+	mtdp->filter.depth = depth > 0 ? depth : 0;
+	mtdp->filter.time  = mcount_threshold;
+	mtdp->filter.gen   = mcount_filter_gen;
+}
+
 /* update filter state from trigger result */
 enum filter_result mcount_entry_filter_check(struct mcount_thread_data *mtdp,
 					     unsigned long child,
@@ -858,6 +986,9 @@ enum filter_result mcount_entry_filter_check(struct mcount_thread_data *mtdp,
 	if (mcount_check_rstack(mtdp))
 		return FILTER_RSTACK;
 
+	if (unlikely(mtdp->filter.gen != mcount_filter_gen))
+		mcount_refresh_filter(mtdp);
+
 	mcount_save_filter(mtdp);
 
 	/* already filtered by notrace option */
@@ -887,7 +1018,8 @@ enum filter_result mcount_entry_filter_check(struct mcount_thread_data *mtdp,
 	}
 
 #define FLAGS_TO_CHECK  (TRIGGER_FL_DEPTH | TRIGGER_FL_TRACE_ON |	\
-			 TRIGGER_FL_TRACE_OFF | TRIGGER_FL_TIME_FILTER)
+			 TRIGGER_FL_TRACE_OFF | TRIGGER_FL_TIME_FILTER |	\
+			 TRIGGER_FL_SNAPSHOT)
 
 	if (tr->flags & FLAGS_TO_CHECK) {
 		if (tr->flags & TRIGGER_FL_DEPTH)
@@ -899,6 +1031,9 @@ enum filter_result mcount_entry_filter_check(struct mcount_thread_data *mtdp,
 		if (tr->flags & TRIGGER_FL_TRACE_OFF)
 			mcount_enabled = false;
 
+		if (tr->flags & TRIGGER_FL_SNAPSHOT)
+			mcount_flight_snapshot();
+
 		if (tr->flags & TRIGGER_FL_TIME_FILTER)
 			mtdp->filter.time = tr->time;
 	}
@@ -915,10 +1050,10 @@ enum filter_result mcount_entry_filter_check(struct mcount_thread_data *mtdp,
 static int script_save_context(struct script_context *sc_ctx,
 			       struct mcount_thread_data *mtdp,
 			       struct mcount_ret_stack *rstack,
-			       char *symname, bool has_arg_retval,
-			       struct list_head *pargs)
+			       struct sym *sym, char *symname,
+			       bool has_arg_retval, struct list_head *pargs)
 {
-	if (!script_match_filter(symname))
+	if (!script_match_filter(sym, symname))
 		return -1;
 
 	sc_ctx->tid       = mcount_gettid(mtdp);
@@ -953,7 +1088,7 @@ static void script_hook_entry(struct mcount_thread_data *mtdp,
 	struct sym *sym = find_symtabs(&symtabs, entry_addr);
 	char *symname = symbol_getname(sym, entry_addr);
 
-	if (script_save_context(&sc_ctx, mtdp, rstack, symname,
+	if (script_save_context(&sc_ctx, mtdp, rstack, sym, symname,
 				tr->flags & TRIGGER_FL_ARGUMENT,
 				tr->pargs) < 0)
 		goto skip;
@@ -975,7 +1110,7 @@ static void script_hook_exit(struct mcount_thread_data *mtdp,
 	struct sym *sym = find_symtabs(&symtabs, entry_addr);
 	char *symname = symbol_getname(sym, entry_addr);
 
-	if (script_save_context(&sc_ctx, mtdp, rstack, symname,
+	if (script_save_context(&sc_ctx, mtdp, rstack, sym, symname,
 				rstack->flags & MCOUNT_FL_RETVAL,
 				rstack->pargs) < 0)
 		goto skip;
@@ -1088,8 +1223,15 @@ void mcount_entry_filter_record(struct mcount_thread_data *mtdp,
 				*rstack->parent_loc = mcount_return_fn;
 				rstack->flags |= MCOUNT_FL_RECOVER;
 			}
-			if (tr->flags & (TRIGGER_FL_TRACE_ON | TRIGGER_FL_TRACE_OFF))
+			if (tr->flags & (TRIGGER_FL_TRACE_ON | TRIGGER_FL_TRACE_OFF)) {
+				/*
+				 * save the trace so far in flight recorder mode,
+				 * it's after flushing the rstack above.
+				 */
+				if (mtdp->enable_cached && !mcount_enabled)
+					mcount_flight_snapshot();
 				mtdp->enable_cached = mcount_enabled;
+			}
 		}
 	}
 
@@ -1172,6 +1314,10 @@ void mcount_exit_filter_record(struct mcount_thread_data *mtdp,
 				mtdp->nr_events = k;  /* invalidate sync events */
 		}
 
+		if (unlikely(mcount_flight_threshold) &&
+		    rstack->end_time - rstack->start_time > mcount_flight_threshold)
+			mcount_flight_snapshot();
+
 		/* script hooking for function exit */
 		if (SCRIPT_ENABLED && script_str)
 			script_hook_exit(mtdp, rstack);
@@ -1863,6 +2009,12 @@ static __used void mcount_startup(void)
 	if (bufsize_str)
 		shmem_bufsize = strtol(bufsize_str, NULL, 0);
 
+	if (getenv("UFTRACE_FLIGHT"))
+		mcount_flight_bufs = strtol(getenv("UFTRACE_FLIGHT"), NULL, 0);
+	if (getenv("UFTRACE_FLIGHT_THRESHOLD"))
+		mcount_flight_threshold = strtoull(getenv("UFTRACE_FLIGHT_THRESHOLD"),
+						   NULL, 0);
+
 	mcount_exename = read_exename();
 	symtabs.dirname = dirname;
 	symtabs.filename = mcount_exename;
@@ -1898,6 +2050,10 @@ static __used void mcount_startup(void)
 	if (getenv("UFTRACE_ESTIMATE_RETURN"))
 		mcount_estimate_return = true;
 
+	/* it should be done before PLT hook to save the original GOT */
+	if (getenv("UFTRACE_ATTACH"))
+		mcount_setup_attach();
+
 	if (plthook_str) {
 		/* PLT hook depends on mcount_estimate_return */
 		mcount_setup_plthook(mcount_exename, nest_libcall);
@@ -1911,6 +2067,9 @@ static __used void mcount_startup(void)
 	if (SCRIPT_ENABLED && script_str)
 		mcount_script_init(patt_type);
 
+	if (getenv("UFTRACE_AGENT"))
+		mcount_agent_init(patt_type);
+
 	compiler_barrier();
 	pr_dbg("mcount setup done\n");
 
@@ -1920,6 +2079,7 @@ static __used void mcount_startup(void)
 
 static void mcount_cleanup(void)
 {
+	mcount_agent_finish();
 	mcount_finish();
 	destroy_dynsym_indexes();
 	mcount_dynamic_finish();
@@ -1981,6 +2141,30 @@ void __visible_default mcount_reset(void)
 	mcount_rstack_reset(mtdp);
 }
 
+/* called by uftrace record -p to stop tracing a running process */
+void __visible_default mcount_detach(void)
+{
+	pr_dbg("detach from the process\n");
+
+	mcount_agent_finish();
+	mcount_restore_plthook();
+	mcount_finish_attach();
+	mcount_dynamic_unpatch(&symtabs);
+
+	/* other threads will finish on their next (function) exit */
+	mcount_global_flags |= MCOUNT_GFL_FINISH;
+	mcount_trace_finish(true);
+}
+
+/* called by the agent to update dynamic patching at runtime */
+int mcount_update_patch(char *patch, enum uftrace_pattern_type ptype)
+{
+	/* newly patched functions might not save registers for the call */
+	mcount_return_fn = (unsigned long)dynamic_return;
+
+	return mcount_dynamic_update(&symtabs, patch, ptype);
+}
+
 void __visible_default __cyg_profile_func_enter(void *child, void *parent)
 {
 	cygprof_entry((unsigned long)parent, (unsigned long)child);
@@ -78,7 +78,8 @@ enum shmem_buffer_flags {
 struct mcount_shmem_buffer {
 	unsigned size;
 	unsigned flag;
-	unsigned unused[2];
+	unsigned seqnum;	/* for flight recorder */
+	unsigned unused;
 	char data[];
 };
 
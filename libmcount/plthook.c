@@ -34,6 +34,10 @@ unsigned long plthook_resolver_addr;	/* referenced by arch/.../plthook.S */
 /* list of plthook_data for each library (module) */
 static LIST_HEAD(plthook_modules);
 
+/* hash table to find plthook_data by module id (open addressing) */
+static struct plthook_data **plthook_table;
+static unsigned plthook_table_bits;
+
 /* check getenv("LD_BIND_NOT") */
 static bool plthook_no_pltbind;
 
@@ -72,12 +76,7 @@ static void resolve_pltgot(struct plthook_data *pd, int idx)
 				addr = (unsigned long)real_addr;
 		}
 
-		if (dbg_domain[DBG_PLTHOOK] >= 2) {
-			char *symname = demangle(sym->name);
-
-			pr_dbg2("resolved addr of %s = %#lx\n", symname, addr);
-			free(symname);
-		}
+		pr_dbg2("resolved addr of %s = %#lx\n", symbol_name(sym), addr);
 		pd->resolved_addr[idx] = addr;
 	}
 }
@@ -150,8 +149,6 @@ static void restore_plt_functions(struct plthook_data *pd)
 		resolved_addr = pd->pltgot_ptr[got_idx];
 		plthook_addr = mcount_arch_plthook_addr(pd, i);
 		if (resolved_addr != plthook_addr) {
-			char *symname;
-
 			/* save already resolved address and hook it */
 			pd->resolved_addr[i] = resolved_addr;
 			overwrite_pltgot(pd, got_idx, (void *)plthook_addr);
@@ -159,11 +156,9 @@ static void restore_plt_functions(struct plthook_data *pd)
 			if (dbg_domain[DBG_PLTHOOK] < 2)
 				continue;
 
-			symname = demangle(sym->name);
 			pr_dbg2("restore GOT[%d] from \"%s\"(%#lx) to PLT(base + %#lx)\n",
-				got_idx, symname, resolved_addr,
+				got_idx, symbol_name(sym), resolved_addr,
 				plthook_addr - pd->base_addr);
-			free(symname);
 		}
 		else if (mcount_estimate_return) {
 			/* we can't resolve PLT functions at return. do it now */
@@ -255,8 +250,7 @@ static int find_got(struct uftrace_elf_data *elf,
 	load_elf_dynsymtab(&pd->dsymtab, elf, pd->base_addr, 0);
 
 	pd->resolved_addr = xcalloc(pd->dsymtab.nr_sym, sizeof(long));
-	pd->special_funcs = NULL;
-	pd->nr_special    = 0;
+	pd->special_flags = NULL;
 
 	mcount_arch_plthook_setup(pd, elf);
 	list_add_tail(&pd->list, &plthook_modules);
@@ -388,29 +382,6 @@ static const char *resolve_syms[] = {
 	"fexecve", "posix_spawn", "posix_spawnp", "pthread_exit",
 };
 
-static void add_special_func(struct plthook_data *pd, unsigned idx, unsigned flags)
-{
-	int i;
-	struct plthook_special_func *func;
-
-	for (i = 0; i < pd->nr_special; i++) {
-		func = &pd->special_funcs[i];
-
-		if (func->idx == idx) {
-			func->flags |= flags;
-			return;
-		}
-	}
-
-	pd->special_funcs = xrealloc(pd->special_funcs,
-				     (pd->nr_special + 1) * sizeof(*func));
-
-	func = &pd->special_funcs[pd->nr_special++];
-
-	func->idx     = idx;
-	func->flags   = flags;
-}
-
 static void build_special_funcs(struct plthook_data *pd, const char *syms[],
 				unsigned nr_sym, unsigned flag)
 {
@@ -419,35 +390,18 @@ static void build_special_funcs(struct plthook_data *pd, const char *syms[],
 
 	build_dynsym_idxlist(&pd->dsymtab, &idxlist, syms, nr_sym);
 	for (i = 0; i < idxlist.count; i++)
-		add_special_func(pd, idxlist.idx[i], flag);
+		pd->special_flags[idxlist.idx[i]] |= flag;
 	destroy_dynsym_idxlist(&idxlist);
 }
 
-static int idxsort(const void *a, const void *b)
-{
-	const struct plthook_special_func *func_a = a;
-	const struct plthook_special_func *func_b = b;
-
-	if (func_a->idx > func_b->idx)
-		return 1;
-	if (func_a->idx < func_b->idx)
-		return -1;
-	return 0;
-}
-
-static int idxfind(const void *a, const void *b)
+void setup_dynsym_indexes(struct plthook_data *pd)
 {
-	unsigned idx = (unsigned long) a;
-	const struct plthook_special_func *func = b;
-
-	if (func->idx == idx)
-		return 0;
+	if (pd->dsymtab.nr_sym == 0)
+		return;
 
-	return (idx > func->idx) ? 1 : -1;
-}
+	pd->special_flags = xcalloc(pd->dsymtab.nr_sym,
+				    sizeof(*pd->special_flags));
 
-void setup_dynsym_indexes(struct plthook_data *pd)
-{
 	build_special_funcs(pd, skip_syms, ARRAY_SIZE(skip_syms),
 			    PLT_FL_SKIP);
 	build_special_funcs(pd, longjmp_syms, ARRAY_SIZE(longjmp_syms),
@@ -464,9 +418,6 @@ void setup_dynsym_indexes(struct plthook_data *pd)
 			    PLT_FL_EXCEPT);
 	build_special_funcs(pd, resolve_syms, ARRAY_SIZE(resolve_syms),
 			    PLT_FL_RESOLVE);
-
-	/* built all table, now sorting */
-	qsort(pd->special_funcs, pd->nr_special, sizeof(*pd->special_funcs), idxsort);
 }
 
 void destroy_dynsym_indexes(void)
@@ -476,10 +427,72 @@ void destroy_dynsym_indexes(void)
 	pr_dbg2("destroy plthook special function index\n");
 
 	list_for_each_entry(pd, &plthook_modules, list) {
-		free(pd->special_funcs);
-		pd->special_funcs = NULL;
-		pd->nr_special = 0;
+		free(pd->special_flags);
+		pd->special_flags = NULL;
+	}
+}
+
+static unsigned hash_module_id(unsigned long module_id)
+{
+	/* module id is usually a pointer, mix the bits */
+	return ((uint64_t)module_id * 0x9E3779B97F4A7C15ULL) >>
+		(64 - plthook_table_bits);
+}
+
+static void build_plthook_table(void)
+{
+	struct plthook_data *pd;
+	unsigned nr_modules = 0;
+	unsigned mask;
+	unsigned idx;
+
+	list_for_each_entry(pd, &plthook_modules, list)
+		nr_modules++;
+
+	if (nr_modules == 0)
+		return;
+
+	/* keep the load factor under 50% */
+	plthook_table_bits = 1;
+	while ((1U << plthook_table_bits) < nr_modules * 2)
+		plthook_table_bits++;
+
+	plthook_table = xcalloc(1U << plthook_table_bits, sizeof(*plthook_table));
+	mask = (1U << plthook_table_bits) - 1;
+
+	list_for_each_entry(pd, &plthook_modules, list) {
+		idx = hash_module_id(pd->module_id);
+		while (plthook_table[idx])
+			idx = (idx + 1) & mask;
+
+		plthook_table[idx] = pd;
 	}
+
+	pr_dbg2("plthook table has %u entries for %u modules\n",
+		1U << plthook_table_bits, nr_modules);
+}
+
+static struct plthook_data * find_plthook_data(unsigned long module_id)
+{
+	struct plthook_data *pd;
+	unsigned mask = (1U << plthook_table_bits) - 1;
+	unsigned idx;
+
+	if (unlikely(plthook_table == NULL)) {
+		list_for_each_entry(pd, &plthook_modules, list) {
+			if (module_id == pd->module_id)
+				return pd;
+		}
+		return NULL;
+	}
+
+	idx = hash_module_id(module_id);
+	while ((pd = plthook_table[idx]) != NULL) {
+		if (likely(pd->module_id == module_id))
+			return pd;
+		idx = (idx + 1) & mask;
+	}
+	return NULL;
 }
 
 static int setup_mod_plthook_data(struct dl_phdr_info *info, size_t sz, void *arg)
@@ -555,6 +568,29 @@ void mcount_setup_plthook(char *exename, bool nest_libcall)
 
 	list_for_each_entry(pd, &plthook_modules, list)
 		setup_dynsym_indexes(pd);
+
+	build_plthook_table();
+}
+
+/* restore the original GOT entries when detaching from a running process */
+void mcount_restore_plthook(void)
+{
+	struct plthook_data *pd;
+	unsigned i;
+
+	pr_dbg("restore PLT hooking\n");
+
+	list_for_each_entry(pd, &plthook_modules, list) {
+		mcount_update_got(&pd->pltgot_ptr[2], plthook_resolver_addr);
+
+		for (i = 0; i < pd->dsymtab.nr_sym; i++) {
+			if (pd->resolved_addr[i] == 0)
+				continue;
+
+			mcount_update_got(&pd->pltgot_ptr[3 + i],
+					  pd->resolved_addr[i]);
+		}
+	}
 }
 
 struct mcount_jmpbuf_rstack {
@@ -757,7 +793,6 @@ static unsigned long __plthook_entry(unsigned long *ret_addr,
 	bool recursion = true;
 	enum filter_result filtered;
 	struct plthook_data *pd;
-	struct plthook_special_func *func;
 	unsigned long special_flag = 0;
 	unsigned long real_addr = 0;
 	struct uftrace_trigger tr;
@@ -766,14 +801,10 @@ static unsigned long __plthook_entry(unsigned long *ret_addr,
 
 	// if necessary, implement it by architecture.
 	child_idx = mcount_arch_child_idx(child_idx);
-	list_for_each_entry(pd, &plthook_modules, list) {
-		if (module_id == pd->module_id)
-			break;
-	}
 
-	if (list_no_entry(pd, &plthook_modules, list)) {
+	pd = find_plthook_data(module_id);
+	if (unlikely(pd == NULL)) {
 		pr_dbg("cannot find pd for module id: %lx\n", module_id);
-		pd = NULL;
 		goto out;
 	}
 
@@ -790,10 +821,8 @@ static unsigned long __plthook_entry(unsigned long *ret_addr,
 
 	recursion = false;
 
-	func = bsearch((void *)child_idx, pd->special_funcs, pd->nr_special,
-		       sizeof(*func), idxfind);
-	if (func)
-		special_flag |= func->flags;
+	if (likely(child_idx < pd->dsymtab.nr_sym && pd->special_flags))
+		special_flag = pd->special_flags[child_idx];
 
 	if (unlikely(special_flag & PLT_FL_SKIP))
 		goto out;
@@ -801,13 +830,8 @@ static unsigned long __plthook_entry(unsigned long *ret_addr,
 	if (likely(child_idx < pd->dsymtab.nr_sym)) {
 		sym = &pd->dsymtab.sym[child_idx];
 
-		if (dbg_domain[DBG_PLTHOOK] >= 3) {
-			char *symname = demangle(sym->name);
-
-			pr_dbg3("[idx: %4d] enter %"PRIx64": %s@plt (mod: %lx)\n",
-				(int)child_idx, sym->addr, symname, module_id);
-			free(symname);
-		}
+		pr_dbg3("[idx: %4d] enter %"PRIx64": %s@plt (mod: %lx)\n",
+			(int)child_idx, sym->addr, symbol_name(sym), module_id);
 	}
 	else {
 		pr_dbg("invalid function idx found! (idx: %lu/%zu, module: %s)\n",
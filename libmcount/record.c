@@ -8,6 +8,7 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/resource.h>
+#include <sys/uio.h>
 
 /* This should be defined before #include "utils.h" */
 #define PR_FMT     "mcount"
@@ -71,25 +72,55 @@ void prepare_shmem_buffer(struct mcount_thread_data *mtdp)
 
 	pr_dbg2("preparing shmem buffers: tid = %d\n", tid);
 
-	shmem->nr_buf = 2;
-	shmem->max_buf = 2;
-	shmem->buffer = xcalloc(sizeof(*shmem->buffer), 2);
+	/* flight recorder uses a fixed ring of buffers */
+	shmem->nr_buf = mcount_flight_bufs ?: 2;
+	shmem->max_buf = shmem->nr_buf;
+	shmem->buffer = xcalloc(sizeof(*shmem->buffer), shmem->nr_buf);
 
 	for (idx = 0; idx < shmem->nr_buf; idx++) {
 		shmem->buffer[idx] = allocate_shmem_buffer(buf, sizeof(buf),
 							   tid, idx);
 		if (shmem->buffer[idx] == NULL)
 			pr_err("mmap shmem buffer");
+
+		/* let uftrace record know every buffer in the ring */
+		if (mcount_flight_bufs)
+			uftrace_send_message(UFTRACE_MSG_REC_START, buf, strlen(buf));
 	}
 
-	/* set idx 0 as current buffer */
-	snprintf(buf, sizeof(buf), SHMEM_SESSION_FMT,
-		 mcount_session_name(), tid, 0);
-	uftrace_send_message(UFTRACE_MSG_REC_START, buf, strlen(buf));
+	if (!mcount_flight_bufs) {
+		/* set idx 0 as current buffer */
+		snprintf(buf, sizeof(buf), SHMEM_SESSION_FMT,
+			 mcount_session_name(), tid, 0);
+		uftrace_send_message(UFTRACE_MSG_REC_START, buf, strlen(buf));
+	}
 
 	shmem->done = false;
 	shmem->curr = 0;
 	shmem->buffer[0]->flag = SHMEM_FL_RECORDING | SHMEM_FL_NEW;
+	shmem->buffer[0]->seqnum = ++shmem->seqnum;
+}
+
+/*
+ * Move to the next buffer in the ring, overwriting the oldest data.
+ * The seqnum is cleared during the reset so that uftrace record can
+ * detect the buffer was reused while it's copying the buffer.
+ */
+static void get_next_flight_buffer(struct mcount_thread_data *mtdp)
+{
+	struct mcount_shmem *shmem = &mtdp->shmem;
+	struct mcount_shmem_buffer *curr_buf;
+	int idx = (shmem->curr + 1) % shmem->nr_buf;
+
+	curr_buf = shmem->buffer[idx];
+
+	curr_buf->seqnum = 0;
+	__sync_synchronize();
+	curr_buf->size = 0;
+	__sync_synchronize();
+	curr_buf->seqnum = ++shmem->seqnum;
+
+	shmem->curr = idx;
 }
 
 static void get_new_shmem_buffer(struct mcount_thread_data *mtdp)
@@ -100,6 +131,11 @@ static void get_new_shmem_buffer(struct mcount_thread_data *mtdp)
 	struct mcount_shmem_buffer **new_buffer;
 	int idx;
 
+	if (mcount_flight_bufs) {
+		get_next_flight_buffer(mtdp);
+		return;
+	}
+
 	/* always use first buffer available */
 	for (idx = 0; idx < shmem->nr_buf; idx++) {
 		curr_buf = shmem->buffer[idx];
@@ -137,9 +173,9 @@ reuse:
 	 */
 	__sync_fetch_and_or(&curr_buf->flag, SHMEM_FL_RECORDING);
 
-	shmem->seqnum++;
 	shmem->curr = idx;
 	curr_buf->size = 0;
+	curr_buf->seqnum = ++shmem->seqnum;
 
 	/* shrink unused buffers */
 	if (idx + 3 <= shmem->nr_buf) {
@@ -187,6 +223,10 @@ static void finish_shmem_buffer(struct mcount_thread_data *mtdp, int idx)
 {
 	char buf[64];
 
+	/* uftrace record doesn't read the buffer until a snapshot */
+	if (mcount_flight_bufs)
+		return;
+
 	snprintf(buf, sizeof(buf), SHMEM_SESSION_FMT,
 		 mcount_session_name(), mcount_gettid(mtdp), idx);
 
@@ -256,6 +296,12 @@ void *get_argbuf(struct mcount_thread_data *mtdp,
 #define   HEAP_REGION_UNIT  128*MB
 #define  STACK_REGION_UNIT    8*MB
 
+/* process_vm_readv() is not usable, read the maps on every miss */
+static bool mem_probe_disabled;
+
+/* size of a page to probe (and to cache the result) */
+static unsigned long mem_page_size;
+
 struct mem_region {
 	struct rb_node		node;
 	unsigned long		start;
@@ -360,10 +406,81 @@ static bool find_mem_region(struct rb_root *root, unsigned long addr)
 			p = &parent->rb_right;
 	}
 
-	pr_dbg2("cannot find mem region: %lx\n", addr);
 	return false;
 }
 
+/*
+ * Check if a page is readable by copying a byte from it.  Unlike
+ * reading the address directly, it just fails with EFAULT.
+ * It returns 1 if readable, 0 if not and -1 if it cannot tell.
+ */
+static int probe_mem_page(unsigned long addr)
+{
+	char byte;
+	struct iovec local = {
+		.iov_base = &byte,
+		.iov_len  = 1,
+	};
+	struct iovec remote = {
+		.iov_base = (void *)addr,
+		.iov_len  = 1,
+	};
+	int saved_errno = errno;
+	int ret = 1;
+
+	if (process_vm_readv(getpid(), &local, 1, &remote, 1, 0) != 1)
+		ret = (errno == EFAULT) ? 0 : -1;
+
+	errno = saved_errno;
+	return ret;
+}
+
+static bool check_mem_page(struct mcount_mem_regions *regions,
+			   unsigned long addr)
+{
+	unsigned long page;
+	unsigned i;
+	int ret;
+
+	if (unlikely(mem_page_size == 0))
+		mem_page_size = getpagesize();
+
+	page = addr & ~(mem_page_size - 1);
+	if (page == 0)
+		return false;
+
+	for (i = 0; i < regions->nr_pages; i++) {
+		if (regions->pages[i] == page)
+			return true;
+	}
+
+	ret = probe_mem_page(page);
+	if (ret < 0) {
+		pr_dbg("cannot probe memory, fallback to read maps\n");
+		mem_probe_disabled = true;
+		return false;
+	}
+
+	if (ret == 0)
+		return false;
+
+	if (regions->nr_pages < MEM_REGION_CACHE)
+		regions->pages[regions->nr_pages++] = page;
+	return true;
+}
+
+/**
+ * check_mem_region - check if the address is accessible
+ * @ctx: argument context
+ * @addr: address to check
+ *
+ * This function returns true if @addr is in one of the known memory
+ * regions.  The regions are read from /proc/self/maps at the first
+ * miss only.  Later misses (for the newly mapped area, likely) probe
+ * the page with a syscall so that it doesn't need to parse the maps
+ * file in the entry path.  The result is kept only while saving the
+ * arguments of the current call since the page can be unmapped later.
+ */
 bool check_mem_region(struct mcount_arg_context *ctx,
 		      unsigned long addr)
 {
@@ -377,6 +494,13 @@ retry:
 	if (find_mem_region(&regions->root, addr))
 		return true;
 
+	if (!RB_EMPTY_ROOT(&regions->root) && !mem_probe_disabled) {
+		if (check_mem_page(regions, addr))
+			return true;
+		if (!mem_probe_disabled)
+			goto out;
+	}
+
 	if (update) {
 		mcount_save_arch_context(ctx->arch);
 		update_mem_regions(regions);
@@ -385,6 +509,8 @@ retry:
 		goto retry;
 	}
 
+out:
+	pr_dbg2("cannot find mem region: %lx\n", addr);
 	return false;
 }
 
@@ -526,6 +652,7 @@ void save_argument(struct mcount_thread_data *mtdp,
 	ctx.regs = regs;
 	ctx.stack_base = rstack->parent_loc;
 	ctx.regions = &mtdp->mem_regions;
+	ctx.regions->nr_pages = 0;
 	ctx.arch = &mtdp->arch;
 
 	size = save_to_argbuf(argbuf, args_spec, &ctx);
@@ -549,6 +676,7 @@ void save_retval(struct mcount_thread_data *mtdp,
 	mcount_memset4(&ctx, 0, sizeof(ctx));
 	ctx.retval = retval;
 	ctx.regions = &mtdp->mem_regions;
+	ctx.regions->nr_pages = 0;
 	ctx.arch = &mtdp->arch;
 
 	size = save_to_argbuf(argbuf, args_spec, &ctx);
@@ -28,7 +28,7 @@ void print_debug_info(struct debug_info *dinfo, bool auto_args)
 		if (argspec == NULL && retspec == NULL && !auto_args)
 			continue;
 
-		printf("%s [addr: %"PRIx64"]\n", loc->sym->name, loc->sym->addr);
+		printf("%s [addr: %"PRIx64"]\n", symbol_name(loc->sym), loc->sym->addr);
 
 		/* skip common parts with compile directory  */
 		if (dinfo->base_dir) {
@@ -50,7 +50,6 @@ int main(int argc, char *argv[])
 	struct uftrace_mmap *map;
 	struct symtabs symtabs = {
 		.dirname = ".",
-		.flags = SYMTAB_FL_DEMANGLE,
 	};
 	char *argspec = NULL;
 	char *retspec = NULL;
@@ -74,7 +74,7 @@ static int print_session_symbol(struct uftrace_session *s, void *arg)
 	if (sym == NULL)
 		return 0;
 
-	printf("  %s", sym->name);
+	printf("  %s", symbol_name(sym));
 
 	dloc = find_file_line(&s->symtabs, addr);
 	if (dloc && dloc->file)
@@ -52,6 +52,9 @@ fi
 if test -f ${SRCDIR}/check-deps/have_libcapstone; then
     DEPS="${DEPS} dynamic"
 fi
+if test -f ${SRCDIR}/check-deps/have_libz; then
+    DEPS="${DEPS} zlib"
+fi
 if [ "x${DEPS}" != "x" ]; then
     DEPS=" (${DEPS} )"
 fi
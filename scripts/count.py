@@ -10,5 +10,13 @@ def uftrace_entry(ctx):
 def uftrace_exit(ctx):
     pass
 
+# for --parallel: pass the count of each process to uftrace_merge()
+def uftrace_partial():
+    return count
+
+def uftrace_merge(partials):
+    global count
+    count = sum(partials)
+
 def uftrace_end():
     print(count)
@@ -0,0 +1,25 @@
+#include <unistd.h>
+
+int __attribute__((noinline)) foo(void)
+{
+	return 0;
+}
+
+int __attribute__((noinline)) bar(void)
+{
+	return foo() + 1;
+}
+
+int main(void)
+{
+	int i;
+
+	/* wait for uftrace record -p to turn on tracing (up to 10 seconds) */
+	for (i = 0; i < 1000; i++) {
+		if (access("agent.ready", F_OK) == 0)
+			break;
+		usleep(10000);
+	}
+
+	return bar() == 1 ? 0 : 1;
+}
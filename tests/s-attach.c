@@ -0,0 +1,48 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/* check if uftrace loaded libmcount into this process */
+static int __attribute__((no_instrument_function)) attached(void)
+{
+	char buf[4096];
+	FILE *fp;
+	int ret = 0;
+
+	fp = fopen("/proc/self/maps", "r");
+	if (fp == NULL)
+		return 0;
+
+	while (fgets(buf, sizeof(buf), fp) != NULL) {
+		if (strstr(buf, "libmcount")) {
+			ret = 1;
+			break;
+		}
+	}
+	fclose(fp);
+	return ret;
+}
+
+int __attribute__((noinline)) foo(void)
+{
+	return 0;
+}
+
+int __attribute__((noinline)) bar(void)
+{
+	return foo() + 1;
+}
+
+int main(void)
+{
+	int i;
+
+	/* wait for uftrace record -p (up to 10 seconds) */
+	for (i = 0; i < 1000; i++) {
+		if (attached())
+			break;
+		usleep(10000);
+	}
+
+	return bar() == 1 ? 0 : 1;
+}
@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/* check if uftrace loaded libmcount into this process */
+static int __attribute__((no_instrument_function)) attached(void)
+{
+	char buf[4096];
+	FILE *fp;
+	int ret = 0;
+
+	fp = fopen("/proc/self/maps", "r");
+	if (fp == NULL)
+		return 0;
+
+	while (fgets(buf, sizeof(buf), fp) != NULL) {
+		if (strstr(buf, "libmcount")) {
+			ret = 1;
+			break;
+		}
+	}
+	fclose(fp);
+	return ret;
+}
+
+/* wait for the file (up to 10 seconds) */
+static void __attribute__((no_instrument_function)) wait_file(const char *name)
+{
+	int i;
+
+	for (i = 0; i < 1000; i++) {
+		if (access(name, F_OK) == 0)
+			break;
+		usleep(10000);
+	}
+}
+
+int __attribute__((noinline)) foo(void)
+{
+	return 0;
+}
+
+int __attribute__((noinline)) bar(void)
+{
+	return foo() + 1;
+}
+
+int main(void)
+{
+	FILE *fp;
+	int i;
+
+	/* wait for uftrace record -p (up to 10 seconds) */
+	for (i = 0; i < 1000; i++) {
+		if (attached())
+			break;
+		usleep(10000);
+	}
+
+	if (bar() != 1)
+		return 1;
+
+	/* let the test interrupt uftrace record */
+	fp = fopen("detach.ready", "w");
+	if (fp)
+		fclose(fp);
+
+	/* it should keep running (without tracing) after uftrace is gone */
+	wait_file("detach.done");
+
+	return bar() == 1 ? 0 : 1;
+}
@@ -0,0 +1,94 @@
+#!/usr/bin/env python
+
+from runtest import TestBase
+
+class TestCase(TestBase):
+    def __init__(self):
+        TestBase.__init__(self, 'abc', """
+process t-abc
+thread t-abc
+B main
+B a
+B b
+B c
+E c
+E b
+E a
+E main
+""")
+
+    def prepare(self):
+        self.subcmd = 'record'
+        return TestBase.runcmd(self)
+
+    def setup(self):
+        self.subcmd = 'dump'
+        self.option = '-F main -D 4 --perfetto'
+
+    def runcmd(self):
+        # convert binary output to hex string
+        return TestBase.runcmd(self) + ' | od -An -v -tx1'
+
+    def sort(self, output, ignore_children=False):
+        """ This function decodes (a subset of) perfetto protobuf messages. """
+        try:
+            data = bytes.fromhex(output.replace('\n', ' '))
+        except ValueError:
+            # expected result is already in text
+            return '\n'.join([ln for ln in output.split('\n') if ln.strip() != ''])
+
+        def varint(buf, pos):
+            val = shift = 0
+            while True:
+                b = buf[pos]
+                pos += 1
+                val |= (b & 0x7f) << shift
+                shift += 7
+                if b < 0x80:
+                    return val, pos
+
+        def fields(buf):
+            pos = 0
+            while pos < len(buf):
+                key, pos = varint(buf, pos)
+                if key & 7 == 0:
+                    val, pos = varint(buf, pos)
+                elif key & 7 == 2:
+                    size, pos = varint(buf, pos)
+                    val = buf[pos:pos+size]
+                    pos += size
+                else:
+                    return
+                yield key >> 3, val
+
+        result = []
+        names = {}
+        stack = {}
+        for field, packet in fields(data):
+            if field != 1:  # Trace.packet
+                return ''
+            for f, v in fields(packet):
+                if f == 60:  # track_descriptor
+                    for df, dv in fields(v):
+                        if df == 3:  # process
+                            result.append('process ' + dict(fields(dv))[6].decode())
+                        elif df == 4:  # thread
+                            result.append('thread ' + dict(fields(dv))[5].decode())
+                elif f == 12:  # interned_data
+                    for nf, nv in fields(v):
+                        if nf == 2:  # event_names
+                            name = dict(fields(nv))
+                            names[name[1]] = name[2].decode()
+                elif f == 11:  # track_event
+                    event = dict(fields(v))
+                    tid = event[11]
+                    if tid not in stack:
+                        stack[tid] = []
+                    if event[9] == 1:  # slice begin
+                        name = names[event[10]]
+                        stack[tid].append(name)
+                    else:
+                        name = stack[tid].pop()
+                    if not name.startswith('__'):
+                        result.append('%s %s' % ('B' if event[9] == 1 else 'E', name))
+        return '\n'.join(result)
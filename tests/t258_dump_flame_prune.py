@@ -0,0 +1,28 @@
+#!/usr/bin/env python
+
+from runtest import TestBase
+
+class TestCase(TestBase):
+    def __init__(self):
+        TestBase.__init__(self, 'sort', """
+main;foo 2
+main;foo;loop 6
+""")
+
+    def prepare(self):
+        self.subcmd = 'record'
+        return self.runcmd()
+
+    def setup(self):
+        self.subcmd = 'dump'
+        self.option = '-F main --flame-graph --min-samples=2'
+
+    def sort(self, output):
+        """ This function post-processes output of the test to be compared .
+            It ignores blank lines and sorts the folded stacks.  """
+        result = []
+        for ln in output.split('\n'):
+            if ln.strip() == '':
+                continue
+            result.append(ln)
+        return '\n'.join(sorted(result))
@@ -0,0 +1,68 @@
+#!/usr/bin/env python
+
+import os
+import struct
+
+from runtest import TestBase
+
+COLUMNAR_DIR = 'columnar.data'
+
+class TestCase(TestBase):
+    def __init__(self):
+        TestBase.__init__(self, 'abc', """
+entry 0 main
+entry 1 a
+entry 2 b
+entry 3 c
+entry 4 getpid
+exit 4 getpid
+exit 3 c
+exit 2 b
+exit 1 a
+exit 0 main
+""")
+
+    def prepare(self):
+        self.subcmd = 'record'
+        return TestBase.runcmd(self)
+
+    def setup(self):
+        self.subcmd = 'dump'
+        self.option = '-F main --columnar=' + COLUMNAR_DIR
+
+    def sort(self, output, ignore_children=False):
+        """ This function reads the column files instead of the output. """
+        if output.strip() != '':
+            # expected result is already in text
+            return '\n'.join([ln for ln in output.split('\n') if ln.strip() != ''])
+
+        if not os.path.exists(COLUMNAR_DIR + '/schema'):
+            return ''
+
+        with open(COLUMNAR_DIR + '/schema') as f:
+            schema = dict(ln.split(': ', 1) for ln in f.read().split('\n')
+                          if ': ' in ln and not ln.startswith('column'))
+        rows = int(schema['rows'])
+
+        def column(name, fmt):
+            with open(COLUMNAR_DIR + '/' + name, 'rb') as f:
+                return struct.unpack('=%d%s' % (rows, fmt), f.read())
+
+        with open(COLUMNAR_DIR + '/names.txt') as f:
+            names = f.read().split('\n')
+
+        time = column('time.u64', 'Q')
+        depth = column('depth.u16', 'H')
+        rtype = column('type.u8', 'B')
+        func = column('func.u32', 'I')
+        duration = column('duration.u64', 'Q')
+
+        result = []
+        for i in range(rows):
+            if i > 0 and time[i] < time[i-1]:
+                return 'unordered time'
+            if rtype[i] == 1 and duration[i] == 0:
+                return 'no duration'
+            result.append('%s %d %s' % ('entry' if rtype[i] == 0 else 'exit',
+                                        depth[i], names[func[i]]))
+        return '\n'.join(result)
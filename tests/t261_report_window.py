@@ -0,0 +1,37 @@
+#!/usr/bin/env python
+
+from runtest import TestBase
+
+class TestCase(TestBase):
+    def __init__(self):
+        TestBase.__init__(self, 'abc', """
+      Window(s)       Calls   Total avg         P50         P99         Max  Function
+  =============  ==========  ==========  ==========  ==========  ==========  ====================
+       0.000000           1    1.361 us    1.361 us    1.361 us    1.361 us  main
+       0.000000           1    1.168 us    1.168 us    1.168 us    1.168 us  a
+       0.000000           1    1.019 us    1.019 us    1.019 us    1.019 us  b
+       0.000000           1    0.806 us    0.806 us    0.806 us    0.806 us  c
+       0.000000           1    0.458 us    0.458 us    0.458 us    0.458 us  getpid
+""")
+
+    def prepare(self):
+        self.subcmd = 'record'
+        return self.runcmd()
+
+    def setup(self):
+        self.subcmd = 'report'
+        self.option = '--window=100s'
+
+    def sort(self, output, ignored=''):
+        """ This function post-processes output of the test to be compared .
+            It only keeps window, call count and function name.  """
+        result = []
+        for ln in output.split('\n'):
+            line = ln.split()
+            if len(line) < 10 or line[0] == 'Window(s)':
+                continue
+            if line[-1].startswith('__'):
+                continue
+            result.append('%s %s %s' % (line[0], line[1], line[-1]))
+
+        return '\n'.join(result)
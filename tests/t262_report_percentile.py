@@ -0,0 +1,46 @@
+#!/usr/bin/env python
+
+from runtest import TestBase
+
+class TestCase(TestBase):
+    def __init__(self):
+        TestBase.__init__(self, 'sort', """
+   Total p99       Calls   Function
+  ==========  ==========   ====================
+   11.173 ms           1   main
+   10.467 ms           1   bar
+   10.297 ms           1   usleep
+  103.570 us           2   foo
+   34.005 us           6   loop
+    0.763 us           1   __monstartup
+    0.299 us           1   __cxa_atexit
+""")
+
+    def prepare(self):
+        self.subcmd = 'record'
+        return self.runcmd()
+
+    def setup(self):
+        self.subcmd = 'report'
+        self.option = '-f total-p99,call -s total-p99'
+
+    def sort(self, output):
+        """ This function post-processes output of the test to be compared .
+            It ignores blank and comment (#) lines and remaining functions.  """
+        result = []
+        for ln in output.split('\n'):
+            if ln.strip() == '':
+                continue
+            line = ln.split()
+            if line[0] == 'Total':
+                continue
+            if line[0].startswith('='):
+                continue
+            # A report line consists of following data
+            # [0]         [1]   [2]     [3]
+            # total_p99   unit  called  function
+            if line[-1].startswith('__'):
+                continue
+            result.append('%s %s' % (line[-2], line[-1]))
+
+        return '\n'.join(result)
@@ -0,0 +1,20 @@
+#!/usr/bin/env python
+
+from runtest import TestBase
+
+class TestCase(TestBase):
+    def __init__(self):
+        TestBase.__init__(self, 'sleep', """
+# DURATION    TID     FUNCTION
+            [18239] | main() {
+            [18239] |   foo() {
+            [18239] |     mem_alloc() {
+   0.835 us [18239] |       malloc();
+   2.016 us [18239] |     } /* mem_alloc */
+            [18239] |     bar() {
+   2.078 ms [18239] |       usleep();
+   2.082 ms [18239] |     } /* bar */
+""")
+
+    def setup(self):
+        self.option = '--flight-recorder=64k -T mem_free@trace_off'
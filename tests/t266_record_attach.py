@@ -0,0 +1,31 @@
+#!/usr/bin/env python
+
+from runtest import TestBase
+import subprocess as sp
+
+class TestCase(TestBase):
+    def __init__(self):
+        TestBase.__init__(self, 'attach', """
+# DURATION     TID     FUNCTION
+            [ 18231] | bar() {
+   0.175 us [ 18231] |   foo();
+   1.502 us [ 18231] | } /* bar */
+""", sort='simple')
+
+    def prerun(self, timeout):
+        # the target waits until libmcount is loaded and then calls bar()
+        self.target_p = sp.Popen(['./t-' + self.name])
+
+        record_cmd  = [TestBase.uftrace_cmd, 'record']
+        record_cmd += TestBase.default_opt.split()
+        record_cmd += ['--no-libcall', '-p', str(self.target_p.pid)]
+        self.pr_debug('prerun command: ' + ' '.join(record_cmd))
+        sp.call(record_cmd)
+
+        self.target_p.wait()
+        return TestBase.TEST_SUCCESS
+
+    def setup(self):
+        self.subcmd = 'replay'
+        self.option = ''
+        self.exearg = ''
@@ -0,0 +1,70 @@
+#!/usr/bin/env python
+
+from runtest import TestBase
+import subprocess as sp
+import os
+import time
+
+class TestCase(TestBase):
+    def __init__(self):
+        TestBase.__init__(self, 'agent', """
+# DURATION     TID     FUNCTION
+   1.502 us [ 18231] | bar();
+   2.354 us [ 18231] | } /* main */
+""", sort='simple')
+
+    def wait_agent(self, pid):
+        # the agent listens on an abstract unix socket
+        name = '@uftrace-agent-%d' % pid
+        for i in range(500):
+            with open('/proc/net/unix') as f:
+                if name in f.read():
+                    return True
+            time.sleep(0.01)
+        return False
+
+    def target_pid(self, pid):
+        # the target is a child of uftrace record
+        for i in range(500):
+            try:
+                with open('/proc/%d/task/%d/children' % (pid, pid)) as f:
+                    children = f.read().split()
+                    if children:
+                        return int(children[0])
+            except IOError:
+                pass
+            time.sleep(0.01)
+        return 0
+
+    def prerun(self, timeout):
+        record_cmd  = [TestBase.uftrace_cmd, 'record']
+        record_cmd += TestBase.default_opt.split()
+        record_cmd += ['--agent', '--disable', '--no-libcall', 't-' + self.name]
+        self.pr_debug('prerun command: ' + ' '.join(record_cmd))
+        record_p = sp.Popen(record_cmd)
+
+        pid = self.target_pid(record_p.pid)
+        if pid == 0 or not self.wait_agent(pid):
+            record_p.kill()
+            record_p.wait()
+            return TestBase.TEST_NONZERO_RETURN
+
+        # turn tracing on without function foo
+        agent_cmd  = [TestBase.uftrace_cmd, 'record']
+        agent_cmd += ['-p', str(pid), '--trace=on', '-N', 'foo']
+        self.pr_debug('agent command: ' + ' '.join(agent_cmd))
+        ret = sp.call(agent_cmd)
+
+        # let the target call bar()
+        open('agent.ready', 'w').close()
+        record_p.wait()
+        os.unlink('agent.ready')
+
+        if ret != 0:
+            return TestBase.TEST_NONZERO_RETURN
+        return TestBase.TEST_SUCCESS
+
+    def setup(self):
+        self.subcmd = 'replay'
+        self.option = ''
+        self.exearg = ''
@@ -0,0 +1,59 @@
+#!/usr/bin/env python
+
+from runtest import TestBase
+import subprocess as sp
+import signal
+import os
+import time
+
+class TestCase(TestBase):
+    def __init__(self):
+        TestBase.__init__(self, 'detach', """
+# DURATION     TID     FUNCTION
+            [ 18231] | bar() {
+   0.175 us [ 18231] |   foo();
+   1.502 us [ 18231] | } /* bar */
+""", sort='simple')
+
+    def wait_file(self, name):
+        for i in range(1000):
+            if os.path.exists(name):
+                return True
+            time.sleep(0.01)
+        return False
+
+    def prerun(self, timeout):
+        # the target calls bar() once after libmcount is loaded
+        target_p = sp.Popen(['./t-' + self.name])
+
+        record_cmd  = [TestBase.uftrace_cmd, 'record']
+        record_cmd += TestBase.default_opt.split()
+        record_cmd += ['--no-libcall', '-p', str(target_p.pid)]
+        self.pr_debug('prerun command: ' + ' '.join(record_cmd))
+        record_p = sp.Popen(record_cmd)
+
+        ret = TestBase.TEST_SUCCESS
+        if not self.wait_file('detach.ready'):
+            ret = TestBase.TEST_NONZERO_RETURN
+
+        # like Ctrl-C, it should detach and leave the target running
+        record_p.send_signal(signal.SIGINT)
+        record_p.wait()
+
+        if target_p.poll() is not None:
+            ret = TestBase.TEST_NONZERO_RETURN
+
+        # the second bar() should not be recorded
+        open('detach.done', 'w').close()
+        if target_p.wait() != 0:
+            ret = TestBase.TEST_NONZERO_RETURN
+
+        for name in ['detach.ready', 'detach.done']:
+            if os.path.exists(name):
+                os.unlink(name)
+        return ret
+
+    def setup(self):
+        self.subcmd = 'replay'
+        self.option = ''
+        self.exearg = ''
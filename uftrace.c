@@ -101,6 +101,19 @@ enum options {
 	OPT_no_sched,
 	OPT_signal,
 	OPT_srcline,
+	OPT_compress,
+	OPT_perf_bufsize,
+	OPT_perfetto,
+	OPT_min_samples,
+	OPT_no_debug_cache,
+	OPT_columnar,
+	OPT_window,
+	OPT_parallel,
+	OPT_flight_recorder,
+	OPT_flight_threshold,
+	OPT_agent,
+	OPT_trace,
+	OPT_clear_filter,
 	OPT_usage,
 };
 
@@ -114,6 +127,7 @@ __used static const char uftrace_usage[] =
 
 __used static const char uftrace_help[] =
 " OPTION:\n"
+"      --agent                Allow to control tracing at runtime (record -p)\n"
 "      --avg-self             Show average/min/max of self function time\n"
 "      --avg-total            Show average/min/max of total function time\n"
 "  -a, --auto-args            Show arguments and return value of known functions\n"
@@ -126,7 +140,10 @@ __used static const char uftrace_help[] =
 "      --column-offset=DEPTH  Offset of each column (default: "
 	stringify(OPT_COLUMN_OFFSET) ")\n"
 "      --column-view          Print tasks in separate columns\n"
+"      --columnar=DIR         Dump recorded data into column files in DIR\n"
+"      --compress             Compress trace data sent to --host\n"
 "  -C, --caller-filter=FUNC   Only trace callers of those FUNCs\n"
+"      --clear-filter         Remove existing filters in the agent (record -p)\n"
 "  -d, --data=DATA            Use this DATA instead of uftrace.data\n"
 "      --debug-domain=DOMAIN  Filter debugging domain\n"
 "      --demangle=TYPE        C++ symbol demangling: full, simple, no\n"
@@ -141,6 +158,10 @@ __used static const char uftrace_help[] =
 "  -E, --Event=EVENT          Enable EVENT to save more information\n"
 "      --flame-graph          Dump recorded data in FlameGraph format\n"
 "      --flat                 Use flat output format\n"
+"      --flight-recorder=SIZE Keep last SIZE of trace per thread and save it\n"
+"                             only when a snapshot is triggered\n"
+"      --flight-threshold=TIME\n"
+"                             Take a snapshot if a function runs longer than TIME\n"
 "      --force                Trace even if executable is not instrumented\n"
 "  -f, --output-fields=FIELD  Show FIELDs in the replay or graph output\n"
 "  -F, --filter=FUNC          Only trace those FUNCs\n"
@@ -164,7 +185,9 @@ __used static const char uftrace_help[] =
 "                             regex)\n"
 "      --max-stack=DEPTH      Set max stack depth to DEPTH (default: "
 	stringify(OPT_RSTACK_MAX) ")\n"
+"      --min-samples=NUM      Hide flame graph stacks under NUM samples\n"
 "      --no-comment           Don't show comments of returned functions\n"
+"      --no-debug-cache       Don't use cached debug info of binaries\n"
 "      --no-event             Disable (default) events\n"
 "      --no-sched             Disable schedule events\n"
 "      --no-libcall           Don't trace library function calls\n"
@@ -176,8 +199,13 @@ __used static const char uftrace_help[] =
 "      --num-thread=NUM       Create NUM recorder threads\n"
 "  -N, --notrace=FUNC         Don't trace those FUNCs\n"
 "      --opt-file=FILE        Read command-line options from FILE\n"
+"      --perf-buffer=SIZE     Size of perf event buffer per cpu (default: "
+	stringify(PERF_BUFFER_SIZE_KB) "K)\n"
+"      --perfetto             Dump recorded data in perfetto (protobuf) format\n"
 "      --port=PORT            Use PORT for network connection (default: "
 	stringify(UFTRACE_RECV_PORT) ")\n"
+"      --parallel=NUM         Run script in NUM processes in parallel\n"
+"  -p, --pid=PID              Attach to a running process PID and trace it\n"
 "  -P, --patch=FUNC           Apply dynamic patching for FUNCs\n"
 "      --record               Record a new trace data before running command\n"
 "      --report               Show live report\n"
@@ -200,12 +228,14 @@ __used static const char uftrace_help[] =
 "      --task-newline         Interleave a newline when task is changed\n"
 "      --tid=TID[,TID,...]    Only replay those tasks\n"
 "      --time                 Print time information\n"
+"      --trace=STATE          Turn tracing on or off in the agent (record -p)\n"
 "  -T, --trigger=FUNC@act[,act,...]\n"
 "                             Trigger action on those FUNCs\n"
 "  -U, --unpatch=FUNC         Don't apply dynamic patching for FUNCs\n"
 "  -v, --debug                Print debug messages\n"
 "      --verbose              Print verbose (debug) messages\n"
 "  -W, --watch=POINT          Watch and report POINT if it's changed\n"
+"      --window=TIME          Report statistics for each TIME window\n"
 "  -Z, --size-filter=SIZE     Apply dynamic patching for functions bigger than SIZE\n"
 "  -h, --help                 Give this help list\n"
 "      --usage                Give a short usage message\n"
@@ -213,7 +243,7 @@ __used static const char uftrace_help[] =
 "\n";
 
 static const char uftrace_shopts[] =
-	"+aA:b:C:d:D:eE:f:F:hH:kK:lL:N:P:r:R:s:S:t:T:U:vVW:Z:";
+	"+aA:b:C:d:D:eE:f:F:hH:kK:lL:N:p:P:r:R:s:S:t:T:U:vVW:Z:";
 
 #define REQ_ARG(name, shopt) { #name, required_argument, 0, shopt }
 #define NO_ARG(name, shopt)  { #name, no_argument, 0, shopt }
@@ -229,6 +259,7 @@ static const struct option uftrace_options[] = {
 	REQ_ARG(retval, 'R'),
 	NO_ARG(auto-args, 'a'),
 	REQ_ARG(patch, 'P'),
+	REQ_ARG(pid, 'p'),
 	REQ_ARG(unpatch, 'U'),
 	REQ_ARG(size-filter, 'Z'),
 	NO_ARG(debug, 'v'),
@@ -297,6 +328,19 @@ static const struct option uftrace_options[] = {
 	REQ_ARG(watch, 'W'),
 	REQ_ARG(signal, OPT_signal),
 	NO_ARG(srcline, OPT_srcline),
+	NO_ARG(compress, OPT_compress),
+	REQ_ARG(perf-buffer, OPT_perf_bufsize),
+	NO_ARG(perfetto, OPT_perfetto),
+	REQ_ARG(min-samples, OPT_min_samples),
+	NO_ARG(no-debug-cache, OPT_no_debug_cache),
+	REQ_ARG(columnar, OPT_columnar),
+	REQ_ARG(window, OPT_window),
+	REQ_ARG(parallel, OPT_parallel),
+	REQ_ARG(flight-recorder, OPT_flight_recorder),
+	REQ_ARG(flight-threshold, OPT_flight_threshold),
+	NO_ARG(agent, OPT_agent),
+	REQ_ARG(trace, OPT_trace),
+	NO_ARG(clear-filter, OPT_clear_filter),
 	REQ_ARG(hide, 'H'),
 	NO_ARG(help, 'h'),
 	NO_ARG(usage, OPT_usage),
@@ -599,6 +643,8 @@ static int parse_option(struct opts *opts, int key, char *arg)
 		strv_append(&default_opts, arg);
 
 		opts->threshold = parse_time(arg, 3);
+		/* -t 0 is meaningful for the agent (to remove the filter) */
+		opts->threshold_set = true;
 		if (opts->range.start || opts->range.stop) {
 			pr_use("--time-range cannot be used with --time-filter\n");
 			opts->range.start = opts->range.stop = 0;
@@ -633,6 +679,15 @@ static int parse_option(struct opts *opts, int key, char *arg)
 		if (opts->threshold) {
 			pr_use("--time-filter cannot be used with --time-range\n");
 			opts->threshold = 0;
+			opts->threshold_set = false;
+		}
+		break;
+
+	case 'p':
+		opts->attach_pid = strtol(arg, NULL, 0);
+		if (opts->attach_pid <= 0) {
+			pr_use("invalid process id: %s\n", arg);
+			opts->attach_pid = 0;
 		}
 		break;
 
@@ -946,6 +1001,76 @@ static int parse_option(struct opts *opts, int key, char *arg)
 		opts->srcline = true;
 		break;
 
+	case OPT_compress:
+		opts->compress = true;
+		break;
+
+	case OPT_perf_bufsize:
+		opts->perf_bufsize = parse_size(arg);
+		if (opts->perf_bufsize & (opts->perf_bufsize - 1) ||
+		    opts->perf_bufsize < (unsigned long)getpagesize()) {
+			pr_use("perf buffer size should be power of 2 pages\n");
+			opts->perf_bufsize = PERF_BUFFER_SIZE;
+		}
+		break;
+
+	case OPT_perfetto:
+		opts->perfetto = true;
+		break;
+
+	case OPT_min_samples:
+		opts->min_samples = strtoull(arg, NULL, 0);
+		break;
+
+	case OPT_no_debug_cache:
+		opts->no_debug_cache = true;
+		break;
+
+	case OPT_columnar:
+		opts->columnar = arg;
+		break;
+
+	case OPT_window:
+		opts->window = parse_time(arg, 9);
+		if (opts->window == 0)
+			pr_use("invalid window: %s (ignoring...)\n", arg);
+		break;
+
+	case OPT_flight_recorder:
+		opts->flight_size = parse_size(arg);
+		if (opts->flight_size == 0)
+			pr_use("invalid flight recorder size: %s (ignoring...)\n", arg);
+		break;
+
+	case OPT_flight_threshold:
+		opts->flight_threshold = parse_time(arg, 3);
+		break;
+
+	case OPT_agent:
+		opts->agent = true;
+		break;
+
+	case OPT_trace:
+		if (!strcmp(arg, "on"))
+			opts->trace = TRACE_STATE_ON;
+		else if (!strcmp(arg, "off"))
+			opts->trace = TRACE_STATE_OFF;
+		else
+			pr_use("invalid trace state: %s (ignoring...)\n", arg);
+		break;
+
+	case OPT_clear_filter:
+		opts->clear_filter = true;
+		break;
+
+	case OPT_parallel:
+		opts->nr_script_jobs = strtol(arg, NULL, 0);
+		if (opts->nr_script_jobs <= 0) {
+			pr_use("invalid number of processes: %s\n", arg);
+			opts->nr_script_jobs = 0;
+		}
+		break;
+
 	default:
 		return -1;
 	}
@@ -1246,6 +1371,7 @@ int main(int argc, char *argv[])
 		.dirname	= UFTRACE_DIR_NAME,
 		.libcall	= true,
 		.bufsize	= SHMEM_BUFFER_SIZE,
+		.perf_bufsize	= PERF_BUFFER_SIZE,
 		.depth		= OPT_DEPTH_DEFAULT,
 		.max_stack	= OPT_RSTACK_DEFAULT,
 		.port		= UFTRACE_RECV_PORT,
@@ -1292,6 +1418,10 @@ int main(int argc, char *argv[])
 	if (opts.exename == NULL) {
 		switch (opts.mode) {
 		case UFTRACE_MODE_RECORD:
+			/* it will find the executable from the process */
+			if (opts.attach_pid)
+				break;
+			/* fall through */
 		case UFTRACE_MODE_LIVE:
 		case UFTRACE_MODE_INVALID:
 			pr_out(uftrace_usage);
@@ -1340,6 +1470,9 @@ int main(int argc, char *argv[])
 		opts.use_pager = false;
 	if (opts.nop)
 		opts.use_pager = false;
+	/* perfetto output is a binary data */
+	if (opts.perfetto)
+		opts.use_pager = false;
 
 	if (opts.use_pager)
 		pager = setup_pager();
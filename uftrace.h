@@ -174,6 +174,7 @@ struct uftrace_data {
 	int nr_tasks;
 	int nr_perf;
 	int last_perf_idx;
+	uint64_t perf_lost;
 	int depth;
 	bool needs_byte_swap;
 	bool needs_bit_swap;
@@ -200,6 +201,13 @@ bool data_is_lp64(struct uftrace_data *handle);
 
 #define UFTRACE_MODE_DEFAULT  UFTRACE_MODE_LIVE
 
+/* tracing state requested to the agent (record --trace) */
+enum uftrace_trace_state {
+	TRACE_STATE_NONE,
+	TRACE_STATE_ON,
+	TRACE_STATE_OFF,
+};
+
 struct opts {
 	char *lib_path;
 	char *filter;
@@ -225,6 +233,7 @@ struct opts {
 	char *caller;
 	char *extern_data;
 	char *hide;
+	char *columnar;
 	int mode;
 	int idx;
 	int depth;
@@ -235,12 +244,19 @@ struct opts {
 	int column_offset;
 	int sort_column;
 	int nr_thread;
+	int nr_script_jobs;
 	int rt_prio;
 	int size_filter;
+	int attach_pid;
 	unsigned long bufsize;
 	unsigned long kernel_bufsize;
+	unsigned long perf_bufsize;
 	uint64_t threshold;
 	uint64_t sample_time;
+	uint64_t min_samples;
+	uint64_t window;
+	uint64_t flight_threshold;
+	unsigned long flight_size;
 	bool flat;
 	bool libcall;
 	bool print_symtab;
@@ -278,8 +294,15 @@ struct opts {
 	bool graphviz;
 	bool srcline;
 	bool estimate_return;
+	bool compress;
+	bool perfetto;
+	bool no_debug_cache;
+	bool agent;
+	bool clear_filter;
+	bool threshold_set;
 	struct uftrace_time_range range;
 	enum uftrace_pattern_type patt_type;
+	enum uftrace_trace_state trace;
 };
 
 extern struct strv default_opts;
@@ -380,6 +403,7 @@ enum uftrace_msg_type {
 	UFTRACE_MSG_LOST,
 	UFTRACE_MSG_DLOPEN,
 	UFTRACE_MSG_FINISH,
+	UFTRACE_MSG_SNAPSHOT,
 
 	UFTRACE_MSG_SEND_START		= 100,
 	UFTRACE_MSG_SEND_DIR_NAME,
@@ -389,8 +413,21 @@ enum uftrace_msg_type {
 	UFTRACE_MSG_SEND_INFO,
 	UFTRACE_MSG_SEND_META_DATA,
 	UFTRACE_MSG_SEND_END,
+	UFTRACE_MSG_SEND_HELLO,
+	UFTRACE_MSG_SEND_BATCH,
+
+	/* control messages for the agent (record --agent) */
+	UFTRACE_MSG_AGENT_TRACE		= 200,
+	UFTRACE_MSG_AGENT_DEPTH,
+	UFTRACE_MSG_AGENT_THRESHOLD,
+	UFTRACE_MSG_AGENT_ADD_FILTER,
+	UFTRACE_MSG_AGENT_SET_FILTER,
+	UFTRACE_MSG_AGENT_PATCH,
 };
 
+/* name of abstract unix socket for the agent (with pid) */
+#define UFTRACE_AGENT_SOCKET  "uftrace-agent-%d"
+
 /* msg format for communicating by pipe */
 struct uftrace_msg {
 	unsigned short magic; /* UFTRACE_MSG_MAGIC */
@@ -422,6 +459,34 @@ struct uftrace_msg_dlopen {
 	char exename[];
 };
 
+/* network protocol version negotiated by UFTRACE_MSG_SEND_HELLO */
+#define UFTRACE_MSG_PROTO_V1  1  /* a message per data buffer */
+#define UFTRACE_MSG_PROTO_V2  2  /* batched (and compressed) data */
+
+enum uftrace_msg_codec {
+	UFTRACE_MSG_CODEC_NONE		= 0,
+	UFTRACE_MSG_CODEC_ZLIB,
+};
+
+struct uftrace_msg_hello {
+	uint32_t version;
+	uint32_t codecs;  /* bitmask of supported codecs */
+};
+
+struct uftrace_msg_batch {
+	uint32_t count;
+	uint32_t codec;
+	uint32_t raw_len;  /* length of data before compression */
+};
+
+/* header of each data buffer in a batch */
+struct uftrace_msg_batch_data {
+	uint16_t type;  /* UFTRACE_MSG_SEND_{,KERNEL_,PERF_}DATA */
+	uint16_t unused;
+	int32_t  id;    /* tid or cpu */
+	uint32_t len;
+};
+
 extern struct uftrace_session *first_session;
 
 void create_session(struct uftrace_session_link *sess,
@@ -464,6 +529,7 @@ void walk_tasks(struct uftrace_session_link *sess,
 		walk_tasks_cb_t callback, void *arg);
 
 int setup_client_socket(struct opts *opts);
+void send_trace_hello(int sock, bool compress);
 void send_trace_dir_name(int sock, char *name);
 void send_trace_data(int sock, int tid, void *data, size_t len);
 void send_trace_kernel_data(int sock, int cpu, void *data, size_t len);
@@ -471,6 +537,7 @@ void send_trace_perf_data(int sock, int cpu, void *data, size_t len);
 void send_trace_metadata(int sock, const char *dirname, char *filename);
 void send_trace_info(int sock, struct uftrace_file_header *hdr,
 		     void *info, int len);
+void send_trace_flush(int sock);
 void send_trace_end(int sock);
 
 void write_task_info(const char *dirname, struct uftrace_msg_task *tmsg);
@@ -29,6 +29,8 @@
 int debug;
 FILE *logfp;
 FILE *outfp;
+/* overrides outfp in the current thread (used by output pipeline) */
+static __thread FILE *thread_outfp;
 enum color_setting log_color;
 enum color_setting out_color;
 int dbg_domain[DBG_DOMAIN_MAX];
@@ -61,7 +63,7 @@ static void color(const char *code, FILE *fp)
 	size_t len = strlen(code);
 
 	if ((fp == logfp && log_color == COLOR_OFF) ||
-	    (fp == outfp && out_color == COLOR_OFF))
+	    (fp != logfp && out_color == COLOR_OFF))
 		return;
 
 	if (fwrite(code, 1, len, fp) == len)
@@ -208,12 +210,31 @@ void __pr_warn(const char *fmt, ...)
 	color(TERM_COLOR_RESET, logfp);
 }
 
+/**
+ * set_thread_outfp - redirect pr_out() of the current thread
+ * @fp: output stream (or %NULL to use outfp again)
+ *
+ * It returns the previous stream of the thread.
+ */
+FILE *set_thread_outfp(FILE *fp)
+{
+	FILE *old = thread_outfp;
+
+	thread_outfp = fp;
+	return old;
+}
+
+static FILE *get_outfp(void)
+{
+	return thread_outfp ?: outfp;
+}
+
 void __pr_out(const char *fmt, ...)
 {
 	va_list ap;
 
 	va_start(ap, fmt);
-	vfprintf(outfp, fmt, ap);
+	vfprintf(get_outfp(), fmt, ap);
 	va_end(ap);
 }
 
@@ -222,19 +243,20 @@ void __pr_color(char code, const char *fmt, ...)
 	size_t i;
 	va_list ap;
 	const char *cs = TERM_COLOR_NORMAL;
+	FILE *fp = get_outfp();
 
 	for (i = 0; i < ARRAY_SIZE(colors); i++) {
 		if (code == colors[i].code)
 			cs = colors[i].color;
 	}
 
-	color(cs, outfp);
+	color(cs, fp);
 
 	va_start(ap, fmt);
-	vfprintf(outfp, fmt, ap);
+	vfprintf(fp, fmt, ap);
 	va_end(ap);
 
-	color(TERM_COLOR_RESET, outfp);
+	color(TERM_COLOR_RESET, fp);
 }
 
 static void __print_time_unit(int64_t delta_nsec, bool needs_sign)
@@ -1758,6 +1758,52 @@ char *demangle(char *str)
 	}
 }
 
+/**
+ * is_mangled_name - check if given @str needs to be demangled
+ * @str: symbol name
+ *
+ * This function returns %true if @str looks like a mangled C++ (or Rust)
+ * symbol name which can be handled by demangle().
+ */
+bool is_mangled_name(const char *str)
+{
+	if (str[0] != '_')
+		return false;
+
+	if (str[1] == 'Z')
+		return true;
+
+	return !strncmp(str, "_GLOBAL__sub_I_", 15);
+}
+
+/**
+ * demangle_symbol - demangle name of given @sym and save the result
+ * @sym: symbol to demangle
+ *
+ * This function returns the demangled name of @sym and saves it in the
+ * symbol so that it's not demangled again.  The name is released when
+ * the symbol table is unloaded.  If the name doesn't need to be
+ * demangled, the original name is returned.  It's safe to call this
+ * function from multiple threads as only one of them can set the name.
+ */
+char *demangle_symbol(struct sym *sym)
+{
+	char *name;
+	char *old = NULL;
+
+	if (demangler == DEMANGLE_NONE || !is_mangled_name(sym->name))
+		return sym->name;
+
+	name = demangle(sym->name);
+	if (!__atomic_compare_exchange_n(&sym->dname, &old, name, false,
+					 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		/* other thread has set it already */
+		free(name);
+		name = old;
+	}
+	return name;
+}
+
 #ifdef UNIT_TEST
 
 #define DEMANGLE_TEST(m, d)				\
@@ -1935,4 +1981,31 @@ TEST_CASE(demangle_rust1)
 	return TEST_OK;
 }
 
+TEST_CASE(demangle_symbol)
+{
+	enum symbol_demangler old = demangler;
+	struct sym normal = { .name = "normal", };
+	struct sym mangled = { .name = "_ZN3ABC3fooEv", };
+	char *name;
+
+	demangler = DEMANGLE_SIMPLE;
+
+	pr_dbg("non-mangled names should be returned as is\n");
+	TEST_EQ(is_mangled_name("normal"), false);
+	TEST_EQ(is_mangled_name(mangled.name), true);
+	TEST_EQ(is_mangled_name("_GLOBAL__sub_I_foo"), true);
+	TEST_EQ(symbol_name(&normal), normal.name);
+	TEST_EQ(normal.dname, NULL);
+
+	pr_dbg("mangled name should be demangled once\n");
+	name = symbol_name(&mangled);
+	TEST_STREQ(name, "ABC::foo");
+	TEST_EQ(mangled.dname, name);
+	TEST_EQ(symbol_name(&mangled), name);
+
+	demangler = old;
+	free(mangled.dname);
+	return TEST_OK;
+}
+
 #endif /* UNIT_TEST */
@@ -7,6 +7,15 @@
 #include <errno.h>
 #include <dlfcn.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include <signal.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <linux/fs.h>
 
 /* This should be defined before #include "utils.h" */
 #define PR_FMT     "dwarf"
@@ -17,6 +26,14 @@
 #include "utils/dwarf.h"
 #include "utils/symbol.h"
 #include "utils/filter.h"
+#include "utils/hashmap.h"
+
+/*
+ * Number of threads to build debug info (0 for the number of CPUs).
+ * The helper threads block all signals and are joined before returning
+ * so it's fine to use them in libmcount before main() starts.
+ */
+int debug_info_threads = 0;
 
 bool debug_info_has_argspec(struct debug_info *dinfo)
 {
@@ -208,6 +225,24 @@ struct cu_files {
 	size_t			num;     /* number of files */
 };
 
+/* source location of a symbol found in a CU */
+struct cu_location {
+	struct sym		*sym;
+	char			*file;   /* copied as the Dwarf handle goes away */
+	int			line;
+};
+
+/* result of a CU built by a thread, to be merged in the CU order */
+struct cu_result {
+	struct cu_location	*locs;
+	int			nr_locs;
+	int			nr_alloc;
+	char			*comp_dir;
+};
+
+/* protects args, rets and enums while building them from multiple threads */
+static pthread_mutex_t build_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static int elf_file_type(struct debug_info *dinfo)
 {
 	GElf_Ehdr ehdr;
@@ -890,7 +925,9 @@ static bool resolve_type_info(Dwarf_Die *die, struct arg_data *ad,
 
 			td->size = type_size(die, sizeof(int));
 
+			pthread_mutex_lock(&build_lock);
 			parse_enum_string(enum_def, &td->arg_data->dinfo->enums);
+			pthread_mutex_unlock(&build_lock);
 			free(enum_def);
 			free(enum_str);
 			return true;
@@ -1336,6 +1373,7 @@ struct build_data {
 	struct uftrace_pattern	*args;
 	struct uftrace_pattern	*rets;
 	struct cu_files		files;
+	struct cu_result	*res;
 };
 
 /* caller should free the return value */
@@ -1366,6 +1404,7 @@ static char *find_last_component(char *name)
 
 static bool match_name(struct sym *sym, char *name)
 {
+	char *symname;
 	bool ret;
 
 	if (sym == NULL)
@@ -1374,35 +1413,32 @@ static bool match_name(struct sym *sym, char *name)
 	if (!strcmp(sym->name, name))
 		return true;
 
+	symname = symbol_name(sym);
+
 	/* name is mangled C++/Rust symbol */
 	if (name[0] == '_' && name[1] == 'Z') {
-		char *demangled_name = demangle(name);
+		char *demangled = demangle(name);
 
-		ret = !strcmp(sym->name, demangled_name);
-		free(demangled_name);
+		ret = !strcmp(symname, demangled);
+		free(demangled);
 		return ret;
 	}
 
 	/* name is already (fully) demangled */
 	if (strpbrk(name, "(<:>)")) {
-		char *demangled_sym = NULL;
 		char *last_sym;
 		char *last_name;
 
 		if (demangler == DEMANGLE_FULL)
-			return !strcmp(sym->name, name);
-
-		if (demangler == DEMANGLE_NONE)
-			demangled_sym = demangle(sym->name);
+			return !strcmp(symname, name);
 
-		last_sym = find_last_component(sym->name);
+		last_sym = find_last_component(symname);
 		last_name = find_last_component(name);
 
 		ret = !strcmp(last_sym, last_name);
 
 		free(last_sym);
 		free(last_name);
-		free(demangled_sym);
 		return ret;
 	}
 
@@ -1412,19 +1448,15 @@ static bool match_name(struct sym *sym, char *name)
 static void get_source_location(Dwarf_Die *die, struct build_data *bd,
 				struct sym *sym)
 {
-	ptrdiff_t sym_idx;
-	const char *filename;
+	const char *filename = NULL;
 	struct debug_info *dinfo = bd->dinfo;
-	struct debug_file *dfile = NULL;
+	struct cu_result *res = bd->res;
+	struct cu_location *loc;
 	int dline = 0;
 
-	sym_idx = sym - bd->symtab->sym;
-
 	if (dwarf_hasattr(die, DW_AT_decl_file)) {
-		if (dwarf_decl_line(die, &dline) == 0) {
+		if (dwarf_decl_line(die, &dline) == 0)
 			filename = dwarf_decl_file(die);
-			dfile = get_debug_file(dinfo, filename);
-		}
 	}
 	else {
 		Dwarf_Die cudie;
@@ -1434,17 +1466,23 @@ static void get_source_location(Dwarf_Die *die, struct build_data *bd,
 		dwarf_diecu(die, &cudie, NULL, NULL);
 		line = dwarf_getsrc_die(&cudie, dwarf_addr);
 		filename = dwarf_linesrc(line, NULL, NULL);
-		dfile = get_debug_file(dinfo, filename);
 		dwarf_lineno(line, &dline);
 	}
 
-	if (dfile == NULL)
+	if (filename == NULL)
 		return;
 
-	dinfo->locs[sym_idx].sym  = sym;
-	dinfo->locs[sym_idx].file = dfile;
-	dinfo->locs[sym_idx].line = dline;
-	dinfo->nr_locs_used++;
+	/* it'll be merged to dinfo->locs after all CUs are done */
+	if (res->nr_locs == res->nr_alloc) {
+		res->nr_alloc = res->nr_alloc ? res->nr_alloc * 2 : 16;
+		res->locs = xrealloc(res->locs,
+				     res->nr_alloc * sizeof(*res->locs));
+	}
+
+	loc = &res->locs[res->nr_locs++];
+	loc->sym  = sym;
+	loc->file = xstrdup(filename);
+	loc->line = dline;
 }
 
 static int get_dwarfspecs_cb(Dwarf_Die *die, void *data)
@@ -1452,6 +1490,7 @@ static int get_dwarfspecs_cb(Dwarf_Die *die, void *data)
 	struct build_data *bd = data;
 	struct arg_data ad;
 	char *name = NULL;
+	char *symname;
 	Dwarf_Addr offset;
 	struct sym *sym;
 	int i;
@@ -1494,15 +1533,18 @@ static int get_dwarfspecs_cb(Dwarf_Die *die, void *data)
 
 	get_source_location(die, bd, sym);
 
-	setup_arg_data(&ad, sym->name, bd->dinfo);
+	symname = symbol_name(sym);
+	setup_arg_data(&ad, symname, bd->dinfo);
 
 	for (i = 0; i < bd->nr_rets; i++) {
-		if (!match_filter_pattern(&bd->rets[i], sym->name))
+		if (!match_filter_pattern(&bd->rets[i], symname))
 			continue;
 
 		if (get_retspec(die, &ad, true)) {
-			add_debug_entry(&bd->dinfo->rets, sym->name, sym->addr,
+			pthread_mutex_lock(&build_lock);
+			add_debug_entry(&bd->dinfo->rets, symname, sym->addr,
 					ad.argspec);
+			pthread_mutex_unlock(&build_lock);
 		}
 
 		free(ad.argspec);
@@ -1511,12 +1553,14 @@ static int get_dwarfspecs_cb(Dwarf_Die *die, void *data)
 	}
 
 	for (i = 0; i < bd->nr_args; i++) {
-		if (!match_filter_pattern(&bd->args[i], sym->name))
+		if (!match_filter_pattern(&bd->args[i], symname))
 			continue;
 
 		if (get_argspec(die, &ad)) {
-			add_debug_entry(&bd->dinfo->args, sym->name, sym->addr,
+			pthread_mutex_lock(&build_lock);
+			add_debug_entry(&bd->dinfo->args, symname, sym->addr,
 					ad.argspec);
+			pthread_mutex_unlock(&build_lock);
 		}
 
 		free(ad.argspec);
@@ -1631,8 +1675,152 @@ static char* get_base_comp_dir(struct rb_root *dirs)
 	return max->name;
 }
 
+#define DWARF_MAX_THREADS  16
+
+/* shared by threads building debug info from the CU list */
+struct build_context {
+	struct debug_info	*dinfo;
+	struct symtab		*symtab;
+	const char		*filename;
+	Dwarf_Off		*cu_offsets;  /* offset of CU DIEs */
+	int			nr_cu;
+	int			next_cu;      /* index of the next CU to build */
+	int			nr_args;
+	int			nr_rets;
+	struct uftrace_pattern	*args;
+	struct uftrace_pattern	*rets;
+	struct cu_result	*results;     /* per-CU result in CU order */
+	struct rb_root		comp_dirs;
+};
+
+static void build_cu_info(struct build_context *ctx, Dwarf *dw, int idx)
+{
+	Dwarf_Die cudie;
+	struct build_data bd = {
+		.dinfo   = ctx->dinfo,
+		.symtab  = ctx->symtab,
+		.args    = ctx->args,
+		.rets    = ctx->rets,
+		.nr_args = ctx->nr_args,
+		.nr_rets = ctx->nr_rets,
+		.res     = &ctx->results[idx],
+	};
+	char *dir;
+
+	if (dwarf_offdie(dw, ctx->cu_offsets[idx], &cudie) == NULL)
+		return;
+
+	dwarf_getsrcfiles(&cudie, &bd.files.files, &bd.files.num);
+
+	dwarf_getfuncs(&cudie, get_dwarfspecs_cb, &bd, 0);
+
+	if (dwarf_hasattr(&cudie, DW_AT_comp_dir)) {
+		dir = str_attr(&cudie, DW_AT_comp_dir, false);
+		if (dir)
+			bd.res->comp_dir = xstrdup(dir);
+	}
+}
+
+/*
+ * Merge the source locations in the CU order so that the result is the
+ * same as building them sequentially: a later CU overrides the location
+ * of a symbol defined in multiple CUs.
+ */
+static void merge_cu_results(struct build_context *ctx)
+{
+	struct debug_info *dinfo = ctx->dinfo;
+	struct debug_location *dloc;
+	struct debug_file *dfile;
+	struct cu_result *res;
+	struct cu_location *loc;
+	int i, k, nr_locs;
+
+	for (i = 0; i < ctx->nr_cu; i++) {
+		res = &ctx->results[i];
+		nr_locs = 0;
+
+		for (k = 0; k < res->nr_locs; k++) {
+			loc = &res->locs[k];
+
+			dfile = get_debug_file(dinfo, loc->file);
+			free(loc->file);
+
+			if (dfile == NULL)
+				continue;
+
+			dloc = &dinfo->locs[loc->sym - ctx->symtab->sym];
+			if (dloc->file == NULL)
+				dinfo->nr_locs_used++;
+
+			dloc->sym  = loc->sym;
+			dloc->file = dfile;
+			dloc->line = loc->line;
+			nr_locs++;
+		}
+
+		if (res->comp_dir) {
+			add_comp_dir(&ctx->comp_dirs, res->comp_dir, nr_locs);
+			free(res->comp_dir);
+		}
+		free(res->locs);
+	}
+}
+
+static void build_cu_list(struct build_context *ctx, Dwarf *dw)
+{
+	int idx;
+
+	while (!uftrace_done) {
+		idx = __sync_fetch_and_add(&ctx->next_cu, 1);
+		if (idx >= ctx->nr_cu)
+			break;
+
+		build_cu_info(ctx, dw, idx);
+	}
+}
+
+/* libdw is not thread-safe, so each thread uses its own handle */
+static void *build_dwarf_thread(void *arg)
+{
+	struct build_context *ctx = arg;
+	Dwarf *dw;
+	int fd;
+
+	fd = open(ctx->filename, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	dw = dwarf_begin(fd, DWARF_C_READ);
+	close(fd);
+
+	if (dw == NULL)
+		return NULL;
+
+	build_cu_list(ctx, dw);
+
+	dwarf_end(dw);
+	return NULL;
+}
+
+static int dwarf_nr_threads(int nr_cu)
+{
+	long nr = debug_info_threads;
+
+	if (nr == 0)
+		nr = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (nr > DWARF_MAX_THREADS)
+		nr = DWARF_MAX_THREADS;
+	if (nr > nr_cu)
+		nr = nr_cu;
+	if (nr < 1)
+		nr = 1;
+
+	return nr;
+}
+
 static void build_dwarf_info(struct debug_info *dinfo, struct symtab *symtab,
-			     enum uftrace_pattern_type ptype,
+			     const char *filename, enum uftrace_pattern_type ptype,
 			     struct strv *args, struct strv *rets)
 {
 	Dwarf_Off curr = 0;
@@ -1640,7 +1828,16 @@ static void build_dwarf_info(struct debug_info *dinfo, struct symtab *symtab,
 	size_t header_sz = 0;
 	struct uftrace_pattern *arg_patt;
 	struct uftrace_pattern *ret_patt;
-	struct rb_root comp_dirs = RB_ROOT;
+	struct build_context ctx = {
+		.dinfo     = dinfo,
+		.symtab    = symtab,
+		.filename  = filename,
+		.comp_dirs = RB_ROOT,
+	};
+	pthread_t threads[DWARF_MAX_THREADS];
+	sigset_t sigset, oldset;
+	int nr_threads;
+	int cu_alloc = 0;
 	char *dir;
 	char *s;
 	int i;
@@ -1656,21 +1853,23 @@ static void build_dwarf_info(struct debug_info *dinfo, struct symtab *symtab,
 	strv_for_each(rets, s, i)
 		init_filter_pattern(ptype, &ret_patt[i], s);
 
+	ctx.args = arg_patt;
+	ctx.rets = ret_patt;
+
+	/* do not read arguments when it's not needed */
+	if (dinfo->needs_args) {
+		ctx.nr_args = args->nr;
+		ctx.nr_rets = rets->nr;
+	}
+
 	dinfo->nr_locs = symtab->nr_sym;
 	dinfo->locs = xcalloc(dinfo->nr_locs, sizeof(*dinfo->locs));
+	dinfo->nr_locs_used = 0;
 
-	/* traverse every CU to find debug info */
+	/* collect every CU to find debug info */
 	while (dwarf_nextcu(dinfo->dw, curr, &next,
 			    &header_sz, NULL, NULL, NULL) == 0) {
 		Dwarf_Die cudie;
-		struct build_data bd = {
-			.dinfo   = dinfo,
-			.symtab  = symtab,
-			.args    = arg_patt,
-			.rets    = ret_patt,
-			.nr_args = args->nr,
-			.nr_rets = rets->nr,
-		};
 
 		if (dwarf_offdie(dinfo->dw, curr + header_sz, &cudie) == NULL)
 			break;
@@ -1678,38 +1877,59 @@ static void build_dwarf_info(struct debug_info *dinfo, struct symtab *symtab,
 		if (dwarf_tag(&cudie) != DW_TAG_compile_unit)
 			break;
 
-		if (uftrace_done)
-			break;
-
-		/* do not read arguments when it's not needed */
-		if (!dinfo->needs_args) {
-			bd.nr_args = 0;
-			bd.nr_rets = 0;
+		if (ctx.nr_cu == cu_alloc) {
+			cu_alloc = cu_alloc ? cu_alloc * 2 : 64;
+			ctx.cu_offsets = xrealloc(ctx.cu_offsets,
+						  cu_alloc * sizeof(*ctx.cu_offsets));
 		}
+		ctx.cu_offsets[ctx.nr_cu++] = curr + header_sz;
 
-		dwarf_getsrcfiles(&cudie, &bd.files.files, &bd.files.num);
+		curr = next;
+	}
 
-		dwarf_getfuncs(&cudie, get_dwarfspecs_cb, &bd, 0);
+	ctx.results = xcalloc(ctx.nr_cu, sizeof(*ctx.results));
 
-		if (dwarf_hasattr(&cudie, DW_AT_comp_dir)) {
-			dir = str_attr(&cudie, DW_AT_comp_dir, false);
-			add_comp_dir(&comp_dirs, dir, dinfo->nr_locs_used);
-			dinfo->nr_locs_used = 0;
-		}
+	/*
+	 * traverse the CUs in parallel.  The current thread works with the
+	 * existing handle and other threads open their own.
+	 */
+	nr_threads = dwarf_nr_threads(ctx.nr_cu) - 1;
+	pr_dbg2("build debug info of %d CUs with %d threads\n",
+		ctx.nr_cu, nr_threads + 1);
 
-		curr = next;
+	/* signals of the traced program should not go to the helpers */
+	sigfillset(&sigset);
+	pthread_sigmask(SIG_BLOCK, &sigset, &oldset);
+
+	for (i = 0; i < nr_threads; i++) {
+		if (pthread_create(&threads[i], NULL, build_dwarf_thread, &ctx)) {
+			pr_dbg("cannot create dwarf thread\n");
+			break;
+		}
 	}
+	nr_threads = i;
+
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+
+	build_cu_list(&ctx, dinfo->dw);
 
-	dir = get_base_comp_dir(&comp_dirs);
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	merge_cu_results(&ctx);
+
+	dir = get_base_comp_dir(&ctx.comp_dirs);
 	if (dir) {
 		pr_dbg3("base dir: %s\n", dir);
 		dinfo->base_dir = xstrdup(dir);
-		free_comp_dir(&comp_dirs);
+		free_comp_dir(&ctx.comp_dirs);
 	}
 	else {
 		dinfo->base_dir = NULL;
 	}
 
+	free(ctx.results);
+	free(ctx.cu_offsets);
 	for (i = 0; i < args->nr; i++)
 		free_filter_pattern(&arg_patt[i]);
 	free(arg_patt);
@@ -1728,7 +1948,7 @@ static int setup_dwarf_info(const char *filename, struct debug_info *dinfo,
 }
 
 static void build_dwarf_info(struct debug_info *dinfo, struct symtab *symtab,
-			     enum uftrace_pattern_type ptype,
+			     const char *filename, enum uftrace_pattern_type ptype,
 			     struct strv *args, struct strv *rets)
 {
 }
@@ -1751,6 +1971,8 @@ static int setup_debug_info(const char *filename, struct debug_info *dinfo,
 	return setup_dwarf_info(filename, dinfo, offset, force);
 }
 
+static void release_line_table(struct debug_info *dinfo);
+
 static void release_debug_info(struct debug_info *dinfo)
 {
 	free_debug_entry(&dinfo->args);
@@ -1762,6 +1984,13 @@ static void release_debug_info(struct debug_info *dinfo)
 	dinfo->locs = NULL;
 
 	free(dinfo->base_dir);
+	free(dinfo->cache_file);
+	dinfo->cache_file = NULL;
+	free(dinfo->cache_key);
+	dinfo->cache_key = NULL;
+	dinfo->cached = false;
+
+	release_line_table(dinfo);
 
 	release_dwarf_info(dinfo);
 	dinfo->loaded = false;
@@ -1802,6 +2031,195 @@ static void extract_dwarf_args(char *argspec, char *retspec,
 	}
 }
 
+static bool match_debug_file(const char *dbgname, const char *pathname,
+			     char *build_id);
+static int read_debug_file(struct debug_info *dinfo, struct symtab *symtab,
+			   const char *pathname, bool needs_srcline);
+
+/*
+ * The debug info of a binary doesn't change as long as the build-id is
+ * same.  So keep the extracted info in the user's cache directory and
+ * reuse it for later recordings instead of reading DWARF again.  As the
+ * result also depends on the argspec patterns, they're part of the key.
+ * The file name has a hash of the key, and the full key is saved in the
+ * file header to be compared when it's loaded.
+ *
+ * libmcount only reads the cache (in UFTRACE_DEBUG_CACHE) and leaves the
+ * name of the cache file in the .dbg file.  uftrace record copies new
+ * files to the cache and evicts old ones after recording.
+ */
+
+/* total size of the cache files, older files are removed first */
+#define DEBUG_CACHE_MAX_SIZE  (256 * MB)
+
+/* cache files not used for this long are removed (in seconds) */
+#define DEBUG_CACHE_MAX_AGE  (30 * 24 * 3600)
+
+static char * make_debug_cache_key(enum uftrace_pattern_type ptype,
+				   struct strv *args, struct strv *rets,
+				   bool force)
+{
+	char *args_str = strv_join(args, ";");
+	char *rets_str = strv_join(rets, ";");
+	char *key;
+
+	xasprintf(&key, "%d:%d:%s:%s", ptype, force,
+		  args_str ?: "", rets_str ?: "");
+
+	free(args_str);
+	free(rets_str);
+	return key;
+}
+
+/* check the full key in the header as different keys can have a same hash */
+static bool match_debug_cache_key(const char *dbgname, const char *key)
+{
+	FILE *fp;
+	bool ret = false;
+	char *line = NULL;
+	size_t len = 0;
+
+	fp = fopen(dbgname, "r");
+	if (fp == NULL)
+		return false;
+
+	while (getline(&line, &len, fp) >= 0) {
+		if (line[0] != '#')
+			break;
+
+		/* remove trailing newline */
+		line[strcspn(line, "\n")] = '\0';
+
+		if (!strncmp(line, "# cache key: ", 13)) {
+			ret = !strcmp(line + 13, key);
+			break;
+		}
+	}
+	free(line);
+	fclose(fp);
+	return ret;
+}
+
+static char * make_debug_cache_dir(char *build_id)
+{
+	char *cache_dir = getenv("UFTRACE_DEBUG_CACHE");
+	char *dirname;
+
+	if (cache_dir == NULL || *cache_dir == '\0')
+		return NULL;
+
+	if (build_id == NULL || *build_id == '\0')
+		return NULL;
+
+	xasprintf(&dirname, "%s/%s", cache_dir, build_id);
+	return dirname;
+}
+
+static int load_debug_cache(struct debug_info *dinfo, struct symtab *symtab,
+			    struct uftrace_mmap *map, const char *key)
+{
+	char *dirname;
+	uint32_t hash;
+
+	dirname = make_debug_cache_dir(map->build_id);
+	if (dirname == NULL)
+		return -1;
+
+	hash = hashmap_string_hash((void *)key);
+	xasprintf(&dinfo->cache_file, "%s/%s-%08x.dbg",
+		  dirname, basename(map->libname), hash);
+	dinfo->cache_key = xstrdup(key);
+	free(dirname);
+
+	if (!match_debug_file(dinfo->cache_file, map->libname, map->build_id))
+		return -1;
+
+	if (!match_debug_cache_key(dinfo->cache_file, key)) {
+		pr_dbg("debug cache has a different key: %s\n",
+		       dinfo->cache_file);
+		/* do not replace the existing cache with this */
+		free(dinfo->cache_file);
+		dinfo->cache_file = NULL;
+		free(dinfo->cache_key);
+		dinfo->cache_key = NULL;
+		return -1;
+	}
+
+	if (read_debug_file(dinfo, symtab, dinfo->cache_file, true) < 0) {
+		/* build it from DWARF again */
+		free(dinfo->locs);
+		dinfo->locs = NULL;
+		dinfo->nr_locs_used = 0;
+		return -1;
+	}
+
+	pr_dbg2("use debug cache: %s\n", dinfo->cache_file);
+	dinfo->cached = true;
+	return 0;
+}
+
+/* create parent directories of the cache file */
+static int create_debug_cache_dir(const char *cache_file)
+{
+	char *dirname = xstrdup(cache_file);
+	char *pos = dirname;
+	int ret = 0;
+
+	while ((pos = strchr(pos + 1, '/')) != NULL) {
+		*pos = '\0';
+		if (mkdir(dirname, 0755) < 0 && errno != EEXIST) {
+			ret = -1;
+			break;
+		}
+		*pos = '/';
+	}
+
+	free(dirname);
+	return ret;
+}
+
+/* copy a debug file, the destination should not exist */
+static int copy_debug_file(const char *src, const char *dst)
+{
+	char buf[4096];
+	ssize_t len;
+	int ifd, ofd;
+	int ret = 0;
+
+	ifd = open(src, O_RDONLY);
+	if (ifd < 0)
+		return -1;
+
+	ofd = open(dst, O_WRONLY | O_CREAT | O_EXCL, 0644);
+	if (ofd < 0) {
+		close(ifd);
+		return -1;
+	}
+
+#ifdef FICLONE
+	/* share the data blocks if the filesystem supports it */
+	if (ioctl(ofd, FICLONE, ifd) == 0)
+		goto out;
+#endif
+
+	while ((len = read(ifd, buf, sizeof(buf))) > 0) {
+		if (write_all(ofd, buf, len) < 0) {
+			ret = -1;
+			break;
+		}
+	}
+	if (len < 0)
+		ret = -1;
+
+out:
+	close(ifd);
+	if (close(ofd) < 0)
+		ret = -1;
+	if (ret < 0)
+		unlink(dst);
+	return ret;
+}
+
 void prepare_debug_info(struct symtabs *symtabs,
 			enum uftrace_pattern_type ptype,
 			char *argspec, char *retspec,
@@ -1810,6 +2228,7 @@ void prepare_debug_info(struct symtabs *symtabs,
 	struct uftrace_mmap *map;
 	struct strv dwarf_args = STRV_INIT;
 	struct strv dwarf_rets = STRV_INIT;
+	char *cache_key;
 
 	extract_dwarf_args(argspec, retspec, &dwarf_args, &dwarf_rets);
 
@@ -1827,17 +2246,27 @@ void prepare_debug_info(struct symtabs *symtabs,
 	/* file and line info need be saved regardless of argspec */
 	pr_dbg("prepare debug info\n");
 
+	cache_key = make_debug_cache_key(ptype, &dwarf_args, &dwarf_rets, force);
+
 	for_each_map(symtabs, map) {
-		struct symtab *stab = &map->mod->symtab;
-		struct debug_info *dinfo = &map->mod->dinfo;
+		struct symtab *stab;
+		struct debug_info *dinfo;
 
 		if (map->mod == NULL || map->mod->dinfo.loaded)
 			continue;
 
+		stab = &map->mod->symtab;
+		dinfo = &map->mod->dinfo;
+
+		if (load_debug_cache(dinfo, stab, map, cache_key) == 0)
+			continue;
+
 		setup_debug_info(map->libname, dinfo, map->start, force);
-		build_dwarf_info(dinfo, stab, ptype, &dwarf_args, &dwarf_rets);
+		build_dwarf_info(dinfo, stab, map->libname, ptype,
+				 &dwarf_args, &dwarf_rets);
 	}
 
+	free(cache_key);
 	strv_free(&dwarf_args);
 	strv_free(&dwarf_rets);
 }
@@ -1884,7 +2313,7 @@ static bool match_debug_file(const char *dbgname, const char *pathname,
 }
 
 static FILE * create_debug_file(const char *dirname, const char *filename,
-				char *build_id)
+				char *build_id, char **pathname)
 {
 	FILE *fp;
 	char *tmp;
@@ -1909,7 +2338,10 @@ static FILE * create_debug_file(const char *dirname, const char *filename,
 		fp = fopen(tmp, "ax");
 	}
 
-	free(tmp);
+	if (fp)
+		*pathname = tmp;
+	else
+		free(tmp);
 	return fp;
 }
 
@@ -1987,101 +2419,544 @@ void save_debug_file(FILE *fp, char code, char *str, unsigned long val)
 	}
 }
 
-static void save_debug_entries(struct debug_info *dinfo, const char *dirname,
-			       const char *filename, char *build_id)
+/* skip common parts with compile directory */
+static char * debug_file_name(struct debug_info *dinfo, struct debug_file *df)
 {
-	int i;
-	FILE *fp;
-	int idx;
 	int len;
 
-	fp = create_debug_file(dirname, filename, build_id);
-	if (fp == NULL)
-		return;  /* somebody already did that! */
+	if (dinfo->base_dir) {
+		len = strlen(dinfo->base_dir);
+		if (!strncmp(df->name, dinfo->base_dir, len))
+			return df->name + len + 1;
+	}
+	return df->name;
+}
 
-	fprintf(fp, "# path name: %s\n", filename);
-	if (strlen(build_id) > 0)
-		fprintf(fp, "# build-id: %s\n", build_id);
+/*
+ * Binary line table (XXX.dbgl) has the same source locations in the
+ * text debug file (XXX.dbg) so that replay (and others) can find them
+ * without parsing the text.  It's mapped to memory and the locations are
+ * looked up on demand.  The entries are sorted by symbol address and
+ * delta-encoded in blocks of LINE_TABLE_BLOCK entries.  Each block has
+ * the address and line of the first entry so that it can find the block
+ * using binary search.  The file layout is:
+ *
+ *   struct line_table_header
+ *   uint32_t name[nr_files]            (offset in the string pool)
+ *   struct line_table_block block[nr_blocks]
+ *   uint8_t  data[data_size]           (ULEB128 address delta,
+ *                                       ULEB128 file id,
+ *                                       SLEB128 line delta)
+ *   char     strs[str_size]            (string pool)
+ */
+#define LINE_TABLE_MAGIC    "UFTRLINE"
+#define LINE_TABLE_VERSION  1
+#define LINE_TABLE_BLOCK    32
+
+struct line_table_header {
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	nr_files;
+	uint32_t	nr_entries;
+	uint32_t	nr_blocks;
+	uint64_t	data_size;
+	uint64_t	str_size;
+	char		build_id[ALIGN(BUILD_ID_STR_SIZE, 8)];
+};
 
-	save_enum_def(&dinfo->enums, fp);
+struct line_table_block {
+	uint64_t	addr;  /* address of the first entry */
+	uint32_t	data;  /* offset of the first entry in data */
+	int32_t		line;  /* line number of the first entry */
+};
 
-	for (i = 0; i < dinfo->nr_locs; i++) {
-		struct debug_location *loc = &dinfo->locs[i];
-		struct debug_entry *entry;
+struct line_table_buf {
+	uint8_t		*data;
+	size_t		size;
+	size_t		alloc;
+};
 
-		if (loc->sym == NULL)
-			continue;
+static size_t line_table_name_size(uint32_t nr_files)
+{
+	return ALIGN(nr_files * sizeof(uint32_t), 8);
+}
 
-		save_debug_file(fp, 'F', loc->sym->name, loc->sym->addr);
+static size_t line_table_size(struct line_table_header *hdr)
+{
+	return sizeof(*hdr) + line_table_name_size(hdr->nr_files) +
+		hdr->nr_blocks * sizeof(struct line_table_block) +
+		hdr->data_size + hdr->str_size;
+}
 
-		idx = 0;
-		if (dinfo->base_dir) {
-			len = strlen(dinfo->base_dir);
-			if (!strncmp(loc->file->name, dinfo->base_dir, len))
-				idx = len + 1;
-		}
+static char * make_line_table_filename(const char *dbgfile)
+{
+	char *linefile = NULL;
 
-		/* skip common parts with compile directory  */
-		save_debug_file(fp, 'L', loc->file->name + idx, loc->line);
+	xasprintf(&linefile, "%sl", dbgfile);
+	return linefile;
+}
 
-		entry = find_debug_entry(&dinfo->args, loc->sym->addr);
-		if (entry && entry->spec)
-			save_debug_file(fp, 'A', entry->spec, 0);
+static void line_table_put(struct line_table_buf *buf, uint64_t val,
+			   bool is_signed)
+{
+	int64_t sval = val;
+	uint8_t byte;
+	bool more = true;
 
-		entry = find_debug_entry(&dinfo->rets, loc->sym->addr);
-		if (entry && entry->spec)
-			save_debug_file(fp, 'R', entry->spec, 0);
-	}
+	while (more) {
+		if (buf->size == buf->alloc) {
+			buf->alloc = buf->alloc ? buf->alloc * 2 : 4096;
+			buf->data = xrealloc(buf->data, buf->alloc);
+		}
 
-	close_debug_file(fp, dirname, basename(filename), build_id);
+		byte = val & 0x7f;
+		if (is_signed) {
+			sval >>= 7;
+			more = !((sval == 0 && !(byte & 0x40)) ||
+				 (sval == -1 && (byte & 0x40)));
+			val = sval;
+		}
+		else {
+			val >>= 7;
+			more = val != 0;
+		}
+
+		if (more)
+			byte |= 0x80;
+		buf->data[buf->size++] = byte;
+	}
 }
 
-void save_debug_info(struct symtabs *symtabs, const char *dirname)
+static uint64_t line_table_get(uint8_t **ptr, uint8_t *end, bool is_signed)
 {
-	struct uftrace_mmap *map;
+	uint8_t *p = *ptr;
+	uint64_t val = 0;
+	int shift = 0;
+	uint8_t byte = 0;
 
-	for_each_map(symtabs, map) {
-		if (map->mod == NULL || !map->mod->dinfo.loaded)
-			continue;
+	while (p < end && shift < 64) {
+		byte = *p++;
+		val |= (uint64_t)(byte & 0x7f) << shift;
+		shift += 7;
 
-		save_debug_entries(&map->mod->dinfo, dirname, map->libname,
-				   map->build_id);
+		if (!(byte & 0x80))
+			break;
 	}
+
+	if (is_signed && shift < 64 && (byte & 0x40))
+		val |= -1ULL << shift;
+
+	*ptr = p;
+	return val;
 }
 
-static int load_debug_file(struct debug_info *dinfo, struct symtab *symtab,
-			   const char *dirname, const char *filename,
-			   char *build_id, bool needs_srcline)
+static void save_line_table(struct debug_info *dinfo, const char *dbgfile,
+			    char *build_id)
 {
-	char *pathname;
+	struct line_table_header hdr = {
+		.magic   = LINE_TABLE_MAGIC,
+		.version = LINE_TABLE_VERSION,
+	};
+	struct line_table_buf buf = {};
+	struct line_table_block *blocks = NULL;
+	struct debug_file *df;
+	struct rb_node *node;
+	uint32_t *names;
+	uint64_t prev_addr = 0;
+	int prev_line = 0;
+	uint64_t pos = 0;
+	char *linefile;
 	FILE *fp;
-	char *line = NULL;
-	size_t len = 0;
+	int i;
+
+	if (dinfo->nr_locs_used == 0)
+		return;
+
+	strncpy(hdr.build_id, build_id, sizeof(hdr.build_id) - 1);
+
+	for (node = rb_first(&dinfo->files); node; node = rb_next(node)) {
+		df = rb_entry(node, struct debug_file, node);
+		df->id = hdr.nr_files++;
+	}
+
+	names = xcalloc(1, line_table_name_size(hdr.nr_files));
+	for (node = rb_first(&dinfo->files); node; node = rb_next(node)) {
+		df = rb_entry(node, struct debug_file, node);
+		names[df->id] = pos;
+		pos += strlen(debug_file_name(dinfo, df)) + 1;
+	}
+	hdr.str_size = pos;
+
+	for (i = 0; i < dinfo->nr_locs; i++) {
+		struct debug_location *loc = &dinfo->locs[i];
+
+		if (loc->sym == NULL || loc->file == NULL)
+			continue;
+
+		/* symbols should be sorted by address */
+		if (hdr.nr_entries && loc->sym->addr < prev_addr)
+			goto out;
+
+		if (hdr.nr_entries % LINE_TABLE_BLOCK == 0) {
+			struct line_table_block *blk;
+
+			blocks = xrealloc(blocks, (hdr.nr_blocks + 1) *
+					  sizeof(*blocks));
+			blk = &blocks[hdr.nr_blocks++];
+			blk->addr = loc->sym->addr;
+			blk->data = buf.size;
+			blk->line = loc->line;
+
+			prev_addr = blk->addr;
+			prev_line = blk->line;
+		}
+
+		line_table_put(&buf, loc->sym->addr - prev_addr, false);
+		line_table_put(&buf, loc->file->id, false);
+		line_table_put(&buf, loc->line - prev_line, true);
+
+		prev_addr = loc->sym->addr;
+		prev_line = loc->line;
+		hdr.nr_entries++;
+	}
+	hdr.data_size = buf.size;
+
+	if (hdr.nr_entries == 0)
+		goto out;
+
+	linefile = make_line_table_filename(dbgfile);
+	fp = fopen(linefile, "w");
+	if (fp == NULL) {
+		pr_dbg("cannot open line table %s: %m\n", linefile);
+		free(linefile);
+		goto out;
+	}
+
+	pr_dbg2("saving line table to %s\n", linefile);
+
+	if (fwrite_all(&hdr, sizeof(hdr), fp) < 0 ||
+	    fwrite_all(names, line_table_name_size(hdr.nr_files), fp) < 0 ||
+	    fwrite_all(blocks, hdr.nr_blocks * sizeof(*blocks), fp) < 0 ||
+	    fwrite_all(buf.data, buf.size, fp) < 0)
+		goto err;
+
+	for (node = rb_first(&dinfo->files); node; node = rb_next(node)) {
+		char *name;
+
+		df = rb_entry(node, struct debug_file, node);
+		name = debug_file_name(dinfo, df);
+
+		if (fwrite_all(name, strlen(name) + 1, fp) < 0)
+			goto err;
+	}
+
+	if (fclose(fp) == 0) {
+		free(linefile);
+		goto out;
+	}
+	fp = NULL;
+
+err:
+	pr_dbg("cannot write line table %s\n", linefile);
+	if (fp)
+		fclose(fp);
+	unlink(linefile);
+	free(linefile);
+
+out:
+	free(names);
+	free(blocks);
+	free(buf.data);
+}
+
+static int load_line_table(struct debug_info *dinfo, struct symtab *symtab,
+			   const char *dbgfile, char *build_id)
+{
+	struct line_table_header *hdr;
+	struct line_table_block *blocks;
+	struct stat line_stat, dbg_stat;
+	char *linefile;
+	void *map = MAP_FAILED;
+	uint32_t *names;
+	char *strs;
+	uint32_t i;
+	int fd;
 	int ret = -1;
-	char *func = NULL;
-	uint64_t offset = 0;
 
-	xasprintf(&pathname, "%s/%s.dbg", dirname, basename(filename));
+	linefile = make_line_table_filename(dbgfile);
 
-	if (!match_debug_file(pathname, filename, build_id)) {
-		char *newfile;
+	fd = open(linefile, O_RDONLY);
+	if (fd < 0)
+		goto out;
 
-		newfile = make_new_symbol_filename(pathname, filename, build_id);
-		len = strlen(newfile);
-		strcpy(newfile + len - 3, "dbg");
+	if (fstat(fd, &line_stat) < 0 || stat(dbgfile, &dbg_stat) < 0)
+		goto out;
 
-		/* replace pathname */
-		free(pathname);
-		pathname = newfile;
-		len = 0;
+	/* ignore the table if the debug file was modified later */
+	if (dbg_stat.st_mtim.tv_sec > line_stat.st_mtim.tv_sec ||
+	    (dbg_stat.st_mtim.tv_sec == line_stat.st_mtim.tv_sec &&
+	     dbg_stat.st_mtim.tv_nsec > line_stat.st_mtim.tv_nsec)) {
+		pr_dbg("ignore outdated line table: %s\n", linefile);
+		goto out;
+	}
+
+	if ((size_t)line_stat.st_size < sizeof(*hdr))
+		goto out;
+
+	map = mmap(NULL, line_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		goto out;
+
+	hdr = map;
+	if (memcmp(hdr->magic, LINE_TABLE_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->version != LINE_TABLE_VERSION || hdr->nr_entries == 0 ||
+	    hdr->nr_blocks != DIV_ROUND_UP(hdr->nr_entries, LINE_TABLE_BLOCK) ||
+	    hdr->str_size == 0 ||
+	    line_table_size(hdr) != (size_t)line_stat.st_size) {
+		pr_dbg("invalid line table: %s\n", linefile);
+		goto out;
+	}
+
+	if (build_id && *build_id && strcmp(build_id, hdr->build_id)) {
+		pr_dbg("build-id mismatch in line table: %s\n", linefile);
+		goto out;
+	}
+
+	names  = map + sizeof(*hdr);
+	blocks = (void *)names + line_table_name_size(hdr->nr_files);
+	strs   = (void *)(blocks + hdr->nr_blocks) + hdr->data_size;
+
+	if (strs[hdr->str_size - 1] != '\0')
+		goto out;
+
+	for (i = 0; i < hdr->nr_files; i++) {
+		if (names[i] >= hdr->str_size)
+			goto out;
+	}
+
+	for (i = 0; i < hdr->nr_blocks; i++) {
+		if (blocks[i].data >= hdr->data_size)
+			goto out;
+	}
+
+	pr_dbg2("loading line table from %s\n", linefile);
+
+	dinfo->line_files = xcalloc(hdr->nr_files, sizeof(*dinfo->line_files));
+	for (i = 0; i < hdr->nr_files; i++) {
+		dinfo->line_files[i].name = strs + names[i];
+		dinfo->line_files[i].id = i;
 	}
 
+	dinfo->line_map = map;
+	dinfo->line_map_size = line_stat.st_size;
+
+	dinfo->nr_locs = symtab->nr_sym;
+	dinfo->locs = xcalloc(dinfo->nr_locs, sizeof(*dinfo->locs));
+	dinfo->nr_locs_used = hdr->nr_entries;
+
+	map = MAP_FAILED;
+	ret = 0;
+
+out:
+	if (map != MAP_FAILED)
+		munmap(map, line_stat.st_size);
+	if (fd >= 0)
+		close(fd);
+	free(linefile);
+	return ret;
+}
+
+static void release_line_table(struct debug_info *dinfo)
+{
+	if (dinfo->line_map == NULL)
+		return;
+
+	munmap(dinfo->line_map, dinfo->line_map_size);
+	dinfo->line_map = NULL;
+
+	free(dinfo->line_files);
+	dinfo->line_files = NULL;
+}
+
+/* find the location of the symbol at @addr in the line table */
+static bool lookup_line_table(struct debug_info *dinfo, struct sym *sym,
+			      struct debug_location *loc)
+{
+	struct line_table_header *hdr = dinfo->line_map;
+	struct line_table_block *blocks;
+	uint8_t *data, *ptr, *end;
+	uint64_t addr;
+	int64_t line;
+	uint64_t file;
+	uint32_t left = 0, right;
+	uint32_t blk, i, nr;
+
+	blocks = dinfo->line_map + sizeof(*hdr) +
+		 line_table_name_size(hdr->nr_files);
+	data = (void *)(blocks + hdr->nr_blocks);
+	end  = data + hdr->data_size;
+
+	if (sym->addr < blocks[0].addr)
+		return false;
+
+	/* find the last block whose address is not greater than sym */
+	right = hdr->nr_blocks;
+	while (right - left > 1) {
+		uint32_t mid = (left + right) / 2;
+
+		if (blocks[mid].addr <= sym->addr)
+			left = mid;
+		else
+			right = mid;
+	}
+	blk = left;
+
+	nr = hdr->nr_entries - blk * LINE_TABLE_BLOCK;
+	if (nr > LINE_TABLE_BLOCK)
+		nr = LINE_TABLE_BLOCK;
+
+	ptr  = data + blocks[blk].data;
+	addr = blocks[blk].addr;
+	line = blocks[blk].line;
+
+	for (i = 0; i < nr && ptr < end; i++) {
+		addr += line_table_get(&ptr, end, false);
+		file  = line_table_get(&ptr, end, false);
+		line += (int64_t)line_table_get(&ptr, end, true);
+
+		if (addr > sym->addr)
+			break;
+		if (addr < sym->addr || file >= hdr->nr_files)
+			continue;
+
+		loc->sym  = sym;
+		loc->line = line;
+		/* set it last as others check the file to see if it's valid */
+		loc->file = &dinfo->line_files[file];
+		return true;
+	}
+	return false;
+}
+
+/**
+ * find_debug_location - find source location of a symbol
+ * @dinfo:  debug info of the module
+ * @symtab: symbol table of the module
+ * @sym:    symbol to find
+ *
+ * This function returns the debug location of @sym.  If the debug info
+ * was loaded from the line table, it looks up the table on demand.
+ */
+struct debug_location *find_debug_location(struct debug_info *dinfo,
+					   struct symtab *symtab,
+					   struct sym *sym)
+{
+	struct debug_location *loc;
+	ptrdiff_t idx;
+
+	idx = sym - symtab->sym;
+	if (dinfo->locs == NULL || idx < 0 || idx >= dinfo->nr_locs)
+		return NULL;
+
+	loc = &dinfo->locs[idx];
+	if (loc->file == NULL && dinfo->line_map)
+		lookup_line_table(dinfo, sym, loc);
+
+	return loc;
+}
+
+static void save_debug_entries(struct debug_info *dinfo, const char *dirname,
+			       const char *filename, char *build_id)
+{
+	int i;
+	FILE *fp;
+	char *dbgfile = NULL;
+
+	/* reuse the cached file as is */
+	if (dinfo->cached) {
+		xasprintf(&dbgfile, "%s/%s.dbg", dirname, basename(filename));
+
+		if (copy_debug_file(dinfo->cache_file, dbgfile) == 0) {
+			save_line_table(dinfo, dbgfile, build_id);
+			free(dbgfile);
+			return;
+		}
+
+		free(dbgfile);
+		dbgfile = NULL;
+	}
+
+	fp = create_debug_file(dirname, filename, build_id, &dbgfile);
+	if (fp == NULL)
+		return;  /* somebody already did that! */
+
+	fprintf(fp, "# path name: %s\n", filename);
+	if (strlen(build_id) > 0)
+		fprintf(fp, "# build-id: %s\n", build_id);
+	/* uftrace record will save it to the cache */
+	if (dinfo->cache_file) {
+		fprintf(fp, "# cache file: %s\n", basename(dinfo->cache_file));
+		fprintf(fp, "# cache key: %s\n", dinfo->cache_key);
+	}
+
+	save_enum_def(&dinfo->enums, fp);
+
+	for (i = 0; i < dinfo->nr_locs; i++) {
+		struct debug_location *loc = &dinfo->locs[i];
+		struct debug_entry *entry;
+
+		if (loc->sym == NULL)
+			continue;
+
+		save_debug_file(fp, 'F', symbol_name(loc->sym), loc->sym->addr);
+		save_debug_file(fp, 'L', debug_file_name(dinfo, loc->file),
+				loc->line);
+
+		entry = find_debug_entry(&dinfo->args, loc->sym->addr);
+		if (entry && entry->spec)
+			save_debug_file(fp, 'A', entry->spec, 0);
+
+		entry = find_debug_entry(&dinfo->rets, loc->sym->addr);
+		if (entry && entry->spec)
+			save_debug_file(fp, 'R', entry->spec, 0);
+	}
+
+	close_debug_file(fp, dirname, basename(filename), build_id);
+
+	/* the file is deleted if it has no debug info */
+	if (!access(dbgfile, F_OK))
+		save_line_table(dinfo, dbgfile, build_id);
+
+	free(dbgfile);
+}
+
+void save_debug_info(struct symtabs *symtabs, const char *dirname)
+{
+	struct uftrace_mmap *map;
+
+	for_each_map(symtabs, map) {
+		if (map->mod == NULL || !map->mod->dinfo.loaded)
+			continue;
+
+		save_debug_entries(&map->mod->dinfo, dirname, map->libname,
+				   map->build_id);
+	}
+}
+
+static int read_debug_file(struct debug_info *dinfo, struct symtab *symtab,
+			   const char *pathname, bool needs_srcline)
+{
+	FILE *fp;
+	char *line = NULL;
+	size_t len = 0;
+	int ret = -1;
+	char *func = NULL;
+	uint64_t offset = 0;
+
 	fp = fopen(pathname, "r");
 	if (fp == NULL) {
-		if (errno == ENOENT) {
-			free(pathname);
+		if (errno == ENOENT)
 			return -1;
-		}
 
 		pr_err("failed to open: %s", pathname);
 	}
@@ -2172,22 +3047,56 @@ out:
 
 	free(line);
 	fclose(fp);
-	free(pathname);
 	free(func);
 	return ret;
 }
 
+static int load_debug_file(struct debug_info *dinfo, struct symtab *symtab,
+			   const char *dirname, const char *filename,
+			   char *build_id, bool needs_srcline)
+{
+	char *pathname;
+	int ret;
+
+	xasprintf(&pathname, "%s/%s.dbg", dirname, basename(filename));
+
+	if (!match_debug_file(pathname, filename, build_id)) {
+		char *newfile;
+		int len;
+
+		newfile = make_new_symbol_filename(pathname, filename, build_id);
+		len = strlen(newfile);
+		strcpy(newfile + len - 3, "dbg");
+
+		/* replace pathname */
+		free(pathname);
+		pathname = newfile;
+	}
+
+	/* no need to read locations in the text if it has the line table */
+	if (needs_srcline &&
+	    load_line_table(dinfo, symtab, pathname, build_id) == 0)
+		needs_srcline = false;
+
+	ret = read_debug_file(dinfo, symtab, pathname, needs_srcline);
+	free(pathname);
+	return ret;
+}
+
 void load_debug_info(struct symtabs *symtabs, bool needs_srcline)
 {
 	struct uftrace_mmap *map;
 
 	for_each_map(symtabs, map) {
-		struct symtab *stab = &map->mod->symtab;
-		struct debug_info *dinfo = &map->mod->dinfo;
+		struct symtab *stab;
+		struct debug_info *dinfo;
 
 		if (map->mod == NULL)
 			continue;
 
+		stab = &map->mod->symtab;
+		dinfo = &map->mod->dinfo;
+
 		if (!debug_info_has_location(dinfo) && !debug_info_has_argspec(dinfo)) {
 			load_debug_file(dinfo, stab, symtabs->dirname,
 					map->libname, map->build_id,
@@ -2216,7 +3125,6 @@ struct debug_location *find_file_line(struct symtabs *symtabs, uint64_t addr)
 	struct symtab *symtab;
 	struct debug_info *dinfo;
 	struct sym *sym = NULL;
-	ptrdiff_t idx;
 
 	map = find_map(symtabs, addr);
 
@@ -2236,8 +3144,245 @@ struct debug_location *find_file_line(struct symtabs *symtabs, uint64_t addr)
 	if (sym == NULL)
 		return NULL;
 
-	idx = sym - symtab->sym;
-	return &dinfo->locs[idx];
+	return find_debug_location(dinfo, symtab, sym);
+}
+
+/**
+ * get_debug_cache_dir - return the debug cache directory of the user
+ *
+ * It's "$XDG_CACHE_HOME/uftrace" or "~/.cache/uftrace".  The caller
+ * should free the returned string.  It returns %NULL if no home.
+ */
+char *get_debug_cache_dir(void)
+{
+	char *cache_home = getenv("XDG_CACHE_HOME");
+	char *home = getenv("HOME");
+	char *dirname;
+
+	if (cache_home && *cache_home)
+		xasprintf(&dirname, "%s/uftrace", cache_home);
+	else if (home && *home)
+		xasprintf(&dirname, "%s/.cache/uftrace", home);
+	else
+		return NULL;
+
+	return dirname;
+}
+
+/* read the build-id and the cache file name in the debug file header */
+static int read_debug_cache_name(const char *dbgfile, char **build_id,
+				 char **cache_name)
+{
+	FILE *fp;
+	char *line = NULL;
+	size_t len = 0;
+
+	fp = fopen(dbgfile, "r");
+	if (fp == NULL)
+		return -1;
+
+	*build_id = NULL;
+	*cache_name = NULL;
+
+	while (getline(&line, &len, fp) >= 0) {
+		if (line[0] != '#')
+			break;
+
+		/* remove trailing newline */
+		line[strcspn(line, "\n")] = '\0';
+
+		if (!strncmp(line, "# build-id: ", 12) && *build_id == NULL)
+			*build_id = xstrdup(line + 12);
+		if (!strncmp(line, "# cache file: ", 14) && *cache_name == NULL)
+			*cache_name = xstrdup(line + 14);
+	}
+
+	free(line);
+	fclose(fp);
+
+	if (*build_id && *cache_name && !strchr(*build_id, '/') &&
+	    !strchr(*cache_name, '/') && **build_id && **cache_name != '.')
+		return 0;
+
+	free(*build_id);
+	free(*cache_name);
+	return -1;
+}
+
+static void save_debug_cache(const char *dbgfile, const char *cache_file)
+{
+	char *tmp;
+
+	/* mark it recently used */
+	if (utimes(cache_file, NULL) == 0)
+		return;
+
+	if (create_debug_cache_dir(cache_file) < 0) {
+		pr_dbg("cannot create debug cache directory: %m\n");
+		return;
+	}
+
+	/* other processes might save the same file concurrently */
+	xasprintf(&tmp, "%s.%d", cache_file, getpid());
+	unlink(tmp);
+
+	if (copy_debug_file(dbgfile, tmp) < 0) {
+		pr_dbg("cannot save debug cache: %s: %m\n", cache_file);
+	}
+	else if (rename(tmp, cache_file) < 0) {
+		pr_dbg("cannot rename debug cache: %s: %m\n", cache_file);
+		unlink(tmp);
+	}
+	else {
+		pr_dbg2("save debug cache: %s\n", cache_file);
+	}
+
+	free(tmp);
+}
+
+struct debug_cache_file {
+	char	*name;
+	time_t	mtime;
+	off_t	size;
+};
+
+static int cache_file_cmp(const void *a, const void *b)
+{
+	const struct debug_cache_file *fa = a;
+	const struct debug_cache_file *fb = b;
+
+	/* newer files come first */
+	if (fa->mtime != fb->mtime)
+		return fa->mtime > fb->mtime ? -1 : 1;
+	return 0;
+}
+
+/* remove cache files not used recently or exceeding the size limit */
+static void evict_debug_cache(const char *cache_dir)
+{
+	struct debug_cache_file *files = NULL;
+	int nr_files = 0, nr_alloc = 0;
+	struct dirent *bent, *fent;
+	DIR *bdir, *fdir;
+	struct stat st;
+	char *subdir, *name;
+	time_t now = time(NULL);
+	uint64_t total = 0;
+	int i;
+
+	bdir = opendir(cache_dir);
+	if (bdir == NULL)
+		return;
+
+	while ((bent = readdir(bdir)) != NULL) {
+		if (bent->d_name[0] == '.')
+			continue;
+
+		xasprintf(&subdir, "%s/%s", cache_dir, bent->d_name);
+		fdir = opendir(subdir);
+		if (fdir == NULL) {
+			free(subdir);
+			continue;
+		}
+
+		while ((fent = readdir(fdir)) != NULL) {
+			if (fent->d_name[0] == '.')
+				continue;
+
+			xasprintf(&name, "%s/%s", subdir, fent->d_name);
+			if (stat(name, &st) < 0 || !S_ISREG(st.st_mode)) {
+				free(name);
+				continue;
+			}
+
+			if (now - st.st_mtime > DEBUG_CACHE_MAX_AGE) {
+				pr_dbg2("remove old debug cache: %s\n", name);
+				unlink(name);
+				free(name);
+				continue;
+			}
+
+			if (nr_files == nr_alloc) {
+				nr_alloc = nr_alloc ? nr_alloc * 2 : 64;
+				files = xrealloc(files, nr_alloc * sizeof(*files));
+			}
+			files[nr_files].name  = name;
+			files[nr_files].mtime = st.st_mtime;
+			files[nr_files].size  = st.st_size;
+			nr_files++;
+		}
+		closedir(fdir);
+		free(subdir);
+	}
+
+	qsort(files, nr_files, sizeof(*files), cache_file_cmp);
+
+	for (i = 0; i < nr_files; i++) {
+		total += files[i].size;
+		if (total > DEBUG_CACHE_MAX_SIZE) {
+			pr_dbg2("remove debug cache: %s\n", files[i].name);
+			unlink(files[i].name);
+		}
+		free(files[i].name);
+	}
+	free(files);
+
+	/* remove empty directories (it fails if not empty) */
+	rewinddir(bdir);
+	while ((bent = readdir(bdir)) != NULL) {
+		if (bent->d_name[0] == '.')
+			continue;
+
+		xasprintf(&subdir, "%s/%s", cache_dir, bent->d_name);
+		rmdir(subdir);
+		free(subdir);
+	}
+	closedir(bdir);
+}
+
+/**
+ * update_debug_cache - save debug files to the cache and evict old ones
+ * @dirname: uftrace data directory
+ * @cache_dir: debug cache directory
+ *
+ * This is called by uftrace record after the recording is done.  The
+ * debug files written by libmcount have the name of the cache file for
+ * them.  New files are copied to the cache and existing files are
+ * marked as recently used.
+ */
+void update_debug_cache(const char *dirname, const char *cache_dir)
+{
+	struct dirent *ent;
+	DIR *dir;
+	char *dbgfile, *cache_file;
+	char *build_id, *cache_name;
+	size_t len;
+
+	dir = opendir(dirname);
+	if (dir == NULL)
+		return;
+
+	while ((ent = readdir(dir)) != NULL) {
+		len = strlen(ent->d_name);
+		if (len < 5 || strcmp(ent->d_name + len - 4, ".dbg"))
+			continue;
+
+		xasprintf(&dbgfile, "%s/%s", dirname, ent->d_name);
+
+		if (read_debug_cache_name(dbgfile, &build_id, &cache_name) == 0) {
+			xasprintf(&cache_file, "%s/%s/%s",
+				  cache_dir, build_id, cache_name);
+			save_debug_cache(dbgfile, cache_file);
+
+			free(cache_file);
+			free(build_id);
+			free(cache_name);
+		}
+		free(dbgfile);
+	}
+	closedir(dir);
+
+	evict_debug_cache(cache_dir);
 }
 
 #ifdef UNIT_TEST
@@ -2454,7 +3599,7 @@ TEST_CASE(dwarf_same_file_name1)
 	int ret;
 
 	/* recover from earlier failures */
-	system("rm -f name*.dbg");
+	system("rm -f name*.dbg name*.dbgl");
 
 	pr_dbg("init debug info and save .dbg files (no build-id)\n");
 	init_test_module_info(&save_mod[0], &save_mod[1], true);
@@ -2490,7 +3635,7 @@ TEST_CASE(dwarf_same_file_name1)
 	free(load_mod[0]);
 	free(load_mod[1]);
 
-	system("rm -f name*.dbg");
+	system("rm -f name*.dbg name*.dbgl");
 
 	return ret;
 }
@@ -2502,7 +3647,7 @@ TEST_CASE(dwarf_same_file_name2)
 	int ret;
 
 	/* recover from earlier failures */
-	system("rm -f name*.dbg");
+	system("rm -f name*.dbg name*.dbgl");
 
 	pr_dbg("init debug info and save .dbg files (with build-id)\n");
 	init_test_module_info(&save_mod[0], &save_mod[1], true);
@@ -2541,9 +3686,182 @@ TEST_CASE(dwarf_same_file_name2)
 	free(load_mod[0]);
 	free(load_mod[1]);
 
-	system("rm -f name*.dbg");
+	system("rm -f name*.dbg name*.dbgl");
+
+	return ret;
+}
+
+TEST_CASE(dwarf_debug_cache)
+{
+	struct uftrace_module *save_mod[2];
+	struct uftrace_module *load_mod[2];
+	struct uftrace_mmap *map;
+	char *cache_file;
+	char *other_file;
+	int ret;
+
+	/* recover from earlier failures */
+	system("rm -rf name*.dbg name*.dbgl dbgcache.test");
+	setenv("UFTRACE_DEBUG_CACHE", "dbgcache.test", 1);
+
+	init_test_module_info(&save_mod[0], &save_mod[1], true);
+
+	map = xzalloc(sizeof(*map) + strlen(save_mod[0]->name) + 1);
+	strcpy(map->libname, save_mod[0]->name);
+	strcpy(map->build_id, save_mod[0]->build_id);
+
+	xasprintf(&cache_file, "dbgcache.test/%s/name-%08x.dbg",
+		  map->build_id, (uint32_t)hashmap_string_hash("key"));
+	xasprintf(&other_file, "dbgcache.test/%s/name-%08x.dbg",
+		  map->build_id, (uint32_t)hashmap_string_hash("other"));
+
+	pr_dbg("save debug info to the cache\n");
+	ret = load_debug_cache(&save_mod[0]->dinfo, &save_mod[0]->symtab,
+			       map, "key");
+	TEST_EQ(ret, -1);
+	TEST_STREQ(save_mod[0]->dinfo.cache_file, cache_file);
+
+	save_debug_entries(&save_mod[0]->dinfo, ".", map->libname, map->build_id);
+	TEST_NE(access(cache_file, F_OK), 0);
+
+	/* uftrace record copies it to the cache */
+	update_debug_cache(".", "dbgcache.test");
+	TEST_EQ(access(cache_file, F_OK), 0);
+	system("rm -f name*.dbg name*.dbgl");
+
+	pr_dbg("load debug info from the cache\n");
+	init_test_module_info(&load_mod[0], &load_mod[1], false);
+
+	ret = load_debug_cache(&load_mod[0]->dinfo, &load_mod[0]->symtab,
+			       map, "key");
+	TEST_EQ(ret, 0);
+	TEST_EQ(load_mod[0]->dinfo.cached, true);
+
+	ret = check_test_debug_info(&save_mod[0]->dinfo, &load_mod[0]->dinfo);
+
+	if (ret == TEST_OK) {
+		pr_dbg("save the cached file in the data directory\n");
+		save_debug_entries(&load_mod[0]->dinfo, ".", map->libname,
+				   map->build_id);
+		ret = access("name.dbg", F_OK) ? TEST_NG : TEST_OK;
+	}
+
+	if (ret == TEST_OK) {
+		pr_dbg("do not use a cache file having a different key\n");
+		/* as if the keys have a same hash */
+		rename(cache_file, other_file);
+		if (load_debug_cache(&load_mod[1]->dinfo, &load_mod[1]->symtab,
+				     map, "other") == 0)
+			ret = TEST_NG;
+		if (load_mod[1]->dinfo.cache_file != NULL)
+			ret = TEST_NG;
+	}
+
+	pr_dbg("release debug info\n");
+	release_debug_info(&save_mod[0]->dinfo);
+	release_debug_info(&load_mod[0]->dinfo);
+	free(save_mod[0]);
+	free(save_mod[1]);
+	free(load_mod[0]);
+	free(load_mod[1]);
+	free(map);
+	free(cache_file);
+	free(other_file);
+
+	unsetenv("UFTRACE_DEBUG_CACHE");
+	system("rm -rf name*.dbg name*.dbgl dbgcache.test");
 
 	return ret;
 }
 
+TEST_CASE(dwarf_line_table)
+{
+	struct uftrace_module *save_mod, *load_mod;
+	const char mod_name[] = "/some/where/line/name";
+	const char *files[] = { "a.c", "b.c", "include/c.h" };
+	int nr_sym = LINE_TABLE_BLOCK * 3 + 5;
+	struct debug_location *loc;
+	int i, ret;
+
+	/* recover from earlier failures */
+	system("rm -f name*.dbg name*.dbgl");
+
+	save_mod = xzalloc(sizeof(*save_mod) + sizeof(mod_name));
+	load_mod = xzalloc(sizeof(*load_mod) + sizeof(mod_name));
+	strcpy(save_mod->name, mod_name);
+	strcpy(load_mod->name, mod_name);
+	strcpy(save_mod->build_id, "1234567890abcdef");
+	strcpy(load_mod->build_id, "1234567890abcdef");
+
+	save_mod->symtab.sym = xcalloc(nr_sym, sizeof(struct sym));
+	save_mod->symtab.nr_sym = nr_sym;
+	for (i = 0; i < nr_sym; i++) {
+		struct sym *sym = &save_mod->symtab.sym[i];
+
+		sym->addr = 0x1000 + i * 0x30;
+		sym->size = 0x30;
+		sym->type = ST_GLOBAL_FUNC;
+		xasprintf(&sym->name, "func%d", i);
+	}
+	load_mod->symtab = save_mod->symtab;
+
+	pr_dbg("save line table with %d symbols\n", nr_sym);
+	save_mod->dinfo.files = RB_ROOT;
+	save_mod->dinfo.nr_locs = nr_sym;
+	save_mod->dinfo.locs = xcalloc(nr_sym, sizeof(*save_mod->dinfo.locs));
+	for (i = 0; i < nr_sym; i++) {
+		/* some symbols have no location */
+		if (i % 7 == 3)
+			continue;
+
+		loc = &save_mod->dinfo.locs[i];
+		loc->sym  = &save_mod->symtab.sym[i];
+		loc->file = get_debug_file(&save_mod->dinfo, files[i % 3]);
+		/* lines go back and forth to check negative deltas */
+		loc->line = (i % 2) ? 1000 - i : i;
+		save_mod->dinfo.nr_locs_used++;
+	}
+
+	save_debug_entries(&save_mod->dinfo, ".", save_mod->name,
+			   save_mod->build_id);
+	TEST_EQ(access("name.dbgl", F_OK), 0);
+
+	pr_dbg("load line table and compare locations\n");
+	ret = load_debug_file(&load_mod->dinfo, &load_mod->symtab, ".",
+			      load_mod->name, load_mod->build_id, true);
+	TEST_EQ(ret, 0);
+	TEST_NE(load_mod->dinfo.line_map, NULL);
+	TEST_EQ(load_mod->dinfo.nr_locs_used, save_mod->dinfo.nr_locs_used);
+
+	for (i = 0; i < nr_sym; i++) {
+		struct debug_location *save_loc = &save_mod->dinfo.locs[i];
+		struct sym *sym = &load_mod->symtab.sym[i];
+
+		loc = find_debug_location(&load_mod->dinfo, &load_mod->symtab, sym);
+		TEST_NE(loc, NULL);
+
+		if (save_loc->sym == NULL) {
+			TEST_EQ(loc->file, NULL);
+			continue;
+		}
+
+		TEST_NE(loc->file, NULL);
+		TEST_STREQ(save_loc->file->name, loc->file->name);
+		TEST_EQ(save_loc->line, loc->line);
+	}
+
+	pr_dbg("release debug info\n");
+	release_debug_info(&save_mod->dinfo);
+	release_debug_info(&load_mod->dinfo);
+	for (i = 0; i < nr_sym; i++)
+		free(save_mod->symtab.sym[i].name);
+	free(save_mod->symtab.sym);
+	free(save_mod);
+	free(load_mod);
+
+	system("rm -f name*.dbg name*.dbgl");
+
+	return TEST_OK;
+}
+
 #endif /* UNIT_TEST */
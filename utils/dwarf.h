@@ -10,6 +10,8 @@
 #include "utils/list.h"
 
 struct symtabs;
+struct symtab;
+struct sym;
 
 #ifdef HAVE_LIBDW
 # include <elfutils/libdw.h>
@@ -21,6 +23,7 @@ struct debug_file {
 	struct list_head	list;
 	struct rb_node		node;
 	char			*name;
+	int			id;
 };
 
 struct debug_location {
@@ -38,13 +41,23 @@ struct debug_info {
 	struct rb_root		files;
 	struct debug_location	*locs;
 	int			nr_locs;
+	/* number of symbols having a location (not counting duplicates) */
 	int			nr_locs_used;
 	int			file_type;
 	bool			needs_args;
 	bool			loaded;
+	bool			cached;      /* loaded from the debug cache */
 	char			*base_dir;
+	char			*cache_file; /* debug cache file for the module */
+	char			*cache_key;  /* full key (options) of the cache */
+	/* mapped line table (locations are looked up on demand) */
+	void			*line_map;
+	size_t			line_map_size;
+	struct debug_file	*line_files;
 };
 
+extern int debug_info_threads;
+
 extern void prepare_debug_info(struct symtabs *symtabs,
 			       enum uftrace_pattern_type ptype,
 			       char *argspec, char *retspec,
@@ -57,8 +70,13 @@ extern char * get_dwarf_argspec(struct debug_info *dinfo, char *name,
 extern char * get_dwarf_retspec(struct debug_info *dinfo, char *name,
 				unsigned long addr);
 struct debug_location *find_file_line(struct symtabs *symtabs, uint64_t addr);
+struct debug_location *find_debug_location(struct debug_info *dinfo,
+					   struct symtab *symtab,
+					   struct sym *sym);
 extern void save_debug_info(struct symtabs *symtabs, const char *dirname);
 extern void load_debug_info(struct symtabs *symtabs, bool needs_srcline);
 extern void save_debug_file(FILE *fp, char code, char *str, unsigned long val);
+extern char *get_debug_cache_dir(void);
+extern void update_debug_cache(const char *dirname, const char *cache_dir);
 
 #endif /* UFTRACE_DWARF_H */
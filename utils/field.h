@@ -45,6 +45,10 @@ enum display_field_id {
 	REPORT_F_SELF_TIME_MIN,
 	REPORT_F_SELF_TIME_MAX,
 	REPORT_F_CALL,
+	REPORT_F_TOTAL_TIME_P50,
+	REPORT_F_TOTAL_TIME_P90,
+	REPORT_F_TOTAL_TIME_P99,
+	REPORT_F_TOTAL_TIME_P999,
 
 	REPORT_F_TASK_TOTAL_TIME = 0,
 	REPORT_F_TASK_SELF_TIME,
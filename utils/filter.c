@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <ctype.h>
 #include <regex.h>
 #include <fnmatch.h>
 #include <sys/utsname.h>
@@ -59,6 +60,8 @@ static void print_trigger(struct uftrace_trigger *tr)
 		pr_dbg("\ttrigger: recover\n");
 	if (tr->flags & TRIGGER_FL_FINISH)
 		pr_dbg("\ttrigger: finish\n");
+	if (tr->flags & TRIGGER_FL_SNAPSHOT)
+		pr_dbg("\ttrigger: snapshot\n");
 
 	if (tr->flags & TRIGGER_FL_ARGUMENT) {
 		struct uftrace_arg_spec *arg;
@@ -604,6 +607,13 @@ static int parse_finish_action(char *action, struct uftrace_trigger *tr,
 	return 0;
 }
 
+static int parse_snapshot_action(char *action, struct uftrace_trigger *tr,
+				 struct uftrace_filter_setting *setting)
+{
+	tr->flags |= TRIGGER_FL_SNAPSHOT;
+	return 0;
+}
+
 static int parse_filter_action(char *action, struct uftrace_trigger *tr,
 			       struct uftrace_filter_setting *setting)
 {
@@ -660,6 +670,7 @@ static const struct trigger_action_parser actions[] = {
 	{ "hide",      parse_hide_action,         TRIGGER_FL_FILTER, },
 	{ "trace",     parse_trace_action,        TRIGGER_FL_SIGNAL, },
 	{ "finish",    parse_finish_action,       TRIGGER_FL_SIGNAL, },
+	{ "snapshot",  parse_snapshot_action,     TRIGGER_FL_SIGNAL, },
 	{ "read=",     parse_read_action, },
 	{ "color=",    parse_color_action, },
 	{ "backtrace", parse_backtrace_action, },
@@ -720,6 +731,102 @@ out:
 	return ret;
 }
 
+/* words which can appear in demangled names but not in mangled names */
+static const char *demangler_words[] = {
+	"std", "allocator", "basic_string", "basic_istream", "basic_ostream",
+	"basic_iostream", "char_traits", "string", "operator", "anonymous",
+	"namespace", "lambda", "unnamed", "type", "clone", "thunk", "virtual",
+	"covariant", "return", "construction", "vtable", "typeinfo", "VTT",
+	"guard_variable", "ref_temp", "reference", "temporary", "transaction",
+	"TLS", "init", "wrapper", "function", "for", "name", "signed",
+	"unsigned", "wchar_t", "char8_t", "char16_t", "char32_t", "short",
+	"int", "long", "float", "double", "bool", "void", "const",
+	"volatile", "restrict", "decltype", "auto", "nullptr",
+};
+
+/*
+ * Find a literal word in the pattern which should be in (mangled) names
+ * of matching symbols.  Identifiers in a demangled name of the Itanium
+ * C++ ABI (starting with "_Z") come from the mangled name as is, so such
+ * symbols without the word can be skipped before demangling.  Other
+ * names should be checked after demangling.  It returns %NULL if no such
+ * word is found.
+ */
+static char *get_filter_keyword(struct uftrace_pattern *patt)
+{
+	char *p = patt->patt;
+	char *word = NULL;
+	size_t len = 0;
+	size_t i, n;
+
+	switch (patt->type) {
+	case PATT_SIMPLE:
+		break;
+	case PATT_REGEX:
+		/* alternation, group and escape can make a word optional */
+		if (strpbrk(p, "|()\\"))
+			return NULL;
+		break;
+	case PATT_GLOB:
+		if (strchr(p, '\\'))
+			return NULL;
+		break;
+	default:
+		return NULL;
+	}
+
+	while (*p) {
+		/* skip a bracket expression ("]" can be the first char) */
+		if (patt->type != PATT_SIMPLE && *p == '[') {
+			p++;
+			if (*p == '!' || *p == '^')
+				p++;
+			if (*p == '\0')
+				return NULL;
+			p = strchr(p + 1, ']');
+			if (p == NULL)
+				return NULL;
+			p++;
+			continue;
+		}
+
+		for (n = 0; isalnum(p[n]) || p[n] == '_'; n++)
+			continue;
+		if (n == 0) {
+			p++;
+			continue;
+		}
+
+		/* the last char is optional */
+		if (patt->type == PATT_REGEX && p[n] && strchr("?*{", p[n]))
+			n--;
+
+		if (n > len) {
+			word = p;
+			len = n;
+		}
+		p += n ?: 1;
+	}
+
+	/* too short or it might come from the demangler */
+	if (len < 3 || strspn(word, "0123456789") >= len)
+		return NULL;
+
+	word = xstrndup(word, len);
+	if (strstr(word, "__"))
+		goto out;
+
+	for (i = 0; i < ARRAY_SIZE(demangler_words); i++) {
+		if (strstr(demangler_words[i], word))
+			goto out;
+	}
+	return word;
+
+out:
+	free(word);
+	return NULL;
+}
+
 static int add_trigger_entry(struct rb_root *root,
 			     struct uftrace_pattern *patt,
 			     struct uftrace_trigger *tr,
@@ -730,19 +837,29 @@ static int add_trigger_entry(struct rb_root *root,
 	struct symtab *symtab = &map->mod->symtab;
 	struct debug_info *dinfo = &map->mod->dinfo;
 	struct sym *sym;
+	char *keyword;
+	char *name;
 	unsigned i;
 	int ret = 0;
 
+	keyword = get_filter_keyword(patt);
+
 	for (i = 0; i < symtab->nr_sym; i++) {
 		sym = &symtab->sym[i];
 
-		if (!match_filter_pattern(patt, sym->name))
+		if (setting->plt_only && sym->type != ST_PLT_FUNC)
 			continue;
 
-		if (setting->plt_only && sym->type != ST_PLT_FUNC)
+		/* do not demangle C++ names which cannot match */
+		if (keyword && !strncmp(sym->name, "_Z", 2) &&
+		    !strstr(sym->name, keyword))
+			continue;
+
+		name = symbol_name(sym);
+		if (!match_filter_pattern(patt, name))
 			continue;
 
-		filter.name  = sym->name;
+		filter.name  = name;
 		filter.start = sym->addr;
 		filter.end   = sym->addr + sym->size;
 
@@ -750,6 +867,7 @@ static int add_trigger_entry(struct rb_root *root,
 				  patt->type == PATT_SIMPLE, dinfo, setting);
 	}
 
+	free(keyword);
 	return ret;
 }
 
@@ -1300,6 +1418,43 @@ TEST_CASE(filter_match)
 	return TEST_OK;
 }
 
+#define KEYWORD_TEST(t, p, k)						\
+do {									\
+	struct uftrace_pattern patt;					\
+	char *keyword;							\
+									\
+	init_filter_pattern(t, &patt, p);				\
+	keyword = get_filter_keyword(&patt);				\
+	pr_dbg("keyword of %s should be %s\n", p, k ?: "(null)");	\
+	if (k)								\
+		TEST_STREQ(keyword, (char *)k);				\
+	else								\
+		TEST_EQ(keyword, NULL);					\
+	free(keyword);							\
+	free_filter_pattern(&patt);					\
+} while (0)
+
+TEST_CASE(filter_keyword)
+{
+	KEYWORD_TEST(PATT_SIMPLE, "foo::bar", "foo");
+	KEYWORD_TEST(PATT_SIMPLE, "ns::method", "method");
+	KEYWORD_TEST(PATT_REGEX, "^foo.*baz$", "foo");
+	KEYWORD_TEST(PATT_REGEX, "foo::barz?", "foo");
+	KEYWORD_TEST(PATT_REGEX, "[abc]xx::yyyy", "yyyy");
+	KEYWORD_TEST(PATT_REGEX, "foo|bar", NULL);
+	KEYWORD_TEST(PATT_GLOB, "foo::b*", "foo");
+	KEYWORD_TEST(PATT_GLOB, "[]ab]::xyz", "xyz");
+
+	pr_dbg("words from the demangler cannot be used\n");
+	KEYWORD_TEST(PATT_SIMPLE, "std::vector", "vector");
+	KEYWORD_TEST(PATT_REGEX, "operator new", NULL);
+	KEYWORD_TEST(PATT_REGEX, "in", NULL);
+	KEYWORD_TEST(PATT_GLOB, "*string*", NULL);
+	KEYWORD_TEST(PATT_GLOB, "__vtable__*", NULL);
+
+	return TEST_OK;
+}
+
 TEST_CASE(trigger_setup_actions)
 {
 	struct symtabs stabs = {
@@ -36,6 +36,7 @@ enum trigger_flag {
 	TRIGGER_FL_CALLER	= (1U << 15),
 	TRIGGER_FL_SIGNAL	= (1U << 16),
 	TRIGGER_FL_HIDE		= (1U << 17),
+	TRIGGER_FL_SNAPSHOT	= (1U << 18),
 };
 
 enum filter_mode {
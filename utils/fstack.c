@@ -139,6 +139,30 @@ static void update_first_timestamp(struct uftrace_data *handle,
 		handle->time_range.first = rstack->time;
 }
 
+/**
+ * skip_task_handle - ignore records in the task
+ * @handle - file handle
+ * @task   - task to be ignored
+ *
+ * This function marks @task as done so that read_rstack() won't return
+ * its records.  But the first record is still read to keep the elapsed
+ * time same.
+ */
+void skip_task_handle(struct uftrace_data *handle,
+		      struct uftrace_task_reader *task)
+{
+	task->done = true;
+
+	/* need to read the data to check elapsed time */
+	if (task->fp) {
+		if (!__read_task_ustack(task))
+			update_first_timestamp(handle, task, &task->ustack);
+
+		fclose(task->fp);
+		task->fp = NULL;
+	}
+}
+
 /**
  * fstack_setup_task - setup task filters using tid
  * @tid_filter - CSV of tid (or possibly separated by  ':')
@@ -198,17 +222,7 @@ setup:
 		}
 
 		if (!found) {
-			task->done = true;
-
-			/* need to read the data to check elapsed time */
-			if (task->fp) {
-				if (!__read_task_ustack(task)) {
-					update_first_timestamp(handle, task,
-							       &task->ustack);
-				}
-				fclose(task->fp);
-				task->fp = NULL;
-			}
+			skip_task_handle(handle, task);
 			continue;
 		}
 
@@ -107,6 +107,8 @@ extern bool live_disabled;
 struct uftrace_task_reader *get_task_handle(struct uftrace_data *handle,
 					   int tid);
 void reset_task_handle(struct uftrace_data *handle);
+void skip_task_handle(struct uftrace_data *handle,
+		      struct uftrace_task_reader *task);
 
 void fstack_setup_task(char *tid_filter, struct uftrace_data *handle);
 
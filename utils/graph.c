@@ -10,6 +10,162 @@ static void *cb_arg;
 
 static struct rb_root task_graph_root = RB_ROOT;
 
+#define GRAPH_CHUNK_SIZE  (64 * 1024)
+
+struct graph_chunk {
+	struct graph_chunk	*next;
+	size_t			size;
+	size_t			used;
+	char			data[];
+};
+
+/* allocate zero-filled memory which will be freed by graph_destroy() */
+static void *graph_alloc(struct uftrace_graph *graph, size_t size)
+{
+	struct graph_chunk *chunk = graph->chunks;
+	void *ptr;
+
+	size = ALIGN(size, sizeof(long));
+
+	if (chunk == NULL || chunk->used + size > chunk->size) {
+		size_t chunk_size = GRAPH_CHUNK_SIZE;
+
+		if (chunk_size < size + sizeof(*chunk))
+			chunk_size = size + sizeof(*chunk);
+
+		chunk = xmalloc(chunk_size);
+		chunk->size = chunk_size - sizeof(*chunk);
+		chunk->used = 0;
+		chunk->next = graph->chunks;
+		graph->chunks = chunk;
+	}
+
+	ptr = chunk->data + chunk->used;
+	chunk->used += size;
+
+	memset(ptr, 0, size);
+	return ptr;
+}
+
+static char *graph_intern_name(struct uftrace_graph *graph, char *name)
+{
+	char *str;
+
+	if (graph->names == NULL) {
+		graph->names = hashmap_create(256, hashmap_string_hash,
+					      hashmap_string_equals);
+	}
+
+	str = hashmap_get(graph->names, name);
+	if (str == NULL) {
+		str = xstrdup(name);
+		hashmap_put(graph->names, str, str);
+	}
+	return str;
+}
+
+static size_t graph_node_hash(struct uftrace_graph_node *parent, char *name)
+{
+	uint64_t key = (uintptr_t)parent ^ ((uintptr_t)name << 16);
+
+	/* from hash_64() in the Linux kernel */
+	return (key * 0x61c8864680b583ebULL) >> 32;
+}
+
+static void graph_insert_slot(struct uftrace_graph *graph,
+			      struct uftrace_graph_node *node)
+{
+	size_t mask = graph->nr_slots - 1;
+	size_t pos = graph_node_hash(node->parent, node->name) & mask;
+
+	while (graph->slots[pos])
+		pos = (pos + 1) & mask;
+	graph->slots[pos] = node;
+}
+
+static void graph_expand_slots(struct uftrace_graph *graph)
+{
+	struct uftrace_graph_node **old = graph->slots;
+	size_t nr_old = graph->nr_slots;
+	size_t i;
+
+	graph->nr_slots = nr_old ? nr_old * 2 : 256;
+	graph->slots = xcalloc(graph->nr_slots, sizeof(*graph->slots));
+
+	for (i = 0; i < nr_old; i++) {
+		if (old[i])
+			graph_insert_slot(graph, old[i]);
+	}
+	free(old);
+}
+
+/**
+ * graph_find_node - find a child node of given name
+ * @graph: graph to search
+ * @parent: parent node
+ * @name: name of child node
+ *
+ * This function returns a child node of @parent which has @name.
+ * Or %NULL if not found.
+ */
+struct uftrace_graph_node * graph_find_node(struct uftrace_graph *graph,
+					    struct uftrace_graph_node *parent,
+					    char *name)
+{
+	struct uftrace_graph_node *node;
+	size_t mask = graph->nr_slots - 1;
+	size_t pos;
+
+	if (graph->names == NULL || graph->nr_slots == 0)
+		return NULL;
+
+	/* all node names are interned, so it can compare pointers */
+	name = hashmap_get(graph->names, name);
+	if (name == NULL)
+		return NULL;
+
+	pos = graph_node_hash(parent, name) & mask;
+	while ((node = graph->slots[pos]) != NULL) {
+		if (node->parent == parent && node->name == name)
+			return node;
+		pos = (pos + 1) & mask;
+	}
+	return NULL;
+}
+
+/**
+ * graph_new_node - add a new child node
+ * @graph: graph to add the node
+ * @parent: parent node
+ * @name: name of the new node
+ * @node_size: size of node (can be bigger than struct uftrace_graph_node)
+ *
+ * This function allocates a new node and adds it to the end of children
+ * list of @parent.  It's not checked whether it already has a child of
+ * the same name.
+ */
+struct uftrace_graph_node * graph_new_node(struct uftrace_graph *graph,
+					   struct uftrace_graph_node *parent,
+					   char *name, size_t node_size)
+{
+	struct uftrace_graph_node *node;
+
+	node = graph_alloc(graph, node_size);
+	node->name = graph_intern_name(graph, name);
+	INIT_LIST_HEAD(&node->head);
+
+	node->parent = parent;
+	list_add_tail(&node->list, &parent->head);
+	parent->nr_edges++;
+
+	/* keep load factor below 0.5 */
+	if (++graph->nr_nodes * 2 > graph->nr_slots)
+		graph_expand_slots(graph);
+	graph_insert_slot(graph, node);
+
+	return node;
+}
+
 void graph_init(struct uftrace_graph *graph, struct uftrace_session *s)
 {
 	memset(graph, 0, sizeof(*graph));
@@ -77,25 +233,14 @@ static int add_graph_entry(struct uftrace_task_graph *tg, char *name,
 	if (curr == NULL || fstack == NULL)
 		return -1;
 
-	list_for_each_entry(node, &curr->head, list) {
-		if (name && !strcmp(name, node->name))
-			break;
-	}
-
-	if (list_no_entry(node, &curr->head, list)) {
+	node = graph_find_node(tg->graph, curr, name ?: "none");
+	if (node == NULL) {
 		struct uftrace_trigger tr;
 		struct uftrace_session *sess = tg->graph->sess;
 
-		node = xzalloc(node_size);
+		node = graph_new_node(tg->graph, curr, name ?: "none", node_size);
 
 		node->addr = fstack->addr;
-		node->name = xstrdup(name ?: "none");
-		INIT_LIST_HEAD(&node->head);
-
-		node->parent = curr;
-		list_add_tail(&node->list, &node->parent->head);
-		node->parent->nr_edges++;
-
 		node->loc = loc;
 
 		if (uftrace_match_filter(fstack->addr, &sess->fixups, &tr)) {
@@ -218,25 +363,34 @@ int graph_add_node(struct uftrace_task_graph *tg, int type, char *name,
 		return 0;
 }
 
-static void graph_destroy_node(struct uftrace_graph_node *node)
+static bool graph_free_name(void *key, void *value, void *arg)
 {
-	struct uftrace_graph_node *child, *tmp;
-
-	list_for_each_entry_safe(child, tmp, &node->head, list)
-		graph_destroy_node(child);
-
-	list_del(&node->list);
-	free(node->name);
-	free(node);
+	free(key);
+	return true;
 }
 
 void graph_destroy(struct uftrace_graph *graph)
 {
-	struct uftrace_graph_node *node, *tmp;
+	struct graph_chunk *chunk, *next;
 	struct uftrace_special_node *snode, *stmp;
 
-	list_for_each_entry_safe(node, tmp, &graph->root.head, list)
-		graph_destroy_node(node);
+	for (chunk = graph->chunks; chunk; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+	graph->chunks = NULL;
+	INIT_LIST_HEAD(&graph->root.head);
+
+	if (graph->names) {
+		hashmap_for_each(graph->names, graph_free_name, NULL);
+		hashmap_free(graph->names);
+		graph->names = NULL;
+	}
+
+	free(graph->slots);
+	graph->slots = NULL;
+	graph->nr_slots = 0;
+	graph->nr_nodes = 0;
 
 	list_for_each_entry_safe(snode, stmp, &graph->special_nodes, list) {
 		list_del(&snode->list);
@@ -8,6 +8,7 @@
 #include "utils/list.h"
 #include "utils/rbtree.h"
 #include "utils/fstack.h"
+#include "utils/hashmap.h"
 
 struct uftrace_graph_node {
 	uint64_t			addr;
@@ -35,11 +36,21 @@ struct uftrace_special_node {
 	int				pid;
 };
 
+struct graph_chunk;
+
 struct uftrace_graph {
 	bool				kernel_only;
 	struct uftrace_session		*sess;
 	struct list_head		special_nodes;
 	struct uftrace_graph_node	root;
+	/* nodes are allocated from chunks and freed together */
+	struct graph_chunk		*chunks;
+	/* interned names of nodes */
+	Hashmap				*names;
+	/* hash table to find a child node by (parent, name) */
+	struct uftrace_graph_node	**slots;
+	size_t				nr_slots;
+	size_t				nr_nodes;
 };
 
 struct uftrace_task_graph {
@@ -62,6 +73,13 @@ struct uftrace_task_graph * graph_get_task(struct uftrace_task_reader *task,
 					   size_t tg_size);
 void graph_remove_task(void);
 
+struct uftrace_graph_node * graph_find_node(struct uftrace_graph *graph,
+					    struct uftrace_graph_node *parent,
+					    char *name);
+struct uftrace_graph_node * graph_new_node(struct uftrace_graph *graph,
+					   struct uftrace_graph_node *parent,
+					   char *name, size_t node_size);
+
 int graph_add_node(struct uftrace_task_graph *tg, int type, char *name,
 		   size_t node_size,
 		   struct debug_location* loc);
@@ -388,6 +388,16 @@ bool hashmap_ptr_equals(void *keyA, void *keyB)
 	return a == b;
 }
 
+hash_t hashmap_string_hash(void *key)
+{
+	return hashmap_hash(key, strlen(key));
+}
+
+bool hashmap_string_equals(void *keyA, void *keyB)
+{
+	return !strcmp(keyA, keyB);
+}
+
 #ifdef UNIT_TEST
 #include "utils/utils.h"
 
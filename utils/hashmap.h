@@ -154,4 +154,14 @@ hash_t hashmap_ptr_hash(void *key);
  */
 bool hashmap_ptr_equals(void* keyA, void* keyB);
 
+/**
+ * Key utilities - use (NUL-terminated) string as key.
+ */
+hash_t hashmap_string_hash(void *key);
+
+/**
+ * Compares two strings for equality.
+ */
+bool hashmap_string_equals(void* keyA, void* keyB);
+
 #endif /* __HASHMAP_H */
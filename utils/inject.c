@@ -0,0 +1,473 @@
+/*
+ * Load a library into a running process using ptrace(2).
+ *
+ * It stops a task in the target process and makes it call functions in the
+ * libc (like dlopen) on behalf of us.  The return address of the call is set
+ * to NULL so that the task will be stopped by SIGSEGV when the call returns.
+ * Then it restores the original registers and lets the task go.
+ *
+ * Only the main thread is stopped.  Other threads keep running since the
+ * call (dlopen) might need a lock held by one of them.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <signal.h>
+#include <unistd.h>
+#include <gnu/lib-names.h>
+#include <sys/ptrace.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+
+/* This should be defined before #include "utils.h" */
+#define PR_FMT     "inject"
+#define PR_DOMAIN  DBG_UFTRACE
+
+#include "utils/utils.h"
+#include "utils/inject.h"
+
+/* skip the red zone (128 bytes on x86_64) below the stack pointer */
+#define INJECT_STACK_GAP  256
+
+/* find the address where the library is loaded in the target process */
+static unsigned long find_remote_base(int pid, const char *libpath)
+{
+	FILE *fp;
+	char buf[PATH_MAX];
+	struct stat st;
+	unsigned long base = 0;
+
+	if (stat(libpath, &st) < 0)
+		return 0;
+
+	snprintf(buf, sizeof(buf), "/proc/%d/maps", pid);
+	fp = fopen(buf, "r");
+	if (fp == NULL)
+		return 0;
+
+	while (fgets(buf, sizeof(buf), fp) != NULL) {
+		unsigned long start, end, off, ino;
+		unsigned int major, minor;
+
+		if (sscanf(buf, "%lx-%lx %*s %lx %x:%x %lu",
+			   &start, &end, &off, &major, &minor, &ino) != 6)
+			continue;
+
+		if (ino == st.st_ino && makedev(major, minor) == st.st_dev &&
+		    off == 0) {
+			base = start;
+			break;
+		}
+	}
+
+	fclose(fp);
+	return base;
+}
+
+/*
+ * Find the address of a libc function in the target process.  It assumes
+ * the target uses the same libc and calculates the address using the
+ * offset of the function in our copy of the libc.
+ */
+static unsigned long find_remote_func(int pid, const char *name,
+				      const char *alt_name)
+{
+	void *handle;
+	void *addr = NULL;
+	unsigned long base;
+	Dl_info info;
+
+	handle = dlopen(LIBC_SO, RTLD_LAZY | RTLD_NOLOAD);
+	if (handle == NULL)
+		return 0;
+
+	addr = dlsym(handle, name);
+	/* older glibc has dlopen() and dlsym() in libdl */
+	if (addr == NULL && alt_name)
+		addr = dlsym(handle, alt_name);
+
+	dlclose(handle);
+
+	if (addr == NULL || !dladdr(addr, &info))
+		return 0;
+
+	base = find_remote_base(pid, info.dli_fname);
+	if (base == 0)
+		return 0;
+
+	base += (unsigned long)addr - (unsigned long)info.dli_fbase;
+
+	pr_dbg2("found %s at %#lx in process %d\n", name, base, pid);
+	return base;
+}
+
+/* stop the main thread (only) of the process */
+static int attach_task(int pid)
+{
+	int status;
+
+	if (ptrace(PTRACE_ATTACH, pid, NULL, NULL) < 0) {
+		pr_warn("cannot attach to process %d: %m\n"
+			"\tplease check /proc/sys/kernel/yama/ptrace_scope\n",
+			pid);
+		return -1;
+	}
+
+	while (true) {
+		if (waitpid(pid, &status, __WALL) < 0) {
+			if (errno == EINTR)
+				continue;
+			pr_warn("waiting for process %d failed: %m\n", pid);
+			return -1;
+		}
+
+		if (!WIFSTOPPED(status)) {
+			pr_warn("process %d has exited\n", pid);
+			return -1;
+		}
+
+		if (WSTOPSIG(status) == SIGSTOP)
+			break;
+
+		/* deliver other signals and wait for the SIGSTOP */
+		ptrace(PTRACE_CONT, pid, NULL, WSTOPSIG(status));
+	}
+
+	pr_dbg("attached to process %d\n", pid);
+	return 0;
+}
+
+static void detach_task(int pid)
+{
+	if (ptrace(PTRACE_DETACH, pid, NULL, NULL) < 0)
+		pr_dbg("detaching process %d failed: %m\n", pid);
+}
+
+/* write data to the target memory (at least as long as the data) */
+static int write_remote(int pid, unsigned long addr, const void *data,
+			size_t len)
+{
+	size_t i;
+	size_t size = ALIGN(len, sizeof(long));
+	char *buf = xzalloc(size);
+	int ret = 0;
+
+	memcpy(buf, data, len);
+
+	for (i = 0; i < size; i += sizeof(long)) {
+		long word;
+
+		memcpy(&word, buf + i, sizeof(word));
+		if (ptrace(PTRACE_POKEDATA, pid, addr + i, word) < 0) {
+			pr_dbg("writing memory of process %d failed: %m\n", pid);
+			ret = -1;
+			break;
+		}
+	}
+
+	free(buf);
+	return ret;
+}
+
+/* copy the string on the stack and return the address */
+static unsigned long push_string(int pid, unsigned long *sp, const char *str)
+{
+	size_t len = strlen(str) + 1;
+
+	*sp -= ALIGN(len, sizeof(long));
+	if (write_remote(pid, *sp, str, len) < 0)
+		return 0;
+
+	return *sp;
+}
+
+#if defined(__x86_64__)
+
+typedef struct user_regs_struct inject_regs_t;
+
+static unsigned long get_stack_pointer(inject_regs_t *regs)
+{
+	return regs->rsp;
+}
+
+static int remote_call(int pid, inject_regs_t *saved, unsigned long sp,
+		       unsigned long func, unsigned long *retval,
+		       int nr_args, unsigned long *args)
+{
+	inject_regs_t regs = *saved;
+	unsigned long null_addr = 0;
+	int status;
+
+	if (func == 0)
+		return -1;
+
+	/* the return address of the function */
+	sp = (sp & ~15UL) - sizeof(long);
+	if (write_remote(pid, sp, &null_addr, sizeof(null_addr)) < 0)
+		return -1;
+
+	regs.rip = func;
+	regs.rsp = sp;
+	regs.rax = 0;
+	/* do not restart the system call it was in */
+	regs.orig_rax = -1;
+
+	regs.rdi = nr_args > 0 ? args[0] : 0;
+	regs.rsi = nr_args > 1 ? args[1] : 0;
+	regs.rdx = nr_args > 2 ? args[2] : 0;
+
+	if (ptrace(PTRACE_SETREGS, pid, NULL, &regs) < 0 ||
+	    ptrace(PTRACE_CONT, pid, NULL, 0) < 0)
+		return -1;
+
+	while (true) {
+		int sig;
+
+		if (waitpid(pid, &status, __WALL) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		if (WIFSIGNALED(status)) {
+			pr_warn("process %d was killed by signal %d\n",
+				pid, WTERMSIG(status));
+			return -1;
+		}
+		if (!WIFSTOPPED(status)) {
+			pr_warn("process %d has exited\n", pid);
+			return -1;
+		}
+
+		sig = WSTOPSIG(status);
+		if (sig == SIGSEGV) {
+			if (ptrace(PTRACE_GETREGS, pid, NULL, &regs) < 0)
+				return -1;
+
+			/* it returned to the NULL address pushed above */
+			if (regs.rip == 0 && regs.rsp == sp + sizeof(long))
+				break;
+
+			/*
+			 * It's a real fault in the function.  Do not restore the
+			 * registers over the broken state but deliver the signal
+			 * so that the process can handle it (or die) as usual.
+			 */
+			pr_warn("process %d got SIGSEGV at %#llx during the call\n",
+				pid, regs.rip);
+		}
+
+		/* deliver other signals to the task */
+		if (sig == SIGSTOP)
+			sig = 0;
+		ptrace(PTRACE_CONT, pid, NULL, sig);
+	}
+
+	*retval = regs.rax;
+	return 0;
+}
+
+static int save_regs(int pid, inject_regs_t *regs)
+{
+	return ptrace(PTRACE_GETREGS, pid, NULL, regs);
+}
+
+static int restore_regs(int pid, inject_regs_t *regs)
+{
+	return ptrace(PTRACE_SETREGS, pid, NULL, regs);
+}
+
+#else  /* !__x86_64__ */
+
+typedef int inject_regs_t;
+
+static unsigned long get_stack_pointer(inject_regs_t *regs)
+{
+	return 0;
+}
+
+static int remote_call(int pid, inject_regs_t *saved, unsigned long sp,
+		       unsigned long func, unsigned long *retval,
+		       int nr_args, unsigned long *args)
+{
+	return -1;
+}
+
+static int save_regs(int pid, inject_regs_t *regs)
+{
+	pr_warn("attaching to a process is not supported on this architecture\n");
+	return -1;
+}
+
+static int restore_regs(int pid, inject_regs_t *regs)
+{
+	return -1;
+}
+
+#endif  /* __x86_64__ */
+
+/* call setenv() or unsetenv() for each "NAME=VALUE" string in envs */
+static int remote_setenv(int pid, inject_regs_t *regs, unsigned long func,
+			 struct strv *envs, bool unset)
+{
+	char *env, *name, *value;
+	unsigned long args[3];
+	unsigned long ret;
+	int i;
+
+	strv_for_each(envs, env, i) {
+		unsigned long sp = get_stack_pointer(regs) - INJECT_STACK_GAP;
+
+		name = xstrdup(env);
+		value = strchr(name, '=');
+		if (value == NULL) {
+			free(name);
+			continue;
+		}
+		*value++ = '\0';
+
+		args[0] = push_string(pid, &sp, name);
+		args[1] = push_string(pid, &sp, value);
+		args[2] = 1;
+		free(name);
+
+		if (args[0] == 0 || args[1] == 0)
+			return -1;
+
+		if (remote_call(pid, regs, sp, func, &ret, unset ? 1 : 3, args) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * inject_library - load a library into a running process
+ * @inj: handle of the loaded library
+ * @pid: process id of the target
+ * @libpath: absolute path of the library
+ * @envs: environment variables ("NAME=VALUE") used during the loading
+ *
+ * This function loads @libpath into the process @pid using dlopen() so that
+ * the constructor in the library can run in the target.  The environment
+ * variables in @envs are set only while the library is loading.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int inject_library(struct uftrace_inject *inj, int pid, const char *libpath,
+		   struct strv *envs)
+{
+	unsigned long setenv_fn, unsetenv_fn, dlopen_fn;
+	unsigned long args[2];
+	unsigned long sp;
+	inject_regs_t regs;
+	int ret = -1;
+
+	inj->pid = pid;
+	inj->handle = 0;
+
+	setenv_fn   = find_remote_func(pid, "setenv", NULL);
+	unsetenv_fn = find_remote_func(pid, "unsetenv", NULL);
+	dlopen_fn   = find_remote_func(pid, "dlopen", "__libc_dlopen_mode");
+
+	if (!setenv_fn || !unsetenv_fn || !dlopen_fn) {
+		pr_warn("cannot find libc functions in process %d\n", pid);
+		return -1;
+	}
+
+	if (attach_task(pid) < 0)
+		return -1;
+
+	if (save_regs(pid, &regs) < 0)
+		goto out;
+
+	if (remote_setenv(pid, &regs, setenv_fn, envs, false) < 0)
+		goto restore;
+
+	sp = get_stack_pointer(&regs) - INJECT_STACK_GAP;
+	args[0] = push_string(pid, &sp, libpath);
+	args[1] = RTLD_NOW;
+
+	if (args[0] == 0 ||
+	    remote_call(pid, &regs, sp, dlopen_fn, &inj->handle, 2, args) < 0)
+		goto restore;
+
+	if (remote_setenv(pid, &regs, unsetenv_fn, envs, true) < 0)
+		goto restore;
+
+	if (inj->handle == 0)
+		pr_warn("cannot load %s in process %d\n", libpath, pid);
+	else
+		ret = 0;
+
+restore:
+	/* it's gone if it got a fatal signal during the call */
+	if (restore_regs(pid, &regs) < 0 && errno != ESRCH)
+		pr_warn("cannot restore registers of process %d\n", pid);
+out:
+	detach_task(pid);
+	return ret;
+}
+
+/**
+ * inject_call_function - call a function in the injected library
+ * @inj: handle of the loaded library
+ * @name: name of the function to call (without arguments)
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int inject_call_function(struct uftrace_inject *inj, const char *name)
+{
+	unsigned long dlsym_fn;
+	unsigned long func = 0;
+	unsigned long ret;
+	unsigned long args[2];
+	unsigned long sp;
+	inject_regs_t regs;
+	int pid = inj->pid;
+	int err = -1;
+
+	if (inj->handle == 0)
+		return -1;
+
+	dlsym_fn = find_remote_func(pid, "dlsym", "__libc_dlsym");
+	if (dlsym_fn == 0) {
+		pr_warn("cannot find libc functions in process %d\n", pid);
+		return -1;
+	}
+
+	if (attach_task(pid) < 0)
+		return -1;
+
+	if (save_regs(pid, &regs) < 0)
+		goto out;
+
+	sp = get_stack_pointer(&regs) - INJECT_STACK_GAP;
+	args[0] = inj->handle;
+	args[1] = push_string(pid, &sp, name);
+
+	if (args[1] == 0 ||
+	    remote_call(pid, &regs, sp, dlsym_fn, &func, 2, args) < 0)
+		goto restore;
+
+	if (func == 0) {
+		pr_warn("cannot find %s in process %d\n", name, pid);
+		goto restore;
+	}
+
+	sp = get_stack_pointer(&regs) - INJECT_STACK_GAP;
+	if (remote_call(pid, &regs, sp, func, &ret, 0, NULL) == 0)
+		err = 0;
+
+restore:
+	/* it's gone if it got a fatal signal during the call */
+	if (restore_regs(pid, &regs) < 0 && errno != ESRCH)
+		pr_warn("cannot restore registers of process %d\n", pid);
+out:
+	detach_task(pid);
+	return err;
+}
@@ -0,0 +1,17 @@
+#ifndef UFTRACE_INJECT_H
+#define UFTRACE_INJECT_H
+
+struct strv;
+
+/* a library loaded into another (running) process */
+struct uftrace_inject {
+	int		pid;
+	/* return value of dlopen() in the target process */
+	unsigned long	handle;
+};
+
+int inject_library(struct uftrace_inject *inj, int pid, const char *libpath,
+		   struct strv *envs);
+int inject_call_function(struct uftrace_inject *inj, const char *name);
+
+#endif /* UFTRACE_INJECT_H */
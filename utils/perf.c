@@ -20,7 +20,7 @@
 
 static bool use_perf = true;
 
-static int open_perf_event(int pid, int cpu, int use_ctxsw)
+static int open_perf_event(int pid, int cpu, int use_ctxsw, size_t bufsize)
 {
 	/* use dummy events to get scheduling info (Linux v4.3 or later) */
 	struct perf_event_attr attr = {
@@ -46,6 +46,12 @@ static int open_perf_event(int pid, int cpu, int use_ctxsw)
 	};
 	unsigned long flag = PERF_FLAG_FD_NO_GROUP;
 
+	/* wake up the reader well before the buffer gets full */
+	if (bufsize / 16 > PERF_WATERMARK)
+		attr.wakeup_watermark = bufsize / 16;
+	else if (bufsize / 2 < PERF_WATERMARK)
+		attr.wakeup_watermark = bufsize / 2;
+
 	return syscall(SYS_perf_event_open, &attr, pid, cpu, -1, flag);
 }
 
@@ -56,6 +62,7 @@ static int open_perf_event(int pid, int cpu, int use_ctxsw)
  * @pid: process id to record
  * @dirname: directory name to save perf record data
  * @use_ctxsw: whether to use context_switch attribute
+ * @bufsize: size of ring buffer for each cpu (should be power of 2 pages)
  *
  * This function prepares recording linux perf events.  The perf_event
  * fd should be opened and mmaped for each cpu.
@@ -64,17 +71,21 @@ static int open_perf_event(int pid, int cpu, int use_ctxsw)
  * finish_perf_record() after recording.
  */
 int setup_perf_record(struct uftrace_perf_writer *perf, int nr_cpu, int pid,
-		      const char *dirname, int use_ctxsw)
+		      const char *dirname, int use_ctxsw, size_t bufsize)
 {
 	char filename[PATH_MAX];
 	int fd, cpu;
 
 	perf->event_fd = xcalloc(nr_cpu, sizeof(*perf->event_fd));
 	perf->data_pos = xcalloc(nr_cpu, sizeof(*perf->data_pos));
+	perf->lost     = xcalloc(nr_cpu, sizeof(*perf->lost));
 	perf->page     = xcalloc(nr_cpu, sizeof(*perf->page));
 	perf->fp       = xcalloc(nr_cpu, sizeof(*perf->fp));
 	perf->nr_event = nr_cpu;
 
+	/* the first page is for header */
+	perf->mmap_size = bufsize + getpagesize();
+
 	memset(perf->event_fd, -1, nr_cpu * sizeof(fd));
 
 	if (!PERF_CTXSW_AVAILABLE && use_ctxsw) {
@@ -84,7 +95,7 @@ int setup_perf_record(struct uftrace_perf_writer *perf, int nr_cpu, int pid,
 	}
 
 	for (cpu = 0; cpu < nr_cpu; cpu++) {
-		fd = open_perf_event(pid, cpu, use_ctxsw);
+		fd = open_perf_event(pid, cpu, use_ctxsw, bufsize);
 		if (fd < 0) {
 			int saved_errno = errno;
 
@@ -98,7 +109,7 @@ int setup_perf_record(struct uftrace_perf_writer *perf, int nr_cpu, int pid,
 		}
 		perf->event_fd[cpu] = fd;
 
-		perf->page[cpu] = mmap(NULL, PERF_MMAP_SIZE, PROT_READ|PROT_WRITE,
+		perf->page[cpu] = mmap(NULL, perf->mmap_size, PROT_READ|PROT_WRITE,
 				       MAP_SHARED, fd, 0);
 		if (perf->page[cpu] == MAP_FAILED) {
 			pr_warn("failed to mmap perf event: %m\n");
@@ -137,7 +148,7 @@ void finish_perf_record(struct uftrace_perf_writer *perf)
 
 	for (cpu = 0; cpu < perf->nr_event; cpu++) {
 		close(perf->event_fd[cpu]);
-		munmap(perf->page[cpu], PERF_MMAP_SIZE);
+		munmap(perf->page[cpu], perf->mmap_size);
 		if (perf->fp[cpu])
 			fclose(perf->fp[cpu]);
 	}
@@ -145,16 +156,79 @@ void finish_perf_record(struct uftrace_perf_writer *perf)
 	free(perf->event_fd);
 	free(perf->page);
 	free(perf->data_pos);
+	free(perf->lost);
 	free(perf->fp);
 
 	perf->event_fd = NULL;
 	perf->page     = NULL;
 	perf->data_pos = NULL;
+	perf->lost     = NULL;
 	perf->fp       = NULL;
 
 	perf->nr_event = 0;
 }
 
+static void write_perf_data(struct uftrace_perf_writer *perf, int cpu,
+			    int sock, void *buf, size_t size)
+{
+	if (sock > 0)
+		send_trace_perf_data(sock, cpu, buf, size);
+	else if (fwrite(buf, 1, size, perf->fp[cpu]) != size)
+		pr_dbg("failed to write perf data: %m\n");
+}
+
+/* count PERF_RECORD_LOST written by kernel between @start and @end */
+static void count_perf_lost(struct uftrace_perf_writer *perf, int cpu,
+			    unsigned char *data, uint64_t mask,
+			    uint64_t start, uint64_t end)
+{
+	struct perf_event_header *h;
+
+	/* perf records are 8-byte aligned so header is not split */
+	while (start < end) {
+		h = (void *)&data[start & mask];
+		if (h->size == 0)
+			break;
+
+		if (h->type == PERF_RECORD_LOST) {
+			uint64_t pos = start + sizeof(*h) +
+				offsetof(struct perf_lost_event, lost);
+
+			perf->lost[cpu] += *(uint64_t *)&data[pos & mask];
+		}
+		start += h->size;
+	}
+}
+
+/*
+ * It should not happen as the kernel doesn't overwrite unread data,
+ * but add a fake PERF_RECORD_LOST so that readers can know it anyway.
+ */
+static void add_perf_lost(struct uftrace_perf_writer *perf, int cpu,
+			  int sock, unsigned long size)
+{
+	struct timespec ts;
+	struct {
+		struct perf_event_header	h;
+		struct perf_lost_event		e;
+	} rec = {
+		.h = {
+			.type	= PERF_RECORD_LOST,
+			.size	= sizeof(rec),
+		},
+		.e = {
+			/* it's not exact, just assume the smallest record */
+			.lost	= size / (sizeof(rec.h) + sizeof(struct sample_id)),
+		},
+	};
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	rec.e.sample_id.time = (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+
+	perf->lost[cpu] += rec.e.lost;
+	write_perf_data(perf, cpu, sock, &rec, sizeof(rec));
+}
+
 /**
  * record_perf_data - record perf event data to file or socket
  * @perf: data structure for perf record
@@ -162,7 +236,8 @@ void finish_perf_record(struct uftrace_perf_writer *perf)
  * @sock: socket fd to send perf data
  *
  * This function copies contents in the perf ring buffer to a file
- * or a network socket.
+ * or a network socket.  It also updates number of lost events in
+ * @perf->lost for the @cpu.
  */
 void record_perf_data(struct uftrace_perf_writer *perf, int cpu, int sock)
 {
@@ -192,6 +267,8 @@ void record_perf_data(struct uftrace_perf_writer *perf, int cpu, int sock)
 			once = false;
 		}
 
+		add_perf_lost(perf, cpu, sock, size);
+
 		pc->data_tail = pos;
 		perf->data_pos[cpu] = pos;
 		return;
@@ -200,30 +277,23 @@ void record_perf_data(struct uftrace_perf_writer *perf, int cpu, int sock)
 	start = old;
 	end   = pos;
 
+	count_perf_lost(perf, cpu, data, mask, start, end);
+
 	/* handle wrap around */
 	if ((start & mask) + size != (end & mask)) {
 		buf = &data[start & mask];
 		size = mask + 1 - (start & mask);
 		start += size;
 
-		if (sock > 0)
-			send_trace_perf_data(sock, cpu, buf, size);
-		else if (fwrite(buf, 1, size, perf->fp[cpu]) != size) {
-			pr_dbg("failed to write perf data: %m\n");
-			goto out;
-		}
+		write_perf_data(perf, cpu, sock, buf, size);
 	}
 
 	buf = &data[start & mask];
 	size = end - start;
 	start += size;
 
-	if (sock > 0)
-		send_trace_perf_data(sock, cpu, buf, size);
-	else if (fwrite(buf, 1, size, perf->fp[cpu]) != size)
-		pr_dbg("failed to write perf data: %m\n");
+	write_perf_data(perf, cpu, sock, buf, size);
 
-out:
 	/* ensure all reads are done before we write the tail. */
 	full_memory_barrier();
 
@@ -307,6 +377,7 @@ static int read_perf_event(struct uftrace_data *handle,
 		struct perf_context_switch_event cs;
 		struct perf_task_event t;
 		struct perf_comm_event c;
+		struct perf_lost_event l;
 	} u;
 	size_t len;
 	int comm_len;
@@ -386,6 +457,16 @@ again:
 		perf->tid  = u.c.tid;
 		break;
 
+	case PERF_RECORD_LOST:
+		if (fread(&u.l, len, 1, perf->fp) != 1)
+			return -1;
+
+		if (handle->needs_byte_swap)
+			u.l.lost = bswap_64(u.l.lost);
+
+		perf->lost += u.l.lost;
+		goto again;
+
 	default:
 		pr_dbg3("skip unknown event: %u\n", h.type);
 
@@ -499,7 +580,8 @@ struct uftrace_record * get_perf_record(struct uftrace_data *handle,
  * @handle: uftrace data file handle
  *
  * This function reads perf events for each cpu data file and updates
- * task->comm for each PERF_RECORD_COMM.
+ * task->comm for each PERF_RECORD_COMM.  It also updates total number
+ * of lost events in @handle->perf_lost.
  */
 void update_perf_task_comm(struct uftrace_data *handle)
 {
@@ -507,6 +589,8 @@ void update_perf_task_comm(struct uftrace_data *handle)
 	struct uftrace_task *task;
 	int i;
 
+	handle->perf_lost = 0;
+
 	for (i = 0; i < handle->nr_perf; i++) {
 		perf = &handle->perf[i];
 
@@ -528,10 +612,13 @@ void update_perf_task_comm(struct uftrace_data *handle)
 			memcpy(task->comm, perf->u.comm.comm, sizeof(task->comm));
 		}
 
+		handle->perf_lost += perf->lost;
+
 		/* reset file position for future processing */
 		rewind(perf->fp);
 		perf->valid = false;
 		perf->done  = false;
+		perf->lost  = 0;
 	}
 }
 
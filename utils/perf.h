@@ -5,8 +5,9 @@
 #include <stdbool.h>
 #include <linux/perf_event.h>
 
-#define PERF_MMAP_SIZE  (132 * 1024)  /* 32 + 1 pages */
-#define PERF_WATERMARK  (8 * 1024)    /* 2 pages */
+#define PERF_BUFFER_SIZE_KB  128  /* 32 pages (+ 1 page for header) */
+#define PERF_BUFFER_SIZE     (PERF_BUFFER_SIZE_KB * 1024)
+#define PERF_WATERMARK       (8 * 1024)  /* 2 pages (at least) */
 
 #define COMM_LEN  16
 
@@ -14,8 +15,10 @@ struct uftrace_perf_writer {
 	int			*event_fd;
 	void			**page;
 	uint64_t		*data_pos;
+	uint64_t		*lost;
 	FILE			**fp;
 	int			nr_event;
+	size_t			mmap_size;
 };
 
 struct sample_id {
@@ -45,6 +48,15 @@ struct perf_comm_event {
 	struct sample_id	 sample_id;
 };
 
+struct perf_lost_event {
+	/*
+	 * type: PERF_RECORD_LOST (2)
+	 */
+	uint64_t		 id;
+	uint64_t		 lost;
+	struct sample_id	 sample_id;
+};
+
 struct perf_context_switch_event {
 	/*
 	 * type: PERF_RECORD_SWITCH (14)
@@ -72,7 +84,7 @@ struct uftrace_comm_event {
 #ifdef HAVE_PERF_CLOCKID
 
 int setup_perf_record(struct uftrace_perf_writer *perf, int nr_cpu, int pid,
-		      const char *dirname, int use_ctxsw);
+		      const char *dirname, int use_ctxsw, size_t bufsize);
 void finish_perf_record(struct uftrace_perf_writer *perf);
 void record_perf_data(struct uftrace_perf_writer *perf, int cpu, int sock);
 
@@ -80,7 +92,7 @@ void record_perf_data(struct uftrace_perf_writer *perf, int cpu, int sock);
 
 static inline int setup_perf_record(struct uftrace_perf_writer *perf,
 				    int nr_cpu, int pid, const char *dirname,
-				    int use_ctxsw)
+				    int use_ctxsw, size_t bufsize)
 {
 	return -1;
 }
@@ -113,6 +125,7 @@ struct uftrace_perf_reader {
 	int			type;
 	int			tid;
 	uint64_t		time;
+	uint64_t		lost;
 	union {
 		struct uftrace_ctxsw_event	ctxsw;
 		struct uftrace_task_event	task;
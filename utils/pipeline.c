@@ -0,0 +1,437 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/* This should be defined before #include "utils.h" */
+#define PR_FMT     "pipeline"
+#define PR_DOMAIN  DBG_UFTRACE
+
+#include "utils/utils.h"
+#include "utils/pipeline.h"
+
+#define PIPELINE_MAX_WORKERS  8
+
+/* item header to find the next item in a batch */
+struct pipe_item {
+	size_t	size;
+	char	data[];
+};
+
+/**
+ * pipeline_nr_workers - return the default number of worker threads
+ *
+ * It leaves a cpu for the reader thread.  Zero means the reader
+ * should render the output by itself.
+ */
+int pipeline_nr_workers(void)
+{
+	long nr = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+
+	if (nr < 0)
+		nr = 0;
+	if (nr > PIPELINE_MAX_WORKERS)
+		nr = PIPELINE_MAX_WORKERS;
+
+	return nr;
+}
+
+static void write_batch(struct uftrace_pipeline *pl,
+			struct uftrace_pipe_batch *batch)
+{
+	if (batch->out_len && fwrite(batch->out, 1, batch->out_len, pl->fp) != batch->out_len)
+		pr_dbg("failed to write output: %m\n");
+
+	batch->nr_items = 0;
+	batch->data_len = 0;
+	batch->out_len  = 0;
+	batch->state    = PIPE_BATCH_FREE;
+}
+
+static void *worker_thread(void *arg)
+{
+	struct uftrace_pipeline *pl = arg;
+	struct uftrace_pipe_batch *batch;
+
+	pthread_mutex_lock(&pl->lock);
+	while (true) {
+		while (pl->next == pl->head && !pl->done)
+			pthread_cond_wait(&pl->cond, &pl->lock);
+
+		if (pl->next == pl->head)
+			break;
+
+		batch = &pl->batch[pl->next++ % pl->nr_batch];
+		batch->state = PIPE_BATCH_BUSY;
+		pthread_mutex_unlock(&pl->lock);
+
+		pl->render(pl, batch);
+
+		pthread_mutex_lock(&pl->lock);
+		batch->state = PIPE_BATCH_DONE;
+		pthread_cond_broadcast(&pl->cond);
+	}
+	pthread_mutex_unlock(&pl->lock);
+
+	return NULL;
+}
+
+/**
+ * setup_pipeline - initialize output pipeline
+ * @pl: pipeline to initialize
+ * @nr_workers: number of worker threads
+ * @render: callback to render a batch into the output buffer
+ * @arg: private data for @render
+ * @fp: output file
+ *
+ * This function creates @nr_workers threads to run @render for each
+ * batch.  If @nr_workers is 0, the batches are rendered synchronously.
+ */
+void setup_pipeline(struct uftrace_pipeline *pl, int nr_workers,
+		    pipeline_render_t render, void *arg, FILE *fp)
+{
+	int i;
+
+	memset(pl, 0, sizeof(*pl));
+
+	pl->render = render;
+	pl->arg    = arg;
+	pl->fp     = fp;
+
+	/* allow workers (and the reader) to proceed while writing */
+	pl->nr_batch = 2 * nr_workers + 1;
+	pl->batch = xcalloc(pl->nr_batch, sizeof(*pl->batch));
+
+	pthread_mutex_init(&pl->lock, NULL);
+	pthread_cond_init(&pl->cond, NULL);
+
+	pl->workers = xcalloc(nr_workers ?: 1, sizeof(*pl->workers));
+	for (i = 0; i < nr_workers; i++) {
+		if (pthread_create(&pl->workers[i], NULL, worker_thread, pl) != 0) {
+			pr_dbg("cannot create worker thread: %m\n");
+			break;
+		}
+	}
+	pl->nr_workers = i;
+
+	pr_dbg("setup output pipeline with %d workers\n", pl->nr_workers);
+}
+
+/* submit current batch and make sure the next batch is available */
+static void submit_batch(struct uftrace_pipeline *pl)
+{
+	struct uftrace_pipe_batch *batch;
+
+	batch = &pl->batch[pl->head % pl->nr_batch];
+	if (batch->nr_items == 0)
+		return;
+
+	if (pl->nr_workers == 0) {
+		pl->render(pl, batch);
+		write_batch(pl, batch);
+		return;
+	}
+
+	pthread_mutex_lock(&pl->lock);
+	batch->state = PIPE_BATCH_READY;
+	pl->head++;
+	pthread_cond_broadcast(&pl->cond);
+
+	/* write finished batches in order */
+	while (pl->tail < pl->head) {
+		batch = &pl->batch[pl->tail % pl->nr_batch];
+
+		if (batch->state != PIPE_BATCH_DONE) {
+			/* wait only if the next batch is not available */
+			if (pl->head - pl->tail < (unsigned)pl->nr_batch)
+				break;
+
+			pthread_cond_wait(&pl->cond, &pl->lock);
+			continue;
+		}
+
+		pthread_mutex_unlock(&pl->lock);
+		write_batch(pl, batch);
+		pthread_mutex_lock(&pl->lock);
+		pl->tail++;
+	}
+	pthread_mutex_unlock(&pl->lock);
+}
+
+/**
+ * pipeline_add_item - allocate a new item in the current batch
+ * @pl: output pipeline
+ * @size: size of the item
+ *
+ * This function returns a pointer to save an item data of @size bytes.
+ * The current batch is submitted to the workers when it's full.
+ */
+void *pipeline_add_item(struct uftrace_pipeline *pl, size_t size)
+{
+	struct uftrace_pipe_batch *batch;
+	struct pipe_item *item;
+	size_t len = ALIGN(sizeof(*item) + size, sizeof(long));
+
+	batch = &pl->batch[pl->head % pl->nr_batch];
+	if (batch->data_len + len > PIPELINE_BATCH_SIZE && batch->nr_items) {
+		submit_batch(pl);
+		batch = &pl->batch[pl->head % pl->nr_batch];
+	}
+
+	if (batch->data_len + len > batch->data_size) {
+		batch->data_size = ALIGN(batch->data_len + len, PIPELINE_BATCH_SIZE);
+		batch->data = xrealloc(batch->data, batch->data_size);
+	}
+
+	item = (void *)&batch->data[batch->data_len];
+	item->size = len;
+
+	batch->data_len += len;
+	batch->nr_items++;
+
+	return item->data;
+}
+
+/**
+ * pipeline_next_item - return next item in the batch
+ * @batch: a batch to render
+ * @item: current item (or %NULL for the first item)
+ */
+void *pipeline_next_item(struct uftrace_pipe_batch *batch, void *item)
+{
+	struct pipe_item *pi;
+	char *pos = batch->data;
+
+	if (item) {
+		pi = container_of(item, struct pipe_item, data);
+		pos = (char *)pi + pi->size;
+	}
+
+	if (pos >= batch->data + batch->data_len)
+		return NULL;
+
+	pi = (void *)pos;
+	return pi->data;
+}
+
+/**
+ * pipeline_flush - write out all pending items
+ * @pl: output pipeline
+ *
+ * This function waits for all the submitted batches to be rendered and
+ * writes the output.  It should be called before writing anything else
+ * to the output file.
+ */
+void pipeline_flush(struct uftrace_pipeline *pl)
+{
+	struct uftrace_pipe_batch *batch;
+
+	submit_batch(pl);
+
+	pthread_mutex_lock(&pl->lock);
+	while (pl->tail < pl->head) {
+		batch = &pl->batch[pl->tail % pl->nr_batch];
+
+		if (batch->state != PIPE_BATCH_DONE) {
+			pthread_cond_wait(&pl->cond, &pl->lock);
+			continue;
+		}
+
+		pthread_mutex_unlock(&pl->lock);
+		write_batch(pl, batch);
+		pthread_mutex_lock(&pl->lock);
+		pl->tail++;
+	}
+	pthread_mutex_unlock(&pl->lock);
+}
+
+/**
+ * finish_pipeline - flush output and release resources
+ * @pl: output pipeline
+ */
+void finish_pipeline(struct uftrace_pipeline *pl)
+{
+	int i;
+
+	pipeline_flush(pl);
+
+	pthread_mutex_lock(&pl->lock);
+	pl->done = true;
+	pthread_cond_broadcast(&pl->cond);
+	pthread_mutex_unlock(&pl->lock);
+
+	for (i = 0; i < pl->nr_workers; i++)
+		pthread_join(pl->workers[i], NULL);
+
+	for (i = 0; i < pl->nr_batch; i++) {
+		free(pl->batch[i].data);
+		free(pl->batch[i].out);
+	}
+	free(pl->batch);
+	free(pl->workers);
+
+	pthread_mutex_destroy(&pl->lock);
+	pthread_cond_destroy(&pl->cond);
+}
+
+static void reserve_output(struct uftrace_pipe_batch *batch, size_t len)
+{
+	if (batch->out_len + len < batch->out_size)
+		return;
+
+	batch->out_size = ALIGN(batch->out_len + len + 1, PIPELINE_BATCH_SIZE);
+	batch->out = xrealloc(batch->out, batch->out_size);
+}
+
+/**
+ * pipeline_printf - print formatted string to the batch output
+ * @batch: a batch being rendered
+ * @fmt: printf-style format string
+ */
+void pipeline_printf(struct uftrace_pipe_batch *batch, const char *fmt, ...)
+{
+	va_list ap;
+	int len;
+
+	reserve_output(batch, 256);
+
+	va_start(ap, fmt);
+	len = vsnprintf(batch->out + batch->out_len,
+			batch->out_size - batch->out_len, fmt, ap);
+	va_end(ap);
+
+	if (batch->out_len + len >= batch->out_size) {
+		reserve_output(batch, len);
+
+		va_start(ap, fmt);
+		vsnprintf(batch->out + batch->out_len,
+			  batch->out_size - batch->out_len, fmt, ap);
+		va_end(ap);
+	}
+
+	batch->out_len += len;
+}
+
+/**
+ * pipeline_write - copy data to the batch output
+ * @batch: a batch being rendered
+ * @buf: data to write
+ * @len: length of @buf
+ */
+void pipeline_write(struct uftrace_pipe_batch *batch, const void *buf, size_t len)
+{
+	reserve_output(batch, len);
+
+	memcpy(batch->out + batch->out_len, buf, len);
+	batch->out_len += len;
+}
+
+static ssize_t pipe_stream_write(void *cookie, const char *buf, size_t len)
+{
+	pipeline_write(cookie, buf, len);
+	return len;
+}
+
+/**
+ * pipeline_open_stream - open a stdio stream to write to the batch output
+ * @batch: a batch being rendered
+ *
+ * This is for renderers using the existing stdio-based output functions.
+ * The stream should be closed before the render callback returns.
+ */
+FILE *pipeline_open_stream(struct uftrace_pipe_batch *batch)
+{
+	cookie_io_functions_t funcs = {
+		.write = pipe_stream_write,
+	};
+	FILE *fp;
+
+	fp = fopencookie(batch, "w", funcs);
+	if (fp == NULL)
+		pr_err("cannot open pipeline stream");
+
+	setvbuf(fp, NULL, _IOFBF, BUFSIZ);
+	return fp;
+}
+
+#ifdef UNIT_TEST
+static void render_test(struct uftrace_pipeline *pl,
+			struct uftrace_pipe_batch *batch)
+{
+	int *item;
+
+	pipeline_for_each_item(batch, item)
+		pipeline_printf(batch, "%d\n", *item);
+}
+
+TEST_CASE(pipeline_order)
+{
+	struct uftrace_pipeline pl;
+	FILE *fp = tmpfile();
+	char buf[32];
+	int nr_workers;
+	int i;
+
+	for (nr_workers = 0; nr_workers < 4; nr_workers++) {
+		pr_dbg("render items with %d workers\n", nr_workers);
+		rewind(fp);
+		setup_pipeline(&pl, nr_workers, render_test, NULL, fp);
+
+		/* add more items than the batch size to use multiple batches */
+		for (i = 0; i < 100000; i++)
+			*(int *)pipeline_add_item(&pl, sizeof(int)) = i;
+
+		finish_pipeline(&pl);
+
+		pr_dbg("check the output is in order\n");
+		rewind(fp);
+		for (i = 0; i < 100000; i++) {
+			TEST_NE(fgets(buf, sizeof(buf), fp), NULL);
+			TEST_EQ(strtol(buf, NULL, 0), i);
+		}
+	}
+	fclose(fp);
+
+	return TEST_OK;
+}
+
+static void render_stream_test(struct uftrace_pipeline *pl,
+			       struct uftrace_pipe_batch *batch)
+{
+	FILE *fp = pipeline_open_stream(batch);
+	int *item;
+
+	pipeline_for_each_item(batch, item)
+		fprintf(fp, "%d\n", *item);
+
+	fclose(fp);
+}
+
+TEST_CASE(pipeline_stream)
+{
+	struct uftrace_pipeline pl;
+	FILE *fp = tmpfile();
+	char buf[32];
+	int i;
+
+	setup_pipeline(&pl, 2, render_stream_test, NULL, fp);
+
+	for (i = 0; i < 100000; i++)
+		*(int *)pipeline_add_item(&pl, sizeof(int)) = i;
+
+	finish_pipeline(&pl);
+
+	pr_dbg("check the stream output is in order\n");
+	rewind(fp);
+	for (i = 0; i < 100000; i++) {
+		TEST_NE(fgets(buf, sizeof(buf), fp), NULL);
+		TEST_EQ(strtol(buf, NULL, 0), i);
+	}
+	fclose(fp);
+
+	return TEST_OK;
+}
+#endif  /* UNIT_TEST */
@@ -0,0 +1,78 @@
+#ifndef UFTRACE_PIPELINE_H
+#define UFTRACE_PIPELINE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+/*
+ * Output pipeline: the (single) reader thread saves items into a batch
+ * and worker threads render the batches into their own output buffers.
+ * The reader writes the output of finished batches in the original order.
+ * It uses a fixed number of batches so memory usage is bounded.
+ */
+#define PIPELINE_BATCH_SIZE  (256 * 1024)
+
+enum uftrace_pipe_batch_state {
+	PIPE_BATCH_FREE,
+	PIPE_BATCH_READY,
+	PIPE_BATCH_BUSY,
+	PIPE_BATCH_DONE,
+};
+
+struct uftrace_pipe_batch {
+	enum uftrace_pipe_batch_state	state;
+	int				nr_items;
+	/* items saved by the reader */
+	char				*data;
+	size_t				data_len;
+	size_t				data_size;
+	/* output rendered by a worker */
+	char				*out;
+	size_t				out_len;
+	size_t				out_size;
+};
+
+struct uftrace_pipeline;
+
+typedef void (*pipeline_render_t)(struct uftrace_pipeline *pl,
+				  struct uftrace_pipe_batch *batch);
+
+struct uftrace_pipeline {
+	pipeline_render_t		render;
+	void				*arg;
+	FILE				*fp;
+	int				nr_workers;
+	int				nr_batch;
+	struct uftrace_pipe_batch	*batch;
+	/* sequence numbers: head >= next >= tail */
+	unsigned long			head;	/* being filled by reader */
+	unsigned long			next;	/* next to render */
+	unsigned long			tail;	/* next to write */
+	bool				done;
+	pthread_t			*workers;
+	pthread_mutex_t			lock;
+	pthread_cond_t			cond;
+};
+
+int pipeline_nr_workers(void);
+void setup_pipeline(struct uftrace_pipeline *pl, int nr_workers,
+		    pipeline_render_t render, void *arg, FILE *fp);
+void finish_pipeline(struct uftrace_pipeline *pl);
+
+void *pipeline_add_item(struct uftrace_pipeline *pl, size_t size);
+void *pipeline_next_item(struct uftrace_pipe_batch *batch, void *item);
+void pipeline_flush(struct uftrace_pipeline *pl);
+
+void pipeline_printf(struct uftrace_pipe_batch *batch, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+void pipeline_write(struct uftrace_pipe_batch *batch, const void *buf, size_t len);
+FILE *pipeline_open_stream(struct uftrace_pipe_batch *batch);
+
+#define pipeline_for_each_item(batch, item)				\
+	for (item = pipeline_next_item(batch, NULL);			\
+	     item != NULL;						\
+	     item = pipeline_next_item(batch, item))
+
+#endif /* UFTRACE_PIPELINE_H */
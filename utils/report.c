@@ -33,6 +33,165 @@ static void finish_time_stat(struct report_time_stat *ts, unsigned long call)
 	ts->avg = (ts->sum + ts->rec) / call;
 }
 
+bool report_use_hist;
+
+static uint64_t hist_percentile(struct report_time_hist *hist,
+				struct report_time_stat *ts, double pct)
+{
+	uint64_t val = report_hist_percentile(hist, pct);
+
+	/* the estimated value can be out of the actual range */
+	if (val < ts->min)
+		val = ts->min;
+	if (val > ts->max)
+		val = ts->max;
+	return val;
+}
+
+static void finish_time_hist(struct report_time_hist *hist,
+			     struct report_time_stat *ts)
+{
+	if (hist->count == 0)
+		return;
+
+	hist->p50  = hist_percentile(hist, ts, 50);
+	hist->p90  = hist_percentile(hist, ts, 90);
+	hist->p99  = hist_percentile(hist, ts, 99);
+	hist->p999 = hist_percentile(hist, ts, 99.9);
+}
+
+static unsigned hist_bucket(uint64_t time_ns)
+{
+	const uint64_t max_time = (1ULL << REPORT_HIST_MAX_BITS) - 1;
+	unsigned shift;
+
+	if (time_ns < (1U << REPORT_HIST_SUB_BITS))
+		return time_ns;
+
+	if (time_ns > max_time)
+		time_ns = max_time;
+
+	/* number of bits below the sub-bucket bits */
+	shift = 63 - __builtin_clzll(time_ns) - REPORT_HIST_SUB_BITS;
+
+	return ((shift + 1) << REPORT_HIST_SUB_BITS) +
+		(time_ns >> shift) - (1U << REPORT_HIST_SUB_BITS);
+}
+
+/* returns the middle value of the bucket */
+static uint64_t hist_bucket_value(unsigned idx)
+{
+	unsigned sub = idx & ((1U << REPORT_HIST_SUB_BITS) - 1);
+	unsigned shift;
+
+	if (idx < (1U << REPORT_HIST_SUB_BITS))
+		return idx;
+
+	shift = (idx >> REPORT_HIST_SUB_BITS) - 1;
+
+	return (((uint64_t)sub + (1U << REPORT_HIST_SUB_BITS)) << shift) +
+		((1ULL << shift) >> 1);
+}
+
+/**
+ * report_hist_add - add a time to the histogram
+ * @hist: histogram
+ * @time_ns: time value in nsec
+ */
+void report_hist_add(struct report_time_hist *hist, uint64_t time_ns)
+{
+	if (unlikely(hist->buckets == NULL))
+		hist->buckets = xcalloc(REPORT_HIST_BUCKETS, sizeof(*hist->buckets));
+
+	hist->buckets[hist_bucket(time_ns)]++;
+	hist->count++;
+}
+
+/**
+ * report_hist_percentile - estimate a percentile of the histogram
+ * @hist: histogram
+ * @pct: percentile (0 - 100)
+ *
+ * This function returns the estimated time value at @pct.
+ * It returns 0 if the histogram is empty.
+ */
+uint64_t report_hist_percentile(struct report_time_hist *hist, double pct)
+{
+	uint64_t rank;
+	uint64_t count = 0;
+	int i;
+
+	if (hist->count == 0)
+		return 0;
+
+	/* rank of the value (1-based) */
+	rank = (uint64_t)(pct * hist->count / 100.0 + 0.5);
+	if (rank == 0)
+		rank = 1;
+	if (rank > hist->count)
+		rank = hist->count;
+
+	for (i = 0; i < REPORT_HIST_BUCKETS; i++) {
+		count += hist->buckets[i];
+		if (count >= rank)
+			break;
+	}
+
+	return hist_bucket_value(i);
+}
+
+void report_hist_free(struct report_time_hist *hist)
+{
+	free(hist->buckets);
+	hist->buckets = NULL;
+	hist->count = 0;
+}
+
+static bool has_percentile(const char *str, const char *prefix)
+{
+	static const char * const pcts[] = { "p50", "p90", "p99", "p999" };
+	struct strv strv = STRV_INIT;
+	bool found = false;
+	size_t len = strlen(prefix);
+	char *s;
+	unsigned i;
+	int j;
+
+	if (str == NULL)
+		return false;
+
+	strv_split(&strv, str, ",");
+	strv_for_each(&strv, s, j) {
+		/* fields can be appended to the default by "+" */
+		if (*s == '+')
+			s++;
+		if (strncmp(s, prefix, len))
+			continue;
+
+		for (i = 0; i < ARRAY_SIZE(pcts); i++) {
+			if (!strcmp(s + len, pcts[i]))
+				found = true;
+		}
+	}
+	strv_free(&strv);
+
+	return found;
+}
+
+/**
+ * report_needs_hist - check whether percentiles are needed
+ * @opts: command line options
+ *
+ * This function returns true if any of the output fields or sort keys
+ * is a percentile of the total time so that histogram should be kept.
+ */
+bool report_needs_hist(struct opts *opts)
+{
+	return has_percentile(opts->fields, "total-") ||
+		has_percentile(opts->sort_keys, "total-") ||
+		has_percentile(opts->sort_keys, "total_");
+}
+
 static struct uftrace_report_node *
 find_or_create_node(struct rb_root *root, const char *name,
 		    struct uftrace_report_node *node)
@@ -87,6 +246,7 @@ void report_add_node(struct rb_root *root, const char *name,
 void report_delete_node(struct rb_root *root, struct uftrace_report_node *node)
 {
 	rb_erase(&node->name_link, root);
+	report_hist_free(&node->hist);
 	free(node->name);
 	free(node);
 }
@@ -121,6 +281,8 @@ void report_update_node(struct uftrace_report_node *node,
 
 	update_time_stat(&node->total, total_time, recursive);
 	update_time_stat(&node->self, self_time, false);
+	if (report_use_hist)
+		report_hist_add(&node->hist, total_time);
 	node->call++;
 	node->loc = loc;
 }
@@ -135,6 +297,7 @@ void report_calc_avg(struct rb_root *root)
 
 		finish_time_stat(&node->total, node->call);
 		finish_time_stat(&node->self, node->call);
+		finish_time_hist(&node->hist, &node->total);
 
 		n = rb_next(n);
 	}
@@ -170,6 +333,10 @@ SORT_KEY(self_avg, self.avg);
 SORT_KEY(self_min, self.min);
 SORT_KEY(self_max, self.max);
 SORT_KEY(call, call);
+SORT_KEY(total_p50, hist.p50);
+SORT_KEY(total_p90, hist.p90);
+SORT_KEY(total_p99, hist.p99);
+SORT_KEY(total_p999, hist.p999);
 
 static int cmp_func(struct uftrace_report_node *a,
 		    struct uftrace_report_node *b)
@@ -193,6 +360,10 @@ static struct sort_key * all_sort_keys[] = {
 	&sort_self_min,
 	&sort_self_max,
 	&sort_call,
+	&sort_total_p50,
+	&sort_total_p90,
+	&sort_total_p99,
+	&sort_total_p999,
 	&sort_func,
 };
 
@@ -367,6 +538,10 @@ DIFF_KEY(self_avg, self.avg);
 DIFF_KEY(self_min, self.min);
 DIFF_KEY(self_max, self.max);
 DIFF_KEY(call, call);
+DIFF_KEY(total_p50, hist.p50);
+DIFF_KEY(total_p90, hist.p90);
+DIFF_KEY(total_p99, hist.p99);
+DIFF_KEY(total_p999, hist.p999);
 
 static int cmp_diff_func(struct uftrace_report_node *a,
 			 struct uftrace_report_node *b,
@@ -391,6 +566,10 @@ static struct diff_key * all_diff_keys[] = {
 	&sort_diff_self_min,
 	&sort_diff_self_max,
 	&sort_diff_call,
+	&sort_diff_total_p50,
+	&sort_diff_total_p90,
+	&sort_diff_total_p99,
+	&sort_diff_total_p999,
 	&sort_diff_func,
 };
 
@@ -487,6 +666,8 @@ void report_diff_nodes(struct rb_root *orig_root, struct rb_root *pair_root,
 		/* node->name is swallow-copied, do not free */
 		node = xzalloc(sizeof(*node));
 		memcpy(node, iter, sizeof(*node));
+		/* histogram is owned (and freed) by the original node */
+		node->hist.buckets = NULL;
 		node->pair = pair;
 		/* mark used pair */
 		pair->pair = node;
@@ -526,6 +707,7 @@ void destroy_diff_nodes(struct rb_root *orig_root, struct rb_root *pair_root)
 
 		/* name is already freed in print_and_delete */
 		rb_erase(&iter->name_link, orig_root);
+		report_hist_free(&iter->hist);
 		free(iter);
 	}
 
@@ -538,6 +720,7 @@ void destroy_diff_nodes(struct rb_root *orig_root, struct rb_root *pair_root)
 		/* if it has a pair, only base name was freed */
 		if (iter->pair)
 			free(iter->name);
+		report_hist_free(&iter->hist);
 		free(iter);
 	}
 }
@@ -843,6 +1026,10 @@ FIELD_TIME(REPORT_F_SELF_TIME_AVG, self-avg, self.avg, self_avg, "Self avg");
 FIELD_TIME(REPORT_F_SELF_TIME_MIN, self-min, self.min, self_min, "Self min");
 FIELD_TIME(REPORT_F_SELF_TIME_MAX, self-max, self.max, self_max, "Self max");
 FIELD_CALL(REPORT_F_CALL, call, call, call, "Calls");
+FIELD_TIME(REPORT_F_TOTAL_TIME_P50, total-p50, hist.p50, total_p50, "Total p50");
+FIELD_TIME(REPORT_F_TOTAL_TIME_P90, total-p90, hist.p90, total_p90, "Total p90");
+FIELD_TIME(REPORT_F_TOTAL_TIME_P99, total-p99, hist.p99, total_p99, "Total p99");
+FIELD_TIME(REPORT_F_TOTAL_TIME_P999, total-p999, hist.p999, total_p999, "Total p999");
 
 FIELD_TIME_DIFF(REPORT_F_TOTAL_TIME, total, total.sum, total, "Total time");
 FIELD_TIME_DIFF(REPORT_F_TOTAL_TIME_AVG, total-avg, total.avg, total_avg, "Total avg");
@@ -853,6 +1040,10 @@ FIELD_TIME_DIFF(REPORT_F_SELF_TIME_AVG, self-avg, self.avg, self_avg, "Self avg"
 FIELD_TIME_DIFF(REPORT_F_SELF_TIME_MIN, self-min, self.min, self_min, "Self min");
 FIELD_TIME_DIFF(REPORT_F_SELF_TIME_MAX, self-max, self.max, self_max, "Self max");
 FIELD_CALL_DIFF(REPORT_F_CALL, call, call, call, "Calls");
+FIELD_TIME_DIFF(REPORT_F_TOTAL_TIME_P50, total-p50, hist.p50, total_p50, "Total p50");
+FIELD_TIME_DIFF(REPORT_F_TOTAL_TIME_P90, total-p90, hist.p90, total_p90, "Total p90");
+FIELD_TIME_DIFF(REPORT_F_TOTAL_TIME_P99, total-p99, hist.p99, total_p99, "Total p99");
+FIELD_TIME_DIFF(REPORT_F_TOTAL_TIME_P999, total-p999, hist.p999, total_p999, "Total p999");
 
 FIELD_TIME_DIFF_FULL(REPORT_F_TOTAL_TIME, total, total.sum, total, "Total time (diff)");
 FIELD_TIME_DIFF_FULL(REPORT_F_TOTAL_TIME_AVG, total-avg, total.avg, total_avg, "Total avg (diff)");
@@ -863,6 +1054,10 @@ FIELD_TIME_DIFF_FULL(REPORT_F_SELF_TIME_AVG, self-avg, self.avg, self_avg, "Self
 FIELD_TIME_DIFF_FULL(REPORT_F_SELF_TIME_MIN, self-min, self.min, self_min, "Self min (diff)");
 FIELD_TIME_DIFF_FULL(REPORT_F_SELF_TIME_MAX, self-max, self.max, self_max, "Self min (diff)");
 FIELD_CALL_DIFF_FULL(REPORT_F_CALL, call, call, call_diff_full, "Calls (diff)");
+FIELD_TIME_DIFF_FULL(REPORT_F_TOTAL_TIME_P50, total-p50, hist.p50, total_p50, "Total p50 (diff)");
+FIELD_TIME_DIFF_FULL(REPORT_F_TOTAL_TIME_P90, total-p90, hist.p90, total_p90, "Total p90 (diff)");
+FIELD_TIME_DIFF_FULL(REPORT_F_TOTAL_TIME_P99, total-p99, hist.p99, total_p99, "Total p99 (diff)");
+FIELD_TIME_DIFF_FULL(REPORT_F_TOTAL_TIME_P999, total-p999, hist.p999, total_p999, "Total p999 (diff)");
 
 FIELD_TIME_DIFF_FULL_PCT(REPORT_F_TOTAL_TIME, total, total.sum, total, "Total time (diff)");
 FIELD_TIME_DIFF_FULL_PCT(REPORT_F_TOTAL_TIME_AVG, total-avg, total.avg, total_avg, "Total avg (diff)");
@@ -873,6 +1068,10 @@ FIELD_TIME_DIFF_FULL_PCT(REPORT_F_SELF_TIME_AVG, self-avg, self.avg, self_avg, "
 FIELD_TIME_DIFF_FULL_PCT(REPORT_F_SELF_TIME_MIN, self-min, self.min, self_min, "Self min (diff)");
 FIELD_TIME_DIFF_FULL_PCT(REPORT_F_SELF_TIME_MAX, self-max, self.max, self_max, "Self min (diff)");
 FIELD_CALL_DIFF_FULL(REPORT_F_CALL, call, call, call_diff_full_percent, "Calls (diff)");
+FIELD_TIME_DIFF_FULL_PCT(REPORT_F_TOTAL_TIME_P50, total-p50, hist.p50, total_p50, "Total p50 (diff)");
+FIELD_TIME_DIFF_FULL_PCT(REPORT_F_TOTAL_TIME_P90, total-p90, hist.p90, total_p90, "Total p90 (diff)");
+FIELD_TIME_DIFF_FULL_PCT(REPORT_F_TOTAL_TIME_P99, total-p99, hist.p99, total_p99, "Total p99 (diff)");
+FIELD_TIME_DIFF_FULL_PCT(REPORT_F_TOTAL_TIME_P999, total-p999, hist.p999, total_p999, "Total p999 (diff)");
 
 FIELD_TIME(REPORT_F_TASK_TOTAL_TIME, total, total.sum, task_total, "Total time");
 FIELD_TIME(REPORT_F_TASK_SELF_TIME, self, self.sum, task_self, "Self time");
@@ -890,6 +1089,10 @@ static struct display_field *field_table[] = {
 	&field_self_min,
 	&field_self_max,
 	&field_call,
+	&field_total_p50,
+	&field_total_p90,
+	&field_total_p99,
+	&field_total_p999,
 };
 
 /* index of this table should be matched to display_field_id */
@@ -903,6 +1106,10 @@ static struct display_field *field_diff_table[] = {
 	&field_self_min_diff,
 	&field_self_max_diff,
 	&field_call_diff,
+	&field_total_p50_diff,
+	&field_total_p90_diff,
+	&field_total_p99_diff,
+	&field_total_p999_diff,
 };
 
 /* index of this table should be matched to display_field_id */
@@ -916,6 +1123,10 @@ static struct display_field *field_diff_full_table[] = {
 	&field_self_min_diff_full,
 	&field_self_max_diff_full,
 	&field_call_diff_full,
+	&field_total_p50_diff_full,
+	&field_total_p90_diff_full,
+	&field_total_p99_diff_full,
+	&field_total_p999_diff_full,
 };
 
 /* index of this table should be matched to display_field_id */
@@ -929,6 +1140,10 @@ static struct display_field *field_diff_full_percent_table[] = {
 	&field_self_min_diff_full_percent,
 	&field_self_max_diff_full_percent,
 	&field_call_diff_full_percent,
+	&field_total_p50_diff_full_percent,
+	&field_total_p90_diff_full_percent,
+	&field_total_p99_diff_full_percent,
+	&field_total_p999_diff_full_percent,
 };
 
 /* index of this table should be matched to display_field_id */
@@ -1251,4 +1466,128 @@ TEST_CASE(report_diff)
 	return TEST_OK;
 }
 
+TEST_CASE(report_hist)
+{
+	struct report_time_hist hist = {};
+	uint64_t val;
+	int i;
+
+	pr_dbg("check histogram buckets\n");
+	TEST_EQ(hist_bucket(0), 0);
+	TEST_EQ(hist_bucket(15), 15);
+	TEST_EQ(hist_bucket(16), 16);
+	TEST_EQ(hist_bucket(31), 31);
+	TEST_EQ(hist_bucket(32), 32);
+	TEST_EQ(hist_bucket(33), 32);
+	TEST_EQ(hist_bucket(-1ULL), REPORT_HIST_BUCKETS - 1);
+
+	for (i = 0; i < REPORT_HIST_BUCKETS; i++)
+		TEST_EQ(hist_bucket(hist_bucket_value(i)), (unsigned)i);
+
+	TEST_EQ(report_hist_percentile(&hist, 50), 0);
+
+	/* 1us ~ 1000us */
+	for (i = 1; i <= 1000; i++)
+		report_hist_add(&hist, i * 1000);
+
+	pr_dbg("check percentiles are within the error bound\n");
+	val = report_hist_percentile(&hist, 50);
+	TEST_GE(val, 500000 * 15 / 16);
+	TEST_LE(val, 500000 * 17 / 16);
+
+	val = report_hist_percentile(&hist, 99);
+	TEST_GE(val, 990000 * 15 / 16);
+	TEST_LE(val, 990000 * 17 / 16);
+
+	val = report_hist_percentile(&hist, 100);
+	TEST_GE(val, 1000000 * 15 / 16);
+	TEST_LE(val, 1000000 * 17 / 16);
+
+	report_hist_free(&hist);
+	TEST_EQ(hist.buckets, NULL);
+
+	return TEST_OK;
+}
+
+TEST_CASE(report_percentile)
+{
+	struct rb_root name_tree = RB_ROOT;
+	struct rb_root sort_tree = RB_ROOT;
+	struct rb_node *rbnode;
+	struct uftrace_report_node *node;
+	static struct fstack fstack[1];
+	struct uftrace_data handle = {
+		.hdr = {
+			.max_stack = 1,
+		},
+		.nr_tasks = 1,
+	};
+	struct uftrace_task_reader task = {
+		.h = &handle,
+		.func_stack = fstack,
+	};
+	struct opts opts = {
+		.fields = "+total-p999",
+	};
+	const char *test_name[] = { "abc", "foo" };
+	int i, k;
+
+	TEST_EQ(report_needs_hist(&opts), true);
+	opts.fields = "total-avg,total-max";
+	TEST_EQ(report_needs_hist(&opts), false);
+	opts.sort_keys = "total_p99";
+	TEST_EQ(report_needs_hist(&opts), true);
+
+	report_use_hist = true;
+
+	pr_dbg("abc has a long tail, foo doesn't\n");
+	for (k = 0; k < 2; k++) {
+		node = xzalloc(sizeof(*node));
+		report_add_node(&name_tree, test_name[k], node);
+
+		for (i = 1; i <= 1000; i++) {
+			fstack[0].total_time = 1000;
+			if (k == 0 && i > 980)
+				fstack[0].total_time = 100000;
+			else if (k == 1)
+				fstack[0].total_time = 1500;
+			report_update_node(node, &task, NULL);
+		}
+	}
+	report_calc_avg(&name_tree);
+
+	pr_dbg("check percentiles are estimated within the actual range\n");
+	node = report_find_node(&name_tree, "abc");
+	TEST_GE(node->hist.p50, 1000);
+	TEST_LE(node->hist.p50, 1000 * 17 / 16);
+	TEST_LE(node->hist.p90, 1000 * 17 / 16);
+	TEST_GE(node->hist.p99, 100000 * 15 / 16);
+	TEST_LE(node->hist.p99, 100000);
+	TEST_LE(node->hist.p999, 100000);
+
+	/* all values are same (min == max) */
+	node = report_find_node(&name_tree, "foo");
+	TEST_EQ(node->hist.p50, 1500);
+	TEST_EQ(node->hist.p999, 1500);
+
+	TEST_EQ(report_setup_sort("total_p50"), 1);
+	report_sort_nodes(&name_tree, &sort_tree);
+	node = rb_entry(rb_first(&sort_tree), typeof(*node), sort_link);
+	TEST_STREQ(node->name, "foo");
+
+	TEST_EQ(report_setup_sort("total_p99"), 1);
+	report_sort_nodes(&name_tree, &sort_tree);
+	node = rb_entry(rb_first(&sort_tree), typeof(*node), sort_link);
+	TEST_STREQ(node->name, "abc");
+
+	while (!RB_EMPTY_ROOT(&name_tree)) {
+		rbnode = rb_first(&name_tree);
+		node = rb_entry(rbnode, typeof(*node), name_link);
+		report_delete_node(&name_tree, node);
+	}
+	report_use_hist = false;
+
+	return TEST_OK;
+}
+
 #endif /* UNIT_TEST */
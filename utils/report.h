@@ -24,10 +24,33 @@ struct report_time_stat {
 	uint64_t	max;
 };
 
+/*
+ * HDR-style histogram of (total) time: values are grouped by the power
+ * of 2 and each group is divided into 2^REPORT_HIST_SUB_BITS buckets so
+ * that relative error is bounded (~6%).  Values less than 2^SUB_BITS
+ * have their own bucket.  It needs O(1) update and buckets are
+ * allocated on the first update.
+ */
+#define REPORT_HIST_SUB_BITS  4
+#define REPORT_HIST_MAX_BITS  48  /* ~78 hours in nsec */
+#define REPORT_HIST_BUCKETS						\
+	((REPORT_HIST_MAX_BITS - REPORT_HIST_SUB_BITS + 1) << REPORT_HIST_SUB_BITS)
+
+struct report_time_hist {
+	uint64_t	count;
+	uint32_t	*buckets;
+	/* estimated percentiles, set by report_calc_avg() */
+	uint64_t	p50;
+	uint64_t	p90;
+	uint64_t	p99;
+	uint64_t	p999;
+};
+
 struct uftrace_report_node {
 	char				*name;
 	struct report_time_stat 	total;
 	struct report_time_stat 	self;
+	struct report_time_hist		hist;
 	struct debug_location		*loc;
 	uint64_t			call;
 	struct rb_node			name_link;
@@ -50,6 +73,14 @@ struct uftrace_diff_policy {
 
 extern struct uftrace_diff_policy diff_policy;
 
+/* whether to keep the histogram in report nodes */
+extern bool report_use_hist;
+
+void report_hist_add(struct report_time_hist *hist, uint64_t time_ns);
+uint64_t report_hist_percentile(struct report_time_hist *hist, double pct);
+void report_hist_free(struct report_time_hist *hist);
+bool report_needs_hist(struct opts *opts);
+
 struct uftrace_report_node * report_find_node(struct rb_root *root,
 					      const char *name);
 void report_add_node(struct rb_root *root, const char *name,
@@ -33,9 +33,11 @@ static void (*dllua_pushinteger)(lua_State *L, lua_Integer n);
 static void (*dllua_pushnumber)(lua_State *L, lua_Number n);
 static void (*dllua_pushboolean)(lua_State *L, int b);
 static void (*dllua_pushnil)(lua_State *L);
+static void (*dllua_pushlightuserdata)(lua_State *L, void *p);
 static void (*dllua_remove)(lua_State *L, int index);
 
 static void (*dllua_getfield)(lua_State *L, int index, const char *k);
+static void (*dllua_setfield)(lua_State *L, int index, const char *k);
 static int (*dllua_type)(lua_State *L, int index);
 static void (*dllua_settop)(lua_State *L, int index);
 
@@ -45,6 +47,12 @@ static void (*dllua_settop)(lua_State *L, int index);
 #define dllua_isnil(L, n) (dllua_type(L, (n)) == LUA_TNIL)
 #define dllua_getglobal(L, s) dllua_getfield(L, LUA_GLOBALSINDEX, (s))
 
+/* registry key for the function names passed to uftrace_batch */
+#define BATCH_NAMES_KEY  "uftrace_batch_names"
+
+/* number of names in the table */
+static int luajit_batch_names;
+
 static void setup_common_context(struct script_context *sc_ctx)
 {
 	dllua_newtable(L);
@@ -286,6 +294,57 @@ static int luajit_uftrace_exit(struct script_context *sc_ctx)
 	return 0;
 }
 
+#define BATCH_COLUMN(_name)						\
+	do {								\
+		dllua_pushstring(L, #_name);				\
+		dllua_pushlightuserdata(L, batch->_name);		\
+		dllua_settable(L, -3);					\
+	} while (0)
+
+static int luajit_uftrace_batch(struct script_batch *batch)
+{
+	int i;
+
+	dllua_getglobal(L, "uftrace_batch");
+	if (dllua_isnil(L, -1)) {
+		dllua_pop(L, 1);
+		return -1;
+	}
+
+	dllua_newtable(L);
+	dllua_pushstring(L, "count");
+	dllua_pushinteger(L, batch->nr);
+	dllua_settable(L, -3);
+
+	/* columns are raw pointers, use ffi.cast() to access */
+	BATCH_COLUMN(type);
+	BATCH_COLUMN(tid);
+	BATCH_COLUMN(depth);
+	BATCH_COLUMN(timestamp);
+	BATCH_COLUMN(duration);
+	BATCH_COLUMN(address);
+	BATCH_COLUMN(name);
+
+	/* names are indexed from 0 like the other columns */
+	dllua_pushstring(L, "names");
+	dllua_getfield(L, LUA_REGISTRYINDEX, BATCH_NAMES_KEY);
+	for (i = luajit_batch_names; i < batch->names.nr; i++) {
+		dllua_pushinteger(L, i);
+		dllua_pushstring(L, batch->names.p[i]);
+		dllua_settable(L, -3);
+	}
+	luajit_batch_names = batch->names.nr;
+	dllua_settable(L, -3);
+
+	if (dllua_pcall(L, 1, 0, 0) != 0) {
+		pr_dbg("uftrace_batch failed: %s\n", dllua_tostring(L, -1));
+		dllua_pop(L, 1);
+		return -1;
+	}
+
+	return 0;
+}
+
 static int luajit_uftrace_end(void)
 {
 	dllua_getglobal(L, "uftrace_end");
@@ -341,10 +400,12 @@ static int load_luajit_api_funcs(void)
 
 	INIT_LUAJIT_API_FUNC(lua_pushboolean);
 	INIT_LUAJIT_API_FUNC(lua_pushnil);
+	INIT_LUAJIT_API_FUNC(lua_pushlightuserdata);
 
 	INIT_LUAJIT_API_FUNC(lua_remove);
 
 	INIT_LUAJIT_API_FUNC(lua_getfield);
+	INIT_LUAJIT_API_FUNC(lua_setfield);
 	INIT_LUAJIT_API_FUNC(lua_type);
 	INIT_LUAJIT_API_FUNC(lua_createtable);
 	INIT_LUAJIT_API_FUNC(lua_settop);
@@ -359,6 +420,7 @@ int script_init_for_luajit(struct script_info *info,
 	pr_dbg("%s()\n", __func__);
 	script_uftrace_entry = luajit_uftrace_entry;
 	script_uftrace_exit = luajit_uftrace_exit;
+	script_uftrace_batch = NULL;
 	script_uftrace_end = luajit_uftrace_end;
 	script_atfork_prepare = luajit_atfork_prepare;
 
@@ -388,6 +450,14 @@ int script_init_for_luajit(struct script_info *info,
 	}
 	dllua_pop(L, 1);
 
+	dllua_getglobal(L, "uftrace_batch");
+	if (!dllua_isnil(L, -1)) {
+		dllua_newtable(L);
+		dllua_setfield(L, LUA_REGISTRYINDEX, BATCH_NAMES_KEY);
+		script_uftrace_batch = luajit_uftrace_batch;
+	}
+	dllua_pop(L, 1);
+
 	luajit_uftrace_begin(info);
 	return 0;
 }
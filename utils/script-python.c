@@ -49,6 +49,8 @@ static int (*__PyObject_HasAttrString)(PyObject *, const char *);
 static PyObject * (*__PyObject_GetAttrString)(PyObject *, const char *);
 static int (*__PyCallable_Check)(PyObject *);
 static PyObject * (*__PyObject_CallObject)(PyObject *callable_object, PyObject *args);
+static PyObject * (*__PyObject_CallMethod)(PyObject *obj, const char *name,
+					   const char *format, ...);
 static int (*__PyRun_SimpleStringFlags)(const char *, PyCompilerFlags *);
 
 static PyObject * (*__PyString_FromString)(const char *);
@@ -59,14 +61,20 @@ static PyObject * (*__PyFloat_FromDouble)(double);
 static PyObject * (*__PyBool_FromLong)(long);
 
 static char * (*__PyString_AsString)(PyObject *);
+static PyObject * (*__PyBytes_FromStringAndSize)(const char *, Py_ssize_t);
+static int (*__PyBytes_AsStringAndSize)(PyObject *, char **, Py_ssize_t *);
 static long (*__PyLong_AsLong)(PyObject *);
 
 static PyObject * (*__PyTuple_New)(Py_ssize_t size);
 static int (*__PyTuple_SetItem)(PyObject *, Py_ssize_t, PyObject *);
 static PyObject * (*__PyTuple_GetItem)(PyObject *, Py_ssize_t);
 
+static PyObject * (*__PyList_New)(Py_ssize_t size);
 static Py_ssize_t (*__PyList_Size)(PyObject *);
 static PyObject * (*__PyList_GetItem)(PyObject *, Py_ssize_t);
+static int (*__PyList_Append)(PyObject *, PyObject *);
+
+static PyObject * (*__PyMemoryView_FromBuffer)(Py_buffer *view);
 
 static PyObject * (*__PyDict_New)(void);
 static int (*__PyDict_SetItem)(PyObject *mp, PyObject *key, PyObject *item);
@@ -99,6 +107,14 @@ static inline void __Py_XDECREF(PyObject *obj)
 #endif  /* PY_VERSION_HEX >= 0x03080000 */
 
 static PyObject *pModule, *pFuncBegin, *pFuncEntry, *pFuncExit, *pFuncEnd;
+static PyObject *pFuncBatch;
+static PyObject *pFuncPartial, *pFuncMerge;
+
+/* pickle module to pass partial results between processes */
+static PyObject *pPickle;
+
+/* list of function names passed to uftrace_batch (appended only) */
+static PyObject *pBatchNames;
 
 enum py_context_idx {
 	PY_CTX_TID = 0,
@@ -159,6 +175,8 @@ static int load_python_api_funcs(void)
 	INIT_PY_API_FUNC(PyString_FromString);
 	INIT_PY_API_FUNC(PyInt_FromLong);
 	INIT_PY_API_FUNC(PyString_AsString);
+	INIT_PY_API_FUNC2(PyBytes_FromStringAndSize, PyString_FromStringAndSize);
+	INIT_PY_API_FUNC2(PyBytes_AsStringAndSize, PyString_AsStringAndSize);
 	/* just to suppress compiler warning */
 	__Py_Dealloc = NULL;
 #else
@@ -167,6 +185,8 @@ static int load_python_api_funcs(void)
 	INIT_PY_API_FUNC2(PyInt_FromLong, PyLong_FromLong);
 	INIT_PY_API_FUNC2(PyString_AsString, PyUnicode_AsUTF8);
 	INIT_PY_API_FUNC2(Py_Dealloc, _Py_Dealloc);
+	INIT_PY_API_FUNC(PyBytes_FromStringAndSize);
+	INIT_PY_API_FUNC(PyBytes_AsStringAndSize);
 #endif
 
 	INIT_PY_API_FUNC(PyErr_Occurred);
@@ -177,6 +197,7 @@ static int load_python_api_funcs(void)
 	INIT_PY_API_FUNC(PyObject_GetAttrString);
 	INIT_PY_API_FUNC(PyCallable_Check);
 	INIT_PY_API_FUNC(PyObject_CallObject);
+	INIT_PY_API_FUNC(PyObject_CallMethod);
 	INIT_PY_API_FUNC(PyRun_SimpleStringFlags);
 
 	INIT_PY_API_FUNC(PyLong_FromLong);
@@ -190,8 +211,12 @@ static int load_python_api_funcs(void)
 	INIT_PY_API_FUNC(PyTuple_SetItem);
 	INIT_PY_API_FUNC(PyTuple_GetItem);
 
+	INIT_PY_API_FUNC(PyList_New);
 	INIT_PY_API_FUNC(PyList_Size);
 	INIT_PY_API_FUNC(PyList_GetItem);
+	INIT_PY_API_FUNC(PyList_Append);
+
+	INIT_PY_API_FUNC(PyMemoryView_FromBuffer);
 
 	INIT_PY_API_FUNC(PyDict_New);
 	INIT_PY_API_FUNC(PyDict_SetItem);
@@ -658,6 +683,121 @@ int python_uftrace_exit(struct script_context *sc_ctx)
 	return 0;
 }
 
+struct python_batch_column {
+	const char	*name;
+	char		*format;	/* see python struct module */
+	Py_ssize_t	itemsize;
+	size_t		offset;
+};
+
+#define BATCH_COLUMN(_name, _fmt)					\
+	{								\
+		.name     = #_name,					\
+		.format   = _fmt,					\
+		.itemsize = sizeof(((struct script_batch *)0)->_name[0]),\
+		.offset   = offsetof(struct script_batch, _name),	\
+	}
+
+static struct python_batch_column python_batch_columns[] = {
+	BATCH_COLUMN(type,      "B"),
+	BATCH_COLUMN(tid,       "i"),
+	BATCH_COLUMN(depth,     "i"),
+	BATCH_COLUMN(timestamp, "Q"),
+	BATCH_COLUMN(duration,  "Q"),
+	BATCH_COLUMN(address,   "Q"),
+	BATCH_COLUMN(name,      "I"),
+};
+
+/* some python versions keep the pointer in the memoryview */
+static Py_ssize_t python_batch_shape;
+
+static PyObject * make_batch_column(struct script_batch *batch,
+				    struct python_batch_column *col)
+{
+	Py_buffer view = {
+		.buf      = (void *)batch + col->offset,
+		.len      = batch->nr * col->itemsize,
+		.itemsize = col->itemsize,
+		.readonly = 1,
+		.ndim     = 1,
+		.format   = col->format,
+		.shape    = &python_batch_shape,
+		.strides  = &col->itemsize,
+	};
+
+	return __PyMemoryView_FromBuffer(&view);
+}
+
+int python_uftrace_batch(struct script_batch *batch)
+{
+	PyObject *views[ARRAY_SIZE(python_batch_columns)];
+	PyObject *pDict;
+	PyObject *pythonContext;
+	Py_ssize_t nr_names;
+	unsigned i;
+
+	if (unlikely(!pFuncBatch))
+		return -1;
+
+	pthread_mutex_lock(&python_interpreter_lock);
+
+	/* add new names only */
+	nr_names = __PyList_Size(pBatchNames);
+	for (i = nr_names; i < (unsigned)batch->names.nr; i++) {
+		PyObject *name = __PyString_FromString(batch->names.p[i]);
+
+		if (__PyErr_Occurred()) {
+			Py_XDECREF(name);
+			name = __PyString_FromString("<invalid value>");
+			__PyErr_Clear();
+		}
+		__PyList_Append(pBatchNames, name);
+		Py_XDECREF(name);
+	}
+
+	pDict = __PyDict_New();
+	python_batch_shape = batch->nr;
+
+	/* the columns refer the batch directly without copying */
+	for (i = 0; i < ARRAY_SIZE(python_batch_columns); i++) {
+		views[i] = make_batch_column(batch, &python_batch_columns[i]);
+		__PyDict_SetItemString(pDict, python_batch_columns[i].name,
+				       views[i]);
+	}
+	insert_dict_long(pDict, "count", batch->nr);
+	__PyDict_SetItemString(pDict, "names", pBatchNames);
+
+	pythonContext = __PyTuple_New(1);
+	__PyTuple_SetItem(pythonContext, 0, pDict);
+
+	/* Call python function "uftrace_batch". */
+	__PyObject_CallObject(pFuncBatch, pythonContext);
+	if (debug) {
+		if (__PyErr_Occurred() && !python_error_reported) {
+			pr_dbg("uftrace_batch failed:\n");
+			__PyErr_Print();
+
+			python_error_reported = true;
+		}
+	}
+	__PyErr_Clear();
+
+	Py_XDECREF(pythonContext);
+
+	/* the batch will be overwritten, invalidate the columns */
+	for (i = 0; i < ARRAY_SIZE(python_batch_columns); i++) {
+		PyObject *ret = __PyObject_CallMethod(views[i], "release", NULL);
+
+		Py_XDECREF(ret);
+		Py_XDECREF(views[i]);
+	}
+	__PyErr_Clear();
+
+	pthread_mutex_unlock(&python_interpreter_lock);
+
+	return 0;
+}
+
 int python_uftrace_end(void)
 {
 	if (unlikely(!pFuncEnd))
@@ -680,6 +820,88 @@ int python_uftrace_end(void)
 	return 0;
 }
 
+int python_uftrace_partial(void **buf, size_t *len)
+{
+	PyObject *result;
+	PyObject *data = NULL;
+	char *str;
+	Py_ssize_t size;
+	int ret = -1;
+
+	pthread_mutex_lock(&python_interpreter_lock);
+
+	/* Call python function "uftrace_partial" and pickle the result. */
+	if (pFuncPartial)
+		result = __PyObject_CallObject(pFuncPartial, NULL);
+	else
+		result = __PyDict_New();
+
+	if (result)
+		data = __PyObject_CallMethod(pPickle, "dumps", "(Oi)", result, -1);
+
+	if (data && __PyBytes_AsStringAndSize(data, &str, &size) == 0) {
+		*buf = xmalloc(size);
+		*len = size;
+		memcpy(*buf, str, size);
+		ret = 0;
+	}
+
+	if (__PyErr_Occurred()) {
+		pr_warn("uftrace_partial failed:\n");
+		__PyErr_Print();
+	}
+
+	Py_XDECREF(data);
+	Py_XDECREF(result);
+
+	pthread_mutex_unlock(&python_interpreter_lock);
+
+	return ret;
+}
+
+int python_uftrace_merge(void **bufs, size_t *lens, int nr)
+{
+	PyObject *partials;
+	PyObject *pythonContext;
+	int i;
+
+	pthread_mutex_lock(&python_interpreter_lock);
+
+	partials = __PyList_New(0);
+
+	for (i = 0; i < nr; i++) {
+		PyObject *data, *result;
+
+		data = __PyBytes_FromStringAndSize(bufs[i], lens[i]);
+		result = __PyObject_CallMethod(pPickle, "loads", "(O)", data);
+		if (result) {
+			__PyList_Append(partials, result);
+			Py_XDECREF(result);
+		}
+		else {
+			pr_warn("cannot load partial result\n");
+			__PyErr_Print();
+		}
+		Py_XDECREF(data);
+	}
+
+	pythonContext = __PyTuple_New(1);
+	__PyTuple_SetItem(pythonContext, 0, partials);
+
+	/* Call python function "uftrace_merge". */
+	__PyObject_CallObject(pFuncMerge, pythonContext);
+	if (__PyErr_Occurred()) {
+		pr_warn("uftrace_merge failed:\n");
+		__PyErr_Print();
+	}
+
+	Py_XDECREF(pythonContext);
+
+	pthread_mutex_unlock(&python_interpreter_lock);
+
+	return 0;
+}
+
 int python_atfork_prepare(void)
 {
 	pr_dbg("flush python buffer in %s()\n", __func__);
@@ -722,7 +944,10 @@ int script_init_for_python(struct script_info *info,
 	/* Bind script_uftrace functions to python's. */
 	script_uftrace_entry = python_uftrace_entry;
 	script_uftrace_exit = python_uftrace_exit;
+	script_uftrace_batch = NULL;
 	script_uftrace_end = python_uftrace_end;
+	script_uftrace_partial = NULL;
+	script_uftrace_merge = NULL;
 	script_atfork_prepare = python_atfork_prepare;
 
 	if (load_python_api_funcs() < 0)
@@ -764,6 +989,32 @@ int script_init_for_python(struct script_info *info,
 	pFuncEntry = get_python_callback("uftrace_entry");
 	pFuncExit  = get_python_callback("uftrace_exit");
 	pFuncEnd   = get_python_callback("uftrace_end");
+	pFuncBatch = get_python_callback("uftrace_batch");
+
+	if (pFuncBatch) {
+		pBatchNames = __PyList_New(0);
+		script_uftrace_batch = python_uftrace_batch;
+	}
+
+	pFuncPartial = get_python_callback("uftrace_partial");
+	pFuncMerge   = get_python_callback("uftrace_merge");
+
+	/* results are merged only for script command (--parallel) */
+	if (pFuncMerge && !info->record) {
+		PyObject *name = __PyString_FromString("pickle");
+
+		pPickle = __PyImport_Import(name);
+		Py_XDECREF(name);
+
+		if (pPickle) {
+			script_uftrace_partial = python_uftrace_partial;
+			script_uftrace_merge = python_uftrace_merge;
+		}
+		else {
+			pr_warn("cannot import pickle module for uftrace_merge\n");
+			__PyErr_Print();
+		}
+	}
 
 	/* Call python function "uftrace_begin" immediately if possible. */
 	python_uftrace_begin(info);
@@ -13,6 +13,7 @@
 #include <unistd.h>
 #include "utils/script.h"
 #include "utils/filter.h"
+#include "utils/symbol.h"
 #include "utils/list.h"
 #include "utils/utils.h"
 #include "utils/script-python.h"
@@ -26,7 +27,10 @@ enum script_type_t script_lang;
 /* The below functions are used both in record time and script command. */
 script_uftrace_entry_t script_uftrace_entry;
 script_uftrace_exit_t script_uftrace_exit;
+script_uftrace_batch_t script_uftrace_batch;
 script_uftrace_end_t script_uftrace_end;
+script_uftrace_partial_t script_uftrace_partial;
+script_uftrace_merge_t script_uftrace_merge;
 script_atfork_prepare_t script_atfork_prepare;
 
 struct script_filter_item {
@@ -36,6 +40,9 @@ struct script_filter_item {
 
 static LIST_HEAD(filters);
 
+/* records not delivered to uftrace_batch() yet */
+static struct script_batch *batch;
+
 enum script_type_t get_script_type(const char *str)
 {
 	char *ext = strrchr(str, '.');
@@ -69,15 +76,10 @@ void script_add_filter(char *func, enum uftrace_pattern_type ptype)
 	list_add_tail(&item->list, &filters);
 }
 
-/* returns 1 on match - script should be run */
-int script_match_filter(char *func)
+static int match_filter_list(char *func)
 {
 	struct script_filter_item *item;
 
-	/* special case: no filter */
-	if (list_empty(&filters))
-		return 1;
-
 	list_for_each_entry(item, &filters, list) {
 		if (match_filter_pattern(&item->patt, func))
 			return 1;
@@ -85,6 +87,44 @@ int script_match_filter(char *func)
 	return 0;
 }
 
+/**
+ * script_match_filter - check if script should be run for the function
+ * @sym: symbol of the function (can be %NULL)
+ * @func: (demangled) name of the function
+ *
+ * The patterns are checked only the first time for each @sym and the
+ * result is saved in the flags of @sym so that later calls don't need to
+ * evaluate them again.  Functions without a symbol are checked every time.
+ *
+ * Returns 1 on match - script should be run.
+ */
+int script_match_filter(struct sym *sym, char *func)
+{
+	unsigned flags;
+
+	/* special case: no filter */
+	if (list_empty(&filters))
+		return 1;
+
+	if (sym == NULL)
+		return match_filter_list(func);
+
+	/*
+	 * it can be called from multiple threads at record time, but they'd
+	 * get the same result so no need to serialize the first check.
+	 */
+	flags = __atomic_load_n(&sym->flags, __ATOMIC_RELAXED);
+	if (!(flags & SYM_FL_SCRIPT_CHECKED)) {
+		flags = SYM_FL_SCRIPT_CHECKED;
+		if (match_filter_list(func))
+			flags |= SYM_FL_SCRIPT_MATCHED;
+
+		__atomic_fetch_or(&sym->flags, flags, __ATOMIC_RELAXED);
+	}
+
+	return !!(flags & SYM_FL_SCRIPT_MATCHED);
+}
+
 void script_finish_filter(void)
 {
 	struct script_filter_item *item, *tmp;
@@ -95,6 +135,75 @@ void script_finish_filter(void)
 	}
 }
 
+static uint32_t batch_name_index(char *name)
+{
+	void *idx;
+
+	idx = hashmap_get(batch->name_map, name);
+	if (idx)
+		return (uintptr_t)idx - 1;
+
+	strv_append(&batch->names, name);
+	/* the key is owned by the strv */
+	hashmap_put(batch->name_map, batch->names.p[batch->names.nr - 1],
+		    (void *)(uintptr_t)batch->names.nr);
+
+	return batch->names.nr - 1;
+}
+
+/**
+ * script_batch_add - add a record to the batch
+ * @type: record type (entry or exit)
+ * @sc_ctx: script context of the record
+ *
+ * This function saves the record in the batch and calls uftrace_batch()
+ * when the batch is full.  Arguments and return values are not saved.
+ */
+void script_batch_add(enum script_batch_type type,
+		      struct script_context *sc_ctx)
+{
+	unsigned n;
+
+	if (batch == NULL) {
+		batch = xzalloc(sizeof(*batch));
+		batch->name_map = hashmap_create(1024, hashmap_string_hash,
+						 hashmap_string_equals);
+	}
+
+	n = batch->nr;
+	batch->type[n]      = type;
+	batch->tid[n]       = sc_ctx->tid;
+	batch->depth[n]     = sc_ctx->depth;
+	batch->timestamp[n] = sc_ctx->timestamp;
+	batch->duration[n]  = sc_ctx->duration;
+	batch->address[n]   = sc_ctx->address;
+	batch->name[n]      = batch_name_index(sc_ctx->name);
+
+	if (++batch->nr == SCRIPT_BATCH_SIZE)
+		script_batch_flush();
+}
+
+/* deliver remaining records to uftrace_batch() */
+void script_batch_flush(void)
+{
+	if (batch == NULL || batch->nr == 0)
+		return;
+
+	script_uftrace_batch(batch);
+	batch->nr = 0;
+}
+
+static void script_batch_finish(void)
+{
+	if (batch == NULL)
+		return;
+
+	hashmap_free(batch->name_map);
+	strv_free(&batch->names);
+	free(batch);
+	batch = NULL;
+}
+
 int script_init(struct script_info *info, enum uftrace_pattern_type ptype)
 {
 	char *script_pathname = info->name;
@@ -145,4 +254,5 @@ void script_finish(void)
 	}
 
 	script_finish_filter();
+	script_batch_finish();
 }
@@ -12,6 +12,9 @@
 #include "utils/script-python.h"
 #include "utils/script-luajit.h"
 #include "utils/utils.h"
+#include "utils/hashmap.h"
+
+struct sym;
 
 #define SCRIPT_ENABLED (SCRIPT_LUAJIT_ENABLED || SCRIPT_PYTHON_ENABLED)
 
@@ -57,26 +60,61 @@ union script_arg_val {
 	unsigned char v[16];
 };
 
+/* number of records passed to uftrace_batch() at once */
+#define SCRIPT_BATCH_SIZE  4096
+
+enum script_batch_type {
+	SCRIPT_BATCH_ENTRY	= 0,
+	SCRIPT_BATCH_EXIT	= 1,
+};
+
+/* records for batch delivery, each field is an array (column) */
+struct script_batch {
+	unsigned		nr;
+	uint8_t			type[SCRIPT_BATCH_SIZE];
+	int32_t			tid[SCRIPT_BATCH_SIZE];
+	int32_t			depth[SCRIPT_BATCH_SIZE];
+	uint64_t		timestamp[SCRIPT_BATCH_SIZE];
+	uint64_t		duration[SCRIPT_BATCH_SIZE];	/* exit only */
+	uint64_t		address[SCRIPT_BATCH_SIZE];
+	uint32_t		name[SCRIPT_BATCH_SIZE];	/* index to names */
+	/* function names seen so far, new names are appended only */
+	struct strv		names;
+	Hashmap			*name_map;
+};
+
 extern char *script_str;
 
 typedef int (*script_uftrace_entry_t)(struct script_context *sc_ctx);
 typedef int (*script_uftrace_exit_t)(struct script_context *sc_ctx);
+typedef int (*script_uftrace_batch_t)(struct script_batch *batch);
 typedef int (*script_uftrace_end_t)(void);
+typedef int (*script_uftrace_partial_t)(void **buf, size_t *len);
+typedef int (*script_uftrace_merge_t)(void **bufs, size_t *lens, int nr);
 typedef int (*script_atfork_prepare_t)(void);
 
 /* The below functions are used both in record time and script command. */
 extern script_uftrace_entry_t script_uftrace_entry;
 extern script_uftrace_exit_t script_uftrace_exit;
+/* set only if the script has uftrace_batch() */
+extern script_uftrace_batch_t script_uftrace_batch;
 extern script_uftrace_end_t script_uftrace_end;
+/* set only if the script has uftrace_merge() */
+extern script_uftrace_partial_t script_uftrace_partial;
+extern script_uftrace_merge_t script_uftrace_merge;
 extern script_atfork_prepare_t script_atfork_prepare;
 
 int script_init(struct script_info *info, enum uftrace_pattern_type ptype);
 void script_finish(void);
 
 void script_add_filter(char *func, enum uftrace_pattern_type ptype);
-int script_match_filter(char *func);
+int script_match_filter(struct sym *sym, char *func);
 void script_finish_filter(void);
 
 enum script_type_t get_script_type(const char *str);
 
+void script_batch_add(enum script_batch_type type,
+		      struct script_context *sc_ctx);
+void script_batch_flush(void);
+
 #endif /* UFTRACE_SCRIPT_H */
@@ -236,7 +236,7 @@ void create_session(struct uftrace_session_link *sessions,
 	if (needs_symtab) {
 		s->symtabs.dirname = dirname;
 		s->symtabs.filename = s->exename;
-		s->symtabs.flags = SYMTAB_FL_USE_SYMFILE | SYMTAB_FL_DEMANGLE;
+		s->symtabs.flags = SYMTAB_FL_USE_SYMFILE;
 		if (sym_rel_addr)
 			s->symtabs.flags |= SYMTAB_FL_ADJ_OFFSET;
 
@@ -744,7 +744,6 @@ struct debug_location * task_find_loc_addr(struct uftrace_session_link *sessions
 	struct uftrace_mmap *map;
 	struct debug_info *dinfo;
 	struct debug_location *loc;
-	ptrdiff_t sym_idx;
 
 	sess = find_task_session(sessions, task->t, time);
 
@@ -773,9 +772,8 @@ struct debug_location * task_find_loc_addr(struct uftrace_session_link *sessions
 		if (dinfo == NULL || dinfo->nr_locs_used == 0)
 			return NULL;
 
-		sym_idx = sym - map->mod->symtab.sym;
-		loc = &dinfo->locs[sym_idx];
-		if (loc->file != NULL)
+		loc = find_debug_location(dinfo, &map->mod->symtab, sym);
+		if (loc && loc->file != NULL)
 			return loc;
 	}
 
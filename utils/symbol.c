@@ -14,6 +14,9 @@
 #include <unistd.h>
 #include <assert.h>
 #include <inttypes.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 /* This should be defined before #include "utils.h" */
 #define PR_FMT     "symbol"
@@ -83,6 +86,56 @@ static int namefind(const void *a, const void *b)
 	return strcmp(name, sym->name);
 }
 
+static int dnamesort(const void *a, const void *b)
+{
+	const struct demangled_name *dna = a;
+	const struct demangled_name *dnb = b;
+
+	return strcmp(dna->name, dnb->name);
+}
+
+static int dnamefind(const void *a, const void *b)
+{
+	const char *name = a;
+	const struct demangled_name *dn = b;
+
+	return strcmp(name, dn->name);
+}
+
+/* returns the first entry of the given (demangled) name */
+static struct demangled_name * find_demangled_name(struct symtab *symtab,
+						   const char *name)
+{
+	struct demangled_name *dn;
+	size_t i;
+
+	if (symtab->nr_sym == 0)
+		return NULL;
+
+	/* build the index of demangled names at the first call */
+	if (symtab->demangled == NULL) {
+		symtab->demangled = xmalloc(symtab->nr_sym * sizeof(*dn));
+
+		for (i = 0; i < symtab->nr_sym; i++) {
+			dn = &symtab->demangled[i];
+
+			dn->sym  = &symtab->sym[i];
+			dn->name = symbol_name(dn->sym);
+		}
+		qsort(symtab->demangled, symtab->nr_sym, sizeof(*dn), dnamesort);
+	}
+
+	dn = bsearch(name, symtab->demangled, symtab->nr_sym,
+		     sizeof(*dn), dnamefind);
+	if (dn == NULL)
+		return NULL;
+
+	while (dn > symtab->demangled && !strcmp(name, dn[-1].name))
+		dn--;
+
+	return dn;
+}
+
 bool has_dependency(const char *filename, const char *libname)
 {
 	bool ret = false;
@@ -183,21 +236,38 @@ static bool is_symbol_end(const char *name)
 	return false;
 }
 
+static bool is_mapped_name(struct symtab *symtab, char *name)
+{
+	char *map = symtab->map;
+
+	return map <= name && name < map + symtab->map_size;
+}
+
 static void unload_symtab(struct symtab *symtab)
 {
 	size_t i;
 
 	for (i = 0; i < symtab->nr_sym; i++) {
 		struct sym *sym = symtab->sym + i;
-		free(sym->name);
+
+		if (!is_mapped_name(symtab, sym->name))
+			free(sym->name);
+		free(sym->dname);
 	}
 
 	free(symtab->sym_names);
 	free(symtab->sym);
+	free(symtab->demangled);
+
+	if (symtab->map)
+		munmap(symtab->map, symtab->map_size);
 
 	symtab->nr_sym = 0;
 	symtab->sym = NULL;
 	symtab->sym_names = NULL;
+	symtab->demangled = NULL;
+	symtab->map = NULL;
+	symtab->map_size = 0;
 }
 
 static int load_symbol(struct symtab *symtab, unsigned long prev_sym_value,
@@ -261,10 +331,9 @@ static int load_symbol(struct symtab *symtab, unsigned long prev_sym_value,
 
 	name = elf_get_name(elf, iter, elf_sym->st_name);
 
-	if (flags & SYMTAB_FL_DEMANGLE)
-		sym->name = demangle(name);
-	else
-		sym->name = xstrdup(name);
+	sym->name = xstrdup(name);
+	sym->dname = NULL;
+	sym->flags = 0;
 
 	pr_dbg4("[%zd] %c %"PRIx64" + %-5u %s\n", symtab->nr_sym,
 		sym->type, sym->addr, sym->size, sym->name);
@@ -435,10 +504,9 @@ static int load_dyn_symbol(struct symtab *dsymtab, int sym_idx,
 	sym->size = plt_entsize;
 	sym->type = ST_PLT_FUNC;
 
-	if (flags & SYMTAB_FL_DEMANGLE)
-		sym->name = demangle(name);
-	else
-		sym->name = xstrdup(name);
+	sym->name = xstrdup(name);
+	sym->dname = NULL;
+	sym->flags = 0;
 
 	pr_dbg4("[%zd] %c %"PRIx64" + %-5u %s\n", dsymtab->nr_sym,
 		sym->type, sym->addr, sym->size, sym->name);
@@ -751,10 +819,7 @@ static int update_symtab_using_dynsym(struct symtab *symtab, const char *filenam
 		free(sym->name);
 		count++;
 
-		if (flags & SYMTAB_FL_DEMANGLE)
-			sym->name = demangle(name);
-		else
-			sym->name = xstrdup(name);
+		sym->name = xstrdup(name);
 	}
 	ret = 1;
 
@@ -852,17 +917,114 @@ struct uftrace_mmap *find_map_by_name(struct symtabs *symtabs,
 	return NULL;
 }
 
+/* state to add symbol entries in the symbol file */
+struct symbol_entry_state {
+	uint64_t	prev_addr;
+	char		prev_type;
+	unsigned	grow;
+};
+
+#define SYMBOL_ENTRY_STATE_INIT  { .prev_addr = -1, .prev_type = 'X', .grow = SYMTAB_GROW }
+
+/*
+ * Add a symbol entry (a line in the symbol file) to the symtab.  It's
+ * used to load the symbol file and to build the binary cache with the
+ * same result while saving the file.
+ */
+static void add_symbol_entry(struct symtab *symtab,
+			     struct symbol_entry_state *st,
+			     uint64_t addr, char type, char *name,
+			     uint64_t offset)
+{
+	static const char allowed_types[] = "?TtwPKDdvu";
+	struct sym *sym;
+
+	if (addr == st->prev_addr && type == st->prev_type) {
+		sym = &symtab->sym[symtab->nr_sym - 1];
+
+		/* for kernel symbols, replace SyS_xxx to sys_xxx */
+		if (!strncmp(sym->name, "SyS_", 4) &&
+		    !strncmp(name, "sys_", 4) &&
+		    !strcmp(sym->name + 4, name + 4))
+			strncpy(sym->name, name, 4);
+
+		/* prefer x64 syscall names than 32 bit ones */
+		if (!strncmp(sym->name, "__ia32", 6) &&
+		    !strncmp(name, "__x64", 5) &&
+		    !strcmp(sym->name + 6, name + 5))
+			strcpy(sym->name, name);
+
+		pr_dbg4("skip duplicated symbols: %s\n", name);
+		return;
+	}
+
+	if (strchr(allowed_types, type) == NULL)
+		return;
+
+	/*
+	 * it should be updated after the type check
+	 * otherwise, it might access invalid sym
+	 * in the above.
+	 */
+	st->prev_addr = addr;
+	st->prev_type = type;
+
+	if (type == ST_UNKNOWN || is_symbol_end(name)) {
+		if (symtab->nr_sym > 0) {
+			sym = &symtab->sym[symtab->nr_sym - 1];
+			sym->size = addr + offset - sym->addr;
+		}
+		return;
+	}
+
+	if (symtab->nr_sym >= symtab->nr_alloc) {
+		if (symtab->nr_alloc >= st->grow * 4)
+			st->grow *= 2;
+		symtab->nr_alloc += st->grow;
+		symtab->sym = xrealloc(symtab->sym,
+				       symtab->nr_alloc * sizeof(*sym));
+	}
+
+	sym = &symtab->sym[symtab->nr_sym++];
+
+	sym->addr = addr + offset;
+	sym->type = type;
+	sym->name = xstrdup(name);
+	sym->dname = NULL;
+	sym->flags = 0;
+	sym->size = 0;
+
+	pr_dbg4("[%zd] %c %lx + %-5u %s\n", symtab->nr_sym,
+		sym->type, sym->addr, sym->size, sym->name);
+
+	if (symtab->nr_sym > 1 && sym[-1].size == 0)
+		sym[-1].size = sym->addr - sym[-1].addr;
+}
+
+/* sort the symbols added by add_symbol_entry() */
+static void sort_symbol_entries(struct symtab *symtab)
+{
+	unsigned int i;
+
+	qsort(symtab->sym, symtab->nr_sym, sizeof(*symtab->sym), addrsort);
+
+	symtab->sym_names = xmalloc(sizeof(*symtab->sym_names) * symtab->nr_sym);
+
+	for (i = 0; i < symtab->nr_sym; i++)
+		symtab->sym_names[i] = &symtab->sym[i];
+	qsort(symtab->sym_names, symtab->nr_sym, sizeof(*symtab->sym_names),
+	      namesort);
+
+	symtab->name_sorted = true;
+}
+
 static int load_module_symbol_file(struct symtab *symtab, const char *symfile,
 				   uint64_t offset)
 {
 	FILE *fp;
 	char *line = NULL;
 	size_t len = 0;
-	unsigned int i;
-	unsigned int grow = SYMTAB_GROW;
-	char allowed_types[] = "?TtwPKDdvu";
-	uint64_t prev_addr = -1;
-	char prev_type = 'X';
+	struct symbol_entry_state st = SYMBOL_ENTRY_STATE_INIT;
 
 	fp = fopen(symfile, "r");
 	if (fp == NULL) {
@@ -872,7 +1034,6 @@ static int load_module_symbol_file(struct symtab *symtab, const char *symfile,
 
 	pr_dbg2("loading symbols from %s: offset = %lx\n", symfile, offset);
 	while (getline(&line, &len, fp) > 0) {
-		struct sym *sym;
 		uint64_t addr;
 		char type;
 		char *name;
@@ -881,7 +1042,7 @@ static int load_module_symbol_file(struct symtab *symtab, const char *symfile,
 		if (*line == '#') {
 			if (!strncmp(line, "# symbols: ", 11)) {
 				size_t nr_syms = strtoul(line + 11, &pos, 10);
-				size_t size_syms = nr_syms * sizeof(*sym);
+				size_t size_syms = nr_syms * sizeof(*symtab->sym);
 
 				symtab->nr_alloc = nr_syms;
 				symtab->sym = xrealloc(symtab->sym, size_syms);
@@ -915,80 +1076,238 @@ static int load_module_symbol_file(struct symtab *symtab, const char *symfile,
 		if (pos)
 			*pos = '\0';
 
-		if (addr == prev_addr && type == prev_type) {
-			sym = &symtab->sym[symtab->nr_sym - 1];
+		add_symbol_entry(symtab, &st, addr, type, name, offset);
+	}
+	free(line);
 
-			/* for kernel symbols, replace SyS_xxx to sys_xxx */
-			if (!strncmp(sym->name, "SyS_", 4) &&
-			    !strncmp(name, "sys_", 4) &&
-			    !strcmp(sym->name + 4, name + 4))
-				strncpy(sym->name, name, 4);
+	sort_symbol_entries(symtab);
 
-			/* prefer x64 syscall names than 32 bit ones */
-			if (!strncmp(sym->name, "__ia32", 6) &&
-			    !strncmp(name, "__x64", 5) &&
-			    !strcmp(sym->name + 6, name + 5))
-				strcpy(sym->name, name);
+	fclose(fp);
+	return 0;
+}
 
-			pr_dbg4("skip duplicated symbols: %s\n", name);
-			continue;
-		}
+/*
+ * Binary symbol cache (XXX.symc) has the same symbols in the text symbol
+ * file (XXX.sym) so that it can be used without parsing the text.  It's
+ * mapped to memory and symbol names are used in place.  The file layout
+ * is:
+ *
+ *   struct symcache_header
+ *   uint64_t addr[nr_sym]     (sorted by address)
+ *   uint32_t size[nr_sym]
+ *   uint32_t name[nr_sym]     (offset in the string pool)
+ *   uint32_t sorted[nr_sym]   (index of symbols sorted by name)
+ *   char     type[nr_sym]
+ *   char     strs[str_size]   (string pool)
+ */
+#define SYMCACHE_MAGIC    "UFTRSYMC"
+#define SYMCACHE_VERSION  1
+
+struct symcache_header {
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	nr_sym;
+	uint64_t	str_size;
+	char		build_id[ALIGN(BUILD_ID_STR_SIZE, 8)];
+};
 
-		if (strchr(allowed_types, type) == NULL)
-			continue;
+static size_t symcache_size(uint32_t nr_sym, uint64_t str_size)
+{
+	return sizeof(struct symcache_header) + str_size +
+		nr_sym * (sizeof(uint64_t) + 3 * sizeof(uint32_t) + 1);
+}
 
-		/*
-		 * it should be updated after the type check
-		 * otherwise, it might access invalid sym
-		 * in the above.
-		 */
-		prev_addr = addr;
-		prev_type = type;
+static char *make_symbol_cache_filename(const char *symfile)
+{
+	char *cachefile = NULL;
 
-		if (type == ST_UNKNOWN || is_symbol_end(name)) {
-			if (symtab->nr_sym > 0) {
-				sym = &symtab->sym[symtab->nr_sym - 1];
-				sym->size = addr + offset - sym->addr;
-			}
-			continue;
-		}
+	xasprintf(&cachefile, "%sc", symfile);
+	return cachefile;
+}
 
-		if (symtab->nr_sym >= symtab->nr_alloc) {
-			if (symtab->nr_alloc >= grow * 4)
-				grow *= 2;
-			symtab->nr_alloc += grow;
-			symtab->sym = xrealloc(symtab->sym,
-					       symtab->nr_alloc * sizeof(*sym));
-		}
+static int load_module_symbol_cache(struct symtab *symtab, const char *symfile,
+				    char *build_id, uint64_t offset)
+{
+	struct symcache_header *hdr;
+	struct stat cache_stat, sym_stat;
+	char *cachefile;
+	void *map = MAP_FAILED;
+	uint64_t *addrs;
+	uint32_t *sizes, *names, *sorted;
+	char *types, *strs;
+	uint32_t i;
+	int fd;
+	int ret = -1;
 
-		sym = &symtab->sym[symtab->nr_sym++];
+	cachefile = make_symbol_cache_filename(symfile);
 
-		sym->addr = addr + offset;
-		sym->type = type;
-		sym->name = demangle(name);
-		sym->size = 0;
+	fd = open(cachefile, O_RDONLY);
+	if (fd < 0)
+		goto out;
 
-		pr_dbg4("[%zd] %c %lx + %-5u %s\n", symtab->nr_sym,
-			sym->type, sym->addr, sym->size, sym->name);
+	if (fstat(fd, &cache_stat) < 0 || stat(symfile, &sym_stat) < 0)
+		goto out;
 
-		if (symtab->nr_sym > 1 && sym[-1].size == 0)
-			sym[-1].size = sym->addr - sym[-1].addr;
+	/* ignore the cache if the symbol file was modified later */
+	if (sym_stat.st_mtim.tv_sec > cache_stat.st_mtim.tv_sec ||
+	    (sym_stat.st_mtim.tv_sec == cache_stat.st_mtim.tv_sec &&
+	     sym_stat.st_mtim.tv_nsec > cache_stat.st_mtim.tv_nsec)) {
+		pr_dbg("ignore outdated symbol cache: %s\n", cachefile);
+		goto out;
 	}
-	free(line);
 
-	qsort(symtab->sym, symtab->nr_sym, sizeof(*symtab->sym), addrsort);
+	if ((size_t)cache_stat.st_size < sizeof(*hdr))
+		goto out;
 
-	symtab->sym_names = xmalloc(sizeof(*symtab->sym_names) * symtab->nr_sym);
+	map = mmap(NULL, cache_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		goto out;
 
-	for (i = 0; i < symtab->nr_sym; i++)
-		symtab->sym_names[i] = &symtab->sym[i];
-	qsort(symtab->sym_names, symtab->nr_sym, sizeof(*symtab->sym_names),
-	      namesort);
+	hdr = map;
+	if (memcmp(hdr->magic, SYMCACHE_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->version != SYMCACHE_VERSION || hdr->nr_sym == 0 ||
+	    symcache_size(hdr->nr_sym, hdr->str_size) != (size_t)cache_stat.st_size) {
+		pr_dbg("invalid symbol cache: %s\n", cachefile);
+		goto out;
+	}
+
+	if (build_id && *build_id && strcmp(build_id, hdr->build_id)) {
+		pr_dbg("build-id mismatch in symbol cache: %s\n", cachefile);
+		goto out;
+	}
+
+	addrs  = map + sizeof(*hdr);
+	sizes  = (void *)(addrs + hdr->nr_sym);
+	names  = sizes + hdr->nr_sym;
+	sorted = names + hdr->nr_sym;
+	types  = (void *)(sorted + hdr->nr_sym);
+	strs   = types + hdr->nr_sym;
+
+	if (strs[hdr->str_size - 1] != '\0')
+		goto out;
+
+	for (i = 0; i < hdr->nr_sym; i++) {
+		if (names[i] >= hdr->str_size || sorted[i] >= hdr->nr_sym)
+			goto out;
+	}
+
+	pr_dbg2("loading symbols from %s: offset = %lx\n", cachefile, offset);
+
+	symtab->nr_sym = symtab->nr_alloc = hdr->nr_sym;
+	symtab->sym = xmalloc(hdr->nr_sym * sizeof(*symtab->sym));
+	symtab->sym_names = xmalloc(hdr->nr_sym * sizeof(*symtab->sym_names));
+	symtab->map = map;
+	symtab->map_size = cache_stat.st_size;
+
+	for (i = 0; i < hdr->nr_sym; i++) {
+		struct sym *sym = &symtab->sym[i];
+
+		sym->addr = addrs[i] + offset;
+		sym->size = sizes[i];
+		sym->type = types[i];
+		sym->name = strs + names[i];
+		sym->dname = NULL;
+		sym->flags = 0;
 
+		symtab->sym_names[i] = &symtab->sym[sorted[i]];
+	}
 	symtab->name_sorted = true;
 
+	map = MAP_FAILED;
+	ret = 0;
+
+out:
+	if (map != MAP_FAILED)
+		munmap(map, cache_stat.st_size);
+	if (fd >= 0)
+		close(fd);
+	free(cachefile);
+	return ret;
+}
+
+/*
+ * Save binary symbol cache using the symbols in @stab.  It should have
+ * the same symbols as the text file (see save_module_symbol_file).
+ */
+static void save_module_symbol_cache(struct symtab *stab, const char *symfile,
+				     char *build_id)
+{
+	struct symcache_header hdr = {
+		.magic   = SYMCACHE_MAGIC,
+		.version = SYMCACHE_VERSION,
+	};
+	char *cachefile;
+	uint64_t *addrs;
+	uint32_t *sizes, *names, *sorted;
+	char *types;
+	uint64_t pos = 0;
+	size_t i;
+	FILE *fp;
+
+	if (stab->nr_sym == 0 || stab->nr_sym > UINT32_MAX)
+		return;
+
+	hdr.nr_sym = stab->nr_sym;
+	strncpy(hdr.build_id, build_id, sizeof(hdr.build_id) - 1);
+
+	addrs  = xmalloc(stab->nr_sym * sizeof(*addrs));
+	sizes  = xmalloc(stab->nr_sym * sizeof(*sizes));
+	names  = xmalloc(stab->nr_sym * sizeof(*names));
+	sorted = xmalloc(stab->nr_sym * sizeof(*sorted));
+	types  = xmalloc(stab->nr_sym);
+
+	for (i = 0; i < stab->nr_sym; i++) {
+		struct sym *sym = &stab->sym[i];
+
+		addrs[i] = sym->addr;
+		sizes[i] = sym->size;
+		types[i] = sym->type;
+		names[i] = pos;
+		sorted[i] = stab->sym_names[i] - stab->sym;
+
+		pos += strlen(sym->name) + 1;
+	}
+	hdr.str_size = pos;
+
+	cachefile = make_symbol_cache_filename(symfile);
+	fp = fopen(cachefile, "w");
+	if (fp == NULL) {
+		pr_dbg("cannot open symbol cache %s: %m\n", cachefile);
+		goto free;
+	}
+
+	pr_dbg2("saving symbol cache to %s\n", cachefile);
+
+	if (fwrite_all(&hdr, sizeof(hdr), fp) < 0 ||
+	    fwrite_all(addrs, stab->nr_sym * sizeof(*addrs), fp) < 0 ||
+	    fwrite_all(sizes, stab->nr_sym * sizeof(*sizes), fp) < 0 ||
+	    fwrite_all(names, stab->nr_sym * sizeof(*names), fp) < 0 ||
+	    fwrite_all(sorted, stab->nr_sym * sizeof(*sorted), fp) < 0 ||
+	    fwrite_all(types, stab->nr_sym, fp) < 0)
+		goto err;
+
+	for (i = 0; i < stab->nr_sym; i++) {
+		char *name = stab->sym[i].name;
+
+		if (fwrite_all(name, strlen(name) + 1, fp) < 0)
+			goto err;
+	}
+
 	fclose(fp);
-	return 0;
+	goto free;
+
+err:
+	pr_dbg("failed to write symbol cache %s\n", cachefile);
+	fclose(fp);
+	unlink(cachefile);
+
+free:
+	free(cachefile);
+	free(addrs);
+	free(sizes);
+	free(names);
+	free(sorted);
+	free(types);
 }
 
 static void load_module_symbol(struct symtabs *symtabs, struct uftrace_module *m)
@@ -1016,7 +1335,9 @@ static void load_module_symbol(struct symtabs *symtabs, struct uftrace_module *m
 				symfile = new_file;
 			}
 		}
-		if (access(symfile, F_OK) == 0)
+		if (access(symfile, F_OK) == 0 &&
+		    load_module_symbol_cache(&m->symtab, symfile,
+					     m->build_id, 0) < 0)
 			load_module_symbol_file(&m->symtab, symfile, 0);
 
 		free(symfile);
@@ -1226,6 +1547,14 @@ char * make_new_symbol_filename(const char *symfile, const char *pathname,
 	return newfile;
 }
 
+/* write a symbol entry to the file and add it to the cache */
+static void write_symbol_entry(FILE *fp, struct symtab *cache,
+			       struct symbol_entry_state *st,
+			       uint64_t addr, char type, char *name)
+{
+	fprintf(fp, "%016"PRIx64" %c %s\n", addr, type, name);
+	add_symbol_entry(cache, st, addr, type, name, 0);
+}
 
 static void save_module_symbol_file(struct symtab *stab, const char *pathname,
 				    char *build_id, const char *symfile,
@@ -1236,6 +1565,8 @@ static void save_module_symbol_file(struct symtab *stab, const char *pathname,
 	bool prev_was_plt = false;
 	struct sym *sym, *prev;
 	char *newfile = NULL;
+	struct symtab cache = {};
+	struct symbol_entry_state st = SYMBOL_ENTRY_STATE_INIT;
 
 	if (stab->nr_sym == 0)
 		return;
@@ -1274,11 +1605,15 @@ static void save_module_symbol_file(struct symtab *stab, const char *pathname,
 	if (strlen(build_id) > 0)
 		fprintf(fp, "# build-id: %s\n", build_id);
 
+	/* build the symbols for the cache as if it's read from the file */
+	cache.nr_alloc = stab->nr_sym;
+	cache.sym = xmalloc(cache.nr_alloc * sizeof(*cache.sym));
+
 	prev = &stab->sym[0];
 	prev_was_plt = (prev->type == ST_PLT_FUNC);
 
-	fprintf(fp, "%016"PRIx64" %c %s\n", prev->addr - offset,
-		(char)prev->type, prev->name);
+	write_symbol_entry(fp, &cache, &st, prev->addr - offset,
+			   prev->type, prev->name);
 
 	/* PLT + normal symbols (in any order)*/
 	for (i = 1; i < stab->nr_sym; i++) {
@@ -1286,28 +1621,32 @@ static void save_module_symbol_file(struct symtab *stab, const char *pathname,
 
 		/* mark end of the this kind of symbols */
 		if ((sym->type == ST_PLT_FUNC) != prev_was_plt) {
-			fprintf(fp, "%016"PRIx64" %c __%ssym_end\n",
-				prev->addr + prev->size - offset,
-				(char)ST_UNKNOWN, prev_was_plt ? "dyn" : "");
+			write_symbol_entry(fp, &cache, &st,
+					   prev->addr + prev->size - offset,
+					   ST_UNKNOWN, prev_was_plt ?
+					   "__dynsym_end" : "__sym_end");
 		}
 		else if (symbol_is_func(prev) && !symbol_is_func(sym)) {
-			fprintf(fp, "%016"PRIx64" %c %s\n",
-				prev->addr + prev->size - offset,
-				(char)ST_UNKNOWN, "__func_end");
+			write_symbol_entry(fp, &cache, &st,
+					   prev->addr + prev->size - offset,
+					   ST_UNKNOWN, "__func_end");
 		}
 
-		fprintf(fp, "%016"PRIx64" %c %s\n", sym->addr - offset,
-			(char)sym->type, sym->name);
+		write_symbol_entry(fp, &cache, &st, sym->addr - offset,
+				   sym->type, sym->name);
 
 		prev = sym;
 		prev_was_plt = (prev->type == ST_PLT_FUNC);
 	}
-	
-	fprintf(fp, "%016"PRIx64" %c __%ssym_end\n",
-		prev->addr + prev->size - offset,
-		(char)ST_UNKNOWN, prev_was_plt ? "dyn" : "");
+
+	write_symbol_entry(fp, &cache, &st, prev->addr + prev->size - offset,
+			   ST_UNKNOWN, prev_was_plt ? "__dynsym_end" : "__sym_end");
 
 	fclose(fp);
+
+	sort_symbol_entries(&cache);
+	save_module_symbol_cache(&cache, symfile, build_id);
+	unload_symtab(&cache);
 	free(newfile);
 }
 
@@ -1453,17 +1792,30 @@ struct uftrace_mmap * find_symbol_map(struct symtabs *symtabs, char *name)
 	struct uftrace_mmap *map;
 
 	for_each_map(symtabs, map) {
-		struct sym *sym;
+		struct demangled_name *dn, *end;
+		struct symtab *symtab;
+
+		if (map->mod == NULL)
+			continue;
+
+		symtab = &map->mod->symtab;
+		dn = find_demangled_name(symtab, name);
+		if (dn == NULL)
+			continue;
 
-		if (map->mod != NULL) {
-			sym = find_symname(&map->mod->symtab, name);
-			if (sym && sym->type != ST_PLT_FUNC)
+		/* PLT and normal symbols can have a same name */
+		end = symtab->demangled + symtab->nr_sym;
+		for (; dn < end && !strcmp(name, dn->name); dn++) {
+			if (dn->sym->type != ST_PLT_FUNC)
 				return map;
 		}
 	}
 	return NULL;
 }
 
+/* protects modules loaded lazily by find_symtabs() */
+static pthread_mutex_t lazy_module_lock = PTHREAD_MUTEX_INITIALIZER;
+
 struct sym * find_symtabs(struct symtabs *symtabs, uint64_t addr)
 {
 	struct symtab *stab;
@@ -1484,10 +1836,21 @@ struct sym * find_symtabs(struct symtabs *symtabs, uint64_t addr)
 	}
 
 	if (map != NULL) {
-		if (map->mod == NULL) {
-			map->mod = load_module_symtab(symtabs, map->libname,
-						      map->build_id);
-			if (map->mod == NULL)
+		struct uftrace_module *mod;
+
+		/* it can be called from multiple threads (e.g. dump --chrome) */
+		mod = __atomic_load_n(&map->mod, __ATOMIC_ACQUIRE);
+		if (mod == NULL) {
+			pthread_mutex_lock(&lazy_module_lock);
+			mod = map->mod;
+			if (mod == NULL) {
+				mod = load_module_symtab(symtabs, map->libname,
+							 map->build_id);
+				__atomic_store_n(&map->mod, mod, __ATOMIC_RELEASE);
+			}
+			pthread_mutex_unlock(&lazy_module_lock);
+
+			if (mod == NULL)
 				return NULL;
 		}
 
@@ -1498,7 +1861,7 @@ struct sym * find_symtabs(struct symtabs *symtabs, uint64_t addr)
 		 */
 		addr -= map->start;
 
-		stab = &map->mod->symtab;
+		stab = &mod->symtab;
 		sym = bsearch(&addr, stab->sym, stab->nr_sym,
 			      sizeof(*sym), addrfind);
 	}
@@ -1553,6 +1916,27 @@ struct sym * find_symname(struct symtab *symtab, const char *name)
 	return NULL;
 }
 
+/**
+ * find_demangled_symname - find a symbol using demangled name
+ * @symtab: symbol table
+ * @name: symbol name (as shown to users)
+ *
+ * This function is similar to find_symname() but it compares demangled
+ * names of the symbols.  As symbol names are saved as is, it needs to
+ * demangle all symbols in the @symtab on the first call.  So this should
+ * be used only for names from users (or output).
+ */
+struct sym * find_demangled_symname(struct symtab *symtab, const char *name)
+{
+	struct demangled_name *dn;
+
+	dn = find_demangled_name(symtab, name);
+	if (dn == NULL)
+		return NULL;
+
+	return dn->sym;
+}
+
 char *symbol_getname(struct sym *sym, uint64_t addr)
 {
 	char *name;
@@ -1562,7 +1946,7 @@ char *symbol_getname(struct sym *sym, uint64_t addr)
 		return name;
 	}
 
-	return sym->name;
+	return symbol_name(sym);
 }
 
 /* must be used in pair with symbol_getname() */
@@ -1578,9 +1962,9 @@ char *symbol_getname_offset(struct sym *sym, uint64_t addr)
 	char *name;
 
 	if (addr == sym->addr)
-		name = xstrdup(sym->name);
+		name = xstrdup(symbol_name(sym));
 	else if (sym->addr < addr && addr < sym->addr + sym->size)
-		xasprintf(&name, "%s+%"PRIu64, sym->name, addr - sym->addr);
+		xasprintf(&name, "%s+%"PRIu64, symbol_name(sym), addr - sym->addr);
 	else
 		name = xstrdup("<unknown>");
 
@@ -1760,6 +2144,78 @@ TEST_CASE(symbol_load_module) {
 
 	unload_symtab(&test);
 	unlink(symfile);
+	unlink("SYM.symc");
+	return TEST_OK;
+}
+
+TEST_CASE(symbol_cache) {
+	struct symtab stab = {
+		.nr_alloc = 0,
+	};
+	struct sym mixed_sym[] = {
+		{ 0x100, 256, ST_PLT_FUNC, "plt1" },
+		{ 0x200, 256, ST_PLT_FUNC, "plt2" },
+		{ 0x1100, 256, ST_GLOBAL_FUNC, "zzz" },
+		{ 0x1200, 256, ST_LOCAL_FUNC,  "aaa" },
+		{ 0x1300, 256, ST_GLOBAL_FUNC, "mmm" },
+	};
+	struct symtab text = {
+		.nr_sym = 0,
+	};
+	struct symtab cache = {
+		.nr_sym = 0,
+	};
+	char symfile[] = "SYMC.sym";
+	char cachefile[] = "SYMC.symc";
+	char build_id[] = "0123456789abcdef0123456789abcdef01234567";
+	/* set mtime of the cache file to be older */
+	struct timespec ts[2] = {
+		{ .tv_nsec = UTIME_OMIT },
+		{ .tv_sec = 0, .tv_nsec = 0 },
+	};
+	size_t i;
+
+	/* recover from earlier failures */
+	unlink(symfile);
+	unlink(cachefile);
+
+	stab.sym = mixed_sym;
+	stab.nr_sym = ARRAY_SIZE(mixed_sym);
+
+	pr_dbg("save symbol file and check the cache file\n");
+	save_module_symbol_file(&stab, symfile, build_id, symfile, 0x400000);
+	TEST_EQ(access(cachefile, F_OK), 0);
+
+	TEST_EQ(load_module_symbol_file(&text, symfile, 0x400000), 0);
+	TEST_EQ(load_module_symbol_cache(&cache, symfile, build_id, 0x400000), 0);
+	TEST_NE(cache.map, NULL);
+
+	pr_dbg("compare symbols with the text file\n");
+	TEST_EQ(cache.nr_sym, text.nr_sym);
+	for (i = 0; i < cache.nr_sym; i++) {
+		TEST_EQ(cache.sym[i].addr, text.sym[i].addr);
+		TEST_EQ(cache.sym[i].size, text.sym[i].size);
+		TEST_EQ(cache.sym[i].type, text.sym[i].type);
+		TEST_STREQ(cache.sym[i].name, text.sym[i].name);
+		TEST_STREQ(cache.sym_names[i]->name, text.sym_names[i]->name);
+	}
+	TEST_EQ(find_sym(&cache, 0x1210), &cache.sym[3]);
+	TEST_EQ(find_symname(&cache, "mmm"), &cache.sym[4]);
+
+	unload_symtab(&cache);
+	TEST_EQ(cache.map, NULL);
+
+	pr_dbg("do not use the cache for different build-id\n");
+	TEST_LT(load_module_symbol_cache(&cache, symfile, "1234", 0), 0);
+
+	pr_dbg("do not use the cache if the symbol file is newer\n");
+	TEST_EQ(utimensat(AT_FDCWD, cachefile, ts, 0), 0);
+	TEST_LT(load_module_symbol_cache(&cache, symfile, build_id, 0), 0);
+	TEST_EQ(cache.nr_sym, 0);
+
+	unload_symtab(&text);
+	unlink(symfile);
+	unlink(cachefile);
 	return TEST_OK;
 }
 
@@ -1909,7 +2365,7 @@ TEST_CASE(symbol_same_file_name1) {
 	size_t i;
 
 	/* recover from earlier failures */
-	system("rm -f name*.sym");
+	system("rm -f name*.sym name*.symc");
 
 	pr_dbg("allocating modules\n");
 	init_test_module_info(&save_mod[0], &save_mod[1], false, true);
@@ -1957,7 +2413,7 @@ TEST_CASE(symbol_same_file_name1) {
 	unload_symtab(&load_mod[1]->symtab);
 	free(load_mod[1]);
 
-	system("rm -f name*.sym");
+	system("rm -f name*.sym name*.symc");
 
 	return TEST_OK;
 }
@@ -1969,7 +2425,7 @@ TEST_CASE(symbol_same_file_name2) {
 	size_t i;
 
 	/* recover from earlier failures */
-	system("rm -f name*.sym");
+	system("rm -f name*.sym name*.symc");
 
 	pr_dbg("allocating modules\n");
 	init_test_module_info(&save_mod[0], &save_mod[1], true, true);
@@ -2018,7 +2474,7 @@ TEST_CASE(symbol_same_file_name2) {
 	unload_symtab(&load_mod[1]->symtab);
 	free(load_mod[1]);
 
-	system("rm -f name*.sym");
+	system("rm -f name*.sym name*.symc");
 
 	return TEST_OK;
 }
@@ -52,16 +52,32 @@ struct sym {
 	unsigned size;
 	enum symtype type;
 	char *name;
+	char *dname;  /* demangled name, set at the first use */
+	unsigned flags;  /* SYM_FL_*, set (atomically) at runtime */
 };
 
+/* script filter was checked for the symbol and the result */
+#define SYM_FL_SCRIPT_CHECKED  (1U << 0)
+#define SYM_FL_SCRIPT_MATCHED  (1U << 1)
+
 #define SYMTAB_GROW  16
 
+struct demangled_name {
+	char *name;
+	struct sym *sym;
+};
+
 struct symtab {
 	struct sym *sym;
 	struct sym **sym_names;
 	size_t nr_sym;
 	size_t nr_alloc;
 	bool name_sorted;
+	/* symbols sorted by demangled name (built on demand) */
+	struct demangled_name *demangled;
+	/* mapped symbol cache file (symbol names are in it) */
+	void *map;
+	size_t map_size;
 };
 
 struct uftrace_module {
@@ -84,7 +100,6 @@ struct uftrace_mmap {
 };
 
 enum symtab_flag {
-	SYMTAB_FL_DEMANGLE	= (1U << 0),
 	SYMTAB_FL_USE_SYMFILE	= (1U << 1),
 	SYMTAB_FL_ADJ_OFFSET	= (1U << 2),
 	SYMTAB_FL_SKIP_NORMAL	= (1U << 3),
@@ -123,6 +138,7 @@ extern struct sym sched_sym;
 struct sym * find_symtabs(struct symtabs *symtabs, uint64_t addr);
 struct sym * find_sym(struct symtab *symtab, uint64_t addr);
 struct sym * find_symname(struct symtab *symtab, const char *name);
+struct sym * find_demangled_symname(struct symtab *symtab, const char *name);
 void print_symtab(struct symtab *symtab);
 
 int arch_load_dynsymtab_noplt(struct symtab *dsymtab,
@@ -204,6 +220,18 @@ enum symbol_demangler {
 extern enum symbol_demangler demangler;
 
 char *demangle(char *str);
+bool is_mangled_name(const char *str);
+char *demangle_symbol(struct sym *sym);
+
+/* symbol names are saved as is, and demangled when they're used */
+static inline char *symbol_name(struct sym *sym)
+{
+	char *name = __atomic_load_n(&sym->dname, __ATOMIC_ACQUIRE);
+
+	if (likely(name))
+		return name;
+	return demangle_symbol(sym);
+}
 
 #ifdef HAVE_CXA_DEMANGLE
 /* copied from /usr/include/c++/4.7.2/cxxabi.h */
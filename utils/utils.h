@@ -97,6 +97,7 @@ enum color_setting {
 
 extern void __pr_dbg(const char *fmt, ...);
 extern void __pr_out(const char *fmt, ...);
+extern FILE *set_thread_outfp(FILE *fp);
 extern void __pr_err(const char *fmt, ...) __attribute__((noreturn));
 extern void __pr_err_s(const char *fmt, ...) __attribute__((noreturn));
 extern void __pr_warn(const char *fmt, ...);
@@ -0,0 +1 @@
+#define UFTRACE_VERSION  " ( x86_64 tui perf sched )"